@@ -0,0 +1,109 @@
+export module raytracer.aabb;
+
+import raytracer.mat;
+import raytracer.ray;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+struct aabb {
+    vec3 min = vec3(std::numeric_limits<f32>::infinity());
+    vec3 max = vec3(-std::numeric_limits<f32>::infinity());
+
+    [[nodiscard]] constexpr bool empty() const
+    {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    [[nodiscard]] constexpr vec3 centroid() const
+    {
+        return (min + max) * 0.5f;
+    }
+
+    [[nodiscard]] constexpr vec3 extent() const
+    {
+        return max - min;
+    }
+
+    [[nodiscard]] constexpr f32 surfaceArea() const
+    {
+        if (empty()) {
+            return 0.0f;
+        }
+        auto e = extent();
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    [[nodiscard]] constexpr usize largestAxis() const
+    {
+        auto e = extent();
+        if (e.x > e.y && e.x > e.z) {
+            return 0;
+        }
+        return e.y > e.z ? 1 : 2;
+    }
+
+    constexpr aabb& extend(vec3 const& p)
+    {
+        min = vec3(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+        max = vec3(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+        return *this;
+    }
+
+    constexpr aabb& extend(aabb const& b)
+    {
+        min = vec3(std::min(min.x, b.min.x), std::min(min.y, b.min.y), std::min(min.z, b.min.z));
+        max = vec3(std::max(max.x, b.max.x), std::max(max.y, b.max.y), std::max(max.z, b.max.z));
+        return *this;
+    }
+
+    bool operator==(aabb const&) const = default;
+};
+
+[[nodiscard]] constexpr aabb merge(aabb a, aabb const& b)
+{
+    return a.extend(b);
+}
+
+// Bounds of the eight transformed corners, so the result stays conservative
+// under rotation.
+[[nodiscard]] constexpr aabb operator*(mat4 const& m, aabb const& b)
+{
+    if (b.empty()) {
+        return b;
+    }
+    aabb result;
+    for (usize i = 0; i < 8; i++) {
+        auto corner = vec4::point(
+            i & 1 ? b.max.x : b.min.x,
+            i & 2 ? b.max.y : b.min.y,
+            i & 4 ? b.max.z : b.min.z);
+        result.extend(vec3(m * corner));
+    }
+    return result;
+}
+
+// Slab test against a precomputed reciprocal direction. Returns the entry
+// distance, or infinity when the ray misses the box before `t_max`.
+[[nodiscard]] constexpr f32 intersect(
+    aabb const& b,
+    ray const& r,
+    vec3 const& inv_d,
+    f32 t_max)
+{
+    auto t0 = (b.min - r.o) * inv_d;
+    auto t1 = (b.max - r.o) * inv_d;
+    f32 t_near = std::max({ std::min(t0.x, t1.x), std::min(t0.y, t1.y), std::min(t0.z, t1.z), 0.0f });
+    f32 t_far = std::min({ std::max(t0.x, t1.x), std::max(t0.y, t1.y), std::max(t0.z, t1.z), t_max });
+    if (t_near > t_far) {
+        return std::numeric_limits<f32>::infinity();
+    }
+    return t_near;
+}
+
+[[nodiscard]] constexpr vec3 reciprocal(vec3 const& d)
+{
+    return vec3(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+}
+} // namespace raytracer
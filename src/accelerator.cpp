@@ -0,0 +1,227 @@
+export module raytracer.accelerator;
+
+import raytracer.aabb;
+import raytracer.bvh;
+import raytracer.ray;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+// Non-owning reference to a callable `f32(u32 primitive, f32 t_max)`, the
+// per-primitive test the backends call through the virtual interface. The
+// callable must outlive the reference.
+class PrimitiveTest {
+public:
+    template<typename F>
+    PrimitiveTest(F const& f)
+        : m_context(&f)
+        , m_call([](void const* context, u32 primitive, f32 t_max) {
+            return (*static_cast<F const*>(context))(primitive, t_max);
+        })
+    {
+    }
+
+    f32 operator()(u32 primitive, f32 t_max) const
+    {
+        return m_call(m_context, primitive, t_max);
+    }
+
+private:
+    void const* m_context;
+    f32 (*m_call)(void const*, u32, f32);
+};
+
+// Spatial index over primitive bounds. intersect() calls the test for
+// candidate primitives roughly front to back; the test returns the new
+// `t_max`, which lets the backend stop once nothing closer can remain.
+class Accelerator {
+public:
+    virtual ~Accelerator() { }
+
+    virtual std::string_view name() const = 0;
+
+    virtual void build(std::span<aabb const> primitive_bounds, u32 thread_count = defaultThreadCount()) = 0;
+
+    // Brings the index up to date after the `changed` primitives moved.
+    // Backends without incremental updates rebuild.
+    virtual bvh_update_stats update(std::span<aabb const> primitive_bounds, std::span<u32 const> changed)
+    {
+        (void)changed;
+        build(primitive_bounds);
+        bvh_update_stats stats;
+        stats.full_rebuild = true;
+        return stats;
+    }
+
+    virtual void intersect(ray const& r, f32 t_max, PrimitiveTest test) const = 0;
+
+    // Bytes held by the index itself, not counting the primitives.
+    virtual usize memoryBytes() const = 0;
+};
+
+template<typename T>
+[[nodiscard]] usize memoryOf(std::vector<T> const& v)
+{
+    return v.capacity() * sizeof(T);
+}
+
+class BvhAccelerator : public Accelerator {
+public:
+    BvhAccelerator() = default;
+
+    // Uses externally owned nodes, e.g. from a SceneCache, until the next
+    // build. The storage must outlive the accelerator.
+    explicit BvhAccelerator(bvh_view view)
+        : m_view(view)
+    {
+    }
+
+    virtual std::string_view name() const override
+    {
+        return "bvh";
+    }
+
+    virtual void build(std::span<aabb const> primitive_bounds, u32 thread_count = defaultThreadCount()) override
+    {
+        m_bvh.build(primitive_bounds, thread_count);
+        m_view = m_bvh.view();
+        m_owned = true;
+    }
+
+    virtual bvh_update_stats update(std::span<aabb const> primitive_bounds, std::span<u32 const> changed) override
+    {
+        if (!m_owned) {
+            return Accelerator::update(primitive_bounds, changed);
+        }
+        auto stats = m_bvh.update(primitive_bounds, changed);
+        m_view = m_bvh.view();
+        return stats;
+    }
+
+    virtual void intersect(ray const& r, f32 t_max, PrimitiveTest test) const override
+    {
+        traverse(m_view, r, t_max, test);
+    }
+
+    virtual usize memoryBytes() const override
+    {
+        return m_view.nodes.size_bytes() + m_view.indices.size_bytes();
+    }
+
+    [[nodiscard]] bvh_view view() const
+    {
+        return m_view;
+    }
+
+private:
+    Bvh m_bvh;
+    bvh_view m_view;
+    bool m_owned = false;
+};
+
+enum class accelerator_kind : u32 {
+    automatic,
+    bvh,
+    grid,
+    kd_tree,
+};
+
+[[nodiscard]] constexpr std::string_view nameOf(accelerator_kind kind)
+{
+    switch (kind) {
+    case accelerator_kind::automatic:
+        return "automatic";
+    case accelerator_kind::bvh:
+        return "bvh";
+    case accelerator_kind::grid:
+        return "grid";
+    case accelerator_kind::kd_tree:
+        return "kd-tree";
+    }
+    return "unknown";
+}
+
+// Cheap summary of how primitives are spread, enough to pick a backend.
+struct scene_statistics {
+    u32 count = 0;
+    aabb bounds;
+    // Fraction of cells of a coarse grid over `bounds` that hold at least
+    // one centroid, relative to what a uniform spread would fill.
+    f32 occupancy = 0.0f;
+    // Coefficient of variation of primitive diagonals; near zero when all
+    // primitives are the same size.
+    f32 size_variation = 0.0f;
+    // Fraction of primitives that are flat along one axis, like the walls
+    // and floors of architectural models.
+    f32 flat_fraction = 0.0f;
+};
+
+[[nodiscard]] scene_statistics statisticsOf(std::span<aabb const> primitive_bounds)
+{
+    constexpr u32 resolution = 16;
+    scene_statistics s;
+    s.count = static_cast<u32>(primitive_bounds.size());
+    if (s.count == 0) {
+        return s;
+    }
+
+    f64 sum = 0.0, sum_squared = 0.0;
+    u32 flat = 0;
+    for (auto const& b : primitive_bounds) {
+        s.bounds.extend(b);
+        auto e = b.extent();
+        f32 diagonal = e.length();
+        sum += diagonal;
+        sum_squared += f64(diagonal) * diagonal;
+        if (std::min({ e.x, e.y, e.z }) <= 0.01f * std::max({ e.x, e.y, e.z })) {
+            flat++;
+        }
+    }
+    f64 mean = sum / s.count;
+    f64 variance = std::max(0.0, sum_squared / s.count - mean * mean);
+    s.size_variation = mean > 0.0 ? f32(std::sqrt(variance) / mean) : 0.0f;
+    s.flat_fraction = f32(flat) / f32(s.count);
+
+    std::vector<bool> occupied(resolution * resolution * resolution);
+    auto lo = s.bounds.min;
+    auto extent = s.bounds.extent();
+    auto cell = [&](f32 c, usize axis) {
+        return extent[axis] > 0.0f
+            ? std::min(resolution - 1, static_cast<u32>((c - lo[axis]) / extent[axis] * resolution))
+            : 0u;
+    };
+    u32 filled = 0;
+    for (auto const& b : primitive_bounds) {
+        auto c = b.centroid();
+        auto i = (cell(c.z, 2) * resolution + cell(c.y, 1)) * resolution + cell(c.x, 0);
+        if (!occupied[i]) {
+            occupied[i] = true;
+            filled++;
+        }
+    }
+    // Expected number of distinct cells hit by `count` uniform samples.
+    f64 cells = f64(occupied.size());
+    f64 expected = cells * (1.0 - std::pow(1.0 - 1.0 / cells, f64(s.count)));
+    s.occupancy = f32(std::min(1.0, filled / expected));
+    return s;
+}
+
+// Uniform grids win whenever primitives are similar in size and spread
+// evenly, kd-trees on unevenly spread scenes dominated by flat primitives,
+// and the BVH everywhere else, including small scenes where build cost
+// dominates.
+[[nodiscard]] accelerator_kind chooseAccelerator(scene_statistics const& s)
+{
+    if (s.count < 1024) {
+        return accelerator_kind::bvh;
+    }
+    if (s.occupancy >= 0.8f && s.size_variation <= 0.5f) {
+        return accelerator_kind::grid;
+    }
+    if (s.flat_fraction >= 0.5f) {
+        return accelerator_kind::kd_tree;
+    }
+    return accelerator_kind::bvh;
+}
+} // namespace raytracer
@@ -0,0 +1,136 @@
+import boost.ut;
+import raytracer;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+
+namespace {
+std::vector<aabb> randomBoxes(u32 count, f32 min_size, f32 max_size)
+{
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<f32> position(-50.0f, 50.0f);
+    std::uniform_real_distribution<f32> size(min_size, max_size);
+    std::vector<aabb> boxes(count);
+    for (auto& box : boxes) {
+        auto p = vec3(position(rng), position(rng), position(rng));
+        box = { p, p + vec3(size(rng), size(rng), size(rng)) };
+    }
+    return boxes;
+}
+
+// Tiles on the walls, floors and ceilings of a few box-shaped rooms, each
+// flat along one axis.
+std::vector<aabb> randomPanels(u32 count)
+{
+    std::mt19937 rng(13);
+    std::uniform_real_distribution<f32> room(-50.0f, 50.0f);
+    std::uniform_real_distribution<f32> u(0.0f, 1.0f);
+    std::vector<vec3> rooms(8);
+    for (auto& r : rooms) {
+        r = vec3(room(rng), room(rng), room(rng));
+    }
+    constexpr f32 room_size = 10.0f;
+    std::vector<aabb> panels(count);
+    for (u32 i = 0; i < count; i++) {
+        auto axis = i % 3;
+        auto p = rooms[i % rooms.size()] + vec3(u(rng), u(rng), u(rng)) * room_size;
+        p[axis] = rooms[i % rooms.size()][axis] + (i % 2 == 0 ? 0.0f : room_size);
+        auto e = vec3(0.5f + u(rng), 0.5f + u(rng), 0.5f + u(rng));
+        e[axis] = 0.0f;
+        panels[i] = { p, p + e };
+    }
+    return panels;
+}
+
+// Checks every backend finds the same closest box as a linear scan.
+void expectMatchesLinearScan(Accelerator& accelerator, std::span<aabb const> boxes)
+{
+    constexpr f32 inf = std::numeric_limits<f32>::infinity();
+    accelerator.build(boxes);
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<f32> u(-1.0f, 1.0f);
+    for (i32 i = 0; i < 500; i++) {
+        auto r = ray(vec3(u(rng), u(rng), u(rng)) * 60.0f, normalize(vec3(u(rng), u(rng), u(rng))));
+        auto inv_d = reciprocal(r.d);
+        f32 expected = inf;
+        for (auto const& box : boxes) {
+            expected = std::min(expected, intersect(box, r, inv_d, inf));
+        }
+        f32 actual = inf;
+        accelerator.intersect(r, inf, [&](u32 p, f32 t_max) {
+            actual = std::min(actual, intersect(boxes[p], r, inv_d, t_max));
+            return actual;
+        });
+        expect(actual == expected) << accelerator.name();
+    }
+}
+} // namespace
+
+int main()
+{
+    feature("Intersecting through an accelerator") = [] {
+        auto boxes = randomBoxes(3000, 0.1f, 2.0f);
+        auto panels = randomPanels(1000);
+        for (auto kind : { accelerator_kind::bvh, accelerator_kind::grid, accelerator_kind::kd_tree }) {
+            given(std::string(nameOf(kind))) = [&] {
+                auto accelerator = makeAccelerator(kind);
+                expectMatchesLinearScan(*accelerator, boxes);
+                expectMatchesLinearScan(*accelerator, panels);
+                expectMatchesLinearScan(*accelerator, std::span(boxes).first(1));
+            };
+        }
+
+        given("An empty scene") = [] {
+            for (auto kind : { accelerator_kind::bvh, accelerator_kind::grid, accelerator_kind::kd_tree }) {
+                auto accelerator = makeAccelerator(kind);
+                accelerator->build({});
+                bool called = false;
+                accelerator->intersect(ray(zero<vec3>, unit_z<vec3>), 1e9f, [&](u32, f32 t_max) {
+                    called = true;
+                    return t_max;
+                });
+                expect(!called);
+            }
+        };
+    };
+
+    feature("Choosing an accelerator") = [] {
+        then("Small scenes use the BVH") = [] {
+            expect(chooseAccelerator(statisticsOf(randomBoxes(100, 1.0f, 1.0f))) == accelerator_kind::bvh);
+        };
+        then("Dense uniform clouds use the grid") = [] {
+            expect(chooseAccelerator(statisticsOf(randomBoxes(50000, 0.5f, 0.6f))) == accelerator_kind::grid);
+        };
+        then("Flat panels use the kd-tree") = [] {
+            expect(chooseAccelerator(statisticsOf(randomPanels(5000))) == accelerator_kind::kd_tree);
+        };
+    };
+
+    feature("Scenes with an explicit backend") = [] {
+        Scene scene;
+        std::mt19937 rng(5);
+        std::uniform_real_distribution<f32> position(-20.0f, 20.0f);
+        for (i32 i = 0; i < 500; i++) {
+            scene.objects.add<Sphere>().setTransform(mat4::translate(position(rng), position(rng), position(rng)));
+        }
+        scene.build();
+        expect(scene.acceleratorKind() == accelerator_kind::bvh);
+        std::vector<std::optional<intersection>> expected;
+        std::vector<ray> rays;
+        for (i32 i = 0; i < 200; i++) {
+            rays.push_back(ray(vec3(position(rng), position(rng), -50.0f), unit_z<vec3>));
+            expected.push_back(scene.intersect(rays.back()));
+        }
+
+        for (auto kind : { accelerator_kind::grid, accelerator_kind::kd_tree }) {
+            scene.preferred_accelerator = kind;
+            scene.build();
+            expect(scene.acceleratorKind() == kind);
+            for (usize i = 0; i < rays.size(); i++) {
+                expect(scene.intersect(rays[i]) == expected[i]) << nameOf(kind);
+            }
+        }
+    };
+}
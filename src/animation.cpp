@@ -0,0 +1,149 @@
+export module raytracer.animation;
+
+import raytracer.bvh;
+import raytracer.camera;
+import raytracer.canvas;
+import raytracer.incremental;
+import raytracer.mat;
+import raytracer.render;
+import raytracer.scene;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+// Object `object` takes `transform` at frame `frame` and keeps it until
+// its next key.
+struct transform_key {
+    u32 frame = 0;
+    u32 object = 0;
+    mat4 transform;
+};
+
+// Keyed transforms of a sequence, ordered by frame.
+class Timeline {
+public:
+    // Keys `object` at `frame`, replacing any key it already has there.
+    void key(u32 frame, u32 object, mat4 const& transform)
+    {
+        auto at = std::ranges::upper_bound(m_keys, frame, {}, &transform_key::frame);
+        auto same = std::find_if(std::ranges::lower_bound(m_keys, frame, {}, &transform_key::frame), at,
+            [&](transform_key const& k) { return k.object == object; });
+        if (same != at) {
+            same->transform = transform;
+            return;
+        }
+        transform_key k;
+        k.frame = frame;
+        k.object = object;
+        k.transform = transform;
+        m_keys.insert(at, k);
+    }
+
+    // One past the last keyed frame.
+    [[nodiscard]] u32 frames() const
+    {
+        return m_keys.empty() ? 0 : m_keys.back().frame + 1;
+    }
+
+    [[nodiscard]] std::span<transform_key const> keysAt(u32 frame) const
+    {
+        auto [first, last] = std::ranges::equal_range(m_keys, frame, {}, &transform_key::frame);
+        return { first, last };
+    }
+
+    [[nodiscard]] std::span<transform_key const> keys() const
+    {
+        return m_keys;
+    }
+
+private:
+    std::vector<transform_key> m_keys;
+};
+
+struct frame_stats {
+    u32 frame = 0;
+    // Objects whose transform changed for this frame.
+    u32 moved = 0;
+    // Pixels copied from the last frame, and pixels traced again.
+    u64 reused_pixels = 0;
+    u64 traced_pixels = 0;
+    bvh_update_stats update;
+};
+
+// Renders a sequence of frames of one scene from one camera, as render()
+// would with tracingKernel(), doing again only what changed since the last
+// frame. Each frame moves the objects keyed for it through an
+// IncrementalRenderer, so the BVH refits their paths and leaves the static
+// objects' subtrees alone, and only the samples whose primary or shadow
+// rays the motion crosses are traced again. Cost per frame thus scales
+// with the screen area motion touches, plus a few box tests per pixel.
+//
+// The scene must change only through renderFrame() in between; call
+// invalidate() after changing it otherwise, e.g. adding lights.
+class AnimationRenderer {
+public:
+    AnimationRenderer(Scene& scene, Camera const& camera, render_options const& options = render_options())
+        : m_renderer(scene, camera, options)
+    {
+    }
+
+    [[nodiscard]] Camera const& camera() const
+    {
+        return m_renderer.camera();
+    }
+
+    // Moves the camera, so the next frame is traced in full.
+    void setCamera(Camera const& camera)
+    {
+        m_renderer.setCamera(camera);
+    }
+
+    // Forgets the last frame, so the next one is traced in full.
+    void invalidate()
+    {
+        m_renderer.invalidate();
+    }
+
+    // Applies `keys`, renders the frame into `out`, which must be the
+    // camera's size, and remembers it for the next.
+    frame_stats renderFrame(u32 frame, std::span<transform_key const> keys, Canvas<vec3>& out)
+    {
+        frame_stats stats;
+        stats.frame = frame;
+        for (auto const& k : keys) {
+            if (m_renderer.setTransform(k.object, k.transform)) {
+                stats.moved++;
+            }
+        }
+        auto rendered = m_renderer.render(out);
+        stats.reused_pixels = rendered.reused_pixels;
+        stats.traced_pixels = rendered.traced_pixels;
+        stats.update = rendered.update;
+        return stats;
+    }
+
+    frame_stats renderFrame(Timeline const& timeline, u32 frame, Canvas<vec3>& out)
+    {
+        return renderFrame(frame, timeline.keysAt(frame), out);
+    }
+
+private:
+    IncrementalRenderer m_renderer;
+};
+
+// Renders frames 0 to timeline.frames() - 1 of `scene`, which must be
+// built, with an AnimationRenderer, calling on_frame(frame, image, stats)
+// after each.
+template<typename F>
+requires std::is_invocable_v<F&, u32, Canvas<vec3> const&, frame_stats const&>
+void renderAnimation(Scene& scene, Camera const& camera, Timeline const& timeline, render_options const& options, F&& on_frame)
+{
+    AnimationRenderer renderer(scene, camera, options);
+    Canvas<vec3> image(camera.width(), camera.height());
+    for (u32 frame = 0; frame < timeline.frames(); frame++) {
+        auto stats = renderer.renderFrame(timeline, frame, image);
+        on_frame(frame, std::as_const(image), stats);
+    }
+}
+} // namespace raytracer
@@ -0,0 +1,136 @@
+import boost.ut;
+import raytracer;
+import raytracer.testing;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+using namespace raytracer::testing;
+
+namespace {
+constexpr i32 width = 40;
+constexpr i32 height = 30;
+// Id of the small ball the tests move.
+constexpr u32 ball = 3;
+
+mat4 ballAt(f32 x, f32 z)
+{
+    return mat4::translate(x, -0.7f, z) * mat4::scale(0.3f, 0.3f, 0.3f);
+}
+
+// spheres() with the small ball at its first position.
+Scene spheresAndBall()
+{
+    auto scene = spheres();
+    addSmallBall(scene, -2.5f, -2);
+    scene.build();
+    return scene;
+}
+} // namespace
+
+int main()
+{
+    feature("Timelines") = [] {
+        Timeline timeline;
+        timeline.key(4, 1, mat4::translate(1, 0, 0));
+        timeline.key(0, 2, mat4());
+        timeline.key(4, 0, mat4());
+        timeline.key(4, 1, mat4::translate(2, 0, 0));
+
+        then("Keys are ordered by frame, one per object and frame") = [&] {
+            expect(timeline.frames() == 5u);
+            expect(timeline.keys().size() == 3u);
+            expect(timeline.keysAt(0).size() == 1u && timeline.keysAt(2).empty());
+            auto keys = timeline.keysAt(4);
+            expect(keys.size() == 2u);
+            expect(keys[0].object == 1u && keys[0].transform == mat4::translate(2, 0, 0));
+        };
+    };
+
+    feature("Animation rendering") = [] {
+        auto scene = spheresAndBall();
+        auto view = camera(width, height);
+        render_options options;
+        options.samples_per_pixel = 2;
+        AnimationRenderer renderer(scene, view, options);
+        Canvas<vec3> image(width, height);
+        Canvas<vec3> expected(width, height);
+        auto pixel_count = u64(width) * u64(height);
+
+        then("The first frame is traced in full") = [&] {
+            auto stats = renderer.renderFrame(0, {}, image);
+            render(scene, view, expected, options);
+            expect(stats.traced_pixels == pixel_count && stats.reused_pixels == 0u);
+            expect(same(image, expected));
+        };
+
+        then("A frame where nothing moves is reused whole") = [&] {
+            std::array keys { transform_key() };
+            keys[0].frame = 1;
+            keys[0].object = ball;
+            keys[0].transform = scene.objects.get(ball).transform();
+            auto stats = renderer.renderFrame(1, keys, image);
+            expect(stats.moved == 0u && stats.traced_pixels == 0u);
+            expect(same(image, expected));
+        };
+
+        then("Each frame matches a full render and retraces only what motion touches") = [&] {
+            Timeline timeline;
+            for (u32 frame = 2; frame < 8; frame++) {
+                timeline.key(frame, ball, ballAt(-2.5f + 0.3f * f32(frame), -2));
+            }
+            for (u32 frame = 2; frame < 8; frame++) {
+                auto stats = renderer.renderFrame(timeline, frame, image);
+                render(scene, view, expected, options);
+                expect(same(image, expected)) << frame;
+                expect(stats.moved == 1u && !stats.update.full_rebuild);
+                expect(stats.traced_pixels > 0u && stats.traced_pixels < pixel_count / 2) << stats.traced_pixels;
+            }
+        };
+
+        then("Bigger motion retraces more") = [&] {
+            std::array keys { transform_key() };
+            keys[0].object = ball;
+            keys[0].transform = ballAt(-0.35f, -2);
+            auto small = renderer.renderFrame(8, keys, image);
+            keys[0].transform = ballAt(1.5f, -2.5f);
+            auto large = renderer.renderFrame(9, keys, image);
+            render(scene, view, expected, options);
+            expect(same(image, expected));
+            expect(small.traced_pixels < large.traced_pixels) << small.traced_pixels << large.traced_pixels;
+        };
+
+        then("A new camera or added object starts over") = [&] {
+            Camera moved(width, height, 1.0f, viewTransform(vec3(1, 2, -6), vec3(0, 0, 0), vec3(0, 1, 0)));
+            renderer.setCamera(moved);
+            auto stats = renderer.renderFrame(10, {}, image);
+            render(scene, moved, expected, options);
+            expect(stats.traced_pixels == pixel_count && same(image, expected));
+
+            scene.objects.add<Sphere>().setTransform(mat4::translate(0, 2, 0));
+            stats = renderer.renderFrame(11, {}, image);
+            render(scene, moved, expected, options);
+            expect(stats.update.full_rebuild && stats.traced_pixels == pixel_count);
+            expect(same(image, expected));
+        };
+
+        then("renderAnimation() hands over every frame") = [&] {
+            auto fresh = spheresAndBall();
+            Timeline timeline;
+            timeline.key(0, ball, ballAt(-2.5f, -2));
+            timeline.key(3, ball, ballAt(-2, -2));
+            std::vector<u64> traced;
+            renderAnimation(fresh, view, timeline, options, [&](u32 frame, Canvas<vec3> const& frame_image, frame_stats const& stats) {
+                expect(stats.frame == frame);
+                traced.push_back(stats.traced_pixels);
+                if (frame == 3) {
+                    render(fresh, view, expected, options);
+                    expect(same(frame_image, expected));
+                }
+            });
+            expect(traced.size() == 4u);
+            expect(traced[0] == pixel_count && traced[1] == 0u && traced[2] == 0u && traced[3] > 0u);
+        };
+    };
+}
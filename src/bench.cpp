@@ -0,0 +1,461 @@
+import std;
+import raytracer;
+
+using namespace raytracer;
+
+using clock_type = std::chrono::steady_clock;
+
+// Random unit-ish boxes in a cube, so build and traversal timings are
+// repeatable between runs.
+std::vector<aabb> randomBoxes(u32 count, u32 seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<f32> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<f32> size(0.05f, 1.0f);
+    std::vector<aabb> boxes(count);
+    for (auto& box : boxes) {
+        auto p = vec3(position(rng), position(rng), position(rng));
+        box = { p, p + vec3(size(rng), size(rng), size(rng)) };
+    }
+    return boxes;
+}
+
+template<typename F>
+f64 millisecondsOf(F&& f)
+{
+    auto start = clock_type::now();
+    f();
+    return std::chrono::duration<f64, std::milli>(clock_type::now() - start).count();
+}
+
+void benchBvhBuild(u32 primitive_count)
+{
+    auto boxes = randomBoxes(primitive_count, 1);
+    std::println("bvh build, {} primitives", primitive_count);
+    std::println("  {:>8} {:>12} {:>14} {:>10} {:>10} {:>10}",
+        "threads", "build ms", "ms / Mprims", "nodes", "SAH", "leaf avg");
+    for (u32 threads : { 1u, defaultThreadCount() }) {
+        Bvh bvh;
+        auto ms = millisecondsOf([&] { bvh.build(boxes, threads); });
+        std::println("  {:>8} {:>12.2f} {:>14.2f} {:>10} {:>10.2f} {:>10.2f}",
+            threads,
+            ms,
+            ms * 1e6 / f64(primitive_count),
+            bvh.nodes().size(),
+            sahCost(bvh.view()),
+            averageLeafSize(bvh.view()));
+        if (threads == defaultThreadCount()) {
+            break;
+        }
+    }
+}
+
+// Spheres scattered with random transforms, so the BVH is built from the
+// world bounds that Scene::build() derives from Object::transform().
+Scene randomSphereScene(u32 count, u32 seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<f32> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<f32> radius(0.05f, 0.5f);
+    Scene scene;
+    for (u32 i = 0; i < count; i++) {
+        auto& s = scene.objects.add<Sphere>();
+        auto r = radius(rng);
+        s.setTransform(mat4::translate(position(rng), position(rng), position(rng)) * mat4::scale(r, r, r));
+    }
+    return scene;
+}
+
+void benchSceneBuild(u32 object_count)
+{
+    auto scene = randomSphereScene(object_count, 2);
+    scene.preferred_accelerator = accelerator_kind::bvh;
+    auto ms = millisecondsOf([&] { scene.build(); });
+    std::println("scene build, {} spheres: {:.2f} ms ({:.2f} ms / Mprims), SAH {:.2f}, leaf avg {:.2f}",
+        object_count,
+        ms,
+        ms * 1e6 / f64(object_count),
+        sahCost(scene.acceleration()),
+        averageLeafSize(scene.acceleration()));
+}
+
+// Quad tiles on the walls, floors and ceilings of box-shaped rooms, a
+// stand-in for architectural scenes.
+Scene randomPanelScene(u32 count, u32 seed)
+{
+    auto quad = std::make_shared<TriangleMesh>(
+        std::vector { vec3(-1, -1, 0), vec3(1, -1, 0), vec3(1, 1, 0), vec3(-1, 1, 0) },
+        std::vector { uvec3(0, 1, 2), uvec3(0, 2, 3) });
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<f32> room(-100.0f, 100.0f);
+    std::uniform_real_distribution<f32> u(0.0f, 1.0f);
+    std::vector<vec3> rooms(16);
+    for (auto& r : rooms) {
+        r = vec3(room(rng), room(rng), room(rng));
+    }
+    constexpr f32 room_size = 20.0f;
+    Scene scene;
+    for (u32 i = 0; i < count; i++) {
+        // Quads face +z; turn them to face the wall's axis.
+        auto axis = i % 3;
+        auto facing = axis == 2 ? identity<mat4> : axis == 1 ? mat4::rotateX(pi<f32> / 2) : mat4::rotateY(pi<f32> / 2);
+        auto p = rooms[i % rooms.size()] + vec3(u(rng), u(rng), u(rng)) * room_size;
+        p[axis] = rooms[i % rooms.size()][axis] + (i % 2 == 0 ? 0.0f : room_size);
+        auto& inst = scene.objects.add<Instance>(quad);
+        inst.setTransform(mat4::translate(p.x, p.y, p.z) * facing * mat4::scale(0.5f + u(rng), 0.5f + u(rng), 1.0f));
+    }
+    return scene;
+}
+
+void benchAccelerators(std::string_view label, Scene& scene, u32 ray_count)
+{
+    std::mt19937 rng(4);
+    std::uniform_real_distribution<f32> u(-1.0f, 1.0f);
+    std::vector<ray> rays(ray_count);
+    for (auto& r : rays) {
+        r = ray(vec3(u(rng), u(rng), u(rng)) * 100.0f, normalize(vec3(u(rng), u(rng), u(rng))));
+    }
+
+    scene.preferred_accelerator = accelerator_kind::automatic;
+    scene.build();
+    std::println("{}, {} objects, {} rays (automatic: {})",
+        label, scene.objects.size(), ray_count, nameOf(scene.acceleratorKind()));
+    std::println("  {:>8} {:>12} {:>12} {:>10} {:>10}", "backend", "build ms", "memory MB", "Mrays/s", "hits");
+    for (auto kind : { accelerator_kind::bvh, accelerator_kind::grid, accelerator_kind::kd_tree }) {
+        scene.preferred_accelerator = kind;
+        auto build_ms = millisecondsOf([&] { scene.build(); });
+        u32 hits = 0;
+        auto trace_ms = millisecondsOf([&] {
+            for (auto const& r : rays) {
+                hits += scene.intersect(r).has_value();
+            }
+        });
+        std::println("  {:>8} {:>12.2f} {:>12.2f} {:>10.2f} {:>10}",
+            nameOf(kind),
+            build_ms,
+            f64(scene.accelerator()->memoryBytes()) / (1024.0 * 1024.0),
+            f64(ray_count) / (trace_ms * 1e3),
+            hits);
+    }
+}
+
+// Per-shading-point cost of evaluating every light against sampling one
+// from the light tree or summing a clustered cut.
+void benchLights(u32 shading_points)
+{
+    std::mt19937 rng(6);
+    std::uniform_real_distribution<f32> u(-1.0f, 1.0f);
+    std::uniform_real_distribution<f32> u01(0.0f, 1.0f);
+    std::vector<vec3> points(shading_points);
+    for (auto& p : points) {
+        p = vec3(u(rng), u(rng), u(rng)) * 100.0f;
+    }
+    material m;
+    auto n = unit_y<vec3>;
+
+    std::println("lights, {} shading points", shading_points);
+    std::println("  {:>8} {:>12} {:>14} {:>14} {:>14}", "lights", "build ms", "all ns/pt", "sample ns/pt", "cluster ns/pt");
+    for (u32 count : { 1'000u, 10'000u, 100'000u }) {
+        std::vector<point_light> lights(count);
+        for (auto& light : lights) {
+            light = point_light(vec3(u(rng), u(rng), u(rng)) * 100.0f, vec3(u01(rng), u01(rng), u01(rng)));
+        }
+        LightTree tree;
+        auto build_ms = millisecondsOf([&] { tree.build(lights); });
+
+        // Only a slice of the points for the linear baseline, which would
+        // otherwise dominate the run.
+        auto all_points = std::min<usize>(points.size(), 1'000'000 / count);
+        vec3 sink = zero<vec3>;
+        auto all_ms = millisecondsOf([&] {
+            for (usize i = 0; i < all_points; i++) {
+                for (auto const& light : lights) {
+                    sink = sink + lighting(m, light, points[i], n, n);
+                }
+            }
+        });
+        auto sample_ms = millisecondsOf([&] {
+            for (auto const& p : points) {
+                if (auto s = tree.sample(p, n, u01(rng))) {
+                    auto light = lights[s->light];
+                    light.intensity = light.intensity * (1.0f / s->pdf);
+                    sink = sink + lighting(m, light, p, n, n);
+                }
+            }
+        });
+        std::array<point_light, LightTree::max_cut_size> cut;
+        auto cluster_ms = millisecondsOf([&] {
+            for (auto const& p : points) {
+                auto size = tree.cluster(p, n, 0.02f, cut);
+                for (usize i = 0; i < size; i++) {
+                    sink = sink + lighting(m, cut[i], p, n, n);
+                }
+            }
+        });
+        std::println("  {:>8} {:>12.2f} {:>14.1f} {:>14.1f} {:>14.1f}{}",
+            count,
+            build_ms,
+            all_ms * 1e6 / f64(all_points),
+            sample_ms * 1e6 / f64(points.size()),
+            cluster_ms * 1e6 / f64(points.size()),
+            sink.x < 0.0f ? " " : "");
+    }
+}
+
+void benchShading(u32 shading_points)
+{
+    std::mt19937 rng(8);
+    std::uniform_real_distribution<f32> u(-1.0f, 1.0f);
+    std::vector<vec3> points(shading_points), eyes(shading_points), normals(shading_points);
+    for (u32 i = 0; i < shading_points; i++) {
+        points[i] = vec3(u(rng), u(rng), u(rng));
+        eyes[i] = normalize(vec3(u(rng), u(rng), u(rng)));
+        normals[i] = normalize(vec3(u(rng), u(rng), u(rng)));
+    }
+    auto light = point_light(vec3(-10, 10, -10), one<vec3>);
+
+    std::println("shading, {} points", shading_points);
+    std::println("  {:>10} {:>12} {:>12} {:>12}", "shininess", "exact ns", "table ns", "batch ns");
+    for (f32 shininess : { 10.0f, 200.0f }) {
+        material m;
+        m.shininess = shininess;
+        SpecularTable table(shininess);
+        vec3 sink = zero<vec3>;
+        auto exact_ms = millisecondsOf([&] {
+            for (u32 i = 0; i < shading_points; i++) {
+                sink = sink + lighting(m, light, points[i], eyes[i], normals[i]);
+            }
+        });
+        auto table_ms = millisecondsOf([&] {
+            for (u32 i = 0; i < shading_points; i++) {
+                sink = sink + lighting(m, table, light, points[i], eyes[i], normals[i]);
+            }
+        });
+        auto batch_ms = millisecondsOf([&] {
+            for (u32 first = 0; first + lighting_batch_size <= shading_points; first += lighting_batch_size) {
+                shading_batch batch;
+                for (usize lane = 0; lane < lighting_batch_size; lane++) {
+                    batch.set(lane, points[first + lane], eyes[first + lane], normals[first + lane]);
+                }
+                color_batch colors;
+                lighting(m, table, light, batch, colors);
+                sink = sink + colors.get(0);
+            }
+        });
+        std::println("  {:>10.0f} {:>12.1f} {:>12.1f} {:>12.1f}{}",
+            shininess,
+            exact_ms * 1e6 / f64(shading_points),
+            table_ms * 1e6 / f64(shading_points),
+            batch_ms * 1e6 / f64(shading_points),
+            sink.x < 0.0f ? " " : "");
+    }
+}
+
+// Diffuse and glossy spheres on a floor inside a closed shell, so paths
+// keep bouncing until max_depth.
+void benchPathTracer(u32 sphere_count)
+{
+    std::mt19937 rng(10);
+    std::uniform_real_distribution<f32> position(-20.0f, 20.0f);
+    std::uniform_real_distribution<f32> radius(0.3f, 1.5f);
+    std::uniform_real_distribution<f32> u01(0.0f, 1.0f);
+    Scene scene;
+    std::array<u32, 4> materials;
+    for (u32 i = 0; i < materials.size(); i++) {
+        material m;
+        m.color = vec3(u01(rng), u01(rng), u01(rng));
+        m.diffuse = i % 2 == 0 ? 0.8f : 0.2f;
+        m.specular = i % 2 == 0 ? 0.1f : 0.7f;
+        m.shininess = i % 2 == 0 ? 10.0f : 100.0f;
+        materials[i] = scene.materials.add(m);
+    }
+    auto& shell = scene.objects.add<Sphere>();
+    shell.setTransform(mat4::scale(60.0f, 60.0f, 60.0f));
+    shell.material_id = materials[0];
+    for (u32 i = 0; i < sphere_count; i++) {
+        auto& s = scene.objects.add<Sphere>();
+        auto r = radius(rng);
+        s.setTransform(mat4::translate(position(rng), position(rng) * 0.25f, position(rng)) * mat4::scale(r, r, r));
+        s.material_id = materials[i % materials.size()];
+    }
+    scene.lights.push_back(point_light(vec3(0, 30, 0), vec3(0.8f, 0.8f, 0.8f)));
+    scene.lights.push_back(point_light(vec3(-30, 10, -30), vec3(0.4f, 0.3f, 0.3f)));
+    scene.build();
+
+    constexpr i32 width = 160;
+    constexpr i32 height = 120;
+    auto origin = vec3(0, 2, -45);
+    auto primary = [&](i32 row, i32 col) {
+        auto target = vec3(f32(col - width / 2) * 0.5f, f32(height / 2 - row) * 0.5f, 0.0f);
+        return ray(origin, normalize(target - origin));
+    };
+
+    std::println("path tracing, {} spheres, {}x{}", sphere_count, width, height);
+    std::println("  {:>12} {:>8} {:>12} {:>14}", "mode", "depth", "ms", "Mpaths / s");
+    for (u32 depth : { 1u, 8u }) {
+        for (auto mode : { path_tracer_mode::megakernel, path_tracer_mode::wavefront }) {
+            for (bool sort : { false, true }) {
+                if (mode == path_tracer_mode::megakernel && sort) {
+                    continue;
+                }
+                path_tracer_settings settings;
+                settings.mode = mode;
+                settings.samples_per_pixel = 4;
+                settings.max_depth = depth;
+                settings.sort_rays = sort;
+                Canvas<vec3> image(width, height);
+                auto ms = millisecondsOf([&] { PathTracer(settings).render(scene, primary, image); });
+                auto label = mode == path_tracer_mode::megakernel ? "megakernel" : sort ? "wave sorted" : "wavefront";
+                std::println("  {:>12} {:>8} {:>12.1f} {:>14.3f}",
+                    label,
+                    depth,
+                    ms,
+                    f64(width * height * settings.samples_per_pixel) / (ms * 1e3));
+            }
+        }
+    }
+
+    adaptive_settings adaptive;
+    adaptive.min_samples = 4;
+    adaptive.max_samples = 32;
+    adaptive.target_error = 0.05f;
+    SampleStatistics statistics(width, height);
+    Canvas<vec3> image(width, height);
+    adaptive_stats stats;
+    auto ms = millisecondsOf([&] { stats = PathTracer().renderAdaptive(scene, primary, adaptive, statistics, image); });
+    std::println("  adaptive, {} to {} spp: {} rounds, {:.1f} spp on average, {:.1f} ms",
+        adaptive.min_samples,
+        adaptive.max_samples,
+        stats.rounds,
+        f64(stats.samples) / (width * height),
+        ms);
+
+    GBuffer gbuffer(width, height);
+    gbuffer.fill(scene, primary);
+    for (u32 threads : { 1u, defaultThreadCount() }) {
+        denoise_settings settings;
+        settings.threads = threads;
+        auto denoise_ms = millisecondsOf([&] { Denoiser(settings).denoise(image, gbuffer, scene.materials); });
+        std::println("  denoise, {} threads: {:.2f} ms", threads, denoise_ms);
+    }
+}
+
+// Primary rays for a 1920x1080 frame: the per-pixel image-plane
+// arithmetic the examples used to do, against Camera rays one at a time
+// and by tile.
+void benchCamera()
+{
+    constexpr i32 width = 1920;
+    constexpr i32 height = 1080;
+    constexpr i32 tile_size = 32;
+    Camera camera(width, height, 1.0f, viewTransform(vec3(0, 2, -45), vec3(0, 0, 0), vec3(0, 1, 0)));
+    std::vector<ray> rays(usize(width) * height);
+    // Folded into the output so no variant is optimized away.
+    f32 checksum = 0.0f;
+    auto report = [&](std::string_view label, f64 ms) {
+        for (auto const& r : rays) {
+            checksum += r.d.x;
+        }
+        std::println("  {:>12} {:>12.2f} {:>14.2f}", label, ms, ms * 1e6 / f64(rays.size()));
+    };
+
+    std::println("primary rays, {}x{}", width, height);
+    std::println("  {:>12} {:>12} {:>14}", "method", "ms", "ns / ray");
+    auto origin = vec3(0, 2, -45);
+    report("by hand", millisecondsOf([&] {
+        for (i32 row = 0; row < height; row++) {
+            for (i32 col = 0; col < width; col++) {
+                f32 world_x = (f32(col) + 0.5f - f32(width) / 2.0f) * 0.01f;
+                f32 world_y = (f32(height) / 2.0f - f32(row) - 0.5f) * 0.01f;
+                rays[usize(row) * width + col] = ray(origin, normalize(vec3(world_x, world_y, 0.0f) - origin));
+            }
+        }
+    }));
+    report("per pixel", millisecondsOf([&] {
+        for (i32 row = 0; row < height; row++) {
+            for (i32 col = 0; col < width; col++) {
+                rays[usize(row) * width + col] = camera(row, col);
+            }
+        }
+    }));
+    report("tiles", millisecondsOf([&] {
+        pixel_tile tile;
+        for (tile.row = 0; tile.row < height; tile.row += tile_size) {
+            for (tile.col = 0; tile.col < width; tile.col += tile_size) {
+                tile.rows = std::min(tile_size, height - tile.row);
+                tile.cols = std::min(tile_size, width - tile.col);
+                auto first = usize(tile.row) * width + usize(tile.col) * usize(tile.rows);
+                camera.generate(tile, std::span(rays).subspan(first, usize(tile.rows * tile.cols)));
+            }
+        }
+    }));
+    Sampler sampler;
+    report("jittered", millisecondsOf([&] {
+        pixel_tile tile;
+        for (tile.row = 0; tile.row < height; tile.row += tile_size) {
+            for (tile.col = 0; tile.col < width; tile.col += tile_size) {
+                tile.rows = std::min(tile_size, height - tile.row);
+                tile.cols = std::min(tile_size, width - tile.col);
+                auto first = usize(tile.row) * width + usize(tile.col) * usize(tile.rows);
+                camera.generate(tile, std::span(rays).subspan(first, usize(tile.rows * tile.cols)), sampler, 0);
+            }
+        }
+    }));
+    std::println("  checksum {:.3f}", checksum);
+}
+
+// Primary hits for a 640x480 frame on one thread: each centre ray traced
+// through the BVH, against a rasterized VisibilityBuffer.
+void benchVisibility(std::string_view label, Scene& scene)
+{
+    constexpr i32 width = 640;
+    constexpr i32 height = 480;
+    scene.build();
+    Camera camera(width, height, 1.0f, viewTransform(vec3(0, 2, -150), vec3(0, 0, 0), vec3(0, 1, 0)));
+    pixel_tile frame;
+    frame.row = 0;
+    frame.col = 0;
+    frame.rows = height;
+    frame.cols = width;
+    std::vector<ray> rays(usize(width) * height);
+    camera.generate(frame, rays);
+    u64 traced_hits = 0;
+    auto traced_ms = millisecondsOf([&] {
+        for (auto const& r : rays) {
+            traced_hits += scene.intersect(ray(r.o, normalize(r.d))).has_value();
+        }
+    });
+    VisibilityBuffer visibility(width, height);
+    render_options options;
+    options.policy = execution_policy::serial;
+    raster_stats stats;
+    auto raster_ms = millisecondsOf([&] { stats = visibility.rasterize(scene, camera, options); });
+    std::println("primary visibility, {}, {}x{}", label, width, height);
+    std::println("  {:>12} {:>12} {:>10}", "method", "ms", "hits");
+    std::println("  {:>12} {:>12.2f} {:>10}", "traced", traced_ms, traced_hits);
+    std::println("  {:>12} {:>12.2f} {:>10}", "rasterized", raster_ms, stats.covered_pixels);
+}
+
+int main(int argc, char** argv)
+{
+    u32 primitive_count = argc > 1 ? static_cast<u32>(std::stoul(argv[1])) : 1'000'000;
+    benchBvhBuild(primitive_count);
+    benchSceneBuild(primitive_count);
+
+    // The kd-tree build is O(n log^2 n), so backends are compared on a
+    // smaller scene.
+    u32 object_count = std::min(primitive_count, 100'000u);
+    auto spheres = randomSphereScene(object_count, 2);
+    benchAccelerators("sphere cloud", spheres, 200'000);
+    auto panels = randomPanelScene(object_count, 3);
+    benchAccelerators("panels", panels, 200'000);
+
+    benchLights(10'000);
+    benchShading(1'000'000);
+    benchCamera();
+    auto few_spheres = randomSphereScene(std::min(primitive_count, 1'000u), 2);
+    benchVisibility("spheres", few_spheres);
+    auto few_panels = randomPanelScene(std::min(primitive_count, 1'000u), 3);
+    benchVisibility("panels", few_panels);
+    benchPathTracer(std::min(primitive_count, 10'000u));
+}
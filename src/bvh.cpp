@@ -0,0 +1,664 @@
+export module raytracer.bvh;
+
+import raytracer.aabb;
+import raytracer.ray;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+struct bvh_node {
+    aabb bounds;
+    // First primitive index for leaves, first of the two adjacent children
+    // for interior nodes.
+    u32 offset = 0;
+    // Primitive count, zero for interior nodes.
+    u32 count = 0;
+
+    [[nodiscard]] constexpr bool isLeaf() const { return count != 0; }
+};
+
+static_assert(sizeof(bvh_node) == 32);
+static_assert(std::is_trivially_copyable_v<bvh_node>);
+
+// Non-owning view over flattened nodes and the primitive indices their leaves
+// refer to, so the same traversal runs over a built Bvh or a mapped file.
+struct bvh_view {
+    std::span<bvh_node const> nodes;
+    std::span<u32 const> indices;
+};
+
+// Visits the primitives of every leaf the ray enters before `t_max`, nearest
+// child first. `f(primitive, t_max)` returns the new `t_max`, which culls
+// nodes that lie behind the closest hit found so far.
+template<typename F>
+void traverse(bvh_view const& bvh, ray const& r, f32 t_max, F&& f)
+{
+    constexpr f32 miss = std::numeric_limits<f32>::infinity();
+    if (bvh.nodes.empty()) {
+        return;
+    }
+    auto inv_d = reciprocal(r.d);
+    auto t_root = intersect(bvh.nodes[0].bounds, r, inv_d, t_max);
+    if (t_root == miss) {
+        return;
+    }
+
+    std::array<std::pair<u32, f32>, 64> stack;
+    usize top = 0;
+    stack[top++] = { 0, t_root };
+    while (top != 0) {
+        auto [index, t_entry] = stack[--top];
+        if (t_entry > t_max) {
+            continue;
+        }
+        auto const& node = bvh.nodes[index];
+        if (node.isLeaf()) {
+            for (u32 i = node.offset; i < node.offset + node.count; i++) {
+                t_max = f(bvh.indices[i], t_max);
+            }
+            continue;
+        }
+        u32 near = node.offset;
+        u32 far = node.offset + 1;
+        f32 t_near = intersect(bvh.nodes[near].bounds, r, inv_d, t_max);
+        f32 t_far = intersect(bvh.nodes[far].bounds, r, inv_d, t_max);
+        if (t_far < t_near) {
+            std::swap(near, far);
+            std::swap(t_near, t_far);
+        }
+        if (t_far != miss) {
+            stack[top++] = { far, t_far };
+        }
+        if (t_near != miss) {
+            stack[top++] = { near, t_near };
+        }
+    }
+}
+
+// Calls f(node) for every node reachable from the root. Incremental
+// updates can leave unreachable nodes behind in the array.
+template<typename F>
+void forEachNode(bvh_view const& bvh, F&& f)
+{
+    if (bvh.nodes.empty()) {
+        return;
+    }
+    std::vector<u32> stack { 0 };
+    while (!stack.empty()) {
+        auto const& node = bvh.nodes[stack.back()];
+        stack.pop_back();
+        f(node);
+        if (!node.isLeaf()) {
+            stack.push_back(node.offset);
+            stack.push_back(node.offset + 1);
+        }
+    }
+}
+
+// Expected cost of a random ray against the tree, relative to one primitive
+// test, with traversal and intersection weighted equally.
+[[nodiscard]] f32 sahCost(bvh_view const& bvh)
+{
+    if (bvh.nodes.empty()) {
+        return 0.0f;
+    }
+    f32 root_area = bvh.nodes[0].bounds.surfaceArea();
+    if (root_area <= 0.0f) {
+        return f32(bvh.indices.size());
+    }
+    f32 cost = 0.0f;
+    forEachNode(bvh, [&](bvh_node const& node) {
+        cost += node.bounds.surfaceArea() * (node.isLeaf() ? f32(node.count) : 1.0f);
+    });
+    return cost / root_area;
+}
+
+[[nodiscard]] f32 averageLeafSize(bvh_view const& bvh)
+{
+    usize leaves = 0;
+    forEachNode(bvh, [&](bvh_node const& node) {
+        leaves += node.isLeaf();
+    });
+    return leaves == 0 ? 0.0f : f32(bvh.indices.size()) / f32(leaves);
+}
+
+struct bvh_update_stats {
+    u32 refitted_nodes = 0;
+    u32 rebuilt_subtrees = 0;
+    u32 rebuilt_primitives = 0;
+    bool full_rebuild = false;
+};
+
+[[nodiscard]] u32 defaultThreadCount()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+class Bvh {
+public:
+    static constexpr u32 max_leaf_size = 8;
+    static constexpr u32 max_depth = 48;
+    static constexpr u32 bin_count = 16;
+    static constexpr f32 traversal_cost = 1.0f;
+    static constexpr f32 intersection_cost = 1.0f;
+    // Smaller subtrees and bin passes stay on the calling thread.
+    static constexpr u32 parallel_subtree_size = 4096;
+    static constexpr u32 parallel_binning_size = 1 << 16;
+
+    Bvh() = default;
+
+    explicit Bvh(std::span<aabb const> primitive_bounds, u32 thread_count = defaultThreadCount())
+    {
+        build(primitive_bounds, thread_count);
+    }
+
+    // Binned SAH build. The thread budget is split between the two children
+    // of every large node, and nodes too close to the root to have many
+    // siblings also bin their primitives in parallel.
+    void build(std::span<aabb const> primitive_bounds, u32 thread_count = defaultThreadCount())
+    {
+        auto n = static_cast<u32>(primitive_bounds.size());
+        m_nodes.clear();
+        m_indices.resize(n);
+        std::iota(m_indices.begin(), m_indices.end(), 0u);
+        m_leaf_of.assign(n, 0);
+        m_parents.clear();
+        m_build_area.clear();
+        m_garbage = 0;
+        if (n == 0) {
+            return;
+        }
+        m_nodes.resize(1);
+        buildSubtree(0, 0, n, 0, primitive_bounds, thread_count);
+    }
+
+    // Recomputes every node's bounds bottom-up in O(n), keeping topology.
+    // Children are always stored after their parent, so a reverse sweep
+    // sees them first.
+    void refit(std::span<aabb const> primitive_bounds)
+    {
+        for (usize i = m_nodes.size(); i-- > 0;) {
+            refitNode(static_cast<u32>(i), primitive_bounds);
+        }
+    }
+
+    // Refits the leaves holding `changed` primitives and their ancestors,
+    // then rebuilds the topmost subtree on each changed path whose surface
+    // area grew past `max_area_growth` times its area when built. Cost is
+    // proportional to the changed primitives and the subtrees rebuilt.
+    bvh_update_stats update(
+        std::span<aabb const> primitive_bounds,
+        std::span<u32 const> changed,
+        f32 max_area_growth = 2.0f,
+        u32 thread_count = defaultThreadCount())
+    {
+        bvh_update_stats stats;
+        if (m_nodes.empty() || changed.empty()) {
+            return stats;
+        }
+
+        // Refit upwards from each changed leaf, stopping where bounds no
+        // longer change; other changed leaves climb past that point.
+        std::vector<u32> touched;
+        for (auto p : changed) {
+            for (u32 node = m_leaf_of[p]; node != no_parent; node = m_parents[node]) {
+                auto old = m_nodes[node].bounds;
+                refitNode(node, primitive_bounds);
+                touched.push_back(node);
+                stats.refitted_nodes++;
+                if (m_nodes[node].bounds == old) {
+                    break;
+                }
+            }
+        }
+
+        std::vector<u32> degraded;
+        for (auto node : touched) {
+            if (isDegraded(node, max_area_growth)) {
+                degraded.push_back(node);
+            }
+        }
+        std::ranges::sort(degraded);
+        auto [last, end] = std::ranges::unique(degraded);
+        degraded.erase(last, end);
+        for (auto node : degraded) {
+            bool topmost = true;
+            for (u32 a = m_parents[node]; a != no_parent && topmost; a = m_parents[a]) {
+                topmost = !std::ranges::binary_search(degraded, a);
+            }
+            if (!topmost) {
+                continue;
+            }
+            if (node == 0) {
+                build(primitive_bounds, thread_count);
+                stats.full_rebuild = true;
+                return stats;
+            }
+            auto [first, count] = primitiveRange(node);
+            m_garbage += subtreeSize(node) - 1;
+            buildSubtree(node, first, count, depthOf(node), primitive_bounds, thread_count);
+            stats.rebuilt_subtrees++;
+            stats.rebuilt_primitives += count;
+        }
+
+        // Rebuilt subtrees leave their old nodes behind; compact by
+        // rebuilding once they dominate the array.
+        if (m_garbage > m_nodes.size() / 2) {
+            build(primitive_bounds, thread_count);
+            stats.full_rebuild = true;
+        }
+        return stats;
+    }
+
+    [[nodiscard]] bvh_view view() const
+    {
+        return { m_nodes, m_indices };
+    }
+
+    [[nodiscard]] std::span<bvh_node const> nodes() const
+    {
+        return m_nodes;
+    }
+
+    [[nodiscard]] std::span<u32 const> indices() const
+    {
+        return m_indices;
+    }
+
+private:
+    static constexpr u32 no_parent = std::numeric_limits<u32>::max();
+
+    std::vector<bvh_node> m_nodes;
+    std::vector<u32> m_indices;
+    // Bookkeeping for incremental updates: parent of each node, leaf of
+    // each primitive, and each node's surface area when it was built.
+    std::vector<u32> m_parents;
+    std::vector<u32> m_leaf_of;
+    std::vector<f32> m_build_area;
+    // Unreachable nodes left behind by subtree rebuilds.
+    usize m_garbage = 0;
+
+    // Builds the primitives m_indices[first, first + count) below node
+    // `index`, appending the new descendants to the node array.
+    void buildSubtree(
+        u32 index,
+        u32 first,
+        u32 count,
+        u32 depth,
+        std::span<aabb const> primitive_bounds,
+        u32 thread_count)
+    {
+        thread_count = std::max(1u, thread_count);
+        auto base = static_cast<u32>(m_nodes.size());
+        m_nodes.resize(base + 2 * count - 2);
+
+        // Primitive references are partitioned in place, which keeps the
+        // binning passes streaming through memory instead of gathering.
+        std::vector<primitive_ref> refs(count);
+        auto tasks = count >= parallel_binning_size ? thread_count : 1;
+        std::vector<build_range> partial(tasks);
+        forEachSlice(0, count, tasks, [&](u32 task, u32 a, u32 b) {
+            for (u32 i = a; i < b; i++) {
+                auto p = m_indices[first + i];
+                refs[i] = { primitive_bounds[p], primitive_bounds[p].centroid(), p };
+                partial[task].bounds.extend(refs[i].bounds);
+                partial[task].centroid_bounds.extend(refs[i].centroid);
+            }
+        });
+        build_range root;
+        root.count = count;
+        for (auto const& p : partial) {
+            root.bounds.extend(p.bounds);
+            root.centroid_bounds.extend(p.centroid_bounds);
+        }
+
+        builder b;
+        b.nodes = m_nodes;
+        b.refs = refs;
+        b.base = first;
+        b.node_count = base;
+        b.buildNode(index, root, depth, thread_count);
+        m_nodes.resize(b.node_count);
+        for (u32 i = 0; i < count; i++) {
+            m_indices[first + i] = refs[i].index;
+        }
+        link(index);
+    }
+
+    // Records parents, primitive leaves and build-time areas below `root`.
+    void link(u32 root)
+    {
+        m_parents.resize(m_nodes.size(), no_parent);
+        m_build_area.resize(m_nodes.size());
+        std::vector<u32> stack { root };
+        while (!stack.empty()) {
+            auto index = stack.back();
+            stack.pop_back();
+            auto const& node = m_nodes[index];
+            m_build_area[index] = node.bounds.surfaceArea();
+            if (node.isLeaf()) {
+                for (u32 i = node.offset; i < node.offset + node.count; i++) {
+                    m_leaf_of[m_indices[i]] = index;
+                }
+                continue;
+            }
+            for (u32 child : { node.offset, node.offset + 1 }) {
+                m_parents[child] = index;
+                stack.push_back(child);
+            }
+        }
+    }
+
+    void refitNode(u32 index, std::span<aabb const> primitive_bounds)
+    {
+        auto& node = m_nodes[index];
+        aabb bounds;
+        if (node.isLeaf()) {
+            for (u32 i = node.offset; i < node.offset + node.count; i++) {
+                bounds.extend(primitive_bounds[m_indices[i]]);
+            }
+        } else {
+            bounds = merge(m_nodes[node.offset].bounds, m_nodes[node.offset + 1].bounds);
+        }
+        node.bounds = bounds;
+    }
+
+    bool isDegraded(u32 index, f32 max_area_growth) const
+    {
+        return !m_nodes[index].isLeaf()
+            && m_nodes[index].bounds.surfaceArea() > max_area_growth * m_build_area[index];
+    }
+
+    // Subtrees cover a contiguous slice of m_indices, from the leftmost
+    // leaf's first primitive to the rightmost leaf's last.
+    std::pair<u32, u32> primitiveRange(u32 index) const
+    {
+        u32 left = index;
+        while (!m_nodes[left].isLeaf()) {
+            left = m_nodes[left].offset;
+        }
+        u32 right = index;
+        while (!m_nodes[right].isLeaf()) {
+            right = m_nodes[right].offset + 1;
+        }
+        u32 first = m_nodes[left].offset;
+        return { first, m_nodes[right].offset + m_nodes[right].count - first };
+    }
+
+    usize subtreeSize(u32 index) const
+    {
+        usize size = 0;
+        std::vector<u32> stack { index };
+        while (!stack.empty()) {
+            auto const& node = m_nodes[stack.back()];
+            stack.pop_back();
+            size++;
+            if (!node.isLeaf()) {
+                stack.push_back(node.offset);
+                stack.push_back(node.offset + 1);
+            }
+        }
+        return size;
+    }
+
+    u32 depthOf(u32 index) const
+    {
+        u32 depth = 0;
+        for (u32 a = m_parents[index]; a != no_parent; a = m_parents[a]) {
+            depth++;
+        }
+        return depth;
+    }
+
+    struct build_range {
+        u32 first = 0;
+        u32 count = 0;
+        aabb bounds;
+        aabb centroid_bounds;
+    };
+
+    struct primitive_ref {
+        aabb bounds;
+        vec3 centroid;
+        u32 index;
+    };
+
+    struct bin {
+        aabb bounds;
+        u32 count = 0;
+    };
+
+    using bin_grid = std::array<std::array<bin, bin_count>, 3>;
+
+    struct split {
+        // Unnormalized SAH cost, infinity when no candidate separates the
+        // primitives.
+        f32 cost = std::numeric_limits<f32>::infinity();
+        usize axis = 0;
+        // Bin index for binned splits, left primitive count for sweeps.
+        u32 position = 0;
+    };
+
+    // Nodes this small are sorted and swept exactly, which is cheaper than
+    // setting up bins for them.
+    static constexpr u32 sweep_size = 16;
+
+    // Runs f(task, first, last) over `tasks` contiguous slices of
+    // [first, first + count), one thread per slice.
+    template<typename F>
+    static void forEachSlice(u32 first, u32 count, u32 tasks, F const& f)
+    {
+        auto slice = [&](u32 task) {
+            return std::pair(
+                first + static_cast<u32>(u64(count) * task / tasks),
+                first + static_cast<u32>(u64(count) * (task + 1) / tasks));
+        };
+        std::vector<std::jthread> workers;
+        workers.reserve(tasks - 1);
+        for (u32 task = 1; task < tasks; task++) {
+            workers.emplace_back([&, task] {
+                auto [a, b] = slice(task);
+                f(task, a, b);
+            });
+        }
+        auto [a, b] = slice(0);
+        f(0u, a, b);
+    }
+
+    struct builder {
+        std::span<bvh_node> nodes;
+        std::span<primitive_ref> refs;
+        // Position of refs[0] in the primitive index array.
+        u32 base = 0;
+        std::atomic<u32> node_count;
+
+        static u32 binIndex(f32 c, f32 lo, f32 scale)
+        {
+            return std::min(bin_count - 1, static_cast<u32>((c - lo) * scale));
+        }
+
+        static f32 binScale(build_range const& r, usize axis)
+        {
+            auto extent = r.centroid_bounds.extent()[axis];
+            return extent > 0.0f ? f32(bin_count) / extent : 0.0f;
+        }
+
+        bin_grid binRange(build_range const& r, u32 threads) const
+        {
+            auto lo = r.centroid_bounds.min;
+            auto scale = vec3(binScale(r, 0), binScale(r, 1), binScale(r, 2));
+            auto fill = [&](bin_grid& grid, u32 first, u32 last) {
+                for (u32 i = first; i < last; i++) {
+                    auto const& ref = refs[i];
+                    for (usize axis = 0; axis < 3; axis++) {
+                        auto& b = grid[axis][binIndex(ref.centroid[axis], lo[axis], scale[axis])];
+                        b.bounds.extend(ref.bounds);
+                        b.count++;
+                    }
+                }
+            };
+            if (threads == 1 || r.count < parallel_binning_size) {
+                bin_grid grid;
+                fill(grid, r.first, r.first + r.count);
+                return grid;
+            }
+
+            std::vector<bin_grid> partial(threads);
+            forEachSlice(r.first, r.count, threads, [&](u32 task, u32 first, u32 last) {
+                fill(partial[task], first, last);
+            });
+            for (u32 task = 1; task < threads; task++) {
+                for (usize axis = 0; axis < 3; axis++) {
+                    for (u32 i = 0; i < bin_count; i++) {
+                        partial[0][axis][i].bounds.extend(partial[task][axis][i].bounds);
+                        partial[0][axis][i].count += partial[task][axis][i].count;
+                    }
+                }
+            }
+            return partial[0];
+        }
+
+        split binnedSplit(build_range const& r, u32 threads) const
+        {
+            auto grid = binRange(r, threads);
+            split best;
+            for (usize axis = 0; axis < 3; axis++) {
+                if (r.centroid_bounds.extent()[axis] <= 0.0f) {
+                    continue;
+                }
+                auto const& bins = grid[axis];
+                std::array<f32, bin_count> right_cost {};
+                aabb acc;
+                u32 count = 0;
+                for (u32 i = bin_count - 1; i > 0; i--) {
+                    acc.extend(bins[i].bounds);
+                    count += bins[i].count;
+                    right_cost[i] = count == 0 ? -1.0f : acc.surfaceArea() * f32(count);
+                }
+                acc = {};
+                count = 0;
+                for (u32 i = 0; i < bin_count - 1; i++) {
+                    acc.extend(bins[i].bounds);
+                    count += bins[i].count;
+                    if (count == 0 || right_cost[i + 1] < 0.0f) {
+                        continue;
+                    }
+                    f32 cost = acc.surfaceArea() * f32(count) + right_cost[i + 1];
+                    if (cost < best.cost) {
+                        best = { cost, axis, i + 1 };
+                    }
+                }
+            }
+            return best;
+        }
+
+        void sortRange(build_range const& r, usize axis)
+        {
+            auto begin = refs.begin() + r.first;
+            std::sort(begin, begin + r.count, [axis](primitive_ref const& a, primitive_ref const& b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+        }
+
+        split sweepSplit(build_range const& r)
+        {
+            split best;
+            std::array<f32, sweep_size> right_cost {};
+            for (usize axis = 0; axis < 3; axis++) {
+                if (r.centroid_bounds.extent()[axis] <= 0.0f) {
+                    continue;
+                }
+                sortRange(r, axis);
+                aabb acc;
+                for (u32 i = r.count - 1; i > 0; i--) {
+                    acc.extend(refs[r.first + i].bounds);
+                    right_cost[i] = acc.surfaceArea() * f32(r.count - i);
+                }
+                acc = {};
+                for (u32 i = 0; i < r.count - 1; i++) {
+                    acc.extend(refs[r.first + i].bounds);
+                    f32 cost = acc.surfaceArea() * f32(i + 1) + right_cost[i + 1];
+                    if (cost < best.cost) {
+                        best = { cost, axis, i + 1 };
+                    }
+                }
+            }
+            return best;
+        }
+
+        build_range rangeOf(u32 first, u32 count) const
+        {
+            build_range r;
+            r.first = first;
+            r.count = count;
+            for (u32 i = first; i < first + count; i++) {
+                r.bounds.extend(refs[i].bounds);
+                r.centroid_bounds.extend(refs[i].centroid);
+            }
+            return r;
+        }
+
+        void makeLeaf(bvh_node& node, build_range const& r)
+        {
+            node.offset = base + r.first;
+            node.count = r.count;
+        }
+
+        void buildNode(u32 index, build_range const& r, u32 depth, u32 threads)
+        {
+            auto& node = nodes[index];
+            node.bounds = r.bounds;
+            if (r.count == 1 || depth >= max_depth) {
+                makeLeaf(node, r);
+                return;
+            }
+
+            bool sweep = r.count <= sweep_size;
+            auto best = sweep ? sweepSplit(r) : binnedSplit(r, threads);
+            u32 left_count;
+            if (best.cost == std::numeric_limits<f32>::infinity()) {
+                // Every centroid coincides, so only an index split is left.
+                if (r.count <= max_leaf_size) {
+                    makeLeaf(node, r);
+                    return;
+                }
+                left_count = r.count / 2;
+            } else {
+                f32 area = r.bounds.surfaceArea();
+                f32 split_cost = traversal_cost + intersection_cost * best.cost / (area > 0.0f ? area : 1.0f);
+                if (r.count <= max_leaf_size && split_cost >= intersection_cost * f32(r.count)) {
+                    makeLeaf(node, r);
+                    return;
+                }
+                if (sweep) {
+                    sortRange(r, best.axis);
+                    left_count = best.position;
+                } else {
+                    auto lo = r.centroid_bounds.min[best.axis];
+                    auto scale = binScale(r, best.axis);
+                    auto begin = refs.begin() + r.first;
+                    auto mid = std::partition(begin, begin + r.count, [&](primitive_ref const& ref) {
+                        return binIndex(ref.centroid[best.axis], lo, scale) < best.position;
+                    });
+                    left_count = static_cast<u32>(mid - begin);
+                }
+            }
+
+            u32 left = node_count.fetch_add(2);
+            node.offset = left;
+            node.count = 0;
+            if (threads > 1 && r.count >= parallel_subtree_size) {
+                u32 half = threads / 2;
+                std::jthread worker([&] {
+                    buildNode(left, rangeOf(r.first, left_count), depth + 1, half);
+                });
+                buildNode(left + 1, rangeOf(r.first + left_count, r.count - left_count), depth + 1, threads - half);
+            } else {
+                buildNode(left, rangeOf(r.first, left_count), depth + 1, 1);
+                buildNode(left + 1, rangeOf(r.first + left_count, r.count - left_count), depth + 1, 1);
+            }
+        }
+    };
+};
+} // namespace raytracer
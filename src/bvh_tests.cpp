@@ -0,0 +1,180 @@
+import boost.ut;
+import raytracer;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+
+namespace {
+std::vector<aabb> randomBoxes(u32 count)
+{
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<f32> position(-50.0f, 50.0f);
+    std::uniform_real_distribution<f32> size(0.1f, 2.0f);
+    std::vector<aabb> boxes(count);
+    for (auto& box : boxes) {
+        auto p = vec3(position(rng), position(rng), position(rng));
+        box = { p, p + vec3(size(rng), size(rng), size(rng)) };
+    }
+    return boxes;
+}
+
+bool contains(aabb const& outer, aabb const& inner)
+{
+    return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z
+        && outer.max.x >= inner.max.x && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+}
+
+// Every primitive appears in exactly one reachable leaf, and every node
+// encloses its children and primitives.
+bool isValid(bvh_view const& bvh, std::span<aabb const> boxes)
+{
+    std::vector<u32> seen(boxes.size());
+    bool valid = true;
+    forEachNode(bvh, [&](bvh_node const& node) {
+        if (node.isLeaf()) {
+            for (u32 i = node.offset; i < node.offset + node.count; i++) {
+                auto p = bvh.indices[i];
+                seen[p]++;
+                valid = valid && contains(node.bounds, boxes[p]);
+            }
+        } else {
+            valid = valid && contains(node.bounds, bvh.nodes[node.offset].bounds)
+                && contains(node.bounds, bvh.nodes[node.offset + 1].bounds);
+        }
+    });
+    return valid && std::ranges::all_of(seen, [](u32 n) { return n == 1; });
+}
+} // namespace
+
+int main()
+{
+    feature("Building a BVH") = [] {
+        given("An empty set of primitives") = [] {
+            Bvh bvh(std::span<aabb const> {});
+            expect(bvh.nodes().empty());
+            expect(sahCost(bvh.view()) == 0.0_f);
+        };
+
+        given("Primitives sharing one centroid") = [] {
+            std::vector<aabb> boxes(100, aabb { vec3(-1), vec3(1) });
+            Bvh bvh(boxes);
+            expect(isValid(bvh.view(), boxes));
+        };
+
+        given("Random primitives") = [] {
+            auto boxes = randomBoxes(20000);
+            for (u32 threads : { 1u, 4u }) {
+                Bvh bvh(boxes, threads);
+                expect(isValid(bvh.view(), boxes));
+                expect(averageLeafSize(bvh.view()) >= 1.0f);
+                expect(averageLeafSize(bvh.view()) <= f32(Bvh::max_leaf_size));
+            }
+        };
+    };
+
+    feature("Traversing a BVH") = [] {
+        auto boxes = randomBoxes(2000);
+        Bvh bvh(boxes);
+        std::mt19937 rng(3);
+        std::uniform_real_distribution<f32> u(-1.0f, 1.0f);
+
+        then("It finds the same closest box as a linear scan") = [&] {
+            for (i32 i = 0; i < 500; i++) {
+                auto r = ray(vec3(u(rng), u(rng), u(rng)) * 60.0f, normalize(vec3(u(rng), u(rng), u(rng))));
+                auto inv_d = reciprocal(r.d);
+                constexpr f32 inf = std::numeric_limits<f32>::infinity();
+
+                f32 expected = inf;
+                for (auto const& box : boxes) {
+                    expected = std::min(expected, intersect(box, r, inv_d, inf));
+                }
+                f32 actual = inf;
+                traverse(bvh.view(), r, inf, [&](u32 p, f32 t_max) {
+                    actual = std::min(actual, intersect(boxes[p], r, inv_d, t_max));
+                    return actual;
+                });
+                expect(actual == expected);
+            }
+        };
+    };
+
+    feature("Updating a BVH") = [] {
+        auto boxes = randomBoxes(5000);
+        Bvh bvh(boxes, 1);
+        auto nodes_before = bvh.nodes().size();
+
+        given("Small motion of a few primitives") = [&] {
+            std::vector<u32> changed { 3, 17, 1024, 4999 };
+            for (auto p : changed) {
+                boxes[p] = { boxes[p].min + vec3(0.1f), boxes[p].max + vec3(0.1f) };
+            }
+            auto stats = bvh.update(boxes, changed, 2.0f, 1);
+
+            then("Only their paths are refit") = [&] {
+                expect(isValid(bvh.view(), boxes));
+                expect(!stats.full_rebuild);
+                expect(stats.rebuilt_subtrees == 0u);
+                expect(stats.refitted_nodes > 0u);
+                expect(stats.refitted_nodes < nodes_before / 10);
+                expect(bvh.nodes().size() == nodes_before);
+            };
+        };
+
+        given("A primitive teleported across the scene") = [&] {
+            std::vector<u32> changed { 42 };
+            auto p = -boxes[42].min;
+            boxes[42] = { p, p + vec3(1.0f) };
+            auto stats = bvh.update(boxes, changed, 2.0f, 1);
+
+            then("Degraded subtrees are rebuilt and the tree stays valid") = [&] {
+                expect(isValid(bvh.view(), boxes));
+                expect(stats.rebuilt_subtrees > 0u || stats.full_rebuild);
+            };
+        };
+
+        given("Every primitive moving") = [&] {
+            for (auto& box : boxes) {
+                box = { box.min * 0.5f, box.max * 0.5f };
+            }
+            bvh.refit(boxes);
+
+            then("A full refit keeps the topology valid") = [&] {
+                expect(isValid(bvh.view(), boxes));
+            };
+        };
+    };
+
+    feature("Updating a scene") = [] {
+        Scene scene;
+        for (i32 i = 0; i < 64; i++) {
+            scene.objects.add<Sphere>().setTransform(mat4::translate(f32(i % 8) * 3.0f, f32(i / 8) * 3.0f, 0.0f));
+        }
+        scene.build();
+        auto between = ray(vec3(4.4f, 3, -5), unit_z<vec3>);
+        expect(!scene.intersect(between));
+
+        given("A sphere moved a little") = [&] {
+            scene.objects.get(9).setTransform(mat4::translate(3.5f, 3.0f, 0.0f));
+            auto stats = scene.update();
+
+            then("Its new position is hit without a rebuild") = [&] {
+                expect(!stats.full_rebuild);
+                auto h = scene.intersect(between);
+                expect(h && h->object_id == 9u);
+            };
+        };
+
+        given("An added sphere") = [&] {
+            scene.objects.add<Sphere>().setTransform(mat4::translate(30.0f, 30.0f, 0.0f));
+            auto stats = scene.update();
+
+            then("The scene is rebuilt and sees it") = [&] {
+                expect(stats.full_rebuild);
+                auto h = scene.intersect(ray(vec3(30, 30, -5), unit_z<vec3>));
+                expect(h && h->object_id == 64u);
+            };
+        };
+    };
+}
@@ -0,0 +1,161 @@
+export module raytracer.camera;
+
+import raytracer.constants;
+import raytracer.mat;
+import raytracer.ray;
+import raytracer.sampler;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+// World-to-camera transform for an eye at `from` looking at `to`, with
+// `up` roughly up. The camera looks down its -z axis.
+[[nodiscard]] mat4 viewTransform(vec3 const& from, vec3 const& to, vec3 const& up)
+{
+    auto forward = normalize(to - from);
+    auto left = cross(forward, normalize(up));
+    auto true_up = cross(left, forward);
+    mat4 orientation(
+        left.x, true_up.x, -forward.x, 0.0f,
+        left.y, true_up.y, -forward.y, 0.0f,
+        left.z, true_up.z, -forward.z, 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f);
+    return orientation * mat4::translate(-from.x, -from.y, -from.z);
+}
+
+// A rectangle of pixels, e.g. a tile of work or a ray packet.
+struct pixel_tile {
+    i32 row;
+    i32 col;
+    i32 rows;
+    i32 cols;
+
+    bool operator==(pixel_tile const&) const = default;
+};
+
+// Pinhole camera with a horizontal or vertical field of view, whichever is
+// the longer side, and a view transform (see viewTransform()). Pixel
+// (row, col) looks through the image plane at z = -1 in camera space.
+//
+// Every pixel's direction is an affine function of its row and column,
+// so the constructor works out, in world space, the direction to the
+// corner of the image and how it changes per column and per row; a ray
+// then costs a few adds and a normalization, with no matrix products.
+// Tiles step along each row by adding the column delta.
+class Camera {
+public:
+    // Sampler group of the subpixel offsets, clear of the ones the path
+    // tracer draws per bounce.
+    static constexpr u32 jitter_group = 1u << 20;
+
+    Camera(i32 width, i32 height, f32 field_of_view, mat4 const& view = mat4())
+        : m_width(width)
+        , m_height(height)
+        , m_field_of_view(field_of_view)
+        , m_view(view)
+    {
+        f32 half_view = std::tan(field_of_view / 2.0f);
+        f32 aspect = f32(width) / f32(height);
+        f32 half_width = aspect >= 1.0f ? half_view : half_view * aspect;
+        f32 half_height = aspect >= 1.0f ? half_view / aspect : half_view;
+        m_pixel_size = 2.0f * half_width / f32(width);
+
+        auto to_world = inverse(view);
+        m_origin = vec3(to_world * vec4::point(0.0f, 0.0f, 0.0f));
+        m_corner = vec3(to_world * vec4::point(half_width, half_height, -1.0f)) - m_origin;
+        m_step_x = vec3(to_world * vec4(-m_pixel_size, 0.0f, 0.0f, 0.0f));
+        m_step_y = vec3(to_world * vec4(0.0f, -m_pixel_size, 0.0f, 0.0f));
+    }
+
+    [[nodiscard]] i32 width() const { return m_width; }
+    [[nodiscard]] i32 height() const { return m_height; }
+    [[nodiscard]] f32 fieldOfView() const { return m_field_of_view; }
+    [[nodiscard]] f32 pixelSize() const { return m_pixel_size; }
+    [[nodiscard]] mat4 const& view() const { return m_view; }
+    [[nodiscard]] vec3 const& origin() const { return m_origin; }
+
+    // Ray through the centre of pixel (row, col), so a camera can be
+    // passed wherever a primary ray function is expected.
+    [[nodiscard]] ray operator()(i32 row, i32 col) const
+    {
+        return at(f32(row) + 0.5f, f32(col) + 0.5f);
+    }
+
+    // Ray through image position (row, col), in pixels from the top left
+    // corner.
+    [[nodiscard]] ray at(f32 row, f32 col) const
+    {
+        return ray(m_origin, normalize(m_corner + m_step_x * col + m_step_y * row));
+    }
+
+    // Where world point `p` lands on the image: x is the column and y the
+    // row, in pixels from the top left corner as at() takes them, and z
+    // the distance in front of the camera along its axis. None for points
+    // not in front of the camera.
+    [[nodiscard]] std::optional<vec3> project(vec3 const& p) const
+    {
+        auto q = vec3(m_view * vec4::point(p));
+        f32 depth = -q.z;
+        if (!(depth > 1e-6f)) {
+            return {};
+        }
+        f32 scale = 1.0f / (depth * m_pixel_size);
+        return vec3(f32(m_width) * 0.5f - q.x * scale, f32(m_height) * 0.5f - q.y * scale, depth);
+    }
+
+    // How the direction through the centre of pixel (row, col) changes to
+    // the next pixel across and down, for texture filtering. The origin
+    // doesn't move.
+    [[nodiscard]] ray_differential differential(i32 row, i32 col) const
+    {
+        auto d = m_corner + m_step_x * (f32(col) + 0.5f) + m_step_y * (f32(row) + 0.5f);
+        auto n = normalize(d);
+        ray_differential rd;
+        rd.dddx = normalize(d + m_step_x) - n;
+        rd.dddy = normalize(d + m_step_y) - n;
+        return rd;
+    }
+
+    // Rays through the centres of `tile`'s pixels, row by row, into `out`,
+    // which must hold rows * cols rays.
+    void generate(pixel_tile const& tile, std::span<ray> out) const
+    {
+        usize i = 0;
+        for (i32 row = tile.row; row < tile.row + tile.rows; row++) {
+            auto d = m_corner + m_step_y * (f32(row) + 0.5f) + m_step_x * (f32(tile.col) + 0.5f);
+            for (i32 col = 0; col < tile.cols; col++, i++) {
+                out[i] = ray(m_origin, normalize(d));
+                d = d + m_step_x;
+            }
+        }
+    }
+
+    // As above, through a point of each pixel drawn from `sampler` for
+    // sample `index`, for antialiasing. Uses the sampler group
+    // jitter_group.
+    void generate(pixel_tile const& tile, std::span<ray> out, Sampler const& sampler, u32 index) const
+    {
+        usize i = 0;
+        for (i32 row = tile.row; row < tile.row + tile.rows; row++) {
+            for (i32 col = tile.col; col < tile.col + tile.cols; col++, i++) {
+                auto u = sampler.get4D(uvec2(static_cast<u32>(col), static_cast<u32>(row)), index, jitter_group);
+                out[i] = at(f32(row) + u.y, f32(col) + u.x);
+            }
+        }
+    }
+
+private:
+    i32 m_width;
+    i32 m_height;
+    f32 m_field_of_view;
+    f32 m_pixel_size;
+    mat4 m_view;
+    vec3 m_origin;
+    // World-space direction to the image's top left corner, and its
+    // change per column and per row.
+    vec3 m_corner;
+    vec3 m_step_x;
+    vec3 m_step_y;
+};
+} // namespace raytracer
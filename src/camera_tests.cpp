@@ -0,0 +1,143 @@
+import boost.ut;
+import raytracer;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+
+namespace {
+bool near(vec3 const& a, vec3 const& b, f32 tolerance = 1e-5f)
+{
+    return std::abs(a.x - b.x) <= tolerance && std::abs(a.y - b.y) <= tolerance && std::abs(a.z - b.z) <= tolerance;
+}
+
+bool near(mat4 const& a, mat4 const& b, f32 tolerance = 1e-5f)
+{
+    for (usize i = 0; i < 4; i++) {
+        for (usize j = 0; j < 4; j++) {
+            if (std::abs(a[i][j] - b[i][j]) > tolerance) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+} // namespace
+
+int main()
+{
+    feature("View transforms") = [] {
+        then("The default orientation is the identity") = [] {
+            expect(near(viewTransform(vec3(0, 0, 0), vec3(0, 0, -1), vec3(0, 1, 0)), mat4()));
+        };
+
+        then("Looking along +z mirrors x and z") = [] {
+            expect(near(viewTransform(vec3(0, 0, 0), vec3(0, 0, 1), vec3(0, 1, 0)), mat4::scale(-1.0f, 1.0f, -1.0f)));
+        };
+
+        then("The view moves the world, not the eye") = [] {
+            expect(near(viewTransform(vec3(0, 0, 8), vec3(0, 0, 0), vec3(0, 1, 0)), mat4::translate(0.0f, 0.0f, -8.0f)));
+        };
+
+        then("An arbitrary view") = [] {
+            auto t = viewTransform(vec3(1, 3, 2), vec3(4, -2, 8), vec3(1, 1, 0));
+            mat4 expected(
+                -0.50709f, 0.76772f, -0.35857f, 0.0f,
+                0.50709f, 0.60609f, 0.59761f, 0.0f,
+                0.67612f, 0.12122f, -0.71714f, 0.0f,
+                -2.36643f, -2.82843f, 0.0f, 1.0f);
+            expect(near(t, expected));
+        };
+    };
+
+    feature("Primary rays") = [] {
+        then("Pixels are sized from the longer side") = [] {
+            expect(std::abs(Camera(200, 125, pi<f32> / 2.0f).pixelSize() - 0.01f) < 1e-6f);
+            expect(std::abs(Camera(125, 200, pi<f32> / 2.0f).pixelSize() - 0.01f) < 1e-6f);
+        };
+
+        given("A 201x101 camera") = [] {
+            Camera camera(201, 101, pi<f32> / 2.0f);
+
+            then("The centre ray looks down -z") = [&] {
+                auto r = camera(50, 100);
+                expect(near(r.o, zero<vec3>) && near(r.d, vec3(0, 0, -1)));
+            };
+
+            then("The corner ray") = [&] {
+                expect(near(camera(0, 0).d, vec3(0.66519f, 0.33259f, -0.66851f)));
+            };
+
+            then("A transformed camera") = [] {
+                Camera moved(201, 101, pi<f32> / 2.0f, mat4::rotateY(pi<f32> / 4.0f) * mat4::translate(0.0f, -2.0f, 5.0f));
+                auto r = moved(50, 100);
+                expect(near(r.o, vec3(0, 2, -5)));
+                expect(near(r.d, vec3(std::sqrt(2.0f) / 2.0f, 0.0f, -std::sqrt(2.0f) / 2.0f)));
+            };
+        };
+
+        given("A tile") = [] {
+            Camera camera(64, 48, 1.0f, viewTransform(vec3(1, 2, -6), vec3(0, 0.5f, 0), vec3(0, 1, 0)));
+            pixel_tile tile;
+            tile.row = 8;
+            tile.col = 40;
+            tile.rows = 16;
+            tile.cols = 24;
+            std::vector<ray> rays(usize(tile.rows * tile.cols));
+
+            then("Stepping across rows gives each pixel's own ray") = [&] {
+                camera.generate(tile, rays);
+                for (i32 row = 0; row < tile.rows; row++) {
+                    for (i32 col = 0; col < tile.cols; col++) {
+                        auto expected = camera(tile.row + row, tile.col + col);
+                        auto const& r = rays[usize(row * tile.cols + col)];
+                        expect(near(r.o, expected.o) && near(r.d, expected.d, 1e-6f)) << row << col;
+                    }
+                }
+            };
+
+            then("Jittered rays stay inside their pixels and vary by sample") = [&] {
+                Sampler sampler;
+                camera.generate(tile, rays, sampler, 3);
+                std::vector<ray> other(rays.size());
+                camera.generate(tile, other, sampler, 4);
+                for (i32 row = 0; row < tile.rows; row++) {
+                    for (i32 col = 0; col < tile.cols; col++) {
+                        auto const& r = rays[usize(row * tile.cols + col)];
+                        // Where the ray crosses the image plane, in pixels.
+                        auto plane = camera.view() * vec4::point(r.o + r.d);
+                        f32 x = -vec3(plane).x / vec3(plane).z;
+                        f32 y = -vec3(plane).y / vec3(plane).z;
+                        f32 pixel_col = (camera.pixelSize() * 32.0f - x) / camera.pixelSize();
+                        f32 pixel_row = (camera.pixelSize() * 24.0f - y) / camera.pixelSize();
+                        expect(std::floor(pixel_col + 1e-4f) == f32(tile.col + col) || std::floor(pixel_col - 1e-4f) == f32(tile.col + col)) << pixel_col;
+                        expect(std::floor(pixel_row + 1e-4f) == f32(tile.row + row) || std::floor(pixel_row - 1e-4f) == f32(tile.row + row)) << pixel_row;
+                        expect(!near(r.d, other[usize(row * tile.cols + col)].d, 1e-7f));
+                    }
+                }
+            };
+
+            then("Points along a ray project back onto its image position") = [&] {
+                for (auto [row, col] : { std::pair(0.0f, 0.0f), std::pair(20.5f, 50.25f), std::pair(48.0f, 64.0f) }) {
+                    auto r = camera.at(row, col);
+                    for (f32 t : { 0.5f, 3.0f, 40.0f }) {
+                        auto p = camera.project(r.o + r.d * t);
+                        expect(p && std::abs(p->x - col) < 1e-3f && std::abs(p->y - row) < 1e-3f) << row << col << t;
+                        expect(p && std::abs(p->z - t * dot(r.d, camera.at(24.0f, 32.0f).d)) < 1e-3f * t);
+                    }
+                }
+                expect(!camera.project(camera.origin() - camera.at(24.0f, 32.0f).d));
+            };
+
+            then("Differentials lead to the neighbouring pixels' rays") = [&] {
+                for (auto [row, col] : { std::pair(0, 0), std::pair(20, 50), std::pair(47, 63) }) {
+                    auto rd = camera.differential(row, col);
+                    auto d = camera(row, col).d;
+                    expect(near(d + rd.dddx, camera(row, col + 1).d, 1e-6f) && near(d + rd.dddy, camera(row + 1, col).d, 1e-6f)) << row << col;
+                    expect(rd.dodx == zero<vec3> && rd.dody == zero<vec3>);
+                }
+            };
+        };
+    };
+}
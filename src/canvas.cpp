@@ -5,8 +5,9 @@ import raytracer.vec;
 import std;
 
 namespace raytracer {
+// Pixels of any vector type; only floating-point ones can be written out,
+// integer ones hold ids and other per-pixel bookkeeping.
 export template<vec V>
-requires(std::floating_point<typename V::scalar_type>)
 class Canvas {
 public:
     constexpr Canvas(i32 width, i32 height)
@@ -83,12 +84,17 @@ private:
 };
 
 template<vec V>
-requires(std::floating_point<typename V::scalar_type>)
 V Canvas<V>::dummy_pixel = V();
 
 export using CanvasRGB = Canvas<vec3>;
 export using CanvasRGBA = Canvas<vec4>;
 
+// Relative luminance of a linear Rec. 709 colour.
+export [[nodiscard]] constexpr f32 luminanceOf(vec3 const& c)
+{
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
 u8 toU8(f32 x)
 {
     if (x <= 0.0f)
@@ -108,6 +114,7 @@ u16 toU16(f32 x)
 }
 
 export template<vec V>
+requires(std::floating_point<typename V::scalar_type>)
 void writePAM(Canvas<V> const& canvas, std::ostream& os)
 {
     char const* depth;
@@ -173,7 +180,42 @@ void writePFM(Canvas<vec3> const& canvas, std::ostream& os)
     }
 }
 
+// Reads a colour ("PF") or greyscale ("Pf") PFM of either byte order;
+// grey pixels are spread over all three channels.
+Canvas<vec3> readPFM(std::istream& is, std::string const& file_path)
+{
+    std::string magic;
+    i32 width = 0, height = 0;
+    f32 scale = 0.0f;
+    is >> magic >> width >> height >> scale;
+    if (!is || (magic != "PF" && magic != "Pf") || width <= 0 || height <= 0 || scale == 0.0f) {
+        throw std::runtime_error(file_path + ": not a PFM");
+    }
+    // A single whitespace character ends the header.
+    is.get();
+    bool swap = (scale < 0.0f) != (std::endian::native == std::endian::little);
+    usize channels = magic == "PF" ? 3 : 1;
+    std::vector<f32> row(usize(width) * channels);
+    Canvas<vec3> canvas(width, height);
+    for (i32 r = height - 1; r >= 0; --r) {
+        if (!is.read(reinterpret_cast<char*>(row.data()), static_cast<std::streamsize>(row.size() * sizeof(f32)))) {
+            throw std::runtime_error(file_path + ": truncated PFM");
+        }
+        if (swap) {
+            for (auto& x : row) {
+                x = std::bit_cast<f32>(std::byteswap(std::bit_cast<u32>(x)));
+            }
+        }
+        for (i32 col = 0; col < width; ++col) {
+            auto const* p = &row[usize(col) * channels];
+            canvas[r, col] = channels == 3 ? vec3(p[0], p[1], p[2]) : vec3(p[0]);
+        }
+    }
+    return canvas;
+}
+
 export template<vec V>
+requires(std::floating_point<typename V::scalar_type>)
 void writePAM(Canvas<V> const& Canvas, std::string const& file_path)
 {
     std::ofstream os(file_path, std::ios::binary);
@@ -186,4 +228,13 @@ void writePFM(Canvas<V> const& Canvas, std::string const& file_path)
     std::ofstream os(file_path, std::ios::binary);
     writePFM(Canvas, os);
 }
+
+export Canvas<vec3> readPFM(std::string const& file_path)
+{
+    std::ifstream is(file_path, std::ios::binary);
+    if (!is) {
+        throw std::runtime_error("cannot open " + file_path);
+    }
+    return readPFM(is, file_path);
+}
 } // namespace raytracer
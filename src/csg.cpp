@@ -0,0 +1,281 @@
+export module raytracer.csg;
+
+import raytracer.aabb;
+import raytracer.mat;
+import raytracer.object;
+import raytracer.ray;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+enum class csg_op : u32 {
+    unite,
+    intersect,
+    subtract,
+};
+
+// Constructive solid geometry over owned child solids. Nested Csg children
+// are flattened into one postfix node array on construction, with their
+// transforms folded into the leaves, so a hit names its leaf directly.
+// Tracing combines t-sorted interval lists in fixed-size stack buffers and
+// skips subtrees whose bounds the ray misses, so it never allocates.
+class Csg : public Object {
+public:
+    using Object::normalAt;
+
+    // Intervals kept per subtree; the farthest are dropped beyond this.
+    static constexpr usize max_intervals = 32;
+    // Each level of the tree holds two interval buffers on the stack.
+    static constexpr u32 max_depth = 64;
+    // Marks surfaces seen from inside, i.e. subtracted ones, whose normals
+    // point the other way.
+    static constexpr u32 flipped = 1u << 31;
+
+    Csg(csg_op op, std::unique_ptr<Object> left, std::unique_ptr<Object> right)
+    {
+        u32 left_depth = absorb(std::move(left));
+        u32 right_depth = absorb(std::move(right));
+        auto right_root = static_cast<u32>(m_nodes.size() - 1);
+        auto left_root = right_root - m_subtree_size;
+        m_nodes.push_back({ merge(m_nodes[left_root].bounds, m_nodes[right_root].bounds), op, left_root, right_root });
+        auto& root = m_nodes.back();
+        if (op == csg_op::intersect) {
+            root.bounds = overlap(m_nodes[left_root].bounds, m_nodes[right_root].bounds);
+        } else if (op == csg_op::subtract) {
+            root.bounds = m_nodes[left_root].bounds;
+        }
+        m_depth = std::max(left_depth, right_depth) + 1;
+        if (m_depth > max_depth) {
+            throw std::invalid_argument("csg tree deeper than Csg::max_depth");
+        }
+    }
+
+    virtual intersections intersect(ray const& r) const override
+    {
+        std::array<interval, max_intervals> buffer;
+        auto count = intervals(r, buffer);
+        intersections xs;
+        for (usize i = 0; i < count; i++) {
+            xs.insert(intersection(buffer[i].t_in, id, buffer[i].surface_in));
+            xs.insert(intersection(buffer[i].t_out, id, buffer[i].surface_out));
+        }
+        return xs;
+    }
+
+    virtual std::optional<intersection> closestHit(ray const& r, f32 t_max) const override
+    {
+        std::array<interval, max_intervals> buffer;
+        auto local = inverseTransform() * r;
+        auto count = evaluate(root(), local, reciprocal(local.d), t_max, buffer);
+        for (usize i = 0; i < count; i++) {
+            auto const& span = buffer[i];
+            if (span.t_in > 0.0f) {
+                if (span.t_in < t_max) {
+                    return intersection(span.t_in, id, span.surface_in);
+                }
+                return {};
+            }
+            if (span.t_out > 0.0f) {
+                if (span.t_out < t_max) {
+                    return intersection(span.t_out, id, span.surface_out);
+                }
+                return {};
+            }
+        }
+        return {};
+    }
+
+    virtual usize intervals(ray const& r, std::span<interval> out) const override
+    {
+        auto local = inverseTransform() * r;
+        return evaluate(root(), local, reciprocal(local.d), std::numeric_limits<f32>::infinity(), out);
+    }
+
+    // Without a hit record this is the normal of the first leaf, so prefer
+    // the overload taking the intersection.
+    virtual vec3 normalAt(vec3 const& p) const override
+    {
+        return normalAt(p, intersection(0.0f, id, 0));
+    }
+
+    virtual vec3 normalAt(vec3 const& p, intersection const& i) const override
+    {
+        auto local_point = vec3(inverseTransform() * vec4::point(p));
+        auto local_normal = vec4(m_leaves[i.primitive & ~flipped]->normalAt(local_point));
+        if (i.primitive & flipped) {
+            local_normal = -local_normal;
+        }
+        auto world_normal = transpose(inverseTransform()) * local_normal;
+        world_normal.w = 0;
+        return vec3(normalize(world_normal));
+    }
+
+    // The hit leaf's own mapping.
+    virtual vec2 uvAt(vec3 const& p, intersection const& i) const override
+    {
+        auto local_point = vec3(inverseTransform() * vec4::point(p));
+        return m_leaves[i.primitive & ~flipped]->uvAt(local_point, i);
+    }
+
+    virtual aabb bounds() const override
+    {
+        return m_nodes[root()].bounds;
+    }
+
+    [[nodiscard]] usize leafCount() const
+    {
+        return m_leaves.size();
+    }
+
+    [[nodiscard]] u32 depth() const
+    {
+        return m_depth;
+    }
+
+private:
+    struct node {
+        // In the Csg's own space; empty for intersections that can't hit.
+        aabb bounds;
+        csg_op op;
+        // Child node indices, or the leaf index in `left` for leaves.
+        u32 left = 0;
+        u32 right = no_id;
+
+        [[nodiscard]] bool isLeaf() const { return right == no_id; }
+    };
+
+    std::vector<node> m_nodes;
+    std::vector<std::unique_ptr<Object>> m_leaves;
+    u32 m_depth = 0;
+    // Node count of the subtree absorb() appended last.
+    u32 m_subtree_size = 0;
+
+    u32 root() const
+    {
+        return static_cast<u32>(m_nodes.size() - 1);
+    }
+
+    static aabb overlap(aabb const& a, aabb const& b)
+    {
+        aabb result;
+        result.min = vec3(std::max(a.min.x, b.min.x), std::max(a.min.y, b.min.y), std::max(a.min.z, b.min.z));
+        result.max = vec3(std::min(a.max.x, b.max.x), std::min(a.max.y, b.max.y), std::min(a.max.z, b.max.z));
+        return result;
+    }
+
+    // Appends `child` as a postfix subtree and returns its depth.
+    u32 absorb(std::unique_ptr<Object> child)
+    {
+        auto first = static_cast<u32>(m_nodes.size());
+        auto csg = dynamic_cast<Csg*>(child.get());
+        if (csg == nullptr) {
+            m_nodes.push_back({ child->worldBounds(), csg_op::unite, static_cast<u32>(m_leaves.size()), no_id });
+            m_leaves.push_back(std::move(child));
+            m_subtree_size = 1;
+            return 0;
+        }
+
+        auto leaf_base = static_cast<u32>(m_leaves.size());
+        auto const& t = csg->transform();
+        for (auto& leaf : csg->m_leaves) {
+            leaf->setTransform(t * leaf->transform(), leaf->inverseTransform() * csg->inverseTransform());
+            m_leaves.push_back(std::move(leaf));
+        }
+        for (auto n : csg->m_nodes) {
+            if (n.isLeaf()) {
+                n.left += leaf_base;
+                n.bounds = m_leaves[n.left]->worldBounds();
+            } else {
+                n.left += first;
+                n.right += first;
+                n.bounds = n.op == csg_op::unite ? merge(m_nodes[n.left].bounds, m_nodes[n.right].bounds)
+                    : n.op == csg_op::intersect  ? overlap(m_nodes[n.left].bounds, m_nodes[n.right].bounds)
+                                                 : m_nodes[n.left].bounds;
+            }
+            m_nodes.push_back(n);
+        }
+        m_subtree_size = static_cast<u32>(csg->m_nodes.size());
+        return csg->m_depth;
+    }
+
+    usize evaluate(u32 index, ray const& r, vec3 const& inv_d, f32 t_max, std::span<interval> out) const
+    {
+        auto const& n = m_nodes[index];
+        if (raytracer::intersect(n.bounds, r, inv_d, t_max) == std::numeric_limits<f32>::infinity()) {
+            return 0;
+        }
+        if (n.isLeaf()) {
+            auto count = m_leaves[n.left]->intervals(r, out);
+            for (usize i = 0; i < count; i++) {
+                out[i].surface_in = n.left;
+                out[i].surface_out = n.left;
+            }
+            return count;
+        }
+
+        std::array<interval, max_intervals> a;
+        auto a_count = evaluate(n.left, r, inv_d, t_max, a);
+        if (a_count == 0 && n.op != csg_op::unite) {
+            return 0;
+        }
+        std::array<interval, max_intervals> b;
+        auto b_count = evaluate(n.right, r, inv_d, t_max, b);
+        if (b_count == 0 && n.op != csg_op::intersect) {
+            auto count = std::min(a_count, out.size());
+            std::copy_n(a.begin(), count, out.begin());
+            return count;
+        }
+        return combine(n.op, std::span(a).first(a_count), std::span(b).first(b_count), out);
+    }
+
+    // Sweeps the boundaries of both lists in t order, tracking whether the
+    // ray is inside each operand, and emits the stretches where `op` holds.
+    static usize combine(csg_op op, std::span<interval const> a, std::span<interval const> b, std::span<interval> out)
+    {
+        auto boundary = [](std::span<interval const> list, usize k) {
+            auto const& span = list[k / 2];
+            return k % 2 == 0 ? std::pair(span.t_in, span.surface_in) : std::pair(span.t_out, span.surface_out);
+        };
+        auto inside = [op](bool in_a, bool in_b) {
+            switch (op) {
+            case csg_op::unite:
+                return in_a || in_b;
+            case csg_op::intersect:
+                return in_a && in_b;
+            case csg_op::subtract:
+                return in_a && !in_b;
+            }
+            return false;
+        };
+
+        usize i = 0, j = 0, count = 0;
+        bool in_a = false, in_b = false, was_inside = false;
+        interval current {};
+        while ((i < 2 * a.size() || j < 2 * b.size()) && count < out.size()) {
+            bool from_a = j == 2 * b.size()
+                || (i < 2 * a.size() && boundary(a, i).first <= boundary(b, j).first);
+            auto [t, surface] = from_a ? boundary(a, i++) : boundary(b, j++);
+            if (from_a) {
+                in_a = !in_a;
+            } else {
+                in_b = !in_b;
+                if (op == csg_op::subtract) {
+                    surface ^= flipped;
+                }
+            }
+            bool now_inside = inside(in_a, in_b);
+            if (now_inside && !was_inside) {
+                current.t_in = t;
+                current.surface_in = surface;
+            } else if (!now_inside && was_inside) {
+                current.t_out = t;
+                current.surface_out = surface;
+                out[count++] = current;
+            }
+            was_inside = now_inside;
+        }
+        return count;
+    }
+};
+} // namespace raytracer
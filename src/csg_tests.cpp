@@ -0,0 +1,120 @@
+import boost.ut;
+import raytracer;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+
+namespace {
+std::unique_ptr<Object> sphereAt(f32 x, f32 y, f32 z, f32 radius = 1.0f)
+{
+    auto s = std::make_unique<Sphere>();
+    s->setTransform(mat4::translate(x, y, z) * mat4::scale(radius, radius, radius));
+    return s;
+}
+
+bool near(f32 a, f32 b)
+{
+    return std::abs(a - b) < 1e-4f;
+}
+
+bool near(vec3 const& a, vec3 const& b)
+{
+    return near(a.x, b.x) && near(a.y, b.y) && near(a.z, b.z);
+}
+} // namespace
+
+int main()
+{
+    // Two unit spheres overlapping between x = -0.5 and x = 0.5, probed
+    // along the x axis from x = -5.
+    auto probe = ray(vec3(-5, 0, 0), unit_x<vec3>);
+
+    feature("Combining two spheres") = [&] {
+        given("A union") = [&] {
+            Csg csg(csg_op::unite, sphereAt(-0.5f, 0, 0), sphereAt(0.5f, 0, 0));
+            std::array<interval, Csg::max_intervals> xs;
+            expect(csg.intervals(probe, xs) == 1u);
+            expect(near(xs[0].t_in, 3.5f) && near(xs[0].t_out, 6.5f));
+        };
+
+        given("An intersection") = [&] {
+            Csg csg(csg_op::intersect, sphereAt(-0.5f, 0, 0), sphereAt(0.5f, 0, 0));
+            auto h = csg.closestHit(probe, std::numeric_limits<f32>::infinity());
+            expect(h.has_value() && near(h->t, 4.5f));
+            expect(near(csg.normalAt(probe.at(h->t), *h), vec3(-1, 0, 0)));
+        };
+
+        given("A difference") = [&] {
+            Csg csg(csg_op::subtract, sphereAt(-0.5f, 0, 0), sphereAt(0.5f, 0, 0));
+            std::array<interval, Csg::max_intervals> xs;
+            expect(csg.intervals(probe, xs) == 1u);
+            expect(near(xs[0].t_in, 3.5f) && near(xs[0].t_out, 4.5f));
+
+            then("The carved surface faces into the removed sphere") = [&] {
+                auto back = ray(vec3(5, 0, 0), -unit_x<vec3>);
+                auto h = csg.closestHit(back, std::numeric_limits<f32>::infinity());
+                expect(h.has_value() && near(h->t, 5.5f));
+                expect(near(csg.normalAt(back.at(h->t), *h), vec3(1, 0, 0)));
+            };
+        };
+
+        given("A ray starting inside") = [&] {
+            Csg csg(csg_op::unite, sphereAt(-0.5f, 0, 0), sphereAt(0.5f, 0, 0));
+            auto h = csg.closestHit(ray(zero<vec3>, unit_x<vec3>), std::numeric_limits<f32>::infinity());
+            expect(h.has_value() && near(h->t, 1.5f));
+        };
+
+        given("A ray missing both bounds") = [&] {
+            Csg csg(csg_op::unite, sphereAt(-0.5f, 0, 0), sphereAt(0.5f, 0, 0));
+            expect(!csg.closestHit(ray(vec3(-5, 3, 0), unit_x<vec3>), 100.0f).has_value());
+        };
+    };
+
+    feature("Nested trees") = [&] {
+        given("A transformed child tree") = [&] {
+            auto inner = std::make_unique<Csg>(csg_op::unite, sphereAt(0, 0, 0), sphereAt(0, 0, 0));
+            inner->setTransform(mat4::translate(2, 0, 0));
+            Csg csg(csg_op::unite, std::move(inner), sphereAt(-2, 0, 0));
+            expect(csg.leafCount() == 3u);
+            expect(csg.depth() == 2u);
+
+            std::array<interval, Csg::max_intervals> xs;
+            expect(csg.intervals(probe, xs) == 2u);
+            expect(near(xs[0].t_in, 2.0f) && near(xs[0].t_out, 4.0f));
+            expect(near(xs[1].t_in, 6.0f) && near(xs[1].t_out, 8.0f));
+        };
+
+        given("Hundreds of beads on a string") = [&] {
+            // A balanced union of 256 small spheres along x, minus a slab
+            // that removes every other one.
+            std::function<std::unique_ptr<Object>(i32, i32)> beads = [&](i32 first, i32 last) -> std::unique_ptr<Object> {
+                if (last - first == 1) {
+                    return sphereAt(f32(first), 0, 0, 0.25f);
+                }
+                auto mid = (first + last) / 2;
+                return std::make_unique<Csg>(csg_op::unite, beads(first, mid), beads(mid, last));
+            };
+            auto string = beads(0, 256);
+            auto cutter = sphereAt(1, 0, 0, 0.5f);
+            Csg csg(csg_op::subtract, std::move(string), std::move(cutter));
+            expect(csg.leafCount() == 257u);
+
+            auto h = csg.closestHit(ray(vec3(-1, 0, 0), unit_x<vec3>), std::numeric_limits<f32>::infinity());
+            expect(h.has_value() && near(h->t, 0.75f));
+            auto h2 = csg.closestHit(ray(vec3(0.5f, 0, 0), unit_x<vec3>), std::numeric_limits<f32>::infinity());
+            expect(h2.has_value() && near(h2->t, 1.25f));
+        };
+    };
+
+    feature("Tracing CSG in a scene") = [] {
+        Scene scene;
+        auto& csg = scene.objects.add<Csg>(csg_op::subtract, sphereAt(0, 0, 0), sphereAt(0, 0, -1));
+        csg.setTransform(mat4::translate(0, 0, 10));
+        scene.build();
+        auto h = scene.intersect(ray(zero<vec3>, unit_z<vec3>));
+        expect(h.has_value() && near(h->t, 10.0f));
+        expect(near(scene.objects.get(h->object_id).normalAt(vec3(0, 0, 10), *h), vec3(0, 0, -1)));
+    };
+}
@@ -0,0 +1,122 @@
+export module raytracer.deferred;
+
+import raytracer.canvas;
+import raytracer.material;
+import raytracer.object;
+import raytracer.ray;
+import raytracer.scene;
+import raytracer.shading;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+// Everything the shading pass needs about the primary hit of each pixel,
+// so a frame can be lit, and re-lit, without tracing again. Pixels whose
+// ray missed have an infinite t and no_id for both ids.
+class GBuffer {
+public:
+    // xyz is the world-space hit point, w the hit t.
+    Canvas<vec4> position;
+    Canvas<vec3> normal;
+    // Unit vector from the hit back along the ray.
+    Canvas<vec3> eye;
+    // x is the object id, y its material id.
+    Canvas<uvec2> ids;
+
+    GBuffer(i32 width, i32 height)
+        : position(width, height)
+        , normal(width, height)
+        , eye(width, height)
+        , ids(width, height)
+    {
+    }
+
+    [[nodiscard]] i32 width() const { return position.width(); }
+    [[nodiscard]] i32 height() const { return position.height(); }
+
+    // Visibility pass: traces `primary(row, col)` for every pixel and
+    // records the closest hit. The scene must be built.
+    template<typename F>
+    requires std::is_invocable_r_v<ray, F const&, i32, i32>
+    void fill(Scene const& scene, F const& primary)
+    {
+        for (i32 row = 0; row < height(); row++) {
+            for (i32 col = 0; col < width(); col++) {
+                auto r = primary(row, col);
+                auto h = scene.intersect(r);
+                if (!h) {
+                    position[row, col] = vec4(zero<vec3>, std::numeric_limits<f32>::infinity());
+                    ids[row, col] = uvec2(no_id, no_id);
+                    continue;
+                }
+                auto const& object = scene.objects.get(h->object_id);
+                auto point = r.at(h->t);
+                position[row, col] = vec4(point, h->t);
+                normal[row, col] = object.normalAt(point, *h);
+                eye[row, col] = normalize(-r.d);
+                ids[row, col] = uvec2(h->object_id, object.material_id);
+            }
+        }
+    }
+
+    // Shading pass: lights every covered pixel into `out`, which must
+    // match the G-buffer's size, and sets the rest to `background`.
+    // Pixels are grouped by material and shaded lighting_batch_size at a
+    // time, so each batch shares one material and specular table.
+    // `materials` may differ from the ones filled with, as long as the
+    // ids are still valid.
+    void shade(
+        MaterialRegistry const& materials,
+        std::span<point_light const> lights,
+        Canvas<vec3>& out,
+        vec3 const& background = zero<vec3>) const
+    {
+        // Counting sort of the covered pixels by material.
+        auto pixel_count = static_cast<u32>(width() * height());
+        std::vector<u32> offsets(materials.size() + 1, 0);
+        for (u32 i = 0; i < pixel_count; i++) {
+            auto material_id = ids.begin()[i].y;
+            if (material_id != no_id) {
+                offsets[material_id + 1]++;
+            }
+        }
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+        std::vector<u32> order(offsets.back());
+        auto next = offsets;
+        for (u32 i = 0; i < pixel_count; i++) {
+            auto material_id = ids.begin()[i].y;
+            if (material_id == no_id) {
+                out.begin()[i] = background;
+            } else {
+                order[next[material_id]++] = i;
+            }
+        }
+
+        for (u32 material_id = 0; material_id < materials.size(); material_id++) {
+            auto pixels = std::span(order).subspan(offsets[material_id], offsets[material_id + 1] - offsets[material_id]);
+            if (pixels.empty()) {
+                continue;
+            }
+            auto m = materials.get(material_id);
+            auto const& table = materials.specularTable(material_id);
+            for (usize first = 0; first < pixels.size(); first += lighting_batch_size) {
+                auto lanes = std::min(lighting_batch_size, pixels.size() - first);
+                shading_batch batch;
+                for (usize lane = 0; lane < lighting_batch_size; lane++) {
+                    // Spare lanes repeat the first pixel; their result is dropped.
+                    auto i = pixels[first + (lane < lanes ? lane : 0)];
+                    batch.set(lane, vec3(position.begin()[i]), eye.begin()[i], normal.begin()[i]);
+                }
+                color_batch colors;
+                for (auto const& light : lights) {
+                    lighting(m, table, light, batch, colors);
+                }
+                for (usize lane = 0; lane < lanes; lane++) {
+                    out.begin()[pixels[first + lane]] = colors.get(lane);
+                }
+            }
+        }
+    }
+};
+} // namespace raytracer
@@ -0,0 +1,105 @@
+import boost.ut;
+import raytracer;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+
+namespace {
+constexpr i32 size = 32;
+
+// Orthographic rays down +z through a 4x4 window centred on the z axis.
+ray primary(i32 row, i32 col)
+{
+    auto x = -2.0f + 4.0f * (f32(col) + 0.5f) / size;
+    auto y = 2.0f - 4.0f * (f32(row) + 0.5f) / size;
+    return ray(vec3(x, y, -10), unit_z<vec3>);
+}
+
+Scene twoSpheres()
+{
+    Scene scene;
+    material red;
+    red.color = vec3(1.0f, 0.2f, 0.2f);
+    material blue;
+    blue.color = vec3(0.2f, 0.2f, 1.0f);
+    blue.shininess = 10.0f;
+    auto& left = scene.objects.add<Sphere>();
+    left.setTransform(mat4::translate(-1, 0, 0) * mat4::scale(0.9f, 0.9f, 0.9f));
+    left.material_id = scene.materials.add(red);
+    auto& right = scene.objects.add<Sphere>();
+    right.setTransform(mat4::translate(1, 0, 0) * mat4::scale(0.9f, 0.9f, 0.9f));
+    right.material_id = scene.materials.add(blue);
+    auto& behind = scene.objects.add<Sphere>();
+    behind.setTransform(mat4::translate(0, 1.5f, 2));
+    behind.material_id = scene.materials.add(red);
+    scene.lights.push_back(point_light(vec3(-10, 10, -10), one<vec3>));
+    scene.build();
+    return scene;
+}
+
+// The single-pass renderer the deferred one replaces.
+vec3 forward(Scene const& scene, std::span<point_light const> lights, i32 row, i32 col)
+{
+    auto r = primary(row, col);
+    auto h = scene.intersect(r);
+    if (!h) {
+        return zero<vec3>;
+    }
+    auto const& object = scene.objects.get(h->object_id);
+    auto point = r.at(h->t);
+    vec3 color = zero<vec3>;
+    for (auto const& light : lights) {
+        color = color + lighting(scene.materials.get(object.material_id), light, point, -r.d, object.normalAt(point, *h));
+    }
+    return color;
+}
+
+bool near(vec3 const& a, vec3 const& b)
+{
+    return std::abs(a.x - b.x) < 2e-3f && std::abs(a.y - b.y) < 2e-3f && std::abs(a.z - b.z) < 2e-3f;
+}
+} // namespace
+
+int main()
+{
+    feature("Deferred shading") = [] {
+        auto scene = twoSpheres();
+        GBuffer gbuffer(size, size);
+        gbuffer.fill(scene, primary);
+
+        then("The visibility pass records hits and misses") = [&] {
+            auto centre = gbuffer.ids[size / 2, size / 4];
+            expect(centre.x == 0u && centre.y == scene.objects.get(0).material_id);
+            expect(gbuffer.normal[size / 2, size / 4].z < -0.9f);
+            expect(gbuffer.ids[0, 0].x == no_id);
+            expect(std::isinf(gbuffer.position[0, 0].w));
+        };
+
+        then("Shading matches the single-pass renderer") = [&] {
+            Canvas<vec3> image(size, size);
+            gbuffer.shade(scene.materials, scene.lights, image);
+            for (i32 row = 0; row < size; row++) {
+                for (i32 col = 0; col < size; col++) {
+                    expect(near(image[row, col], forward(scene, scene.lights, row, col))) << row << col;
+                }
+            }
+        };
+
+        then("The same G-buffer can be re-lit") = [&] {
+            std::vector<point_light> lights {
+                point_light(vec3(10, 0, -10), vec3(0.5f, 0.5f, 0.5f)),
+                point_light(vec3(0, -10, -5), vec3(0.2f, 0.6f, 0.2f)),
+            };
+            Canvas<vec3> image(size, size);
+            gbuffer.shade(scene.materials, lights, image, vec3(0.1f, 0.1f, 0.1f));
+            for (i32 row = 0; row < size; row++) {
+                for (i32 col = 0; col < size; col++) {
+                    auto expected = gbuffer.ids[row, col].x == no_id ? vec3(0.1f, 0.1f, 0.1f) : forward(scene, lights, row, col);
+                    expect(near(image[row, col], expected)) << row << col;
+                }
+            }
+        };
+    };
+}
@@ -0,0 +1,246 @@
+export module raytracer.denoise;
+
+import raytracer.bvh;
+import raytracer.canvas;
+import raytracer.deferred;
+import raytracer.material;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+struct denoise_settings {
+    // Filter passes; pass i reads taps 2^i pixels apart, so five passes
+    // cover a 125 pixel wide footprint.
+    u32 iterations = 5;
+    // Edge-stopping widths: a neighbour's weight falls off as a Gaussian
+    // of its difference from the centre pixel in each buffer, scaled by
+    // these. Colour differences are measured on the previous pass's
+    // output, with the width halved every pass as the noise goes down.
+    f32 color_sigma = 0.5f;
+    f32 normal_sigma = 0.5f;
+    // On the logarithm of depth, so roughly a relative difference.
+    f32 depth_sigma = 0.05f;
+    f32 albedo_sigma = 0.1f;
+    // Output tiles handed to the worker threads.
+    u32 tile_size = 32;
+    u32 threads = defaultThreadCount();
+};
+
+// Edge-avoiding à-trous wavelet filter (Dammertz et al. 2010): repeated
+// 5x5 B3-spline blurs with holes, each pass twice as wide as the last,
+// where every tap is weighted down by how much its colour, normal, depth
+// and albedo differ from the centre pixel's. Flat regions are smoothed
+// over a wide footprint while silhouettes, creases and texture edges
+// stay sharp. Pixels whose primary ray missed are only mixed with each
+// other.
+//
+// The buffers are copied into padded planes, one per channel, so each
+// tap of a row of lanes is a unit-stride load with no bounds checks and
+// the lane loops vectorize. Passes are split into tiles shared out among
+// the threads.
+class Denoiser {
+public:
+    explicit Denoiser(denoise_settings const& settings = denoise_settings())
+        : m_settings(settings)
+    {
+    }
+
+    [[nodiscard]] denoise_settings const& settings() const
+    {
+        return m_settings;
+    }
+
+    // Filters `image` in place, guided by the primary hits in `gbuffer`
+    // and the colours of their materials. The sizes must match.
+    void denoise(Canvas<vec3>& image, GBuffer const& gbuffer, MaterialRegistry const& materials) const
+    {
+        planes p(image.width(), image.height(), padFor(m_settings.iterations));
+        for (i32 y = 0; y < image.height(); y++) {
+            for (i32 x = 0; x < image.width(); x++) {
+                auto i = p.index(x, y);
+                auto const& color = image[y, x];
+                p.r[i] = color.x, p.g[i] = color.y, p.b[i] = color.z;
+                auto material_id = gbuffer.ids[y, x].y;
+                if (material_id == no_id) {
+                    p.miss[i] = 1.0f;
+                    continue;
+                }
+                p.hit[i] = 1.0f;
+                auto const& normal = gbuffer.normal[y, x];
+                p.nx[i] = normal.x, p.ny[i] = normal.y, p.nz[i] = normal.z;
+                p.depth[i] = std::log(std::max(gbuffer.position[y, x].w, 1e-6f));
+                p.ar[i] = materials.red()[material_id];
+                p.ag[i] = materials.green()[material_id];
+                p.ab[i] = materials.blue()[material_id];
+            }
+        }
+
+        for (u32 pass = 0; pass < m_settings.iterations; pass++) {
+            filterPass(p, 1 << pass, m_settings.color_sigma / f32(1 << pass));
+            std::swap(p.r, p.out_r);
+            std::swap(p.g, p.out_g);
+            std::swap(p.b, p.out_b);
+        }
+
+        for (i32 y = 0; y < image.height(); y++) {
+            for (i32 x = 0; x < image.width(); x++) {
+                auto i = p.index(x, y);
+                image[y, x] = vec3(p.r[i], p.g[i], p.b[i]);
+            }
+        }
+    }
+
+private:
+    static constexpr usize lanes = 8;
+    static constexpr std::array<f32, 5> kernel { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+    denoise_settings m_settings;
+
+    // The image and guides, one array per channel with `pad` pixels of
+    // padding all round. Taps only mix two hits or two misses; padding
+    // is neither, so taps may run off the image without clamping.
+    struct planes {
+        i32 width;
+        i32 height;
+        i32 pad;
+        i32 stride;
+        std::vector<f32> r, g, b;
+        std::vector<f32> out_r, out_g, out_b;
+        std::vector<f32> nx, ny, nz;
+        // Logarithm of the hit t, so differences are relative.
+        std::vector<f32> depth;
+        std::vector<f32> ar, ag, ab;
+        // 1 where the primary ray hit, or missed, and 0 elsewhere.
+        std::vector<f32> hit, miss;
+
+        planes(i32 width, i32 height, i32 pad)
+            : width(width)
+            , height(height)
+            , pad(pad)
+            // Rounded up to whole lanes, so the last batch of a row stays
+            // inside the padding.
+            , stride(static_cast<i32>((usize(width) + lanes - 1) / lanes * lanes) + 2 * pad)
+        {
+            auto size = usize(stride) * usize(height + 2 * pad);
+            for (auto* plane : { &r, &g, &b, &out_r, &out_g, &out_b, &nx, &ny, &nz, &depth, &ar, &ag, &ab, &hit, &miss }) {
+                plane->assign(size, 0.0f);
+            }
+        }
+
+        [[nodiscard]] usize index(i32 x, i32 y) const
+        {
+            return usize(y + pad) * usize(stride) + usize(x + pad);
+        }
+    };
+
+    // e^-x for x >= 0, within 2e-4 relative: 2^-x split into an exponent
+    // put straight into the float's bits and a cubic for the fraction.
+    // Unlike std::exp this has no calls or branches, and the clamp
+    // compares the bits as integers, which are ordered like non-negative
+    // floats, since float compares may not be if-converted, so the lane
+    // loops vectorize.
+    static f32 negativeExp(f32 x)
+    {
+        f32 clamped = std::bit_cast<f32>(std::min(std::bit_cast<i32>(x), std::bit_cast<i32>(80.0f)));
+        f32 t = -clamped * std::numbers::log2e_v<f32>;
+        // Truncation rounds up for t <= 0, so one less is at most t.
+        i32 whole = static_cast<i32>(t) - 1;
+        f32 f = t - f32(whole);
+        f32 fraction = 1.0f + f * (0.6954300f + f * (0.2269401f + f * 0.0773806f));
+        return std::bit_cast<f32>(std::bit_cast<i32>(fraction) + whole * (1 << 23));
+    }
+
+    // Border wide enough for the outer taps of the widest pass.
+    static i32 padFor(u32 iterations)
+    {
+        return iterations == 0 ? 0 : 2 << (iterations - 1);
+    }
+
+    void filterPass(planes& p, i32 step, f32 color_sigma) const
+    {
+        i32 tile_size = static_cast<i32>(std::max<usize>(m_settings.tile_size / lanes * lanes, lanes));
+        i32 tiles_x = (p.width + tile_size - 1) / tile_size;
+        i32 tiles_y = (p.height + tile_size - 1) / tile_size;
+        u32 tile_count = static_cast<u32>(tiles_x * tiles_y);
+        if (tile_count == 0) {
+            return;
+        }
+        std::atomic<u32> next_tile = 0;
+        auto work = [&] {
+            for (u32 tile; (tile = next_tile.fetch_add(1)) < tile_count;) {
+                i32 x0 = static_cast<i32>(tile) % tiles_x * tile_size;
+                i32 y0 = static_cast<i32>(tile) / tiles_x * tile_size;
+                for (i32 y = y0; y < std::min(y0 + tile_size, p.height); y++) {
+                    for (i32 x = x0; x < std::min(x0 + tile_size, p.width); x += lanes) {
+                        filterLanes(p, x, y, step, color_sigma);
+                    }
+                }
+            }
+        };
+        u32 threads = std::clamp(m_settings.threads, 1u, tile_count);
+        std::vector<std::jthread> workers;
+        workers.reserve(threads - 1);
+        for (u32 i = 1; i < threads; i++) {
+            workers.emplace_back(work);
+        }
+        work();
+    }
+
+    // Filters the `lanes` pixels starting at (x, y). Lanes past the right
+    // edge read and write padding, which is never used.
+    void filterLanes(planes& p, i32 x, i32 y, i32 step, f32 color_sigma) const
+    {
+        auto centre = p.index(x, y);
+        f32 inv_color = 1.0f / (color_sigma * color_sigma);
+        f32 inv_normal = 1.0f / (m_settings.normal_sigma * m_settings.normal_sigma);
+        f32 inv_albedo = 1.0f / (m_settings.albedo_sigma * m_settings.albedo_sigma);
+        f32 inv_depth = 1.0f / (m_settings.depth_sigma * m_settings.depth_sigma);
+
+        f32 const* r = p.r.data();
+        f32 const* g = p.g.data();
+        f32 const* b = p.b.data();
+        f32 const* nx = p.nx.data();
+        f32 const* ny = p.ny.data();
+        f32 const* nz = p.nz.data();
+        f32 const* depth = p.depth.data();
+        f32 const* ar = p.ar.data();
+        f32 const* ag = p.ag.data();
+        f32 const* ab = p.ab.data();
+        f32 const* hit = p.hit.data();
+        f32 const* miss = p.miss.data();
+
+        std::array<f32, lanes> sum_r {}, sum_g {}, sum_b {}, sum_w {};
+        for (i32 ky = 0; ky < 5; ky++) {
+            for (i32 kx = 0; kx < 5; kx++) {
+                f32 k = kernel[ky] * kernel[kx];
+                auto tap = centre + usize(std::ptrdiff_t((ky - 2) * step) * p.stride + (kx - 2) * step);
+                for (usize l = 0; l < lanes; l++) {
+                    auto c = centre + l;
+                    auto q = tap + l;
+                    f32 dr = r[q] - r[c], dg = g[q] - g[c], db = b[q] - b[c];
+                    f32 dnx = nx[q] - nx[c], dny = ny[q] - ny[c], dnz = nz[q] - nz[c];
+                    f32 dar = ar[q] - ar[c], dag = ag[q] - ag[c], dab = ab[q] - ab[c];
+                    f32 dz = depth[q] - depth[c];
+                    f32 exponent = (dr * dr + dg * dg + db * db) * inv_color
+                        + (dnx * dnx + dny * dny + dnz * dnz) * inv_normal
+                        + (dar * dar + dag * dag + dab * dab) * inv_albedo
+                        + dz * dz * inv_depth;
+                    f32 w = k * negativeExp(exponent) * (hit[q] * hit[c] + miss[q] * miss[c]);
+                    sum_r[l] += w * r[q];
+                    sum_g[l] += w * g[q];
+                    sum_b[l] += w * b[q];
+                    sum_w[l] += w;
+                }
+            }
+        }
+        for (usize l = 0; l < lanes; l++) {
+            // Only padding has no weight, even at its centre.
+            f32 inv_w = sum_w[l] > 0.0f ? 1.0f / sum_w[l] : 0.0f;
+            p.out_r[centre + l] = sum_r[l] * inv_w;
+            p.out_g[centre + l] = sum_g[l] * inv_w;
+            p.out_b[centre + l] = sum_b[l] * inv_w;
+        }
+    }
+};
+} // namespace raytracer
@@ -0,0 +1,154 @@
+import boost.ut;
+import raytracer;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+
+namespace {
+constexpr i32 size = 48;
+
+// Noise in [-amplitude, amplitude) that differs per pixel.
+f32 noise(i32 row, i32 col, f32 amplitude)
+{
+    u32 state = pcgHash(static_cast<u32>(row * size + col));
+    return amplitude * (2.0f * nextUniform(state) - 1.0f);
+}
+
+f32 rmse(Canvas<vec3> const& a, Canvas<vec3> const& b)
+{
+    f32 squared = 0.0f;
+    for (i32 i = 0; i < a.size(); i++) {
+        auto d = a.begin()[i] - b.begin()[i];
+        squared += dot(d, d) / 3.0f;
+    }
+    return std::sqrt(squared / f32(a.size()));
+}
+
+// Pinhole rays from z = -5 through a 4x4 window at z = 0.
+ray primary(i32 row, i32 col)
+{
+    auto target = vec3(-2.0f + 4.0f * (f32(col) + 0.5f) / size, 2.0f - 4.0f * (f32(row) + 0.5f) / size, 0.0f);
+    auto origin = vec3(0, 0, -5);
+    return ray(origin, normalize(target - origin));
+}
+
+// A diffuse floor under two spheres, lit by one light.
+Scene room()
+{
+    Scene scene;
+    material floor;
+    floor.color = vec3(0.8f, 0.8f, 0.7f);
+    floor.specular = 0.0f;
+    material matte;
+    matte.color = vec3(0.2f, 0.4f, 0.9f);
+    matte.specular = 0.1f;
+    material red;
+    red.color = vec3(0.9f, 0.3f, 0.2f);
+    red.specular = 0.2f;
+    red.shininess = 20.0f;
+    for (auto [center, radius, m] : { std::tuple(vec3(0, -1001, 0), 1000.0f, floor), std::tuple(vec3(-0.8f, 0, 1), 1.0f, red), std::tuple(vec3(1.2f, -0.4f, 0.5f), 0.6f, matte) }) {
+        auto& s = scene.objects.add<Sphere>();
+        s.setTransform(mat4::translate(center.x, center.y, center.z) * mat4::scale(radius, radius, radius));
+        s.material_id = scene.materials.add(m);
+    }
+    scene.lights.push_back(point_light(vec3(-5, 8, -5), one<vec3>));
+    scene.build();
+    return scene;
+}
+} // namespace
+
+int main()
+{
+    feature("Denoising flat regions") = [] {
+        // Two walls meeting at column size / 2, with different normals
+        // and materials, and a strip of sky along the top.
+        MaterialRegistry materials;
+        material grey;
+        grey.color = vec3(0.5f, 0.5f, 0.5f);
+        material green;
+        green.color = vec3(0.1f, 0.9f, 0.1f);
+        auto left_id = materials.add(grey);
+        auto right_id = materials.add(green);
+        GBuffer gbuffer(size, size);
+        Canvas<vec3> truth(size, size);
+        for (i32 row = 0; row < size; row++) {
+            for (i32 col = 0; col < size; col++) {
+                bool sky = row < 4;
+                bool left = col < size / 2;
+                gbuffer.ids[row, col] = sky ? uvec2(no_id, no_id) : uvec2(left ? 0 : 1, left ? left_id : right_id);
+                gbuffer.normal[row, col] = left ? vec3(1, 0, 0) : vec3(0, 0, -1);
+                gbuffer.position[row, col] = vec4(zero<vec3>, sky ? std::numeric_limits<f32>::infinity() : 5.0f);
+                truth[row, col] = sky ? zero<vec3> : left ? vec3(0.2f, 0.2f, 0.2f) : vec3(0.1f, 0.8f, 0.1f);
+            }
+        }
+        Canvas<vec3> noisy(size, size);
+        for (i32 row = 0; row < size; row++) {
+            for (i32 col = 0; col < size; col++) {
+                noisy[row, col] = row < 4 ? zero<vec3> : truth[row, col] + vec3(noise(row, col, 0.15f));
+            }
+        }
+
+        given("One thread") = [&] {
+            denoise_settings settings;
+            settings.threads = 1;
+            Canvas<vec3> image(noisy);
+            Denoiser(settings).denoise(image, gbuffer, materials);
+
+            then("Noise goes down") = [&] {
+                auto before = rmse(noisy, truth);
+                auto after = rmse(image, truth);
+                expect(after < before / 4.0f) << after << before;
+            };
+
+            then("Edges do not bleed") = [&] {
+                for (i32 row = 4; row < size; row++) {
+                    for (i32 col : { size / 2 - 1, size / 2 }) {
+                        auto error = image[row, col] - truth[row, col];
+                        expect(std::sqrt(dot(error, error)) < 0.1f) << row << col;
+                    }
+                }
+                for (i32 col = 0; col < size; col++) {
+                    expect(image[0, col] == zero<vec3>) << col;
+                    expect(image[3, col] == zero<vec3>) << col;
+                }
+            };
+
+            then("Threads share out tiles without changing the result") = [&] {
+                settings.threads = 4;
+                settings.tile_size = 8;
+                Canvas<vec3> threaded(noisy);
+                Denoiser(settings).denoise(threaded, gbuffer, materials);
+                expect(std::equal(image.begin(), image.end(), threaded.begin()));
+            };
+        };
+    };
+
+    feature("Denoising a path-traced render") = [] {
+        auto scene = room();
+        GBuffer gbuffer(size, size);
+        gbuffer.fill(scene, primary);
+        auto render = [&](u32 samples) {
+            path_tracer_settings settings;
+            settings.samples_per_pixel = samples;
+            settings.max_depth = 3;
+            // White noise, whose error doubles with a quarter of the
+            // samples.
+            settings.sampler = sampler_kind::independent;
+            Canvas<vec3> image(size, size);
+            PathTracer(settings).render(scene, primary, image);
+            return image;
+        };
+        auto reference = render(512);
+
+        then("A quarter of the samples, denoised, beats the full count") = [&] {
+            auto full = render(16);
+            auto quarter = render(4);
+            Denoiser().denoise(quarter, gbuffer, scene.materials);
+            auto denoised_error = rmse(quarter, reference);
+            auto full_error = rmse(full, reference);
+            expect(denoised_error < full_error) << denoised_error << full_error;
+        };
+    };
+}
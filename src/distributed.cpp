@@ -0,0 +1,323 @@
+module;
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+export module raytracer.distributed;
+
+import raytracer.bvh;
+import raytracer.camera;
+import raytracer.canvas;
+import raytracer.ray;
+import raytracer.render;
+import raytracer.sampler;
+import raytracer.scene;
+import raytracer.socket;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+namespace raytracer {
+// Pixels in an anonymous shared mapping, which forked processes write
+// into and the parent reads.
+class SharedPixels {
+public:
+    explicit SharedPixels(usize count)
+        : m_size(std::max<usize>(count, 1) * sizeof(vec3))
+    {
+        m_data = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (m_data == MAP_FAILED) {
+            throw std::runtime_error("cannot map shared pixels");
+        }
+    }
+
+    SharedPixels(SharedPixels const&) = delete;
+    SharedPixels& operator=(SharedPixels const&) = delete;
+
+    ~SharedPixels()
+    {
+        ::munmap(m_data, m_size);
+    }
+
+    [[nodiscard]] vec3* data() const
+    {
+        return static_cast<vec3*>(m_data);
+    }
+
+private:
+    void* m_data;
+    usize m_size;
+};
+
+// A forked worker and its end of the connection to it.
+struct worker_process {
+    ::pid_t pid = -1;
+    Descriptor socket;
+    // Tile it is rendering, if any.
+    std::optional<u32> tile;
+};
+
+// Threads of this process, the calling one included.
+usize threadCount()
+{
+    std::error_code error;
+    auto tasks = std::filesystem::directory_iterator("/proc/self/task", error);
+    if (error) {
+        throw std::runtime_error("cannot count this process's threads");
+    }
+    return static_cast<usize>(std::distance(tasks, std::filesystem::directory_iterator()));
+}
+
+// Waits for every worker still running, killing them first unless they
+// were told to quit.
+void reap(std::vector<worker_process>& workers, bool kill)
+{
+    for (auto& w : workers) {
+        if (w.pid > 0) {
+            if (kill) {
+                ::kill(w.pid, SIGKILL);
+            }
+            w.socket.reset();
+            ::waitpid(w.pid, nullptr, 0);
+            w.pid = -1;
+        }
+    }
+}
+} // namespace raytracer
+
+export namespace raytracer {
+enum class tile_transport : u32 {
+    // Workers write into the frame directly, in memory shared with the
+    // coordinator.
+    shared_memory,
+    // Workers send the pixels back with each finished tile, as workers on
+    // another machine would have to.
+    stream,
+};
+
+struct distributed_options {
+    // Worker processes, each rendering on one thread.
+    u32 workers = defaultThreadCount();
+    // Rows per tile.
+    i32 tile_rows = 8;
+    tile_transport transport = tile_transport::shared_memory;
+    // Samples, sampler and trace settings; the policy is not used.
+    render_options render;
+};
+
+struct distributed_stats {
+    u32 tiles = 0;
+    // Tiles handed out again because their worker died or answered
+    // with the wrong tile.
+    u32 reissued = 0;
+    u32 worker_deaths = 0;
+};
+
+// Renders `out` over options.workers forked processes, each running
+// worker(index, socket, shared) and then exiting. Each worker must
+// answer what it receives on `socket`:
+//
+//   - A pixel_tile with rows > 0 asks it to render that tile. It fills
+//     the tile's rows of `shared`, the whole frame in memory shared with
+//     the coordinator, or, with the stream transport, keeps them.
+//   - When done it sends back the same pixel_tile. For the stream
+//     transport it then sends rows * cols pixels, row by row.
+//   - An empty tile tells it to return.
+//
+// A worker that dies, or answers with a different tile, is killed, and
+// its tile is handed to the next idle worker. The frame completes as long
+// as one worker survives; if none does, this throws.
+//
+// Forking copies only the calling thread, so a lock held by another
+// thread at that moment, such as a TextureCache's, would stay locked in
+// every worker. Throws std::logic_error unless the calling thread is the
+// process's only one; start no thread pool before calling this.
+template<typename W>
+requires std::is_invocable_v<W const&, u32, int, std::span<vec3>>
+distributed_stats renderOnWorkers(Canvas<vec3>& out, distributed_options const& options, W const& worker)
+{
+    if (threadCount() != 1) {
+        throw std::logic_error("distributed rendering forks, so it must start before any other thread");
+    }
+    i32 width = out.width();
+    i32 band = std::max(options.tile_rows, 1);
+    u32 tile_count = static_cast<u32>((out.height() + band - 1) / band);
+    auto tileAt = [&](u32 index) {
+        pixel_tile tile;
+        tile.row = static_cast<i32>(index) * band;
+        tile.col = 0;
+        tile.rows = std::min(band, out.height() - tile.row);
+        tile.cols = width;
+        return tile;
+    };
+
+    SharedPixels shared(usize(out.size()));
+    std::vector<worker_process> workers(std::max(options.workers, 1u));
+    for (usize i = 0; i < workers.size(); i++) {
+        auto [ours, theirs] = socketPair();
+        ::pid_t pid = ::fork();
+        if (pid < 0) {
+            reap(workers, true);
+            throw std::runtime_error("cannot start render workers");
+        }
+        if (pid == 0) {
+            // Worker: leave without running the parent's exit handlers.
+            for (usize j = 0; j < i; j++) {
+                workers[j].socket.reset();
+            }
+            ours.reset();
+            try {
+                worker(static_cast<u32>(i), theirs.get(), std::span(shared.data(), usize(out.size())));
+            } catch (...) {
+                std::_Exit(1);
+            }
+            std::_Exit(0);
+        }
+        workers[i].pid = pid;
+        workers[i].socket = std::move(ours);
+    }
+
+    distributed_stats stats;
+    stats.tiles = tile_count;
+    std::deque<u32> pending(tile_count);
+    std::iota(pending.begin(), pending.end(), 0u);
+    u32 finished = 0;
+
+    auto retire = [&](worker_process& w) {
+        if (w.tile) {
+            pending.push_front(*w.tile);
+            w.tile.reset();
+            stats.reissued++;
+        }
+        // Dead or talking nonsense; make sure it's the former.
+        ::kill(w.pid, SIGKILL);
+        w.socket.reset();
+        ::waitpid(w.pid, nullptr, 0);
+        w.pid = -1;
+        stats.worker_deaths++;
+    };
+    auto assign = [&](worker_process& w) {
+        if (w.pid < 0 || w.tile || pending.empty()) {
+            return;
+        }
+        auto tile = tileAt(pending.front());
+        try {
+            sendAll(w.socket.get(), &tile, sizeof(tile));
+        } catch (std::runtime_error const&) {
+            retire(w);
+            return;
+        }
+        w.tile = pending.front();
+        pending.pop_front();
+    };
+
+    try {
+        while (finished < tile_count) {
+            for (auto& w : workers) {
+                assign(w);
+            }
+            std::vector<::pollfd> polls;
+            std::vector<worker_process*> polled;
+            for (auto& w : workers) {
+                if (w.pid > 0) {
+                    ::pollfd p {};
+                    p.fd = w.socket.get();
+                    p.events = POLLIN;
+                    polls.push_back(p);
+                    polled.push_back(&w);
+                }
+            }
+            if (polls.empty()) {
+                throw std::runtime_error("every render worker died");
+            }
+            if (::poll(polls.data(), polls.size(), -1) < 0) {
+                continue;
+            }
+            for (usize i = 0; i < polls.size(); i++) {
+                if (polls[i].revents == 0) {
+                    continue;
+                }
+                auto& w = *polled[i];
+                pixel_tile tile;
+                try {
+                    // Anything but the tile it was given could write past
+                    // the frame.
+                    if (!receiveAll(w.socket.get(), &tile, sizeof(tile)) || !w.tile || tile != tileAt(*w.tile)) {
+                        retire(w);
+                        continue;
+                    }
+                    if (options.transport == tile_transport::stream) {
+                        receiveAll(w.socket.get(), out.begin() + usize(tile.row) * usize(width), usize(tile.rows) * usize(width) * sizeof(vec3));
+                    }
+                } catch (std::runtime_error const&) {
+                    retire(w);
+                    continue;
+                }
+                w.tile.reset();
+                finished++;
+            }
+        }
+    } catch (...) {
+        reap(workers, true);
+        throw;
+    }
+
+    pixel_tile quit {};
+    for (auto& w : workers) {
+        if (w.pid > 0) {
+            try {
+                sendAll(w.socket.get(), &quit, sizeof(quit));
+            } catch (std::runtime_error const&) {
+                // It's gone already.
+            }
+        }
+    }
+    reap(workers, false);
+    if (options.transport == tile_transport::shared_memory) {
+        std::copy(shared.data(), shared.data() + out.size(), out.begin());
+    }
+    return stats;
+}
+
+// Renders like render(camera, out, options.render, kernel), spread over
+// forked worker processes (see renderOnWorkers()). The coordinator, the
+// calling process, splits the frame into bands of rows and hands one at a
+// time to each idle worker; a worker renders its band and reports it
+// done, writing the pixels into shared memory or sending them back.
+// Workers inherit the kernel and whatever it refers to, such as the
+// scene, copy-on-write.
+template<typename K>
+requires std::is_invocable_r_v<vec3, K&, ray const&, i32, i32> && std::copy_constructible<K>
+distributed_stats renderDistributed(Camera const& camera, Canvas<vec3>& out, distributed_options const& options, K const& kernel)
+{
+    i32 width = out.width();
+    return renderOnWorkers(out, options, [&](u32, int socket, std::span<vec3> shared) {
+        Sampler sampler(options.render.sampler, options.render.seed);
+        u32 samples = std::max(options.render.samples_per_pixel, 1u);
+        std::vector<vec3> local;
+        pixel_tile tile;
+        while (receiveAll(socket, &tile, sizeof(tile)) && tile.rows > 0) {
+            auto count = usize(tile.rows) * usize(width);
+            local.resize(count);
+            auto pixels = options.transport == tile_transport::shared_memory
+                ? shared.subspan(usize(tile.row) * usize(width), count)
+                : std::span(local);
+            for (i32 row = tile.row; row < tile.row + tile.rows; row++) {
+                K k = kernel;
+                renderRow(camera, sampler, samples, k, row, pixels.subspan(usize(row - tile.row) * usize(width), usize(width)));
+            }
+            sendAll(socket, &tile, sizeof(tile));
+            if (options.transport == tile_transport::stream) {
+                sendAll(socket, pixels.data(), pixels.size_bytes());
+            }
+        }
+    });
+}
+
+// As above with tracingKernel(), rendering `scene`.
+distributed_stats renderDistributed(Scene const& scene, Camera const& camera, Canvas<vec3>& out, distributed_options const& options = distributed_options())
+{
+    return renderDistributed(camera, out, options, tracingKernel(scene, camera, options.render.trace));
+}
+} // namespace raytracer
@@ -0,0 +1,119 @@
+import boost.ut;
+import raytracer;
+import raytracer.testing;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+using namespace raytracer::testing;
+
+namespace {
+constexpr i32 width = 40;
+constexpr i32 height = 30;
+} // namespace
+
+int main()
+{
+    feature("Distributed rendering") = [] {
+        auto scene = spheres();
+        auto view = camera(width, height);
+        distributed_options options;
+        options.workers = 3;
+        options.tile_rows = 4;
+        options.render.samples_per_pixel = 2;
+        // Workers are forked, which needs this process to have no other
+        // threads, so the reference is rendered without a pool.
+        options.render.policy = execution_policy::serial;
+        Canvas<vec3> expected(width, height);
+        render(scene, view, expected, options.render);
+
+        then("Workers composite the image render() gives") = [&] {
+            for (auto transport : { tile_transport::shared_memory, tile_transport::stream }) {
+                auto o = options;
+                o.transport = transport;
+                Canvas<vec3> image(width, height);
+                auto stats = renderDistributed(scene, view, image, o);
+                expect(same(image, expected)) << static_cast<u32>(transport);
+                expect(stats.tiles == 8u && stats.reissued == 0u && stats.worker_deaths == 0u);
+            }
+        };
+
+        then("More workers than tiles is fine") = [&] {
+            auto o = options;
+            o.workers = 12;
+            o.tile_rows = height;
+            Canvas<vec3> image(width, height);
+            expect(renderDistributed(scene, view, image, o).tiles == 1u);
+            expect(same(image, expected));
+        };
+
+        then("A dead worker's tile is rendered by another") = [&] {
+            // The first worker to reach this pixel dies, once.
+            auto marker = (std::filesystem::temp_directory_path() / "raytracer_distributed_tests.died").string();
+            std::filesystem::remove(marker);
+            auto kernel = [inner = tracingKernel(scene, view, options.render.trace), marker](ray const& r, i32 row, i32 col) mutable {
+                if (row == 13 && col == 5 && !std::filesystem::exists(marker)) {
+                    std::ofstream { marker };
+                    std::_Exit(1);
+                }
+                return inner(r, row, col);
+            };
+            for (auto transport : { tile_transport::shared_memory, tile_transport::stream }) {
+                auto o = options;
+                o.transport = transport;
+                std::filesystem::remove(marker);
+                Canvas<vec3> image(width, height);
+                auto stats = renderDistributed(view, image, o, kernel);
+                expect(stats.worker_deaths == 1u && stats.reissued == 1u) << stats.worker_deaths << stats.reissued;
+                expect(same(image, expected));
+            }
+            std::filesystem::remove(marker);
+        };
+
+        then("The frame fails only when every worker dies") = [&] {
+            Canvas<vec3> image(width, height);
+            expect(throws([&] {
+                (void)renderDistributed(view, image, options, [](ray const&, i32, i32) -> vec3 { std::_Exit(1); });
+            }));
+        };
+
+        then("A worker answering with the wrong tile is retired") = [&] {
+            for (auto transport : { tile_transport::shared_memory, tile_transport::stream }) {
+                auto o = options;
+                o.transport = transport;
+                Canvas<vec3> image(width, height);
+                // Every pixel holds its tile's first row; worker 0 claims
+                // far more rows than it was given.
+                auto stats = renderOnWorkers(image, o, [&](u32 index, int socket, std::span<vec3> shared) {
+                    pixel_tile tile;
+                    while (receiveAll(socket, &tile, sizeof(tile)) && tile.rows > 0) {
+                        std::vector<vec3> pixels(usize(tile.rows) * usize(tile.cols), vec3(f32(tile.row)));
+                        std::ranges::copy(pixels, shared.begin() + tile.row * width);
+                        if (index == 0) {
+                            tile.rows += 1000;
+                        }
+                        sendAll(socket, &tile, sizeof(tile));
+                        if (transport == tile_transport::stream) {
+                            sendAll(socket, pixels.data(), pixels.size() * sizeof(vec3));
+                        }
+                    }
+                });
+                expect(stats.worker_deaths == 1u && stats.reissued == 1u) << stats.worker_deaths << stats.reissued;
+                for (i32 row = 0; row < height; row++) {
+                    expect(image[row, 0] == vec3(f32(row / o.tile_rows * o.tile_rows)) && image[row, width - 1] == image[row, 0]) << row;
+                }
+            }
+        };
+
+        then("Forking while other threads run is refused") = [&] {
+            std::jthread other([](std::stop_token stop) {
+                while (!stop.stop_requested()) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            });
+            Canvas<vec3> image(width, height);
+            expect(throws<std::logic_error>([&] { (void)renderDistributed(scene, view, image, options); }));
+        };
+    };
+}
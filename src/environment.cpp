@@ -0,0 +1,219 @@
+export module raytracer.environment;
+
+import raytracer.canvas;
+import raytracer.constants;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+struct distribution_sample {
+    u32 index;
+    // Where in the bin the sample fell, in [0, 1).
+    f32 offset;
+    // Density over [0, 1) of the point index + offset, over the bin count.
+    f32 pdf;
+};
+
+// Piecewise-constant density over [0, 1) with one bin per weight, sampled
+// by inverting its cumulative distribution with a binary search. All-zero
+// weights give the uniform density.
+class Distribution1D {
+public:
+    explicit Distribution1D(std::span<f32 const> weights)
+        : m_weights(weights.begin(), weights.end())
+        , m_cdf(weights.size() + 1, 0.0f)
+    {
+        for (auto& w : m_weights) {
+            w = std::max(w, 0.0f);
+        }
+        for (usize i = 0; i < m_weights.size(); i++) {
+            m_cdf[i + 1] = m_cdf[i] + m_weights[i];
+        }
+        m_total = m_cdf.back();
+        for (usize i = 0; i < m_cdf.size(); i++) {
+            m_cdf[i] = m_total > 0.0f ? m_cdf[i] / m_total : f32(i) / f32(size());
+        }
+        m_cdf.back() = 1.0f;
+    }
+
+    [[nodiscard]] usize size() const
+    {
+        return m_weights.size();
+    }
+
+    // Sum of the weights.
+    [[nodiscard]] f32 total() const
+    {
+        return m_total;
+    }
+
+    // The point whose cumulative probability is `u`, in [0, 1). Empty bins
+    // are never picked.
+    [[nodiscard]] distribution_sample sample(f32 u) const
+    {
+        auto it = std::upper_bound(m_cdf.begin() + 1, m_cdf.end(), u);
+        auto index = static_cast<u32>(std::min<usize>(it - m_cdf.begin() - 1, size() - 1));
+        f32 width = m_cdf[index + 1] - m_cdf[index];
+        distribution_sample s;
+        s.index = index;
+        s.offset = width > 0.0f ? std::min((u - m_cdf[index]) / width, 0x1.fffffep-1f) : 0.0f;
+        s.pdf = pdf(index);
+        return s;
+    }
+
+    // Density inside bin `index`.
+    [[nodiscard]] f32 pdf(u32 index) const
+    {
+        return m_total > 0.0f ? m_weights[index] / m_total * f32(size()) : 1.0f;
+    }
+
+private:
+    std::vector<f32> m_weights;
+    std::vector<f32> m_cdf;
+    f32 m_total;
+};
+
+// Piecewise-constant density over the unit square from a row-major grid of
+// weights: a marginal distribution picks the row and that row's
+// conditional distribution the column.
+class Distribution2D {
+public:
+    Distribution2D(std::span<f32 const> weights, u32 width, u32 height)
+        : m_rows(rowsOf(weights, width, height))
+        , m_marginal(totalsOf(m_rows))
+    {
+    }
+
+    // A point with x across the columns and y down the rows, and its
+    // density over the unit square.
+    [[nodiscard]] std::pair<vec2, f32> sample(vec2 u) const
+    {
+        auto row = m_marginal.sample(u.y);
+        auto col = m_rows[row.index].sample(u.x);
+        auto point = vec2(
+            (f32(col.index) + col.offset) / f32(m_rows[row.index].size()),
+            (f32(row.index) + row.offset) / f32(m_rows.size()));
+        return { point, row.pdf * col.pdf };
+    }
+
+    [[nodiscard]] f32 pdf(vec2 point) const
+    {
+        auto rows = m_rows.size();
+        auto cols = m_rows[0].size();
+        auto row = static_cast<u32>(std::clamp<f32>(point.y * f32(rows), 0.0f, f32(rows - 1)));
+        auto col = static_cast<u32>(std::clamp<f32>(point.x * f32(cols), 0.0f, f32(cols - 1)));
+        return m_marginal.pdf(row) * m_rows[row].pdf(col);
+    }
+
+private:
+    std::vector<Distribution1D> m_rows;
+    Distribution1D m_marginal;
+
+    static std::vector<Distribution1D> rowsOf(std::span<f32 const> weights, u32 width, u32 height)
+    {
+        std::vector<Distribution1D> rows;
+        rows.reserve(height);
+        for (u32 row = 0; row < height; row++) {
+            rows.emplace_back(weights.subspan(usize(row) * width, width));
+        }
+        return rows;
+    }
+
+    static std::vector<f32> totalsOf(std::vector<Distribution1D> const& rows)
+    {
+        std::vector<f32> totals;
+        for (auto const& row : rows) {
+            totals.push_back(row.total());
+        }
+        return totals;
+    }
+};
+
+struct environment_sample {
+    vec3 direction;
+    vec3 radiance;
+    // Over solid angle.
+    f32 pdf;
+};
+
+// Distant lighting from an HDR image in latitude-longitude layout: the
+// top row looks up +y and the centre column along +z. Texels are
+// constant, so radiance lookups are nearest-texel.
+//
+// Directions can be importance sampled in proportion to luminance: the
+// texel weights are the luminance scaled by the solid angle each row
+// covers, and a Distribution2D over them picks texels. A small bright sun
+// then gets nearly all the samples it deserves instead of the sliver of
+// the hemisphere it covers.
+class EnvironmentMap {
+public:
+    explicit EnvironmentMap(Canvas<vec3> image)
+        : m_image(std::move(image))
+        , m_distribution(weightsOf(m_image), static_cast<u32>(m_image.width()), static_cast<u32>(m_image.height()))
+    {
+    }
+
+    [[nodiscard]] Canvas<vec3> const& image() const
+    {
+        return m_image;
+    }
+
+    // Radiance arriving from `direction`, which must be normalized, i.e.
+    // seen looking along it.
+    [[nodiscard]] vec3 radiance(vec3 const& direction) const
+    {
+        auto uv = uvOf(direction);
+        auto col = static_cast<i32>(std::min(uv.x * f32(m_image.width()), f32(m_image.width() - 1)));
+        auto row = static_cast<i32>(std::min(uv.y * f32(m_image.height()), f32(m_image.height() - 1)));
+        return m_image[row, col];
+    }
+
+    // A direction drawn in proportion to the radiance from it, using two
+    // uniform numbers.
+    [[nodiscard]] environment_sample sample(vec2 u) const
+    {
+        auto [uv, pdf] = m_distribution.sample(u);
+        f32 theta = uv.y * pi<f32>;
+        f32 phi = (uv.x - 0.5f) * 2.0f * pi<f32>;
+        f32 sin_theta = std::sin(theta);
+        environment_sample s;
+        s.direction = vec3(sin_theta * std::sin(phi), std::cos(theta), sin_theta * std::cos(phi));
+        s.radiance = radiance(s.direction);
+        s.pdf = sin_theta > 0.0f ? pdf / (2.0f * pi<f32> * pi<f32> * sin_theta) : 0.0f;
+        return s;
+    }
+
+    // Solid-angle density with which sample() returns `direction`.
+    [[nodiscard]] f32 pdf(vec3 const& direction) const
+    {
+        auto uv = uvOf(direction);
+        f32 sin_theta = std::sin(uv.y * pi<f32>);
+        return sin_theta > 0.0f ? m_distribution.pdf(uv) / (2.0f * pi<f32> * pi<f32> * sin_theta) : 0.0f;
+    }
+
+private:
+    Canvas<vec3> m_image;
+    Distribution2D m_distribution;
+
+    static vec2 uvOf(vec3 const& d)
+    {
+        f32 u = 0.5f + std::atan2(d.x, d.z) / (2.0f * pi<f32>);
+        f32 v = std::acos(std::clamp(d.y, -1.0f, 1.0f)) / pi<f32>;
+        return vec2(u, v);
+    }
+
+    static std::vector<f32> weightsOf(Canvas<vec3> const& image)
+    {
+        std::vector<f32> weights;
+        weights.reserve(usize(image.size()));
+        for (i32 row = 0; row < image.height(); row++) {
+            f32 sin_theta = std::sin((f32(row) + 0.5f) / f32(image.height()) * pi<f32>);
+            for (i32 col = 0; col < image.width(); col++) {
+                weights.push_back(std::max(luminanceOf(image[row, col]), 0.0f) * sin_theta);
+            }
+        }
+        return weights;
+    }
+};
+} // namespace raytracer
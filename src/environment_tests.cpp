@@ -0,0 +1,219 @@
+import boost.ut;
+import raytracer;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+
+namespace {
+constexpr i32 size = 32;
+
+f32 rmse(Canvas<vec3> const& a, Canvas<vec3> const& b)
+{
+    f32 squared = 0.0f;
+    for (i32 i = 0; i < a.size(); i++) {
+        auto d = a.begin()[i] - b.begin()[i];
+        squared += dot(d, d) / 3.0f;
+    }
+    return std::sqrt(squared / f32(a.size()));
+}
+
+vec3 meanOf(Canvas<vec3> const& image)
+{
+    vec3 sum = zero<vec3>;
+    for (auto const& c : image) {
+        sum = sum + c;
+    }
+    return sum / f32(image.size());
+}
+
+// Texel of a width x height latitude-longitude map that `d` falls in.
+ivec2 texelOf(vec3 const& d, i32 width, i32 height)
+{
+    f32 u = 0.5f + std::atan2(d.x, d.z) / (2.0f * pi<f32>);
+    f32 v = std::acos(d.y) / pi<f32>;
+    return ivec2(static_cast<i32>(u * f32(width)), static_cast<i32>(v * f32(height)));
+}
+
+// A pale sky, brighter towards the zenith, with an optional small sun.
+Canvas<vec3> sky(f32 sun)
+{
+    Canvas<vec3> image(64, 32);
+    for (i32 row = 0; row < image.height(); row++) {
+        for (i32 col = 0; col < image.width(); col++) {
+            image[row, col] = vec3(0.3f, 0.4f, 0.6f) * (1.0f - f32(row) / f32(image.height()));
+        }
+    }
+    auto texel = texelOf(normalize(vec3(0.3f, 0.8f, 0.5f)), image.width(), image.height());
+    image[texel.y, texel.x] = vec3(sun);
+    return image;
+}
+
+// Pinhole rays from z = -5 through a 4x4 window at z = 0.
+ray primary(i32 row, i32 col)
+{
+    auto target = vec3(-2.0f + 4.0f * (f32(col) + 0.5f) / size, 2.0f - 4.0f * (f32(row) + 0.5f) / size, 0.0f);
+    auto origin = vec3(0, 0, -5);
+    return ray(origin, normalize(target - origin));
+}
+
+// A diffuse floor and a glossy ball under an environment and no lights.
+Scene outdoors(Canvas<vec3> environment)
+{
+    Scene scene;
+    material floor;
+    floor.color = vec3(0.8f, 0.8f, 0.7f);
+    floor.specular = 0.0f;
+    material ball;
+    ball.color = vec3(0.9f, 0.3f, 0.2f);
+    ball.diffuse = 0.6f;
+    ball.specular = 0.3f;
+    ball.shininess = 20.0f;
+    for (auto [center, radius, m] : { std::tuple(vec3(0, -1001, 0), 1000.0f, floor), std::tuple(vec3(0, 0, 1), 1.0f, ball) }) {
+        auto& s = scene.objects.add<Sphere>();
+        s.setTransform(mat4::translate(center.x, center.y, center.z) * mat4::scale(radius, radius, radius));
+        s.material_id = scene.materials.add(m);
+    }
+    scene.environment = std::make_shared<EnvironmentMap>(std::move(environment));
+    scene.build();
+    return scene;
+}
+
+Canvas<vec3> render(Scene const& scene, u32 samples, bool sample_environment)
+{
+    path_tracer_settings settings;
+    settings.samples_per_pixel = samples;
+    settings.max_depth = 3;
+    settings.sample_environment = sample_environment;
+    Canvas<vec3> image(size, size);
+    PathTracer(settings).render(scene, primary, image);
+    return image;
+}
+} // namespace
+
+int main()
+{
+    feature("Reading PFM images") = [] {
+        Canvas<vec3> image(5, 3);
+        for (i32 row = 0; row < image.height(); row++) {
+            for (i32 col = 0; col < image.width(); col++) {
+                image[row, col] = vec3(f32(row), f32(col), 1e3f * f32(row + col));
+            }
+        }
+        auto path = (std::filesystem::temp_directory_path() / "raytracer_environment_tests.pfm").string();
+        writePFM(image, path);
+
+        then("What was written is read back") = [&] {
+            auto read = readPFM(path);
+            expect(read.width() == 5 && read.height() == 3);
+            expect(std::equal(image.begin(), image.end(), read.begin()));
+        };
+
+        then("Truncated files are rejected") = [&] {
+            std::filesystem::resize_file(path, std::filesystem::file_size(path) - 4);
+            expect(throws([&] { (void)readPFM(path); }));
+        };
+        std::filesystem::remove(path);
+    };
+
+    feature("Piecewise-constant distributions") = [] {
+        std::array<f32, 4> weights { 1.0f, 0.0f, 3.0f, 4.0f };
+        Distribution1D d(weights);
+
+        then("Bins are picked in proportion to their weight") = [&] {
+            std::array<u32, 4> counts {};
+            constexpr u32 n = 800;
+            for (u32 i = 0; i < n; i++) {
+                auto s = d.sample((f32(i) + 0.5f) / f32(n));
+                counts[s.index]++;
+                expect(s.offset >= 0.0f && s.offset < 1.0f);
+                expect(s.pdf == d.pdf(s.index));
+            }
+            expect(counts[0] == 100u && counts[1] == 0u && counts[2] == 300u && counts[3] == 400u);
+            expect(d.pdf(3) == 2.0f);
+        };
+
+        then("Zero weights give the uniform distribution") = [] {
+            std::array<f32, 2> none {};
+            Distribution1D uniform(none);
+            expect(uniform.sample(0.75f).index == 1u && uniform.pdf(0) == 1.0f);
+        };
+    };
+
+    feature("Environment maps") = [] {
+        EnvironmentMap environment(sky(500.0f));
+        auto const& image = environment.image();
+
+        then("The top row looks up and the centre column along z") = [&] {
+            expect(environment.radiance(vec3(0, 1, 0)) == image[0, image.width() / 2]);
+            expect(environment.radiance(vec3(0, 0, 1)) == image[image.height() / 2, image.width() / 2]);
+        };
+
+        then("Samples report the density they were drawn with") = [&] {
+            Sampler sampler;
+            for (u32 i = 0; i < 256; i++) {
+                auto u = sampler.get4D(uvec2(0, 0), i, 0);
+                auto s = environment.sample(vec2(u.x, u.y));
+                expect(std::abs(s.direction.length() - 1.0f) < 1e-5f);
+                expect(std::abs(s.pdf - environment.pdf(s.direction)) <= 1e-3f * s.pdf) << i;
+                expect(s.radiance == environment.radiance(s.direction));
+            }
+        };
+
+        then("The density integrates to one over the sphere") = [&] {
+            // Midpoints of equal-area cells.
+            constexpr i32 rings = 512, sectors = 1024;
+            f64 integral = 0.0;
+            for (i32 i = 0; i < rings; i++) {
+                f32 y = 1.0f - 2.0f * (f32(i) + 0.5f) / rings;
+                f32 r = std::sqrt(1.0f - y * y);
+                for (i32 j = 0; j < sectors; j++) {
+                    f32 phi = 2.0f * pi<f32> * (f32(j) + 0.5f) / sectors;
+                    integral += environment.pdf(vec3(r * std::cos(phi), y, r * std::sin(phi)));
+                }
+            }
+            integral *= 4.0 * pi<f64> / (rings * sectors);
+            expect(std::abs(integral - 1.0) < 0.01) << integral;
+        };
+
+        then("The sun gets most samples") = [&] {
+            auto sun = texelOf(normalize(vec3(0.3f, 0.8f, 0.5f)), image.width(), image.height());
+            u32 hits = 0;
+            constexpr u32 n = 1000;
+            for (u32 i = 0; i < n; i++) {
+                auto s = environment.sample(vec2(f32(i % 37) / 37.0f, (f32(i) + 0.5f) / f32(n)));
+                hits += texelOf(s.direction, image.width(), image.height()) == sun;
+            }
+            expect(hits > n / 2) << hits;
+        };
+    };
+
+    feature("Image-based lighting") = [] {
+        then("Escaping rays see the environment") = [] {
+            auto scene = outdoors(sky(0.0f));
+            trace_stats stats;
+            u32 rng = 0;
+            auto up = RayTracer().trace(scene, ray(vec3(0, 5, 0), vec3(0, 1, 0)), 8, rng, stats);
+            expect(up == scene.environment->radiance(vec3(0, 1, 0)));
+            auto image = render(scene, 1, true);
+            expect(image[0, 0] == scene.environment->radiance(normalize(primary(0, 0).d)));
+        };
+
+        then("Sampling the sky converges to the same image") = [] {
+            auto scene = outdoors(sky(0.0f));
+            auto sampled = meanOf(render(scene, 64, true));
+            auto bounced = meanOf(render(scene, 64, false));
+            auto difference = sampled - bounced;
+            expect(std::abs(difference.x) < 0.02f * sampled.x && std::abs(difference.z) < 0.02f * sampled.z) << sampled.x << bounced.x;
+        };
+
+        then("Sampling the sky finds a small sun with far fewer samples") = [] {
+            auto scene = outdoors(sky(500.0f));
+            auto reference = render(scene, 256, true);
+            auto sampled = rmse(render(scene, 16, true), reference);
+            auto bounced = rmse(render(scene, 16, false), reference);
+            expect(sampled < 0.25f * bounced) << sampled << bounced;
+        };
+    };
+}
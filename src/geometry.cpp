@@ -0,0 +1,136 @@
+export module raytracer.geometry;
+
+import raytracer.aabb;
+import raytracer.bvh;
+import raytracer.ray;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+struct geometry_hit {
+    f32 t;
+    u32 primitive;
+};
+
+// Shape data in its own space, shared by any number of Instance objects.
+class Geometry {
+public:
+    virtual ~Geometry() { }
+
+    // Closest hit with t in (0, t_max).
+    virtual std::optional<geometry_hit> intersect(ray const& r, f32 t_max) const = 0;
+    virtual vec3 normalAt(vec3 const& p, u32 primitive) const = 0;
+    virtual aabb bounds() const = 0;
+    // Number of primitives, which hits number from 0.
+    virtual u32 primitiveCount() const = 0;
+};
+
+// Indexed triangle mesh with its own bottom-level BVH over triangles.
+class TriangleMesh : public Geometry {
+public:
+    TriangleMesh(std::vector<vec3> vertices, std::vector<uvec3> triangles)
+        : m_owned_vertices(std::move(vertices))
+        , m_owned_triangles(std::move(triangles))
+        , m_vertices(m_owned_vertices)
+        , m_triangles(m_owned_triangles)
+    {
+        std::vector<aabb> bounds(m_triangles.size());
+        for (usize i = 0; i < m_triangles.size(); i++) {
+            auto const& tri = m_triangles[i];
+            bounds[i].extend(m_vertices[tri.x]).extend(m_vertices[tri.y]).extend(m_vertices[tri.z]);
+            m_bounds.extend(bounds[i]);
+        }
+        m_bvh.build(bounds);
+        m_acceleration = m_bvh.view();
+    }
+
+    // Uses externally owned buffers, e.g. from a SceneCache, which must
+    // outlive the mesh.
+    TriangleMesh(std::span<vec3 const> vertices, std::span<uvec3 const> triangles, bvh_view acceleration)
+        : m_vertices(vertices)
+        , m_triangles(triangles)
+        , m_acceleration(acceleration)
+    {
+        if (!acceleration.nodes.empty()) {
+            m_bounds = acceleration.nodes[0].bounds;
+        }
+    }
+
+    TriangleMesh(TriangleMesh const&) = delete;
+    TriangleMesh& operator=(TriangleMesh const&) = delete;
+
+    virtual std::optional<geometry_hit> intersect(ray const& r, f32 t_max) const override
+    {
+        std::optional<geometry_hit> closest;
+        traverse(m_acceleration, r, t_max, [&](u32 primitive, f32 t_max) {
+            auto t = intersectTriangle(r, primitive, t_max);
+            if (t < t_max) {
+                closest = { t, primitive };
+                return t;
+            }
+            return t_max;
+        });
+        return closest;
+    }
+
+    virtual vec3 normalAt(vec3 const&, u32 primitive) const override
+    {
+        auto const& tri = m_triangles[primitive];
+        auto e1 = m_vertices[tri.y] - m_vertices[tri.x];
+        auto e2 = m_vertices[tri.z] - m_vertices[tri.x];
+        return normalize(cross(e1, e2));
+    }
+
+    virtual aabb bounds() const override
+    {
+        return m_bounds;
+    }
+
+    virtual u32 primitiveCount() const override
+    {
+        return static_cast<u32>(m_triangles.size());
+    }
+
+    [[nodiscard]] std::span<vec3 const> vertices() const { return m_vertices; }
+    [[nodiscard]] std::span<uvec3 const> triangles() const { return m_triangles; }
+    [[nodiscard]] bvh_view acceleration() const { return m_acceleration; }
+
+    // Hit of triangle `primitive` alone, by Möller-Trumbore; t_max on a
+    // miss.
+    [[nodiscard]] f32 intersectTriangle(ray const& r, u32 primitive, f32 t_max) const
+    {
+        auto const& tri = m_triangles[primitive];
+        auto p0 = m_vertices[tri.x];
+        auto e1 = m_vertices[tri.y] - p0;
+        auto e2 = m_vertices[tri.z] - p0;
+        auto pvec = cross(r.d, e2);
+        auto det = dot(e1, pvec);
+        if (std::abs(det) < 1e-8f) {
+            return t_max;
+        }
+        auto inv_det = 1.0f / det;
+        auto tvec = r.o - p0;
+        auto u = dot(tvec, pvec) * inv_det;
+        if (u < 0.0f || u > 1.0f) {
+            return t_max;
+        }
+        auto qvec = cross(tvec, e1);
+        auto v = dot(r.d, qvec) * inv_det;
+        if (v < 0.0f || u + v > 1.0f) {
+            return t_max;
+        }
+        auto t = dot(e2, qvec) * inv_det;
+        return t > 0.0f ? t : t_max;
+    }
+
+private:
+    std::vector<vec3> m_owned_vertices;
+    std::vector<uvec3> m_owned_triangles;
+    std::span<vec3 const> m_vertices;
+    std::span<uvec3 const> m_triangles;
+    Bvh m_bvh;
+    bvh_view m_acceleration;
+    aabb m_bounds;
+};
+} // namespace raytracer
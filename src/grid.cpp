@@ -0,0 +1,184 @@
+export module raytracer.grid;
+
+import raytracer.aabb;
+import raytracer.accelerator;
+import raytracer.ray;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+// Uniform grid with per-cell primitive lists in one flat array, traversed
+// with a 3D-DDA. Primitives overlapping several cells are listed in each.
+class UniformGrid : public Accelerator {
+public:
+    // Target primitives per cell; resolution follows from this and the
+    // scene volume.
+    static constexpr f32 density = 3.0f;
+    static constexpr u32 max_resolution = 256;
+    static constexpr u32 max_cells = 1 << 22;
+
+    virtual std::string_view name() const override
+    {
+        return "grid";
+    }
+
+    // Single-threaded; the counting and filling passes are bandwidth bound.
+    virtual void build(std::span<aabb const> primitive_bounds, u32 = defaultThreadCount()) override
+    {
+        m_bounds = {};
+        for (auto const& b : primitive_bounds) {
+            m_bounds.extend(b);
+        }
+        m_cell_offsets.clear();
+        m_cell_items.clear();
+        if (primitive_bounds.empty()) {
+            return;
+        }
+
+        // Flat scenes still get a non-zero extent so cell sizes stay finite.
+        auto extent = m_bounds.extent();
+        f32 pad = std::max({ extent.x, extent.y, extent.z, 1e-6f }) * 1e-3f;
+        extent = vec3(std::max(extent.x, pad), std::max(extent.y, pad), std::max(extent.z, pad));
+        m_bounds.max = m_bounds.min + extent;
+        f32 k = std::cbrt(density * f32(primitive_bounds.size()) / (extent.x * extent.y * extent.z));
+        for (usize axis = 0; axis < 3; axis++) {
+            m_resolution[axis] = std::clamp(static_cast<u32>(std::round(extent[axis] * k)), 1u, max_resolution);
+        }
+        while (u64(m_resolution[0]) * m_resolution[1] * m_resolution[2] > max_cells) {
+            for (auto& r : m_resolution) {
+                r = std::max(1u, r / 2);
+            }
+        }
+        for (usize axis = 0; axis < 3; axis++) {
+            m_cell_size[axis] = extent[axis] / f32(m_resolution[axis]);
+        }
+
+        // Count, prefix-sum, then fill, so cell lists are contiguous.
+        m_cell_offsets.assign(usize(m_resolution[0]) * m_resolution[1] * m_resolution[2] + 1, 0);
+        forEachCell(primitive_bounds, [&](u32, usize cell) {
+            m_cell_offsets[cell + 1]++;
+        });
+        std::partial_sum(m_cell_offsets.begin(), m_cell_offsets.end(), m_cell_offsets.begin());
+        m_cell_items.resize(m_cell_offsets.back());
+        std::vector<u32> cursor(m_cell_offsets.begin(), m_cell_offsets.end() - 1);
+        forEachCell(primitive_bounds, [&](u32 primitive, usize cell) {
+            m_cell_items[cursor[cell]++] = primitive;
+        });
+    }
+
+    virtual void intersect(ray const& r, f32 t_max, PrimitiveTest test) const override
+    {
+        constexpr f32 miss = std::numeric_limits<f32>::infinity();
+        if (m_cell_items.empty()) {
+            return;
+        }
+        auto inv_d = reciprocal(r.d);
+        f32 t_enter = raytracer::intersect(m_bounds, r, inv_d, t_max);
+        if (t_enter == miss) {
+            return;
+        }
+
+        // Amanatides-Woo: step into whichever neighbouring cell boundary the
+        // ray reaches first.
+        std::array<i32, 3> cell, step, end;
+        vec3 t_next, t_delta;
+        for (usize axis = 0; axis < 3; axis++) {
+            f32 p = r.o[axis] + r.d[axis] * t_enter;
+            auto c = static_cast<i32>(std::floor((p - m_bounds.min[axis]) / m_cell_size[axis]));
+            cell[axis] = std::clamp(c, 0, i32(m_resolution[axis]) - 1);
+            if (r.d[axis] > 0.0f) {
+                step[axis] = 1;
+                end[axis] = i32(m_resolution[axis]);
+                t_next[axis] = (m_bounds.min[axis] + f32(cell[axis] + 1) * m_cell_size[axis] - r.o[axis]) * inv_d[axis];
+                t_delta[axis] = m_cell_size[axis] * inv_d[axis];
+            } else if (r.d[axis] < 0.0f) {
+                step[axis] = -1;
+                end[axis] = -1;
+                t_next[axis] = (m_bounds.min[axis] + f32(cell[axis]) * m_cell_size[axis] - r.o[axis]) * inv_d[axis];
+                t_delta[axis] = -m_cell_size[axis] * inv_d[axis];
+            } else {
+                step[axis] = 0;
+                end[axis] = -1;
+                t_next[axis] = miss;
+                t_delta[axis] = miss;
+            }
+        }
+
+        // Primitives spanning several cells would otherwise be tested once
+        // per cell; a few recent ids catch most repeats.
+        std::array<u32, 8> mailbox;
+        mailbox.fill(std::numeric_limits<u32>::max());
+        usize mailbox_next = 0;
+        while (true) {
+            auto index = (usize(cell[2]) * m_resolution[1] + usize(cell[1])) * m_resolution[0] + usize(cell[0]);
+            for (u32 i = m_cell_offsets[index]; i < m_cell_offsets[index + 1]; i++) {
+                auto primitive = m_cell_items[i];
+                if (std::ranges::find(mailbox, primitive) != mailbox.end()) {
+                    continue;
+                }
+                mailbox[mailbox_next++ % mailbox.size()] = primitive;
+                t_max = test(primitive, t_max);
+            }
+            usize axis = t_next.x < t_next.y
+                ? (t_next.x < t_next.z ? 0 : 2)
+                : (t_next.y < t_next.z ? 1 : 2);
+            // A hit inside this cell beats anything in later cells.
+            if (t_max <= t_next[axis]) {
+                return;
+            }
+            cell[axis] += step[axis];
+            if (cell[axis] == end[axis]) {
+                return;
+            }
+            t_next[axis] += t_delta[axis];
+        }
+    }
+
+    virtual usize memoryBytes() const override
+    {
+        return memoryOf(m_cell_offsets) + memoryOf(m_cell_items);
+    }
+
+    [[nodiscard]] std::array<u32, 3> resolution() const
+    {
+        return m_resolution;
+    }
+
+private:
+    aabb m_bounds;
+    std::array<u32, 3> m_resolution {};
+    vec3 m_cell_size;
+    // CSR layout: cell c lists m_cell_items[m_cell_offsets[c], m_cell_offsets[c + 1]).
+    std::vector<u32> m_cell_offsets;
+    std::vector<u32> m_cell_items;
+
+    u32 cellOf(f32 p, usize axis) const
+    {
+        auto c = static_cast<i32>((p - m_bounds.min[axis]) / m_cell_size[axis]);
+        return static_cast<u32>(std::clamp(c, 0, i32(m_resolution[axis]) - 1));
+    }
+
+    // Calls f(primitive, cell) for every cell a primitive's bounds overlap.
+    template<typename F>
+    void forEachCell(std::span<aabb const> primitive_bounds, F const& f) const
+    {
+        for (u32 p = 0; p < primitive_bounds.size(); p++) {
+            auto const& b = primitive_bounds[p];
+            if (b.empty()) {
+                continue;
+            }
+            auto x0 = cellOf(b.min.x, 0), x1 = cellOf(b.max.x, 0);
+            auto y0 = cellOf(b.min.y, 1), y1 = cellOf(b.max.y, 1);
+            auto z0 = cellOf(b.min.z, 2), z1 = cellOf(b.max.z, 2);
+            for (u32 z = z0; z <= z1; z++) {
+                for (u32 y = y0; y <= y1; y++) {
+                    for (u32 x = x0; x <= x1; x++) {
+                        f(p, (usize(z) * m_resolution[1] + y) * m_resolution[0] + x);
+                    }
+                }
+            }
+        }
+    }
+};
+} // namespace raytracer
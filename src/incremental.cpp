@@ -0,0 +1,250 @@
+export module raytracer.incremental;
+
+import raytracer.aabb;
+import raytracer.bvh;
+import raytracer.camera;
+import raytracer.canvas;
+import raytracer.mat;
+import raytracer.material;
+import raytracer.object;
+import raytracer.ray;
+import raytracer.render;
+import raytracer.sampler;
+import raytracer.scene;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+struct incremental_stats {
+    // Pixels kept from the last render, and pixels traced again.
+    u64 reused_pixels = 0;
+    u64 traced_pixels = 0;
+    bvh_update_stats update;
+};
+
+// Renders one scene from one camera, as render() would with
+// tracingKernel(), and after edits made through it renders again only the
+// pixels they can have changed; the result is the same as a full render's
+// bit for bit. Each sample keeps its colour unless an edit reaches what it
+// depends on:
+//
+//  - a moved object's old or new world bounds cross its primary ray, up to
+//    the hit recorded for it, or the shadow rays from that hit to a light;
+//  - the object it hit, or that object's material, was edited;
+//  - it hit a reflective or transparent surface, whose secondary rays are
+//    not tracked, and anything was edited at all.
+//
+// Moves refit the BVH through Scene::update() rather than rebuilding it.
+// The scene must change only through the renderer in between renders;
+// call invalidate() after changing it otherwise, e.g. adding lights.
+class IncrementalRenderer {
+public:
+    IncrementalRenderer(Scene& scene, Camera const& camera, render_options const& options = render_options())
+        : m_scene(scene)
+        , m_camera(camera)
+        , m_options(options)
+    {
+    }
+
+    [[nodiscard]] Scene const& scene() const
+    {
+        return m_scene;
+    }
+
+    [[nodiscard]] Camera const& camera() const
+    {
+        return m_camera;
+    }
+
+    // Moves the camera, so the next render is traced in full.
+    void setCamera(Camera const& camera)
+    {
+        m_camera = camera;
+        invalidate();
+    }
+
+    // Forgets the last render, so the next one is traced in full.
+    void invalidate()
+    {
+        m_colors.clear();
+        m_hits.clear();
+    }
+
+    // Gives `object` a new transform. False, and no work for the next
+    // render, if it already had it.
+    bool setTransform(u32 object, mat4 const& transform)
+    {
+        auto& o = m_scene.objects.get(object);
+        if (o.transform() == transform) {
+            return false;
+        }
+        auto bounds = m_scene.objectBounds();
+        m_moved.push_back(object < bounds.size() ? bounds[object] : o.worldBounds());
+        m_moved_ids.push_back(object);
+        o.setTransform(transform);
+        return true;
+    }
+
+    // Replaces material `material_id`, for every object using it.
+    void setMaterial(u32 material_id, material const& m)
+    {
+        m_scene.materials.set(material_id, m);
+        m_edited_materials.push_back(material_id);
+    }
+
+    // Points `object` at another material.
+    void setObjectMaterial(u32 object, u32 material_id)
+    {
+        m_scene.objects.get(object).material_id = material_id;
+        m_edited_objects.push_back(object);
+    }
+
+    // Renders into `out`, which must be the camera's size, and remembers
+    // the result for the next render.
+    incremental_stats render(Canvas<vec3>& out)
+    {
+        incremental_stats stats;
+        stats.update = m_scene.update();
+        for (auto id : m_moved_ids) {
+            m_moved.push_back(m_scene.objectBounds()[id]);
+        }
+        // Shadow rays start just off the surface; keep them from slipping
+        // past a box they graze.
+        for (auto& b : m_moved) {
+            b.min = b.min - vec3(margin);
+            b.max = b.max + vec3(margin);
+        }
+
+        i32 width = m_camera.width();
+        i32 height = m_camera.height();
+        u32 samples = std::max(m_options.samples_per_pixel, 1u);
+        auto pixel_count = usize(width) * usize(height);
+        bool full = m_colors.size() != pixel_count || stats.update.full_rebuild;
+        if (full) {
+            m_colors.assign(pixel_count, zero<vec3>);
+            m_hits.assign(pixel_count * samples, primary_hit());
+        }
+
+        bool edited = !m_moved.empty() || !m_edited_materials.empty() || !m_edited_objects.empty();
+        if (full || edited) {
+            Sampler sampler(m_options.sampler, m_options.seed);
+            auto kernel = tracingKernel(m_scene, m_camera, m_options.trace);
+            std::atomic<u64> traced = 0;
+            forEachRow(m_options, 0, height, [&](i32 row) {
+                auto k = kernel;
+                std::vector<ray> rays(usize(width) * samples);
+                for (u32 s = 0; s < samples; s++) {
+                    primaryRays(m_camera, sampler, row, samples, s, std::span(rays).subspan(usize(s) * usize(width), usize(width)));
+                }
+                u64 row_traced = 0;
+                for (i32 col = 0; col < width; col++) {
+                    auto pixel = usize(row) * usize(width) + usize(col);
+                    auto hits = std::span(m_hits).subspan(pixel * samples, samples);
+                    bool reuse = !full;
+                    for (u32 s = 0; reuse && s < samples; s++) {
+                        reuse = unchanged(rays[usize(s) * usize(width) + usize(col)], hits[s]);
+                    }
+                    if (reuse) {
+                        continue;
+                    }
+                    // Summed as renderRow() does, so the pixel matches render().
+                    vec3 color;
+                    for (u32 s = 0; s < samples; s++) {
+                        auto const& r = rays[usize(s) * usize(width) + usize(col)];
+                        auto value = invokeKernel(k, r, row, col, s);
+                        color = s == 0 ? value : color + value;
+                        hits[s] = primaryHitOf(r);
+                    }
+                    m_colors[pixel] = samples > 1 ? color / f32(samples) : color;
+                    row_traced++;
+                }
+                traced += row_traced;
+            });
+            stats.traced_pixels = traced;
+        }
+        stats.reused_pixels = pixel_count - stats.traced_pixels;
+        m_moved.clear();
+        m_moved_ids.clear();
+        m_edited_materials.clear();
+        m_edited_objects.clear();
+        std::copy(m_colors.begin(), m_colors.end(), out.begin());
+        return stats;
+    }
+
+private:
+    static constexpr f32 margin = 1e-3f;
+
+    // Where one sample's primary ray stopped last time.
+    struct primary_hit {
+        // Infinite for a miss.
+        f32 t = std::numeric_limits<f32>::infinity();
+        u32 object = no_id;
+        // Whether the hit spawns reflected or refracted rays.
+        bool secondary = false;
+    };
+
+    Scene& m_scene;
+    Camera m_camera;
+    render_options m_options;
+    // Last render's pixels, and the hit of each of their samples.
+    std::vector<vec3> m_colors;
+    std::vector<primary_hit> m_hits;
+    // Edits since the last render. m_moved holds the old bounds of the
+    // moved objects, and their new ones while rendering.
+    std::vector<aabb> m_moved;
+    std::vector<u32> m_moved_ids;
+    std::vector<u32> m_edited_materials;
+    std::vector<u32> m_edited_objects;
+
+    [[nodiscard]] primary_hit primaryHitOf(ray const& r) const
+    {
+        primary_hit hit;
+        if (auto h = m_scene.intersect(r)) {
+            auto m = m_scene.materials.get(m_scene.objects.get(h->object_id).material_id);
+            hit.t = h->t;
+            hit.object = h->object_id;
+            hit.secondary = m.reflective > 0.0f || m.transparency > 0.0f;
+        }
+        return hit;
+    }
+
+    // Whether a sample along `r` that stopped at `hit` last time sees the
+    // same thing after the pending edits.
+    [[nodiscard]] bool unchanged(ray const& r, primary_hit const& hit) const
+    {
+        if (m_moved.empty() && m_edited_materials.empty() && m_edited_objects.empty()) {
+            return true;
+        }
+        if (hit.secondary) {
+            return false;
+        }
+        if (hit.object != no_id
+            && (std::ranges::find(m_edited_objects, hit.object) != m_edited_objects.end()
+                || std::ranges::find(m_edited_materials, m_scene.objects.get(hit.object).material_id) != m_edited_materials.end())) {
+            return false;
+        }
+        auto inv_d = reciprocal(r.d);
+        for (auto const& b : m_moved) {
+            if (intersect(b, r, inv_d, hit.t) != std::numeric_limits<f32>::infinity()) {
+                return false;
+            }
+        }
+        if (hit.object == no_id) {
+            return true;
+        }
+        auto point = r.o + r.d * hit.t;
+        for (auto const& light : m_scene.lights) {
+            // Parametrized so the light is at t = 1.
+            ray shadow(point, light.position - point);
+            auto shadow_inv_d = reciprocal(shadow.d);
+            for (auto const& b : m_moved) {
+                if (intersect(b, shadow, shadow_inv_d, 1.0f) != std::numeric_limits<f32>::infinity()) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+};
+} // namespace raytracer
@@ -0,0 +1,98 @@
+import boost.ut;
+import raytracer;
+import raytracer.testing;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+using namespace raytracer::testing;
+
+namespace {
+constexpr i32 width = 40;
+constexpr i32 height = 30;
+constexpr u32 red_ball = 1;
+constexpr u32 small_ball = 3;
+
+// spheres() with a small ball in front.
+Scene spheresAndBall()
+{
+    auto scene = spheres();
+    addSmallBall(scene, -2, -2);
+    scene.build();
+    return scene;
+}
+} // namespace
+
+int main()
+{
+    feature("Incremental rendering") = [] {
+        auto scene = spheresAndBall();
+        auto view = camera(width, height);
+        render_options options;
+        options.samples_per_pixel = 2;
+        IncrementalRenderer renderer(scene, view, options);
+        Canvas<vec3> image(width, height);
+        Canvas<vec3> expected(width, height);
+        auto pixel_count = u64(width) * u64(height);
+        auto check = [&](incremental_stats const& stats) {
+            render(scene, view, expected, options);
+            expect(same(image, expected));
+            expect(stats.traced_pixels + stats.reused_pixels == pixel_count);
+        };
+
+        then("The first render traces everything and the next nothing") = [&] {
+            check(renderer.render(image));
+            auto stats = renderer.render(image);
+            expect(stats.traced_pixels == 0u);
+            check(stats);
+        };
+
+        then("A material edit retraces what shows that material") = [&] {
+            auto red = scene.materials.get(scene.objects.get(red_ball).material_id);
+            red.color = vec3(0.2f, 0.3f, 0.9f);
+            renderer.setMaterial(scene.objects.get(red_ball).material_id, red);
+            auto stats = renderer.render(image);
+            check(stats);
+            expect(stats.traced_pixels > 0u && stats.traced_pixels < pixel_count / 2) << stats.traced_pixels;
+        };
+
+        then("Reassigning an object's material retraces that object") = [&] {
+            material chrome;
+            chrome.color = vec3(0.3f);
+            chrome.reflective = 0.9f;
+            renderer.setObjectMaterial(small_ball, scene.materials.add(chrome));
+            auto stats = renderer.render(image);
+            check(stats);
+            expect(stats.traced_pixels > 0u && stats.traced_pixels < pixel_count / 2) << stats.traced_pixels;
+        };
+
+        then("A move retraces the old and new places and the shadows") = [&] {
+            expect(!renderer.setTransform(red_ball, scene.objects.get(red_ball).transform()));
+            expect(renderer.setTransform(small_ball, mat4::translate(-1.4f, -0.7f, -2) * mat4::scale(0.3f, 0.3f, 0.3f)));
+            auto stats = renderer.render(image);
+            check(stats);
+            expect(!stats.update.full_rebuild);
+            expect(stats.traced_pixels > 0u && stats.traced_pixels < pixel_count / 2) << stats.traced_pixels;
+        };
+
+        then("Several edits go into one render") = [&] {
+            auto mirror_id = scene.objects.get(2).material_id;
+            auto mirror = scene.materials.get(mirror_id);
+            mirror.reflective = 0.4f;
+            renderer.setMaterial(mirror_id, mirror);
+            renderer.setTransform(red_ball, mat4::translate(-1, 0.5f, 1));
+            check(renderer.render(image));
+            expect(renderer.render(image).traced_pixels == 0u);
+        };
+
+        then("A new camera traces everything again") = [&] {
+            Camera moved(width, height, 1.0f, viewTransform(vec3(1, 2, -6), vec3(0, 0, 0), vec3(0, 1, 0)));
+            renderer.setCamera(moved);
+            auto stats = renderer.render(image);
+            expect(stats.traced_pixels == pixel_count);
+            render(scene, moved, expected, options);
+            expect(same(image, expected));
+        };
+    };
+}
@@ -0,0 +1,78 @@
+export module raytracer.instance;
+
+import raytracer.aabb;
+import raytracer.geometry;
+import raytracer.mat;
+import raytracer.object;
+import raytracer.ray;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+// An Object that places shared Geometry in the scene. Only the transform,
+// its inverse and the material id are stored per instance, so the scene BVH
+// acts as the top level over instances and each geometry keeps its own
+// bottom level.
+class Instance : public Object {
+public:
+    using Object::normalAt;
+
+    explicit Instance(std::shared_ptr<Geometry const> geometry)
+        : m_geometry(std::move(geometry))
+    {
+    }
+
+    virtual intersections intersect(ray const& r) const override
+    {
+        auto h = closestHit(r, std::numeric_limits<f32>::infinity());
+        if (!h) {
+            return {};
+        }
+        return { *h };
+    }
+
+    // The ray is moved into instance space but not renormalized, so hit
+    // distances are valid in both spaces.
+    virtual std::optional<intersection> closestHit(ray const& r, f32 t_max) const override
+    {
+        auto h = m_geometry->intersect(inverseTransform() * r, t_max);
+        if (!h) {
+            return {};
+        }
+        return intersection(h->t, id, h->primitive);
+    }
+
+    // Without a hit record the primitive is unknown, so this only serves
+    // single-primitive geometry; pass the intersection otherwise.
+    virtual vec3 normalAt(vec3 const& p) const override
+    {
+        if (m_geometry->primitiveCount() != 1) {
+            throw std::logic_error("Instance::normalAt() needs the intersection for geometry with several primitives");
+        }
+        return normalAt(p, intersection(0.0f, id, 0));
+    }
+
+    virtual vec3 normalAt(vec3 const& p, intersection const& i) const override
+    {
+        auto object_point = vec3(inverseTransform() * vec4::point(p));
+        auto object_normal = vec4(m_geometry->normalAt(object_point, i.primitive));
+        auto world_normal = transpose(inverseTransform()) * object_normal;
+        world_normal.w = 0;
+        return vec3(normalize(world_normal));
+    }
+
+    virtual aabb bounds() const override
+    {
+        return m_geometry->bounds();
+    }
+
+    [[nodiscard]] std::shared_ptr<Geometry const> const& geometry() const
+    {
+        return m_geometry;
+    }
+
+private:
+    std::shared_ptr<Geometry const> m_geometry;
+};
+} // namespace raytracer
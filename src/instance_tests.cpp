@@ -0,0 +1,70 @@
+import boost.ut;
+import raytracer;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+
+namespace {
+bool near(vec3 const& a, vec3 const& b, f32 tolerance = 1e-4f)
+{
+    return std::abs(a.x - b.x) <= tolerance && std::abs(a.y - b.y) <= tolerance && std::abs(a.z - b.z) <= tolerance;
+}
+
+// Two triangles spanning [-1, 1]^2 at z = 0, facing +z.
+std::shared_ptr<TriangleMesh> quad()
+{
+    return std::make_shared<TriangleMesh>(
+        std::vector { vec3(-1, -1, 0), vec3(1, -1, 0), vec3(1, 1, 0), vec3(-1, 1, 0) },
+        std::vector { uvec3(0, 1, 2), uvec3(0, 2, 3) });
+}
+
+mat4 placement(i32 i)
+{
+    return mat4::translate(f32(i % 10) * 5.0f, f32(i / 10) * 5.0f, 0.0f) * mat4::rotateY(0.05f * f32(i % 10)) * mat4::scale(2.0f, 1.0f, 1.0f);
+}
+} // namespace
+
+int main()
+{
+    feature("Instancing shared geometry") = [] {
+        auto mesh = quad();
+        Scene scene;
+        for (i32 i = 0; i < 100; i++) {
+            scene.objects.add<Instance>(mesh).setTransform(placement(i));
+        }
+        scene.build();
+
+        then("Every instance refers to the one mesh") = [&] {
+            expect(mesh.use_count() == 101);
+            for (u32 id = 0; id < scene.objects.size(); id++) {
+                auto const& instance = dynamic_cast<Instance const&>(scene.objects.get(id));
+                expect(instance.geometry().get() == mesh.get());
+            }
+        };
+
+        then("Each instance hits in its own place, with its own normals") = [&] {
+            for (i32 i = 0; i < 100; i++) {
+                auto t = placement(i);
+                auto normal = normalize(vec3(transpose(inverse(t)) * vec4(0, 0, 1, 0)));
+                for (auto [local, primitive] : { std::pair(vec3(0.3f, -0.2f, 0), 0u), std::pair(vec3(-0.5f, 0.5f, 0), 1u) }) {
+                    auto point = vec3(t * vec4::point(local));
+                    auto h = scene.intersect(ray(point + normal * 2.0f, -normal));
+                    expect(h && h->object_id == u32(i) && h->primitive == primitive) << i;
+                    expect(h && std::abs(h->t - 2.0f) < 1e-4f) << i;
+                    expect(h && near(scene.objects.get(h->object_id).normalAt(point, *h), normal)) << i;
+                }
+            }
+        };
+
+        then("A normal without the hit is refused for several triangles") = [&] {
+            expect(throws([&] { (void)scene.objects.get(0).normalAt(vec3(0, 0, 0)); }));
+            auto triangle = std::make_shared<TriangleMesh>(std::vector { vec3(0, 0, 0), vec3(1, 0, 0), vec3(0, 1, 0) }, std::vector { uvec3(0, 1, 2) });
+            Instance single(triangle);
+            single.setTransform(mat4::rotateY(pi<f32> / 2.0f));
+            auto expected = normalize(vec3(transpose(inverse(single.transform())) * vec4(0, 0, 1, 0)));
+            expect(near(single.normalAt(vec3(0, 0, 0)), expected));
+        };
+    };
+}
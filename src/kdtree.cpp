@@ -0,0 +1,270 @@
+export module raytracer.kdtree;
+
+import raytracer.aabb;
+import raytracer.accelerator;
+import raytracer.ray;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+struct kd_node {
+    // Splitting plane position along `axis`, unused by leaves.
+    f32 split = 0.0f;
+    // Split axis, or 3 for leaves.
+    u32 axis = 3;
+    // Below child for interior nodes, whose above child follows it; first
+    // item for leaves.
+    u32 offset = 0;
+    u32 count = 0;
+
+    [[nodiscard]] constexpr bool isLeaf() const { return axis == 3; }
+};
+
+static_assert(sizeof(kd_node) == 16);
+
+// SAH kd-tree over primitive bounds. Splits are chosen exactly from the
+// sorted bound edges on every axis, so primitives straddling a plane are
+// referenced from both sides.
+class KdTree : public Accelerator {
+public:
+    static constexpr f32 traversal_cost = 1.0f;
+    static constexpr f32 intersection_cost = 8.0f;
+    // Favors splits that cut off empty space.
+    static constexpr f32 empty_bonus = 0.5f;
+    static constexpr u32 max_leaf_size = 1;
+    // Splits allowed to cost more than the leaf they replace, in case a
+    // better one follows further down.
+    static constexpr u32 max_bad_refines = 3;
+    static constexpr u32 max_stack_depth = 60;
+
+    virtual std::string_view name() const override
+    {
+        return "kd-tree";
+    }
+
+    // Single-threaded; the sorted-edge SAH search is O(n log^2 n).
+    virtual void build(std::span<aabb const> primitive_bounds, u32 = defaultThreadCount()) override
+    {
+        m_nodes.clear();
+        m_items.clear();
+        m_bounds = {};
+        std::vector<u32> primitives;
+        for (u32 p = 0; p < primitive_bounds.size(); p++) {
+            if (!primitive_bounds[p].empty()) {
+                m_bounds.extend(primitive_bounds[p]);
+                primitives.push_back(p);
+            }
+        }
+        if (primitives.empty()) {
+            return;
+        }
+        // The usual 8 + 1.3 log2(n) budget of splits. Cuts that only trim
+        // empty space don't spend it, since sparse scenes need many of them;
+        // the traversal stack bounds the actual depth.
+        auto split_budget = static_cast<u32>(std::round(8.0f + 1.3f * std::log2(f32(primitives.size()))));
+        m_nodes.resize(1);
+        builder b { *this, primitive_bounds, {} };
+        b.buildNode(0, m_bounds, primitives, 0, split_budget, 0);
+    }
+
+    virtual void intersect(ray const& r, f32 t_max, PrimitiveTest test) const override
+    {
+        if (m_nodes.empty()) {
+            return;
+        }
+        auto inv_d = reciprocal(r.d);
+        auto t0 = (m_bounds.min - r.o) * inv_d;
+        auto t1 = (m_bounds.max - r.o) * inv_d;
+        f32 t_near = std::max({ std::min(t0.x, t1.x), std::min(t0.y, t1.y), std::min(t0.z, t1.z), 0.0f });
+        f32 t_far = std::min({ std::max(t0.x, t1.x), std::max(t0.y, t1.y), std::max(t0.z, t1.z), t_max });
+        if (t_near > t_far) {
+            return;
+        }
+
+        struct entry {
+            u32 node;
+            f32 t_near, t_far;
+        };
+        std::array<entry, max_stack_depth + 1> stack;
+        usize top = 0;
+        stack[top++] = { 0, t_near, t_far };
+        while (top != 0) {
+            auto [index, t_min, t_end] = stack[--top];
+            if (t_min > t_max) {
+                continue;
+            }
+            while (!m_nodes[index].isLeaf()) {
+                auto const& node = m_nodes[index];
+                auto axis = node.axis;
+                f32 t_split = (node.split - r.o[axis]) * inv_d[axis];
+                bool below_first = r.o[axis] < node.split || (r.o[axis] == node.split && r.d[axis] <= 0.0f);
+                u32 near = below_first ? node.offset : node.offset + 1;
+                u32 far = below_first ? node.offset + 1 : node.offset;
+                if (t_split > t_end || t_split <= 0.0f) {
+                    index = near;
+                } else if (t_split < t_min) {
+                    index = far;
+                } else {
+                    stack[top++] = { far, t_split, t_end };
+                    index = near;
+                    t_end = t_split;
+                }
+            }
+            auto const& leaf = m_nodes[index];
+            for (u32 i = leaf.offset; i < leaf.offset + leaf.count; i++) {
+                t_max = test(m_items[i], t_max);
+            }
+            // Nodes still on the stack all lie beyond this leaf.
+            if (t_max <= t_end) {
+                return;
+            }
+        }
+    }
+
+    virtual usize memoryBytes() const override
+    {
+        return memoryOf(m_nodes) + memoryOf(m_items);
+    }
+
+    [[nodiscard]] std::span<kd_node const> nodes() const
+    {
+        return m_nodes;
+    }
+
+private:
+    aabb m_bounds;
+    std::vector<kd_node> m_nodes;
+    std::vector<u32> m_items;
+
+    struct edge {
+        f32 t;
+        u32 primitive;
+        bool start;
+    };
+
+    struct builder {
+        KdTree& tree;
+        std::span<aabb const> primitive_bounds;
+        std::vector<edge> edges;
+
+        void sortEdges(aabb const& node_bounds, std::span<u32 const> primitives, usize axis)
+        {
+            edges.clear();
+            for (auto p : primitives) {
+                auto const& b = primitive_bounds[p];
+                edges.push_back({ std::max(b.min[axis], node_bounds.min[axis]), p, true });
+                edges.push_back({ std::min(b.max[axis], node_bounds.max[axis]), p, false });
+            }
+            // Starts before ends at equal positions, so primitives flat on
+            // a plane count on both sides of it.
+            std::ranges::sort(edges, [](edge const& a, edge const& b) {
+                return a.t < b.t || (a.t == b.t && a.start && !b.start);
+            });
+        }
+
+        void makeLeaf(u32 index, std::span<u32 const> primitives)
+        {
+            auto& node = tree.m_nodes[index];
+            node.axis = 3;
+            node.offset = static_cast<u32>(tree.m_items.size());
+            node.count = static_cast<u32>(primitives.size());
+            tree.m_items.insert(tree.m_items.end(), primitives.begin(), primitives.end());
+        }
+
+        void buildNode(
+            u32 index,
+            aabb const& node_bounds,
+            std::vector<u32>& primitives,
+            u32 depth,
+            u32 split_budget,
+            u32 bad_refines)
+        {
+            auto n = static_cast<u32>(primitives.size());
+            if (n <= max_leaf_size || split_budget == 0 || depth == max_stack_depth) {
+                makeLeaf(index, primitives);
+                return;
+            }
+
+            f32 leaf_cost = intersection_cost * f32(n);
+            if (node_bounds.surfaceArea() <= 0.0f) {
+                makeLeaf(index, primitives);
+                return;
+            }
+            f32 inv_area = 1.0f / node_bounds.surfaceArea();
+            auto extent = node_bounds.extent();
+            f32 best_cost = std::numeric_limits<f32>::infinity();
+            usize best_axis = 3;
+            f32 best_split = 0.0f;
+            for (usize axis = 0; axis < 3; axis++) {
+                sortEdges(node_bounds, primitives, axis);
+                usize other0 = (axis + 1) % 3, other1 = (axis + 2) % 3;
+                u32 below = 0, above = n;
+                for (auto const& e : edges) {
+                    if (!e.start) {
+                        above--;
+                    }
+                    if (e.t > node_bounds.min[axis] && e.t < node_bounds.max[axis]) {
+                        f32 d_below = e.t - node_bounds.min[axis];
+                        f32 d_above = node_bounds.max[axis] - e.t;
+                        f32 side = extent[other0] * extent[other1];
+                        f32 p_below = 2.0f * (side + d_below * (extent[other0] + extent[other1])) * inv_area;
+                        f32 p_above = 2.0f * (side + d_above * (extent[other0] + extent[other1])) * inv_area;
+                        f32 bonus = below == 0 || above == 0 ? empty_bonus : 0.0f;
+                        f32 cost = traversal_cost
+                            + intersection_cost * (1.0f - bonus) * (p_below * f32(below) + p_above * f32(above));
+                        if (cost < best_cost) {
+                            best_cost = cost;
+                            best_axis = axis;
+                            best_split = e.t;
+                        }
+                    }
+                    if (e.start) {
+                        below++;
+                    }
+                }
+            }
+
+            if (best_cost > leaf_cost) {
+                bad_refines++;
+            }
+            if (best_axis == 3 || bad_refines == max_bad_refines || (best_cost > 4.0f * leaf_cost && n < 16)) {
+                makeLeaf(index, primitives);
+                return;
+            }
+
+            std::vector<u32> below_primitives, above_primitives;
+            for (auto p : primitives) {
+                auto const& b = primitive_bounds[p];
+                f32 lo = std::max(b.min[best_axis], node_bounds.min[best_axis]);
+                f32 hi = std::min(b.max[best_axis], node_bounds.max[best_axis]);
+                if (lo < best_split || (lo == best_split && hi == best_split)) {
+                    below_primitives.push_back(p);
+                }
+                if (hi > best_split) {
+                    above_primitives.push_back(p);
+                }
+            }
+            primitives = {};
+
+            auto child = static_cast<u32>(tree.m_nodes.size());
+            tree.m_nodes.resize(child + 2);
+            auto& node = tree.m_nodes[index];
+            node.axis = static_cast<u32>(best_axis);
+            node.split = best_split;
+            node.offset = child;
+            node.count = 0;
+
+            auto below_bounds = node_bounds;
+            below_bounds.max[best_axis] = best_split;
+            auto above_bounds = node_bounds;
+            above_bounds.min[best_axis] = best_split;
+            if (!below_primitives.empty() && !above_primitives.empty()) {
+                split_budget--;
+            }
+            buildNode(child, below_bounds, below_primitives, depth + 1, split_budget, bad_refines);
+            buildNode(child + 1, above_bounds, above_primitives, depth + 1, split_budget, bad_refines);
+        }
+    };
+};
+} // namespace raytracer
@@ -0,0 +1,284 @@
+export module raytracer.light_tree;
+
+import raytracer.aabb;
+import raytracer.bvh;
+import raytracer.object;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+struct light_sample {
+    u32 light;
+    // Probability of having picked `light`; divide its contribution by this.
+    f32 pdf;
+};
+
+// Point lights under a bounding hierarchy that stores the summed intensity
+// of every subtree. sample() walks one root-to-leaf path, choosing children
+// by their estimated contribution to a shading point, and cluster() grows
+// a small cut of the tree whose subtrees stand in for their lights. Both
+// cost O(log n) per shading point instead of O(n).
+class LightTree {
+public:
+    // Upper bound on the lights cluster() returns.
+    static constexpr usize max_cut_size = 64;
+
+    LightTree() = default;
+
+    explicit LightTree(std::span<point_light const> lights)
+    {
+        build(lights);
+    }
+
+    void build(std::span<point_light const> lights)
+    {
+        m_lights.assign(lights.begin(), lights.end());
+        std::vector<aabb> bounds(lights.size());
+        for (usize i = 0; i < lights.size(); i++) {
+            bounds[i] = { lights[i].position, lights[i].position };
+        }
+        m_bvh.build(bounds);
+
+        // Children follow their parents, so a reverse sweep sums bottom-up.
+        auto nodes = m_bvh.nodes();
+        auto indices = m_bvh.indices();
+        m_clusters.assign(nodes.size(), {});
+        for (usize i = nodes.size(); i-- > 0;) {
+            auto& c = m_clusters[i];
+            auto const& node = nodes[i];
+            if (node.isLeaf()) {
+                for (u32 k = node.offset; k < node.offset + node.count; k++) {
+                    add(c, indices[k], m_lights[indices[k]].intensity);
+                }
+            } else {
+                auto const& left = m_clusters[node.offset];
+                auto const& right = m_clusters[node.offset + 1];
+                add(c, left.representative, left.intensity);
+                add(c, right.representative, right.intensity);
+            }
+        }
+    }
+
+    // Picks one light with probability roughly proportional to its
+    // contribution at `p`, for a surface with normal `n` (zero for none).
+    // `u` is a uniform number in [0, 1).
+    [[nodiscard]] std::optional<light_sample> sample(vec3 const& p, vec3 const& n, f32 u) const
+    {
+        auto nodes = m_bvh.nodes();
+        if (nodes.empty()) {
+            return {};
+        }
+        f32 pdf = 1.0f;
+        u32 index = 0;
+        while (!nodes[index].isLeaf()) {
+            auto const& node = nodes[index];
+            f32 left = importance(node.offset, p, n);
+            f32 right = importance(node.offset + 1, p, n);
+            if (left + right <= 0.0f) {
+                return {};
+            }
+            f32 p_left = left / (left + right);
+            if (u < p_left) {
+                u = std::min(u / p_left, one_minus_epsilon);
+                pdf *= p_left;
+                index = node.offset;
+            } else {
+                u = std::min((u - p_left) / (1.0f - p_left), one_minus_epsilon);
+                pdf *= 1.0f - p_left;
+                index = node.offset + 1;
+            }
+        }
+
+        auto const& leaf = nodes[index];
+        auto indices = m_bvh.indices().subspan(leaf.offset, leaf.count);
+        f32 total = 0.0f;
+        for (auto light : indices) {
+            total += importance(m_lights[light], p, n);
+        }
+        if (total <= 0.0f) {
+            return {};
+        }
+        // First light whose running sum passes the target, or the last
+        // one that can contribute if rounding leaves the target beyond it.
+        f32 target = u * total;
+        u32 chosen = 0;
+        f32 weight = 0.0f;
+        for (auto light : indices) {
+            f32 w = importance(m_lights[light], p, n);
+            if (w > 0.0f) {
+                chosen = light;
+                weight = w;
+                if (target < w) {
+                    break;
+                }
+                target -= w;
+            }
+        }
+        return light_sample { chosen, pdf * weight / total };
+    }
+
+    // Deterministic alternative to sample(): refines a cut of the tree,
+    // always splitting the subtree with the largest error bound, until no
+    // subtree's bound exceeds `max_error` times the estimated total or the
+    // cut fills `out`. Each remaining subtree is written as its brightest
+    // light carrying the whole subtree's intensity. Returns the count.
+    usize cluster(vec3 const& p, vec3 const& n, f32 max_error, std::span<point_light> out) const
+    {
+        auto nodes = m_bvh.nodes();
+        auto indices = m_bvh.indices();
+        auto capacity = std::min(out.size(), max_cut_size);
+        if (nodes.empty() || capacity == 0) {
+            return 0;
+        }
+
+        // Entries are either a subtree or, once its leaf has been opened,
+        // a single light with no error.
+        struct entry {
+            u32 node;
+            u32 light;
+            f32 estimate;
+            f32 error;
+        };
+        std::array<entry, max_cut_size> cut;
+        usize size = 0;
+        auto push_node = [&](u32 node) {
+            auto const& c = m_clusters[node];
+            auto const& position = m_lights[c.representative].position;
+            f32 estimate = importance(aabb { position, position }, c.power, p, n);
+            f32 error = nodes[node].count == 1 ? 0.0f : bound(nodes[node].bounds, c.power, p, n);
+            cut[size++] = { node, no_id, estimate, error };
+        };
+        auto push_light = [&](u32 light) {
+            cut[size++] = { no_id, light, importance(m_lights[light], p, n), 0.0f };
+        };
+
+        push_node(0);
+        while (true) {
+            usize worst = 0;
+            f32 total = 0.0f;
+            for (usize i = 0; i < size; i++) {
+                total += cut[i].estimate;
+                if (cut[i].error > cut[worst].error) {
+                    worst = i;
+                }
+            }
+            if (cut[worst].error <= max_error * total) {
+                break;
+            }
+            auto const& node = nodes[cut[worst].node];
+            u32 expansion = node.isLeaf() ? node.count : 2;
+            if (size - 1 + expansion > capacity) {
+                break;
+            }
+            cut[worst] = cut[--size];
+            if (node.isLeaf()) {
+                for (u32 k = node.offset; k < node.offset + node.count; k++) {
+                    push_light(indices[k]);
+                }
+            } else {
+                push_node(node.offset);
+                push_node(node.offset + 1);
+            }
+        }
+
+        for (usize i = 0; i < size; i++) {
+            if (cut[i].light != no_id) {
+                out[i] = m_lights[cut[i].light];
+            } else {
+                auto const& c = m_clusters[cut[i].node];
+                out[i] = point_light(m_lights[c.representative].position, c.intensity);
+            }
+        }
+        return size;
+    }
+
+    [[nodiscard]] std::span<point_light const> lights() const
+    {
+        return m_lights;
+    }
+
+    [[nodiscard]] bvh_view view() const
+    {
+        return m_bvh.view();
+    }
+
+private:
+    static constexpr f32 one_minus_epsilon = 1.0f - std::numeric_limits<f32>::epsilon() / 2.0f;
+
+    struct light_cluster {
+        vec3 intensity = zero<vec3>;
+        f32 power = 0.0f;
+        // Brightest light in the subtree.
+        u32 representative = 0;
+    };
+
+    std::vector<point_light> m_lights;
+    Bvh m_bvh;
+    // Parallel to the BVH nodes.
+    std::vector<light_cluster> m_clusters;
+
+    static f32 power(vec3 const& intensity)
+    {
+        return 0.2126f * intensity.x + 0.7152f * intensity.y + 0.0722f * intensity.z;
+    }
+
+    void add(light_cluster& c, u32 light, vec3 const& intensity) const
+    {
+        if (c.power == 0.0f || power(m_lights[light].intensity) > power(m_lights[c.representative].intensity)) {
+            c.representative = light;
+        }
+        c.intensity = c.intensity + intensity;
+        c.power += power(intensity);
+    }
+
+    // False when the whole box lies below the surface at `p`.
+    static bool facing(aabb const& b, vec3 const& p, vec3 const& n)
+    {
+        if (n == zero<vec3>) {
+            return true;
+        }
+        for (usize i = 0; i < 8; i++) {
+            auto corner = vec3(i & 1 ? b.max.x : b.min.x, i & 2 ? b.max.y : b.min.y, i & 4 ? b.max.z : b.min.z);
+            if (dot(corner - p, n) > 0.0f) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Power over squared distance to the box center, with the distance
+    // clamped to the box radius so nearby clusters aren't overrated.
+    static f32 importance(aabb const& b, f32 power, vec3 const& p, vec3 const& n)
+    {
+        if (!facing(b, p, n)) {
+            return 0.0f;
+        }
+        f32 radius_squared = b.extent().lengthSquared() * 0.25f;
+        f32 d2 = std::max({ (b.centroid() - p).lengthSquared(), radius_squared, 1e-6f });
+        return power / d2;
+    }
+
+    static f32 importance(point_light const& light, vec3 const& p, vec3 const& n)
+    {
+        return importance(aabb { light.position, light.position }, power(light.intensity), p, n);
+    }
+
+    f32 importance(u32 node, vec3 const& p, vec3 const& n) const
+    {
+        return importance(m_bvh.nodes()[node].bounds, m_clusters[node].power, p, n);
+    }
+
+    // Upper bound on a subtree's contribution, and so on the error of
+    // replacing it with one light: the whole power at the box's closest
+    // point.
+    static f32 bound(aabb const& b, f32 power, vec3 const& p, vec3 const& n)
+    {
+        if (!facing(b, p, n)) {
+            return 0.0f;
+        }
+        auto closest = vec3(std::clamp(p.x, b.min.x, b.max.x), std::clamp(p.y, b.min.y, b.max.y), std::clamp(p.z, b.min.z, b.max.z));
+        return power / std::max((closest - p).lengthSquared(), 1e-6f);
+    }
+};
+} // namespace raytracer
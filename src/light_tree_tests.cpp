@@ -0,0 +1,121 @@
+import boost.ut;
+import raytracer;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+
+namespace {
+std::vector<point_light> randomLights(u32 count)
+{
+    std::mt19937 rng(17);
+    std::uniform_real_distribution<f32> position(-50.0f, 50.0f);
+    std::uniform_real_distribution<f32> intensity(0.1f, 1.0f);
+    std::vector<point_light> lights(count);
+    for (auto& light : lights) {
+        light = point_light(
+            vec3(position(rng), position(rng), position(rng)),
+            vec3(intensity(rng), intensity(rng), intensity(rng)));
+    }
+    return lights;
+}
+
+f32 power(vec3 const& intensity)
+{
+    return 0.2126f * intensity.x + 0.7152f * intensity.y + 0.0722f * intensity.z;
+}
+
+// Unshadowed irradiance-like sum the tree approximates.
+f32 contribution(point_light const& light, vec3 const& p, vec3 const& n)
+{
+    auto to_light = light.position - p;
+    if (dot(to_light, n) <= 0.0f) {
+        return 0.0f;
+    }
+    return power(light.intensity) / to_light.lengthSquared();
+}
+
+f32 exactSum(std::span<point_light const> lights, vec3 const& p, vec3 const& n)
+{
+    f32 sum = 0.0f;
+    for (auto const& light : lights) {
+        sum += contribution(light, p, n);
+    }
+    return sum;
+}
+} // namespace
+
+int main()
+{
+    auto p = vec3(0, -40, 0);
+    auto n = unit_y<vec3>;
+
+    feature("Sampling lights from the tree") = [&] {
+        auto lights = randomLights(5000);
+        LightTree tree(lights);
+
+        then("The estimate converges to the sum over all lights") = [&] {
+            constexpr u32 samples = 50000;
+            f64 estimate = 0.0;
+            for (u32 i = 0; i < samples; i++) {
+                auto s = tree.sample(p, n, (f32(i) + 0.5f) / samples);
+                expect(s.has_value());
+                if (s) {
+                    expect(s->pdf > 0.0f);
+                    estimate += contribution(lights[s->light], p, n) / s->pdf;
+                }
+            }
+            estimate /= samples;
+            auto exact = exactSum(lights, p, n);
+            expect(std::abs(estimate - exact) < 0.02 * exact) << estimate << exact;
+        };
+
+        then("Lights below the surface are never picked") = [&] {
+            for (u32 i = 0; i < 1000; i++) {
+                auto s = tree.sample(p, n, f32(i) / 1000.0f);
+                expect(s.has_value() && lights[s->light].position.y > p.y);
+            }
+        };
+
+        then("An empty tree has nothing to sample") = [&] {
+            LightTree empty;
+            expect(!empty.sample(p, n, 0.5f).has_value());
+        };
+    };
+
+    feature("Clustering lights") = [&] {
+        given("Fewer lights than the cut can hold") = [&] {
+            auto lights = randomLights(40);
+            LightTree tree(lights);
+            std::array<point_light, LightTree::max_cut_size> cut;
+            auto count = tree.cluster(p, n, 0.0f, cut);
+
+            then("An exact cut lists every contributing light") = [&] {
+                f32 sum = 0.0f;
+                for (usize i = 0; i < count; i++) {
+                    sum += contribution(cut[i], p, n);
+                }
+                auto exact = exactSum(lights, p, n);
+                expect(std::abs(sum - exact) < 1e-4f * exact);
+            };
+        };
+
+        given("Thousands of lights") = [&] {
+            auto lights = randomLights(20000);
+            LightTree tree(lights);
+            std::array<point_light, LightTree::max_cut_size> cut;
+            auto count = tree.cluster(p, n, 0.01f, cut);
+
+            then("A bounded cut approximates the sum") = [&] {
+                expect(count > 1u && count <= LightTree::max_cut_size);
+                f32 sum = 0.0f;
+                for (usize i = 0; i < count; i++) {
+                    sum += contribution(cut[i], p, n);
+                }
+                auto exact = exactSum(lights, p, n);
+                expect(std::abs(sum - exact) < 0.1f * exact) << sum << exact;
+            };
+        };
+    };
+}
@@ -0,0 +1,243 @@
+export module raytracer.material;
+
+import raytracer.constants;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+// Material::texture for an untextured material.
+constexpr u32 no_texture = std::numeric_limits<u32>::max();
+
+struct material {
+    vec3 color = one<vec3>;
+    f32 ambient = 0.1f,
+        diffuse = 0.9f,
+        specular = 0.9f,
+        shininess = 200.0f;
+    // Fractions of light carried by the mirror and the refracted ray.
+    f32 reflective = 0.0f,
+        transparency = 0.0f,
+        refractive_index = 1.0f;
+    // Id in the scene's TextureCache whose colour multiplies `color` at
+    // the hit's texture coordinates.
+    u32 texture = no_texture;
+
+    bool operator==(material const&) const = default;
+};
+
+// Phong specular falloff x^shininess sampled over the cosines where it is
+// still visible. Below the cutoff the table reads zero; above it, linear
+// interpolation keeps the error within a few 1e-4 even for very glossy
+// materials, since the samples crowd together as shininess grows.
+class SpecularTable {
+public:
+    static constexpr usize size = 256;
+    // Cosines whose falloff is below this read as zero.
+    static constexpr f32 cutoff = 1e-4f;
+
+    explicit SpecularTable(f32 shininess)
+        : m_shininess(shininess)
+        , m_min(shininess > 0.0f ? std::pow(cutoff, 1.0f / shininess) : 0.0f)
+        , m_scale(f32(size) / (1.0f - m_min))
+    {
+        for (usize i = 0; i <= size; i++) {
+            m_values[i] = std::pow(m_min + f32(i) / m_scale, shininess);
+        }
+    }
+
+    // x^shininess for x in [0, 1], clamped outside it; branch-free so
+    // batches vectorize.
+    [[nodiscard]] f32 operator()(f32 x) const
+    {
+        // NaN reads position 0 and then zero.
+        f32 t = (x - m_min) * m_scale;
+        t = t > 0.0f ? std::min(t, f32(size)) : 0.0f;
+        auto i = std::min(static_cast<usize>(t), size - 1);
+        f32 f = t - f32(i);
+        f32 value = m_values[i] + (m_values[i + 1] - m_values[i]) * f;
+        return x >= m_min ? value : 0.0f;
+    }
+
+    [[nodiscard]] f32 shininess() const
+    {
+        return m_shininess;
+    }
+
+private:
+    f32 m_shininess;
+    f32 m_min;
+    f32 m_scale;
+    std::array<f32, size + 1> m_values;
+};
+
+// Materials stored once each, one array per parameter, and referred to by
+// id. Objects sharing a material share its id, and shading can gather a
+// parameter for many hits from one contiguous array. Each material also
+// gets its SpecularTable as it is added, shared with the others of the
+// same shininess. A new registry holds just the default material, as
+// default_material, which objects start with.
+class MaterialRegistry {
+public:
+    static constexpr u32 default_material = 0;
+
+    MaterialRegistry()
+    {
+        clear();
+    }
+
+    // Id of `m`, adding it if no identical material is registered.
+    u32 add(material const& m)
+    {
+        auto [it, inserted] = m_ids.try_emplace(m, static_cast<u32>(size()));
+        if (inserted) {
+            append(m);
+        }
+        return it->second;
+    }
+
+    // Changes material `id` for everything that uses it.
+    void set(u32 id, material const& m)
+    {
+        auto old = get(id);
+        if (auto it = m_ids.find(old); it != m_ids.end() && it->second == id) {
+            m_ids.erase(it);
+        }
+        m_ids.try_emplace(m, id);
+        m_red[id] = m.color.x;
+        m_green[id] = m.color.y;
+        m_blue[id] = m.color.z;
+        m_ambient[id] = m.ambient;
+        m_diffuse[id] = m.diffuse;
+        m_specular[id] = m.specular;
+        m_shininess[id] = m.shininess;
+        m_reflective[id] = m.reflective;
+        m_transparency[id] = m.transparency;
+        m_refractive_index[id] = m.refractive_index;
+        m_texture[id] = m.texture;
+        m_specular_tables[id] = tableFor(m.shininess);
+    }
+
+    [[nodiscard]] material get(u32 id) const
+    {
+        material m;
+        m.color = vec3(m_red[id], m_green[id], m_blue[id]);
+        m.ambient = m_ambient[id];
+        m.diffuse = m_diffuse[id];
+        m.specular = m_specular[id];
+        m.shininess = m_shininess[id];
+        m.reflective = m_reflective[id];
+        m.transparency = m_transparency[id];
+        m.refractive_index = m_refractive_index[id];
+        m.texture = m_texture[id];
+        return m;
+    }
+
+    // Replaces every material, keeping the given order as the ids, e.g.
+    // for a loaded scene. An empty list leaves just the default.
+    void assign(std::span<material const> materials)
+    {
+        reset();
+        for (auto const& m : materials) {
+            m_ids.try_emplace(m, static_cast<u32>(size()));
+            append(m);
+        }
+        if (materials.empty()) {
+            add(material());
+        }
+    }
+
+    // Drops every material but the default.
+    void clear()
+    {
+        reset();
+        add(material());
+    }
+
+    [[nodiscard]] usize size() const
+    {
+        return m_red.size();
+    }
+
+    [[nodiscard]] std::span<f32 const> red() const { return m_red; }
+    [[nodiscard]] std::span<f32 const> green() const { return m_green; }
+    [[nodiscard]] std::span<f32 const> blue() const { return m_blue; }
+    [[nodiscard]] std::span<f32 const> ambient() const { return m_ambient; }
+    [[nodiscard]] std::span<f32 const> diffuse() const { return m_diffuse; }
+    [[nodiscard]] std::span<f32 const> specular() const { return m_specular; }
+    [[nodiscard]] std::span<f32 const> shininess() const { return m_shininess; }
+    [[nodiscard]] std::span<f32 const> reflective() const { return m_reflective; }
+    [[nodiscard]] std::span<f32 const> transparency() const { return m_transparency; }
+    [[nodiscard]] std::span<f32 const> refractiveIndex() const { return m_refractive_index; }
+    [[nodiscard]] std::span<u32 const> texture() const { return m_texture; }
+
+    // Falloff table for material `id`'s shininess, read without locking.
+    [[nodiscard]] SpecularTable const& specularTable(u32 id) const
+    {
+        return *m_specular_tables[id];
+    }
+
+private:
+    struct material_hash {
+        usize operator()(material const& m) const
+        {
+            usize h = 0;
+            for (f32 x : { m.color.x, m.color.y, m.color.z, m.ambient, m.diffuse, m.specular, m.shininess, m.reflective, m.transparency, m.refractive_index }) {
+                h = h * 0x9e3779b97f4a7c15ull + std::hash<f32> {}(x);
+            }
+            return h * 0x9e3779b97f4a7c15ull + m.texture;
+        }
+    };
+
+    std::vector<f32> m_red;
+    std::vector<f32> m_green;
+    std::vector<f32> m_blue;
+    std::vector<f32> m_ambient;
+    std::vector<f32> m_diffuse;
+    std::vector<f32> m_specular;
+    std::vector<f32> m_shininess;
+    std::vector<f32> m_reflective;
+    std::vector<f32> m_transparency;
+    std::vector<f32> m_refractive_index;
+    std::vector<u32> m_texture;
+    std::unordered_map<material, u32, material_hash> m_ids;
+    std::vector<std::shared_ptr<SpecularTable const>> m_specular_tables;
+    // Every table built so far, by shininess.
+    std::unordered_map<f32, std::shared_ptr<SpecularTable const>> m_tables;
+
+    std::shared_ptr<SpecularTable const> tableFor(f32 shininess)
+    {
+        auto& table = m_tables[shininess];
+        if (!table) {
+            table = std::make_shared<SpecularTable const>(shininess);
+        }
+        return table;
+    }
+
+    void reset()
+    {
+        m_ids.clear();
+        for (auto* column : { &m_red, &m_green, &m_blue, &m_ambient, &m_diffuse, &m_specular, &m_shininess, &m_reflective, &m_transparency, &m_refractive_index }) {
+            column->clear();
+        }
+        m_texture.clear();
+        m_specular_tables.clear();
+    }
+
+    void append(material const& m)
+    {
+        m_red.push_back(m.color.x);
+        m_green.push_back(m.color.y);
+        m_blue.push_back(m.color.z);
+        m_ambient.push_back(m.ambient);
+        m_diffuse.push_back(m.diffuse);
+        m_specular.push_back(m.specular);
+        m_shininess.push_back(m.shininess);
+        m_reflective.push_back(m.reflective);
+        m_transparency.push_back(m.transparency);
+        m_refractive_index.push_back(m.refractive_index);
+        m_texture.push_back(m.texture);
+        m_specular_tables.push_back(tableFor(m.shininess));
+    }
+};
+} // namespace raytracer
@@ -0,0 +1,64 @@
+import boost.ut;
+import raytracer;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+
+int main()
+{
+    feature("Registering materials") = [] {
+        MaterialRegistry registry;
+        material red;
+        red.color = vec3(1, 0, 0);
+        material glossy;
+        glossy.shininess = 1000.0f;
+
+        then("A new registry holds the default material") = [&] {
+            expect(registry.size() == 1u);
+            expect(registry.get(MaterialRegistry::default_material) == material());
+        };
+
+        then("Identical materials share an id") = [&] {
+            auto a = registry.add(red);
+            auto b = registry.add(glossy);
+            expect(a != b);
+            expect(registry.add(red) == a);
+            expect(registry.add(material()) == MaterialRegistry::default_material);
+            expect(registry.size() == 3u);
+            expect(registry.get(a) == red && registry.get(b) == glossy);
+        };
+
+        then("Parameters live in one array each") = [&] {
+            auto id = registry.add(glossy);
+            expect(registry.shininess()[id] == 1000.0f);
+            expect(registry.red()[registry.add(red)] == 1.0f);
+            expect(registry.shininess().size() == registry.size());
+            material textured = red;
+            textured.texture = 3;
+            auto textured_id = registry.add(textured);
+            expect(textured_id != registry.add(red));
+            expect(registry.texture()[textured_id] == 3u);
+            expect(registry.texture()[registry.add(red)] == no_texture);
+        };
+
+        then("Changing a material keeps its id and is found again") = [&] {
+            auto id = registry.add(red);
+            material dark_red = red;
+            dark_red.color = vec3(0.5f, 0, 0);
+            registry.set(id, dark_red);
+            expect(registry.get(id) == dark_red);
+            expect(registry.add(dark_red) == id);
+            expect(registry.add(red) != id);
+        };
+
+        then("Assigning keeps the given order") = [&] {
+            std::array materials { glossy, red, glossy };
+            registry.assign(materials);
+            expect(registry.size() == 3u);
+            expect(registry.get(0) == glossy && registry.get(1) == red && registry.get(2) == glossy);
+            expect(registry.add(glossy) == 0u);
+        };
+    };
+}
@@ -1,7 +1,9 @@
 export module raytracer.object;
 
+import raytracer.aabb;
 import raytracer.constants;
 import raytracer.mat;
+import raytracer.material;
 import raytracer.ray;
 import raytracer.types;
 import raytracer.vec;
@@ -10,16 +12,6 @@ import std;
 export namespace raytracer {
 constexpr u32 no_id = std::numeric_limits<u32>::max();
 
-struct material {
-    vec3 color = one<vec3>;
-    f32 ambient = 0.1f,
-        diffuse = 0.9f,
-        specular = 0.9f,
-        shininess = 200.0f;
-
-    bool operator==(material const&) const = default;
-};
-
 struct point_light {
     vec3 position;
     vec3 intensity;
@@ -31,15 +23,62 @@ struct intersection;
 
 using intersections = std::unordered_set<intersection>;
 
+// Stretch of a ray inside a solid, between the entry and exit distances.
+// Unlike `intersections`, interval lists keep the entry/exit order, which
+// is what CSG combines.
+struct interval {
+    f32 t_in;
+    f32 t_out;
+    // Shape-specific surface at each end, e.g. a CSG leaf.
+    u32 surface_in = 0;
+    u32 surface_out = 0;
+};
+
 class Object {
 public:
     u32 id = no_id;
-    material material;
+    // Index into the owning scene's MaterialRegistry.
+    u32 material_id = MaterialRegistry::default_material;
 
     virtual ~Object() { }
     virtual intersections intersect(ray const& r) const = 0;
     virtual vec3 normalAt(vec3 const& p) const = 0;
 
+    // Normal at a recorded hit, for shapes that need more than the point,
+    // such as the hit triangle of an instanced mesh.
+    virtual vec3 normalAt(vec3 const& p, intersection const&) const
+    {
+        return normalAt(p);
+    }
+
+    // Texture coordinates of the surface at `p`, for a recorded hit.
+    // Shapes without a parameterization map everything to the origin.
+    virtual vec2 uvAt(vec3 const&, intersection const&) const
+    {
+        return zero<vec2>;
+    }
+
+    // Closest hit with t in (0, t_max). Shapes override this to skip
+    // building an intersections set.
+    virtual std::optional<intersection> closestHit(ray const& r, f32 t_max) const;
+
+    // Writes the ray's intervals inside this solid to `out`, sorted and
+    // disjoint, including any behind the origin, and returns how many were
+    // written. Lists longer than `out` drop their farthest intervals.
+    // Shapes that don't enclose a volume report none.
+    virtual usize intervals(ray const&, std::span<interval>) const
+    {
+        return 0;
+    }
+
+    // Object-space bounds; see worldBounds() for the transformed box.
+    virtual aabb bounds() const = 0;
+
+    aabb worldBounds() const
+    {
+        return m_transform * bounds();
+    }
+
     mat4 const& transform() const
     {
         return m_transform;
@@ -54,16 +93,46 @@ public:
     {
         m_transform = t;
         m_inverse_transform = inverse(t);
+        markDirty();
+    }
+
+    // For callers that already hold the inverse, e.g. a loaded scene cache.
+    void setTransform(mat4 const& t, mat4 const& inverse_t)
+    {
+        m_transform = t;
+        m_inverse_transform = inverse_t;
+        markDirty();
+    }
+
+    // Whether the world bounds changed since the owning pool last handed
+    // out its dirty list.
+    bool dirty() const
+    {
+        return m_dirty;
     }
 
 private:
+    friend class ObjectPool;
+
     mat4 m_transform;
     mat4 m_inverse_transform;
+    bool m_dirty = false;
+    std::vector<u32>* m_dirty_list = nullptr;
+
+    void markDirty()
+    {
+        if (!m_dirty && m_dirty_list) {
+            m_dirty = true;
+            m_dirty_list->push_back(id);
+        }
+    }
 };
 
 class ObjectPool {
 private:
     std::vector<std::unique_ptr<Object>> m_storage;
+    // Heap-allocated so objects keep a valid pointer when the pool moves.
+    std::unique_ptr<std::vector<u32>> m_dirty = std::make_unique<std::vector<u32>>();
 
 public:
     template<typename T, typename... Args>
@@ -72,19 +141,43 @@ public:
         auto obj = std::make_unique<T>(std::forward<Args>(args)...);
         T& ref = *obj;
         obj->id = m_storage.size();
+        obj->m_dirty_list = m_dirty.get();
         m_storage.push_back(std::move(obj));
         return ref;
     }
 
+    // Ids of objects whose transform changed since the last call, each
+    // listed once, in the order they were first changed.
+    std::vector<u32> takeDirty()
+    {
+        auto dirty = std::exchange(*m_dirty, {});
+        for (auto id : dirty) {
+            m_storage[id]->m_dirty = false;
+        }
+        return dirty;
+    }
+
     Object& get(u32 id)
     {
         return *m_storage[id];
     }
+
+    Object const& get(u32 id) const
+    {
+        return *m_storage[id];
+    }
+
+    usize size() const
+    {
+        return m_storage.size();
+    }
 };
 
 struct intersection {
     f32 t;
     u32 object_id;
+    // Shape-specific sub-object, e.g. a triangle index.
+    u32 primitive = 0;
 
     intersection() = delete;
 
@@ -100,6 +193,13 @@ struct intersection {
     {
     }
 
+    intersection(f32 t, u32 object_id, u32 primitive)
+        : t(t)
+        , object_id(object_id)
+        , primitive(primitive)
+    {
+    }
+
     intersection(f32 t, Object const& o)
         : t(t)
         , object_id(o.id)
@@ -122,6 +222,8 @@ struct std::hash<raytracer::intersection> {
 export namespace raytracer {
 class Sphere : public Object {
 public:
+    using Object::normalAt;
+
     virtual intersections intersect(ray const& r) const override
     {
         auto r2 = inverseTransform() * r;
@@ -138,6 +240,45 @@ public:
         return { intersection(t1, id), intersection(t2, id) };
     }
 
+    virtual std::optional<intersection> closestHit(ray const& r, f32 t_max) const override
+    {
+        auto r2 = inverseTransform() * r;
+        auto sphere_to_ray = r2.o - zero<vec3>;
+        auto a = dot(r2.d, r2.d);
+        auto b = 2 * dot(r2.d, sphere_to_ray);
+        auto c = dot(sphere_to_ray, sphere_to_ray) - 1;
+        auto discriminant = b * b - 4.0f * a * c;
+        if (discriminant < 0.0f) {
+            return {};
+        }
+        auto t1 = (-b - std::sqrt(discriminant)) / (2.0f * a);
+        auto t2 = (-b + std::sqrt(discriminant)) / (2.0f * a);
+        auto t = t1 > 0.0f ? t1 : t2;
+        if (t <= 0.0f || t >= t_max) {
+            return {};
+        }
+        return intersection(t, id);
+    }
+
+    virtual usize intervals(ray const& r, std::span<interval> out) const override
+    {
+        if (out.empty()) {
+            return 0;
+        }
+        auto r2 = inverseTransform() * r;
+        auto sphere_to_ray = r2.o - zero<vec3>;
+        auto a = dot(r2.d, r2.d);
+        auto b = 2 * dot(r2.d, sphere_to_ray);
+        auto c = dot(sphere_to_ray, sphere_to_ray) - 1;
+        auto discriminant = b * b - 4.0f * a * c;
+        if (discriminant < 0.0f) {
+            return 0;
+        }
+        out[0].t_in = (-b - std::sqrt(discriminant)) / (2.0f * a);
+        out[0].t_out = (-b + std::sqrt(discriminant)) / (2.0f * a);
+        return 1;
+    }
+
     virtual vec3 normalAt(vec3 const& p) const override
     {
         auto object_point = inverseTransform() * vec4::point(p);
@@ -146,6 +287,21 @@ public:
         world_normal.w = 0;
         return vec3(normalize(world_normal));
     }
+
+    // Spherical map: u runs once round the y axis and v from the south
+    // pole to the north one.
+    virtual vec2 uvAt(vec3 const& p, intersection const&) const override
+    {
+        auto object_point = vec3(inverseTransform() * vec4::point(p));
+        f32 theta = std::atan2(object_point.x, object_point.z);
+        f32 phi = std::acos(std::clamp(object_point.y / object_point.length(), -1.0f, 1.0f));
+        return vec2(0.5f - theta / (2.0f * pi<f32>), 1.0f - phi / pi<f32>);
+    }
+
+    virtual aabb bounds() const override
+    {
+        return { -one<vec3>, one<vec3> };
+    }
 };
 
 [[nodiscard]] std::optional<intersection> hit(intersections const& xs)
@@ -199,3 +355,14 @@ public:
     return ambient + diffuse + specular; // vec3
 }
 } // namespace raytracer
+
+namespace raytracer {
+std::optional<intersection> Object::closestHit(ray const& r, f32 t_max) const
+{
+    auto h = hit(intersect(r));
+    if (h && h->t < t_max) {
+        return h;
+    }
+    return {};
+}
+} // namespace raytracer
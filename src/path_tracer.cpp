@@ -0,0 +1,838 @@
+export module raytracer.path_tracer;
+
+import raytracer.aabb;
+import raytracer.canvas;
+import raytracer.constants;
+import raytracer.environment;
+import raytracer.light_tree;
+import raytracer.material;
+import raytracer.object;
+import raytracer.ray;
+import raytracer.render;
+import raytracer.sampler;
+import raytracer.scene;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+enum class path_tracer_mode : u32 {
+    // Each path is traced to the end before the next one starts.
+    megakernel,
+    // Paths advance together one bounce at a time through queued stages.
+    // Pays for sorting and gathering, so it wins only when traversal
+    // dominates and rays diverge, e.g. many bounces over large scenes;
+    // bench compares the two.
+    wavefront,
+};
+
+struct path_tracer_settings {
+    path_tracer_mode mode = path_tracer_mode::megakernel;
+    u32 samples_per_pixel = 16;
+    // Surface hits per path, the primary one included.
+    u32 max_depth = 4;
+    // Paths in flight at once in wavefront mode; bounds queue memory.
+    u32 wave_size = 1u << 18;
+    // Reorder rays by direction and origin before each trace.
+    bool sort_rays = true;
+    // Source of the four numbers each hit draws.
+    sampler_kind sampler = sampler_kind::sobol;
+    // Sample the scene's environment map as a light at every hit, weighed
+    // against bounces that escape to it by multiple importance sampling.
+    // Off, only escaping bounces see it.
+    bool sample_environment = true;
+    u32 seed = 0;
+};
+
+struct adaptive_settings {
+    // Samples every pixel gets in the first round.
+    u32 min_samples = 16;
+    u32 max_samples = 1024;
+    // A pixel has converged once the standard error of its mean luminance
+    // is within this fraction of the mean. Pixels darker than
+    // dark_luminance are held to that fraction of dark_luminance instead.
+    f32 target_error = 0.02f;
+    f32 dark_luminance = 0.1f;
+    // No round starts after this long; zero means no limit.
+    std::chrono::steady_clock::duration time_budget {};
+    // Side of the square tiles that are refined and stopped as one, so a
+    // pixel whose few samples happen to agree isn't stopped while its
+    // neighbours are still noisy.
+    u32 tile_size = 8;
+};
+
+struct adaptive_stats {
+    u32 rounds = 0;
+    u64 samples = 0;
+    // Tiles still short of the target when rendering stopped.
+    u32 noisy_tiles = 0;
+    bool out_of_time = false;
+};
+
+// Running statistics of the samples traced into each pixel: their sum,
+// and the count, mean and sum of squared deviations of their luminance,
+// updated with Welford's method, which tell how converged the pixel is.
+class SampleStatistics {
+public:
+    Canvas<vec3> sum;
+    // x is the sample count, y the mean luminance, z the sum of squared
+    // deviations from it.
+    Canvas<vec3> luminance;
+
+    SampleStatistics(i32 width, i32 height)
+        : sum(width, height)
+        , luminance(width, height)
+    {
+    }
+
+    void add(u32 pixel, vec3 const& radiance)
+    {
+        sum.begin()[pixel] = sum.begin()[pixel] + radiance;
+        auto& l = luminance.begin()[pixel];
+        f32 y = luminanceOf(radiance);
+        f32 delta = y - l.y;
+        l.x += 1.0f;
+        l.y += delta / l.x;
+        l.z += delta * (y - l.y);
+    }
+
+    [[nodiscard]] u32 count(u32 pixel) const
+    {
+        return static_cast<u32>(luminance.begin()[pixel].x);
+    }
+
+    [[nodiscard]] vec3 mean(u32 pixel) const
+    {
+        f32 n = luminance.begin()[pixel].x;
+        return n > 0.0f ? sum.begin()[pixel] / n : zero<vec3>;
+    }
+
+    // Standard error of the mean luminance; infinite below two samples.
+    [[nodiscard]] f32 standardError(u32 pixel) const
+    {
+        auto const& l = luminance.begin()[pixel];
+        if (l.x < 2.0f) {
+            return std::numeric_limits<f32>::infinity();
+        }
+        return std::sqrt(l.z / (l.x - 1.0f) / l.x);
+    }
+
+    // Writes each pixel's mean to `out`, which must match in size.
+    void resolve(Canvas<vec3>& out) const
+    {
+        for (u32 i = 0; i < static_cast<u32>(out.size()); i++) {
+            out.begin()[i] = mean(i);
+        }
+    }
+};
+
+// Monte Carlo path tracer over the scene's Phong materials and point
+// lights. Every hit samples one light through the light tree for a shadow
+// ray and, unless it is the last, continues the path through the diffuse
+// or the glossy lobe. Ambient light stands in for the rest of the path at
+// the last hit only.
+//
+// Light sampling and bounces share one BRDF: the diffuse and normalized
+// Phong lobes, weighted by the probabilities bounces choose them with. A
+// point light of intensity I gives irradiance pi * I where it faces the
+// surface, so for diffuse materials with max_depth 1 the result is
+// lighting() with shadows.
+//
+// Paths that escape pick up the scene's environment map. Each hit also
+// draws a direction from the map's own distribution for a second shadow
+// ray, and the two estimates are combined with the power heuristic (Veach
+// 1997), so bright, small parts of the sky are found by light sampling
+// and glossy reflections of it by the bounces.
+//
+// The random numbers come from a stateless Sampler keyed by pixel, sample
+// index and bounce, so each bounce of a pixel's samples is one stratified
+// 4D point set with the Sobol samplers.
+//
+// Both modes trace the same paths with the same random numbers. Wavefront
+// mode keeps paths in structure-of-arrays queues and runs each stage
+// (generate, extend, shade, shadow, accumulate) over a whole queue, with
+// rays sorted for coherent traversal and hits shaded grouped by material.
+class PathTracer {
+public:
+    explicit PathTracer(path_tracer_settings const& settings = path_tracer_settings())
+        : m_settings(settings)
+    {
+    }
+
+    [[nodiscard]] path_tracer_settings const& settings() const
+    {
+        return m_settings;
+    }
+
+    // Renders into `out` with samples_per_pixel paths per pixel, each
+    // starting with `primary(row, col)`. The scene must be built. Bands of
+    // rows are traced under options.policy, each with its own queues, and
+    // `primary` is called from those threads; the other options are not
+    // used. The random numbers depend only on the pixel, sample and
+    // bounce, and each pixel sums its samples in order, so every policy
+    // gives the same image.
+    template<typename F>
+    requires std::is_invocable_r_v<ray, F const&, i32, i32>
+    void render(Scene const& scene, F const& primary, Canvas<vec3>& out, render_options const& options = render_options()) const
+    {
+        SampleStatistics statistics(out.width(), out.height());
+        frame prototype(scene, m_settings, statistics);
+        auto width = static_cast<u32>(out.width());
+        i32 height = out.height();
+        // A row at a time for the megakernel. Wavefront bands fill a wave
+        // where they can, but are cut so every thread gets some.
+        i32 band = 1;
+        if (m_settings.mode == path_tracer_mode::wavefront) {
+            u64 row_paths = std::max<u64>(u64(width) * m_settings.samples_per_pixel, 1);
+            i32 most = options.policy == execution_policy::serial ? height : std::max(height / min_bands, 1);
+            band = static_cast<i32>(std::clamp<u64>(m_settings.wave_size / row_paths, 1, u64(std::max(most, 1))));
+        }
+        forEachRow(options, 0, (height + band - 1) / band, [&](i32 b) {
+            frame f = prototype;
+            i32 first = b * band;
+            auto first_pixel = static_cast<u32>(first) * width;
+            auto pixel_count = static_cast<u32>(std::min(band, height - first)) * width;
+            u64 path_count = u64(pixel_count) * m_settings.samples_per_pixel;
+            u64 index = 0;
+            tracePaths(f, primary, [&](u32& pixel, u32& sample) {
+                if (index == path_count) {
+                    return false;
+                }
+                pixel = first_pixel + static_cast<u32>(index % pixel_count);
+                sample = static_cast<u32>(index / pixel_count);
+                index++;
+                return true;
+            });
+        });
+        statistics.resolve(out);
+    }
+
+    // Renders in rounds, spending samples where the image is still noisy;
+    // samples_per_pixel is not used. The first round brings every pixel
+    // to min_samples. After each round, a tile whose noisiest pixel
+    // misses the target gets as many more samples as its error predicts
+    // it needs, error falling with the square root of the count, but no
+    // more than it already has, in case the estimate was unlucky, and
+    // never past max_samples. Rendering stops once no tile wants more or
+    // the time budget, checked between rounds, is spent; the first round
+    // always runs.
+    //
+    // Samples add to `statistics`, which must match `out` in size, so a
+    // finished render can be resumed with a tighter target.
+    template<typename F>
+    requires std::is_invocable_r_v<ray, F const&, i32, i32>
+    adaptive_stats renderAdaptive(
+        Scene const& scene,
+        F const& primary,
+        adaptive_settings const& adaptive,
+        SampleStatistics& statistics,
+        Canvas<vec3>& out) const
+    {
+        auto started = std::chrono::steady_clock::now();
+        adaptive_stats stats;
+        frame f(scene, m_settings, statistics);
+        auto width = static_cast<u32>(out.width());
+        auto height = static_cast<u32>(out.height());
+        u32 tile_size = std::max(adaptive.tile_size, 1u);
+        u32 tiles_x = (width + tile_size - 1) / tile_size;
+        u32 tile_count = tiles_x * ((height + tile_size - 1) / tile_size);
+        u32 min_samples = std::max(adaptive.min_samples, 2u);
+        u32 max_samples = std::max(adaptive.max_samples, min_samples);
+        auto tileAt = [&](u32 tile) {
+            u32 x = tile % tiles_x * tile_size;
+            u32 y = tile / tiles_x * tile_size;
+            return uvec4(x, y, std::min(tile_size, width - x), std::min(tile_size, height - y));
+        };
+
+        std::vector<u32> extra(tile_count);
+        std::vector<u32> active;
+        std::vector<u32> base(out.size());
+        while (true) {
+            // Plan the round.
+            active.clear();
+            stats.noisy_tiles = 0;
+            for (u32 tile = 0; tile < tile_count; tile++) {
+                auto rect = tileAt(tile);
+                u32 n = std::numeric_limits<u32>::max();
+                f32 ratio = 0.0f;
+                for (u32 y = rect.y; y < rect.y + rect.w; y++) {
+                    for (u32 x = rect.x; x < rect.x + rect.z; x++) {
+                        u32 pixel = y * width + x;
+                        f32 target = adaptive.target_error * std::max(luminanceOf(statistics.mean(pixel)), adaptive.dark_luminance);
+                        n = std::min(n, statistics.count(pixel));
+                        ratio = std::max(ratio, statistics.standardError(pixel) / target);
+                    }
+                }
+                stats.noisy_tiles += !(ratio <= 1.0f);
+                if (n < min_samples) {
+                    extra[tile] = min_samples - n;
+                } else if (ratio <= 1.0f || n >= max_samples) {
+                    extra[tile] = 0;
+                } else {
+                    u32 cap = std::min(n, max_samples - n);
+                    f32 needed = f32(n) * (ratio * ratio - 1.0f);
+                    extra[tile] = needed >= f32(cap) ? cap : std::max(1u, static_cast<u32>(std::ceil(needed)));
+                }
+                if (extra[tile] != 0) {
+                    active.push_back(tile);
+                }
+            }
+            if (active.empty()) {
+                break;
+            }
+            if (stats.rounds != 0 && adaptive.time_budget.count() != 0 && std::chrono::steady_clock::now() - started >= adaptive.time_budget) {
+                stats.out_of_time = true;
+                break;
+            }
+
+            // Trace it: the s-th new sample of every active tile, then the
+            // next, so each tile's samples stay in index order.
+            std::ranges::stable_sort(active, std::greater(), [&](u32 tile) { return extra[tile]; });
+            for (u32 i = 0; i < base.size(); i++) {
+                base[i] = statistics.count(i);
+            }
+            u32 s = 0;
+            usize t = 0;
+            u32 i = 0;
+            tracePaths(f, primary, [&](u32& pixel, u32& sample) {
+                while (true) {
+                    if (t == active.size() || extra[active[t]] <= s) {
+                        s++, t = 0, i = 0;
+                        if (extra[active[0]] <= s) {
+                            return false;
+                        }
+                        continue;
+                    }
+                    auto rect = tileAt(active[t]);
+                    if (i == rect.z * rect.w) {
+                        t++, i = 0;
+                        continue;
+                    }
+                    pixel = (rect.y + i / rect.z) * width + rect.x + i % rect.z;
+                    sample = base[pixel] + s;
+                    i++;
+                    stats.samples++;
+                    return true;
+                }
+            });
+            stats.rounds++;
+        }
+        statistics.resolve(out);
+        return stats;
+    }
+
+private:
+    // Offset along the normal that keeps secondary rays off their surface.
+    static constexpr f32 ray_bias = 1e-4f;
+    // Cells per axis of the grid paths are binned by before tracing.
+    static constexpr u32 sort_grid = 16;
+    // Fewest bands render() splits an image into in wavefront mode when
+    // it runs on several threads.
+    static constexpr i32 min_bands = 16;
+    // Sampler groups for environment samples start here, clear of any
+    // bounce's.
+    static constexpr u32 environment_groups = 1u << 16;
+
+    path_tracer_settings m_settings;
+
+    struct path {
+        vec3 origin;
+        vec3 direction;
+        vec3 throughput;
+        u32 pixel;
+        u32 sample;
+        u32 bounce;
+        // Where the path's radiance collects in frame::samples.
+        u32 slot;
+        // Solid-angle density the direction was drawn with; 0 for
+        // primary rays.
+        f32 pdf;
+    };
+
+    struct shadow_ray {
+        ray r;
+        f32 t_max;
+        vec3 contribution;
+        u32 slot;
+    };
+
+    // Per-render state shared by both modes; each band of rows traces
+    // with its own copy.
+    struct frame {
+        Scene const& scene;
+        path_tracer_settings const& settings;
+        Sampler sampler;
+        SampleStatistics& statistics;
+        u32 width;
+        // Sum of light intensities, which lighting() applies ambient to.
+        vec3 ambient_light = zero<vec3>;
+        aabb bounds;
+        // Radiance of the paths in flight, by slot, and their pixels.
+        std::vector<vec3> samples;
+        std::vector<u32> sample_pixels;
+
+        frame(Scene const& scene, path_tracer_settings const& settings, SampleStatistics& statistics)
+            : scene(scene)
+            , settings(settings)
+            , sampler(settings.sampler, settings.seed)
+            , statistics(statistics)
+            , width(static_cast<u32>(statistics.sum.width()))
+        {
+            for (auto const& light : scene.lights) {
+                ambient_light = ambient_light + light.intensity;
+            }
+            for (auto const& b : scene.objectBounds()) {
+                bounds = merge(bounds, b);
+            }
+        }
+    };
+
+    // One array per field, so each stage streams only what it touches.
+    struct path_queue {
+        std::vector<f32> ox, oy, oz;
+        std::vector<f32> dx, dy, dz;
+        std::vector<f32> tr, tg, tb;
+        std::vector<u32> pixel, sample, bounce, slot;
+        std::vector<f32> pdf;
+
+        [[nodiscard]] usize size() const { return pixel.size(); }
+
+        void clear()
+        {
+            for (auto* column : { &ox, &oy, &oz, &dx, &dy, &dz, &tr, &tg, &tb, &pdf }) {
+                column->clear();
+            }
+            pixel.clear();
+            sample.clear();
+            bounce.clear();
+            slot.clear();
+        }
+
+        void push(path const& p)
+        {
+            ox.push_back(p.origin.x), oy.push_back(p.origin.y), oz.push_back(p.origin.z);
+            dx.push_back(p.direction.x), dy.push_back(p.direction.y), dz.push_back(p.direction.z);
+            tr.push_back(p.throughput.x), tg.push_back(p.throughput.y), tb.push_back(p.throughput.z);
+            pixel.push_back(p.pixel);
+            sample.push_back(p.sample);
+            bounce.push_back(p.bounce);
+            slot.push_back(p.slot);
+            pdf.push_back(p.pdf);
+        }
+
+        [[nodiscard]] path get(usize i) const
+        {
+            path p;
+            p.origin = vec3(ox[i], oy[i], oz[i]);
+            p.direction = vec3(dx[i], dy[i], dz[i]);
+            p.throughput = vec3(tr[i], tg[i], tb[i]);
+            p.pixel = pixel[i];
+            p.sample = sample[i];
+            p.bounce = bounce[i];
+            p.slot = slot[i];
+            p.pdf = pdf[i];
+            return p;
+        }
+
+        [[nodiscard]] ray rayAt(usize i) const
+        {
+            return ray(vec3(ox[i], oy[i], oz[i]), vec3(dx[i], dy[i], dz[i]));
+        }
+    };
+
+    struct shadow_queue {
+        std::vector<f32> ox, oy, oz;
+        std::vector<f32> dx, dy, dz;
+        std::vector<f32> t_max;
+        std::vector<f32> cr, cg, cb;
+        std::vector<u32> slot;
+
+        [[nodiscard]] usize size() const { return slot.size(); }
+
+        void clear()
+        {
+            for (auto* column : { &ox, &oy, &oz, &dx, &dy, &dz, &t_max, &cr, &cg, &cb }) {
+                column->clear();
+            }
+            slot.clear();
+        }
+
+        void push(shadow_ray const& s)
+        {
+            ox.push_back(s.r.o.x), oy.push_back(s.r.o.y), oz.push_back(s.r.o.z);
+            dx.push_back(s.r.d.x), dy.push_back(s.r.d.y), dz.push_back(s.r.d.z);
+            t_max.push_back(s.t_max);
+            cr.push_back(s.contribution.x), cg.push_back(s.contribution.y), cb.push_back(s.contribution.z);
+            slot.push_back(s.slot);
+        }
+    };
+
+    struct queues {
+        path_queue paths;
+        path_queue next;
+        path_queue scratch;
+        shadow_queue shadows;
+        // Closest hit of each queued path; t is infinite on a miss.
+        std::vector<intersection> hits;
+        std::vector<u32> order;
+        std::vector<u32> keys;
+        std::vector<u32> offsets;
+    };
+
+    // Tangent and bitangent completing `n` to an orthonormal basis
+    // (Duff et al. 2017).
+    static std::pair<vec3, vec3> basis(vec3 const& n)
+    {
+        f32 sign = std::copysign(1.0f, n.z);
+        f32 a = -1.0f / (sign + n.z);
+        f32 b = n.x * n.y * a;
+        return { vec3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x), vec3(b, sign + n.y * n.y * a, -n.y) };
+    }
+
+    // Direction around `axis` with density proportional to cos^exponent.
+    static vec3 sampleLobe(vec3 const& axis, f32 exponent, f32 u1, f32 u2)
+    {
+        f32 cos_theta = std::pow(u1, 1.0f / (exponent + 1.0f));
+        f32 sin_theta = std::sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+        f32 phi = 2.0f * pi<f32> * u2;
+        auto [t, b] = basis(axis);
+        return normalize(t * (std::cos(phi) * sin_theta) + b * (std::sin(phi) * sin_theta) + axis * cos_theta);
+    }
+
+    // Probabilities of continuing through the diffuse and the glossy lobe.
+    // They follow the albedos, scaled down when diffuse and specular add up
+    // past one so that bounces never add energy; the rest is absorbed.
+    static std::pair<f32, f32> lobeProbabilities(material const& m)
+    {
+        f32 scale = 1.0f / std::max(1.0f, m.diffuse + m.specular);
+        return { m.diffuse * scale, m.specular * scale };
+    }
+
+    // Value and solid-angle density of the scattering scatter() samples,
+    // from direction `incoming` into `outgoing` at a surface facing
+    // against `incoming`.
+    static std::pair<vec3, f32> scattering(material const& m, vec3 const& incoming, vec3 const& facing, vec3 const& outgoing)
+    {
+        f32 cos_theta = dot(outgoing, facing);
+        if (cos_theta <= 0.0f) {
+            return { zero<vec3>, 0.0f };
+        }
+        auto [p_diffuse, p_specular] = lobeProbabilities(m);
+        f32 lobe = std::pow(std::max(0.0f, dot(outgoing, reflect(incoming, facing))), m.shininess) / (2.0f * pi<f32>);
+        auto value = m.color * (p_diffuse / pi<f32>) + vec3(p_specular * (m.shininess + 2.0f) * lobe);
+        f32 pdf = p_diffuse * cos_theta / pi<f32> + p_specular * (m.shininess + 1.0f) * lobe;
+        return { value, pdf };
+    }
+
+    static f32 powerHeuristic(f32 pdf, f32 other_pdf)
+    {
+        return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
+    }
+
+    // Adds what escaping path `p` sees of the environment.
+    static void escape(frame& f, path const& p)
+    {
+        if (!f.scene.environment) {
+            return;
+        }
+        auto const& environment = *f.scene.environment;
+        f32 weight = 1.0f;
+        if (p.pdf > 0.0f && f.settings.sample_environment) {
+            weight = powerHeuristic(p.pdf, environment.pdf(p.direction));
+        }
+        f.samples[p.slot] = f.samples[p.slot] + p.throughput * environment.radiance(p.direction) * weight;
+    }
+
+    // Shades hit `h` of `p`: adds ambient light at the last hit, appends
+    // shadow rays for one sampled light and the environment to `shadows`
+    // if they can contribute, and turns `p` into its next segment. Returns
+    // whether the path goes on. The same samples are drawn whatever
+    // happens, so paths stay in step across modes.
+    static bool scatter(frame& f, path& p, intersection const& h, bool last, std::vector<shadow_ray>& shadows)
+    {
+        auto pixel = uvec2(p.pixel % f.width, p.pixel / f.width);
+        u32 group = p.bounce++;
+        auto u = f.sampler.get4D(pixel, p.sample, group);
+        f32 u_light = u.x;
+        f32 u_lobe = u.y;
+        f32 u1 = u.z;
+        f32 u2 = u.w;
+
+        auto const& object = f.scene.objects.get(h.object_id);
+        auto m = f.scene.materials.get(object.material_id);
+        auto point = p.origin + p.direction * h.t;
+        auto normal = object.normalAt(point, h);
+        auto eye = -p.direction;
+        auto facing = dot(normal, eye) < 0.0f ? -normal : normal;
+
+        if (last) {
+            f.samples[p.slot] = f.samples[p.slot] + p.throughput * m.color * f.ambient_light * m.ambient;
+        }
+
+        shadows.clear();
+        if (auto s = f.scene.lightTree().sample(point, facing, u_light)) {
+            auto const& light = f.scene.lightTree().lights()[s->light];
+            auto origin = point + facing * ray_bias;
+            auto to_light = light.position - origin;
+            f32 distance = to_light.length();
+            auto direction = to_light / distance;
+            // The BRDF the bounces sample, under a light that gives
+            // irradiance pi * intensity; see the class comment.
+            auto value = scattering(m, p.direction, facing, direction).first;
+            auto direct = light.intensity * value * (pi<f32> * dot(direction, facing));
+            if (direct != zero<vec3>) {
+                shadow_ray r;
+                r.r = ray(origin, direction);
+                r.t_max = distance;
+                r.contribution = p.throughput * direct / s->pdf;
+                r.slot = p.slot;
+                shadows.push_back(r);
+            }
+        }
+
+        if (f.scene.environment && f.settings.sample_environment) {
+            auto v = f.sampler.get4D(pixel, p.sample, environment_groups + group);
+            auto s = f.scene.environment->sample(vec2(v.x, v.y));
+            auto [value, pdf] = scattering(m, p.direction, facing, s.direction);
+            if (s.pdf > 0.0f && pdf > 0.0f) {
+                // The last hit has no bounce to share the estimate with.
+                f32 weight = last ? 1.0f : powerHeuristic(s.pdf, pdf);
+                auto contribution = p.throughput * value * s.radiance * (dot(s.direction, facing) / s.pdf * weight);
+                if (contribution != zero<vec3>) {
+                    shadow_ray r;
+                    r.r = ray(point + facing * ray_bias, s.direction);
+                    r.t_max = std::numeric_limits<f32>::infinity();
+                    r.contribution = contribution;
+                    r.slot = p.slot;
+                    shadows.push_back(r);
+                }
+            }
+        }
+
+        if (last) {
+            return false;
+        }
+        auto [p_diffuse, p_specular] = lobeProbabilities(m);
+        vec3 direction;
+        if (u_lobe < p_diffuse) {
+            direction = sampleLobe(facing, 1.0f, u1, u2);
+            p.throughput = p.throughput * m.color;
+        } else if (u_lobe < p_diffuse + p_specular) {
+            direction = sampleLobe(reflect(p.direction, facing), m.shininess, u1, u2);
+            f32 cos_theta = dot(direction, facing);
+            if (cos_theta <= 0.0f) {
+                return false;
+            }
+            // Normalized Phong over its sampling density.
+            p.throughput = p.throughput * ((m.shininess + 2.0f) / (m.shininess + 1.0f) * cos_theta);
+        } else {
+            return false;
+        }
+        p.origin = point + facing * ray_bias;
+        p.direction = direction;
+        p.pdf = scattering(m, -eye, facing, direction).second;
+        return true;
+    }
+
+    // Traces a path for every (pixel, sample) that `next` yields, until
+    // it returns false, and adds each path's radiance to the statistics.
+    template<typename F, typename G>
+    void tracePaths(frame& f, F const& primary, G&& next) const
+    {
+        u32 pixel = 0;
+        u32 sample = 0;
+        auto start = [&](u32 slot) {
+            auto r = primary(static_cast<i32>(pixel / f.width), static_cast<i32>(pixel % f.width));
+            path p;
+            p.origin = r.o;
+            p.direction = normalize(r.d);
+            p.throughput = one<vec3>;
+            p.pixel = pixel;
+            p.sample = sample;
+            p.bounce = 0;
+            p.slot = slot;
+            p.pdf = 0.0f;
+            return p;
+        };
+
+        if (m_settings.mode == path_tracer_mode::megakernel) {
+            f.samples.assign(1, zero<vec3>);
+            while (next(pixel, sample)) {
+                f.samples[0] = zero<vec3>;
+                tracePath(f, start(0));
+                f.statistics.add(pixel, f.samples[0]);
+            }
+            return;
+        }
+        queues q;
+        usize wave_size = std::max(m_settings.wave_size, 1u);
+        for (bool more = true; more;) {
+            q.paths.clear();
+            f.samples.clear();
+            f.sample_pixels.clear();
+            while (q.paths.size() < wave_size && (more = next(pixel, sample))) {
+                q.paths.push(start(static_cast<u32>(q.paths.size())));
+                f.samples.push_back(zero<vec3>);
+                f.sample_pixels.push_back(pixel);
+            }
+            traceWave(f, q);
+            for (usize slot = 0; slot < f.samples.size(); slot++) {
+                f.statistics.add(f.sample_pixels[slot], f.samples[slot]);
+            }
+        }
+    }
+
+    static void traceShadow(frame& f, shadow_ray const& s)
+    {
+        if (!f.scene.occluded(s.r, s.t_max)) {
+            f.samples[s.slot] = f.samples[s.slot] + s.contribution;
+        }
+    }
+
+    static void tracePath(frame& f, path p)
+    {
+        std::vector<shadow_ray> shadows;
+        for (u32 depth = 0; depth < f.settings.max_depth; depth++) {
+            auto h = f.scene.intersect(ray(p.origin, p.direction));
+            if (!h) {
+                escape(f, p);
+                return;
+            }
+            bool more = scatter(f, p, *h, depth + 1 == f.settings.max_depth, shadows);
+            for (auto const& shadow : shadows) {
+                traceShadow(f, shadow);
+            }
+            if (!more) {
+                return;
+            }
+        }
+    }
+
+    static void traceWave(frame& f, queues& q)
+    {
+        for (u32 depth = 0; depth < f.settings.max_depth && q.paths.size() != 0; depth++) {
+            if (f.settings.sort_rays && !f.bounds.empty()) {
+                sortPaths(f, q);
+            }
+            extend(f, q);
+            shade(f, q, depth + 1 == f.settings.max_depth);
+            traceShadows(f, q);
+            std::swap(q.paths, q.next);
+        }
+    }
+
+    // Bins paths by direction octant, then by the Morton order of their
+    // origin's cell in a sort_grid^3 grid over the scene bounds, so rays
+    // next to each other in the queue tend to visit the same nodes. A
+    // counting sort keeps this linear in the queue size.
+    static void sortPaths(frame const& f, queues& q)
+    {
+        auto const& paths = q.paths;
+        auto extent = f.bounds.extent();
+        auto scale = vec3(
+            extent.x > 0.0f ? f32(sort_grid) / extent.x : 0.0f,
+            extent.y > 0.0f ? f32(sort_grid) / extent.y : 0.0f,
+            extent.z > 0.0f ? f32(sort_grid) / extent.z : 0.0f);
+        auto cell = [](f32 x) {
+            return static_cast<u32>(std::clamp(x, 0.0f, f32(sort_grid - 1)));
+        };
+        constexpr u32 cells = sort_grid * sort_grid * sort_grid;
+        q.keys.resize(paths.size());
+        q.offsets.assign(8 * cells + 1, 0);
+        for (usize i = 0; i < paths.size(); i++) {
+            u32 octant = (paths.dx[i] < 0.0f ? 1u : 0u) | (paths.dy[i] < 0.0f ? 2u : 0u) | (paths.dz[i] < 0.0f ? 4u : 0u);
+            u32 morton = mortonCode(
+                cell((paths.ox[i] - f.bounds.min.x) * scale.x),
+                cell((paths.oy[i] - f.bounds.min.y) * scale.y),
+                cell((paths.oz[i] - f.bounds.min.z) * scale.z));
+            q.keys[i] = octant * cells + morton;
+            q.offsets[q.keys[i] + 1]++;
+        }
+        std::partial_sum(q.offsets.begin(), q.offsets.end(), q.offsets.begin());
+        q.order.resize(paths.size());
+        for (usize i = 0; i < paths.size(); i++) {
+            q.order[q.offsets[q.keys[i]]++] = static_cast<u32>(i);
+        }
+        q.scratch.clear();
+        for (auto i : q.order) {
+            q.scratch.push(paths.get(i));
+        }
+        std::swap(q.paths, q.scratch);
+    }
+
+    // Interleaves the low 10 bits of each coordinate.
+    static u32 mortonCode(u32 x, u32 y, u32 z)
+    {
+        auto spread = [](u32 v) {
+            v = (v | (v << 16)) & 0x030000ffu;
+            v = (v | (v << 8)) & 0x0300f00fu;
+            v = (v | (v << 4)) & 0x030c30c3u;
+            v = (v | (v << 2)) & 0x09249249u;
+            return v;
+        };
+        return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+    }
+
+    static void extend(frame const& f, queues& q)
+    {
+        q.hits.clear();
+        for (usize i = 0; i < q.paths.size(); i++) {
+            auto h = f.scene.intersect(q.paths.rayAt(i));
+            q.hits.push_back(h ? *h : intersection(std::numeric_limits<f32>::infinity()));
+        }
+    }
+
+    // Shades the hits grouped by material, queueing continuations and
+    // shadow rays. Misses see the environment and end their paths here.
+    static void shade(frame& f, queues& q, bool last)
+    {
+        auto material_count = f.scene.materials.size();
+        q.offsets.assign(material_count + 1, 0);
+        auto material_of = [&](usize i) {
+            return f.scene.objects.get(q.hits[i].object_id).material_id;
+        };
+        for (usize i = 0; i < q.hits.size(); i++) {
+            if (q.hits[i].object_id != no_id) {
+                q.offsets[material_of(i) + 1]++;
+            }
+        }
+        std::partial_sum(q.offsets.begin(), q.offsets.end(), q.offsets.begin());
+        q.order.resize(q.offsets.back());
+        for (usize i = 0; i < q.hits.size(); i++) {
+            if (q.hits[i].object_id != no_id) {
+                q.order[q.offsets[material_of(i)]++] = static_cast<u32>(i);
+            }
+        }
+
+        q.next.clear();
+        q.shadows.clear();
+        for (usize i = 0; i < q.hits.size(); i++) {
+            if (q.hits[i].object_id == no_id) {
+                escape(f, q.paths.get(i));
+            }
+        }
+        std::vector<shadow_ray> shadows;
+        for (auto i : q.order) {
+            auto p = q.paths.get(i);
+            bool more = scatter(f, p, q.hits[i], last, shadows);
+            for (auto const& shadow : shadows) {
+                q.shadows.push(shadow);
+            }
+            if (more) {
+                q.next.push(p);
+            }
+        }
+    }
+
+    static void traceShadows(frame& f, queues& q)
+    {
+        auto const& s = q.shadows;
+        for (usize i = 0; i < s.size(); i++) {
+            auto r = ray(vec3(s.ox[i], s.oy[i], s.oz[i]), vec3(s.dx[i], s.dy[i], s.dz[i]));
+            if (!f.scene.occluded(r, s.t_max[i])) {
+                f.samples[s.slot[i]] = f.samples[s.slot[i]] + vec3(s.cr[i], s.cg[i], s.cb[i]);
+            }
+        }
+    }
+};
+} // namespace raytracer
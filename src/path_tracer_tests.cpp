@@ -0,0 +1,316 @@
+import boost.ut;
+import raytracer;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+
+namespace {
+constexpr i32 size = 24;
+
+// Pinhole rays from z = -5 through a 4x4 window at z = 0.
+ray primary(i32 row, i32 col)
+{
+    auto target = vec3(-2.0f + 4.0f * (f32(col) + 0.5f) / size, 2.0f - 4.0f * (f32(row) + 0.5f) / size, 0.0f);
+    auto origin = vec3(0, 0, -5);
+    return ray(origin, normalize(target - origin));
+}
+
+Sphere& addSphere(Scene& scene, vec3 const& center, f32 radius, material const& m)
+{
+    auto& s = scene.objects.add<Sphere>();
+    s.setTransform(mat4::translate(center.x, center.y, center.z) * mat4::scale(radius, radius, radius));
+    s.material_id = scene.materials.add(m);
+    return s;
+}
+
+// A diffuse floor under a glossy and a matte sphere, lit by two lights.
+Scene room()
+{
+    Scene scene;
+    material floor;
+    floor.color = vec3(0.8f, 0.8f, 0.7f);
+    floor.specular = 0.0f;
+    material glossy;
+    glossy.color = vec3(0.9f, 0.3f, 0.2f);
+    glossy.diffuse = 0.3f;
+    glossy.specular = 0.6f;
+    glossy.shininess = 50.0f;
+    material matte;
+    matte.color = vec3(0.2f, 0.4f, 0.9f);
+    matte.specular = 0.1f;
+    addSphere(scene, vec3(0, -1001, 0), 1000.0f, floor);
+    addSphere(scene, vec3(-0.8f, 0, 1), 1.0f, glossy);
+    addSphere(scene, vec3(1.2f, -0.4f, 0.5f), 0.6f, matte);
+    scene.lights.push_back(point_light(vec3(-5, 8, -5), vec3(0.8f, 0.8f, 0.8f)));
+    scene.lights.push_back(point_light(vec3(5, 3, -2), vec3(0.3f, 0.3f, 0.5f)));
+    scene.build();
+    return scene;
+}
+
+bool near(vec3 const& a, vec3 const& b, f32 tolerance)
+{
+    return std::abs(a.x - b.x) <= tolerance && std::abs(a.y - b.y) <= tolerance && std::abs(a.z - b.z) <= tolerance;
+}
+
+Canvas<vec3> render(Scene const& scene, path_tracer_settings const& settings)
+{
+    Canvas<vec3> image(size, size);
+    PathTracer(settings).render(scene, primary, image);
+    return image;
+}
+} // namespace
+
+int main()
+{
+    feature("Direct lighting") = [] {
+        Scene scene;
+        material m;
+        m.color = vec3(1.0f, 0.2f, 1.0f);
+        m.specular = 0.0f;
+        addSphere(scene, zero<vec3>, 1.0f, m);
+        scene.lights.push_back(point_light(vec3(-10, 10, -10), one<vec3>));
+        scene.build();
+
+        then("One hit per path reproduces lighting() on diffuse surfaces") = [&] {
+            path_tracer_settings settings;
+            settings.samples_per_pixel = 1;
+            settings.max_depth = 1;
+            auto image = render(scene, settings);
+            for (i32 row = 0; row < size; row++) {
+                for (i32 col = 0; col < size; col++) {
+                    auto r = primary(row, col);
+                    auto h = scene.intersect(r);
+                    auto expected = zero<vec3>;
+                    if (h) {
+                        auto point = r.at(h->t);
+                        auto normal = scene.objects.get(h->object_id).normalAt(point, *h);
+                        expected = lighting(m, scene.lights[0], point, -r.d, normal);
+                    }
+                    expect(near(image[row, col], expected, 1e-4f)) << row << col;
+                }
+            }
+        };
+
+        then("Occluded lights only leave ambient") = [&] {
+            addSphere(scene, vec3(-5, 5, -5), 1.0f, m);
+            scene.build();
+            auto towards_light = ray(vec3(-2, 2, -2), normalize(vec3(-1, 1, -1)));
+            expect(scene.occluded(towards_light, 20.0f));
+            expect(!scene.occluded(towards_light, 3.0f));
+
+            path_tracer_settings settings;
+            settings.samples_per_pixel = 1;
+            settings.max_depth = 1;
+            auto image = render(scene, settings);
+            auto centre = image[size / 2, size / 2];
+            expect(near(centre, m.color * m.ambient, 1e-5f));
+        };
+
+        then("Surfaces seen from behind are lit on the viewer's side") = [&] {
+            // The camera and the light are inside a sphere, whose normals
+            // point away from both.
+            Scene inside;
+            addSphere(inside, zero<vec3>, 10.0f, m);
+            inside.lights.push_back(point_light(vec3(0, 3, -4), one<vec3>));
+            inside.build();
+            path_tracer_settings settings;
+            settings.samples_per_pixel = 1;
+            settings.max_depth = 1;
+            Canvas<vec3> image(size, size);
+            PathTracer(settings).render(inside, primary, image);
+            auto centre = image[size / 2, size / 2];
+            expect(centre.x > 2.0f * m.color.x * m.ambient) << centre.x;
+        };
+    };
+
+    feature("Wavefront and megakernel modes") = [] {
+        auto scene = room();
+        path_tracer_settings settings;
+        settings.samples_per_pixel = 4;
+        settings.max_depth = 5;
+        settings.mode = path_tracer_mode::megakernel;
+        auto reference = render(scene, settings);
+
+        given("Sorted rays in small waves") = [&] {
+            settings.mode = path_tracer_mode::wavefront;
+            settings.wave_size = 500;
+            auto image = render(scene, settings);
+
+            then("They trace the same paths") = [&] {
+                for (i32 row = 0; row < size; row++) {
+                    for (i32 col = 0; col < size; col++) {
+                        expect(near(image[row, col], reference[row, col], 1e-4f)) << row << col;
+                    }
+                }
+            };
+        };
+
+        given("Unsorted rays") = [&] {
+            settings.mode = path_tracer_mode::wavefront;
+            settings.sort_rays = false;
+            auto image = render(scene, settings);
+
+            then("Sorting only changes the order") = [&] {
+                for (i32 row = 0; row < size; row++) {
+                    for (i32 col = 0; col < size; col++) {
+                        expect(near(image[row, col], reference[row, col], 1e-4f)) << row << col;
+                    }
+                }
+            };
+        };
+
+        then("Bounces add light") = [&] {
+            path_tracer_settings direct;
+            direct.samples_per_pixel = 4;
+            direct.max_depth = 1;
+            direct.mode = path_tracer_mode::megakernel;
+            auto first_hit = render(scene, direct);
+            f32 direct_sum = 0.0f, indirect_sum = 0.0f;
+            for (i32 i = 0; i < size * size; i++) {
+                auto const& c = reference.begin()[i];
+                expect(std::isfinite(c.x) && std::isfinite(c.y) && std::isfinite(c.z));
+                expect(c.x >= 0.0f && c.y >= 0.0f && c.z >= 0.0f);
+                direct_sum += first_hit.begin()[i].x + first_hit.begin()[i].y + first_hit.begin()[i].z;
+                indirect_sum += c.x + c.y + c.z;
+            }
+            expect(indirect_sum > 0.5f * direct_sum) << indirect_sum << direct_sum;
+        };
+    };
+
+    feature("Threads") = [] {
+        auto scene = room();
+        ThreadPool pool(4);
+        for (auto mode : { path_tracer_mode::megakernel, path_tracer_mode::wavefront }) {
+            path_tracer_settings settings;
+            settings.mode = mode;
+            settings.samples_per_pixel = 4;
+            settings.max_depth = 5;
+            settings.wave_size = 500;
+            render_options serial;
+            serial.policy = execution_policy::serial;
+            Canvas<vec3> reference(size, size);
+            PathTracer(settings).render(scene, primary, reference, serial);
+
+            then("Pooled and parallel rendering give the serial image") = [&] {
+                for (auto policy : { execution_policy::parallel, execution_policy::thread_pool }) {
+                    render_options options;
+                    options.policy = policy;
+                    options.pool = &pool;
+                    Canvas<vec3> image(size, size);
+                    PathTracer(settings).render(scene, primary, image, options);
+                    expect(std::equal(image.begin(), image.end(), reference.begin())) << nameOf(policy) << static_cast<u32>(mode);
+                }
+            };
+        }
+    };
+
+    feature("Sample statistics") = [] {
+        SampleStatistics statistics(2, 1);
+        for (f32 y : { 1.0f, 2.0f, 3.0f, 4.0f }) {
+            statistics.add(1, vec3(y, y, y));
+        }
+
+        then("They keep the mean and its standard error") = [&] {
+            expect(statistics.count(0) == 0u && statistics.count(1) == 4u);
+            expect(near(statistics.mean(1), vec3(2.5f, 2.5f, 2.5f), 1e-5f));
+            // Sample variance 5/3, over four samples.
+            expect(std::abs(statistics.standardError(1) - std::sqrt(5.0f / 12.0f)) < 1e-5f);
+            expect(std::isinf(statistics.standardError(0)));
+        };
+    };
+
+    feature("Adaptive sampling") = [] {
+        auto scene = room();
+        adaptive_settings adaptive;
+        adaptive.min_samples = 8;
+        adaptive.max_samples = 128;
+        adaptive.target_error = 0.1f;
+        adaptive.tile_size = 4;
+        PathTracer tracer;
+        SampleStatistics statistics(size, size);
+        Canvas<vec3> image(size, size);
+        auto stats = tracer.renderAdaptive(scene, primary, adaptive, statistics, image);
+        auto converged = [&](u32 pixel, f32 target_error) {
+            f32 target = target_error * std::max(luminanceOf(statistics.mean(pixel)), adaptive.dark_luminance);
+            return statistics.standardError(pixel) <= target || statistics.count(pixel) >= adaptive.max_samples;
+        };
+
+        then("Empty background stops after the first round") = [&] {
+            // The top rows look past the floor and spheres.
+            for (i32 col = 0; col < size; col++) {
+                expect(statistics.count(col) == adaptive.min_samples) << col;
+                expect(image[0, col] == zero<vec3>);
+            }
+        };
+
+        then("Noisy pixels get more samples until they converge") = [&] {
+            u32 most = 0;
+            u64 total = 0;
+            for (u32 i = 0; i < size * size; i++) {
+                most = std::max(most, statistics.count(i));
+                total += statistics.count(i);
+                expect(converged(i, adaptive.target_error)) << i;
+            }
+            expect(stats.rounds > 1u);
+            // Only tiles that hit max_samples may still be noisy.
+            expect(stats.noisy_tiles == 0u || most == adaptive.max_samples);
+            expect(!stats.out_of_time);
+            expect(most > adaptive.min_samples);
+            expect(total == stats.samples);
+            expect(total < u64(size * size) * adaptive.max_samples * 3 / 4) << total;
+        };
+
+        then("A tighter target resumes where the render stopped") = [&] {
+            std::vector<u32> before;
+            for (u32 i = 0; i < size * size; i++) {
+                before.push_back(statistics.count(i));
+            }
+            adaptive.target_error = 0.05f;
+            auto more = tracer.renderAdaptive(scene, primary, adaptive, statistics, image);
+            expect(more.samples > 0u);
+            for (u32 i = 0; i < size * size; i++) {
+                expect(statistics.count(i) >= before[i]);
+                expect(converged(i, adaptive.target_error)) << i;
+            }
+        };
+
+        then("A spent time budget stops after the first round") = [&] {
+            adaptive.time_budget = std::chrono::nanoseconds(1);
+            SampleStatistics fresh(size, size);
+            auto timed = tracer.renderAdaptive(scene, primary, adaptive, fresh, image);
+            expect(timed.rounds == 1u);
+            expect(timed.out_of_time);
+            expect(timed.samples == u64(size * size) * adaptive.min_samples);
+        };
+    };
+
+    feature("Samplers") = [] {
+        auto scene = room();
+        path_tracer_settings settings;
+        settings.max_depth = 3;
+        settings.samples_per_pixel = 256;
+        settings.seed = 99;
+        auto reference = render(scene, settings);
+        auto error = [&](sampler_kind kind) {
+            settings.sampler = kind;
+            settings.samples_per_pixel = 16;
+            auto image = render(scene, settings);
+            f32 squared = 0.0f;
+            for (i32 i = 0; i < size * size; i++) {
+                auto d = image.begin()[i] - reference.begin()[i];
+                squared += dot(d, d);
+            }
+            return std::sqrt(squared / f32(size * size));
+        };
+
+        then("Low-discrepancy samples lower the noise") = [&] {
+            auto independent = error(sampler_kind::independent);
+            auto sobol = error(sampler_kind::sobol);
+            auto blue_noise = error(sampler_kind::blue_noise);
+            expect(sobol < independent) << sobol << independent;
+            expect(blue_noise < independent) << blue_noise << independent;
+        };
+    };
+}
@@ -0,0 +1,23 @@
+export module raytracer.random;
+
+import raytracer.types;
+import std;
+
+export namespace raytracer {
+// PCG-based hash (Jarzynski and Olano 2020); mixes well enough to seed
+// independent streams from pixel and sample indices.
+[[nodiscard]] constexpr u32 pcgHash(u32 x)
+{
+    u32 state = x * 747796405u + 2891336453u;
+    u32 word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// Advances a one-word random stream and returns a uniform number in
+// [0, 1). The whole state is the u32, so it fits in queued ray records.
+[[nodiscard]] constexpr f32 nextUniform(u32& state)
+{
+    state = pcgHash(state);
+    return f32(state >> 8) * 0x1p-24f;
+}
+} // namespace raytracer
@@ -0,0 +1,374 @@
+export module raytracer.raster;
+
+import raytracer.aabb;
+import raytracer.camera;
+import raytracer.canvas;
+import raytracer.geometry;
+import raytracer.instance;
+import raytracer.mat;
+import raytracer.object;
+import raytracer.ray;
+import raytracer.render;
+import raytracer.scene;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+namespace raytracer {
+// Pixels of a row the rasterizer tests at once, one per SIMD lane.
+constexpr usize raster_lanes = 8;
+// Rows per bin; bins are rasterized in parallel.
+constexpr i32 raster_band = 16;
+
+// A triangle set up for rasterizing in image space, x being the column and
+// y the row.
+struct raster_triangle {
+    // Barycentric coordinate of each vertex as a function of image
+    // position, w = a x + b y + c; all three are non-negative inside.
+    std::array<f32, 3> a;
+    std::array<f32, 3> b;
+    std::array<f32, 3> c;
+    // 1 / depth at each vertex, which is linear in image space.
+    std::array<f32, 3> inverse_depth;
+    pixel_tile pixels;
+    u32 object;
+    u32 primitive;
+};
+
+// An object covered by testing its own intersection at each pixel of its
+// projected bounds.
+struct raster_object {
+    pixel_tile pixels;
+    u32 object;
+};
+
+// Id and depth buffer for one band of rows. Rows are padded by a lane
+// group so a group starting at any column stays inside its row.
+struct raster_band_buffer {
+    i32 row;
+    i32 rows;
+    usize stride;
+    // Depth along the camera axis of the closest surface so far.
+    std::vector<f32> depth;
+    // Hit t, or -1 where a rasterized triangle won and t is still to be
+    // found.
+    std::vector<f32> t;
+    std::vector<u32> object;
+    std::vector<u32> primitive;
+
+    raster_band_buffer(i32 row, i32 rows, i32 width)
+        : row(row)
+        , rows(rows)
+        , stride(usize(width) + raster_lanes)
+        , depth(usize(rows) * stride, std::numeric_limits<f32>::infinity())
+        , t(depth.size(), std::numeric_limits<f32>::infinity())
+        , object(depth.size(), no_id)
+        , primitive(depth.size(), 0)
+    {
+    }
+};
+
+// Pixels whose centres may lie in the image-space box from `min` to `max`,
+// clamped to the image; none if it is off the image.
+pixel_tile pixelsCovering(vec2 const& min, vec2 const& max, i32 width, i32 height)
+{
+    auto first = [](f32 x, i32 size) { return static_cast<i32>(std::floor(std::clamp(x - 0.5f, -1.0f, f32(size)))); };
+    auto last = [](f32 x, i32 size) { return static_cast<i32>(std::ceil(std::clamp(x - 0.5f, -1.0f, f32(size)))); };
+    pixel_tile pixels;
+    pixels.col = std::max(first(min.x, width), 0);
+    pixels.row = std::max(first(min.y, height), 0);
+    pixels.cols = std::min(last(max.x, width), width - 1) - pixels.col + 1;
+    pixels.rows = std::min(last(max.y, height), height - 1) - pixels.row + 1;
+    return pixels;
+}
+
+pixel_tile wholeImage(Camera const& camera)
+{
+    pixel_tile pixels;
+    pixels.row = 0;
+    pixels.col = 0;
+    pixels.rows = camera.height();
+    pixels.cols = camera.width();
+    return pixels;
+}
+
+// Pixels the world-space box `b` may cover: the bounds of its projected
+// corners, or the whole image when it reaches behind the camera.
+pixel_tile projectedPixels(Camera const& camera, aabb const& b)
+{
+    if (b.empty()) {
+        pixel_tile none {};
+        return none;
+    }
+    vec2 min(std::numeric_limits<f32>::infinity());
+    vec2 max(-std::numeric_limits<f32>::infinity());
+    for (usize i = 0; i < 8; i++) {
+        auto p = camera.project(vec3(i & 1 ? b.max.x : b.min.x, i & 2 ? b.max.y : b.min.y, i & 4 ? b.max.z : b.min.z));
+        if (!p || !std::isfinite(p->x) || !std::isfinite(p->y)) {
+            return wholeImage(camera);
+        }
+        min = vec2(std::min(min.x, p->x), std::min(min.y, p->y));
+        max = vec2(std::max(max.x, p->x), std::max(max.y, p->y));
+    }
+    return pixelsCovering(min, max, camera.width(), camera.height());
+}
+
+// Sets up the triangles of `instance` into `out`; false, adding none, if
+// a vertex doesn't project.
+bool setUpTriangles(Camera const& camera, Instance const& instance, TriangleMesh const& mesh, std::vector<raster_triangle>& out)
+{
+    std::vector<vec3> projected(mesh.vertices().size());
+    for (usize i = 0; i < projected.size(); i++) {
+        auto p = camera.project(vec3(instance.transform() * vec4::point(mesh.vertices()[i])));
+        if (!p) {
+            return false;
+        }
+        projected[i] = *p;
+    }
+    for (u32 primitive = 0; primitive < mesh.triangles().size(); primitive++) {
+        auto const& tri = mesh.triangles()[primitive];
+        std::array v { projected[tri.x], projected[tri.y], projected[tri.z] };
+        f32 area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[1].y - v[0].y) * (v[2].x - v[0].x);
+        if (!(std::abs(area) > 1e-12f)) {
+            // Edge-on; it covers no pixel centres.
+            continue;
+        }
+        raster_triangle t;
+        for (usize i = 0; i < 3; i++) {
+            // Edge opposite vertex i, from vertex j to vertex k.
+            auto const& j = v[(i + 1) % 3];
+            auto const& k = v[(i + 2) % 3];
+            t.a[i] = (j.y - k.y) / area;
+            t.b[i] = (k.x - j.x) / area;
+            t.c[i] = ((k.y - j.y) * j.x - (k.x - j.x) * j.y) / area;
+            t.inverse_depth[i] = 1.0f / v[i].z;
+        }
+        vec2 min(std::min({ v[0].x, v[1].x, v[2].x }), std::min({ v[0].y, v[1].y, v[2].y }));
+        vec2 max(std::max({ v[0].x, v[1].x, v[2].x }), std::max({ v[0].y, v[1].y, v[2].y }));
+        t.pixels = pixelsCovering(min, max, camera.width(), camera.height());
+        t.object = instance.id;
+        t.primitive = primitive;
+        if (t.pixels.rows > 0 && t.pixels.cols > 0) {
+            out.push_back(t);
+        }
+    }
+    return true;
+}
+
+// Rasterizes `tri` into the rows of `band` it covers, raster_lanes pixels
+// at a time. The lanes are branch-free so each group maps onto SIMD lanes.
+void rasterize(raster_triangle const& tri, raster_band_buffer& band)
+{
+    i32 first_row = std::max(tri.pixels.row, band.row);
+    i32 last_row = std::min(tri.pixels.row + tri.pixels.rows, band.row + band.rows);
+    i32 end_col = tri.pixels.col + tri.pixels.cols;
+    for (i32 row = first_row; row < last_row; row++) {
+        f32 y = f32(row) + 0.5f;
+        std::array<f32, 3> row_start;
+        for (usize i = 0; i < 3; i++) {
+            row_start[i] = tri.b[i] * y + tri.c[i];
+        }
+        usize base = usize(row - band.row) * band.stride;
+        for (i32 col = tri.pixels.col; col < end_col; col += i32(raster_lanes)) {
+            for (usize lane = 0; lane < raster_lanes; lane++) {
+                f32 x = f32(col) + f32(lane) + 0.5f;
+                f32 w0 = tri.a[0] * x + row_start[0];
+                f32 w1 = tri.a[1] * x + row_start[1];
+                f32 w2 = tri.a[2] * x + row_start[2];
+                bool inside = (w0 >= 0.0f) & (w1 >= 0.0f) & (w2 >= 0.0f) & (col + i32(lane) < end_col);
+                f32 depth = 1.0f / (w0 * tri.inverse_depth[0] + w1 * tri.inverse_depth[1] + w2 * tri.inverse_depth[2]);
+                auto i = base + usize(col) + lane;
+                bool closer = inside & (depth > 0.0f) & (depth < band.depth[i]);
+                band.depth[i] = closer ? depth : band.depth[i];
+                band.t[i] = closer ? -1.0f : band.t[i];
+                band.object[i] = closer ? tri.object : band.object[i];
+                band.primitive[i] = closer ? tri.primitive : band.primitive[i];
+            }
+        }
+    }
+}
+} // namespace raytracer
+
+export namespace raytracer {
+struct raster_stats {
+    // Triangles rasterized with edge functions.
+    u32 triangles = 0;
+    // Objects without triangles, or too close to the camera to project,
+    // covered by testing their own intersection over their projected
+    // bounds instead.
+    u32 exact_objects = 0;
+    // Pixels that see something.
+    u64 covered_pixels = 0;
+    // Pixels whose rasterized triangle then missed its exact test, e.g.
+    // on an edge, and that were traced instead.
+    u64 traced_pixels = 0;
+};
+
+// Closest hit of the ray through each pixel's centre, found without
+// tracing: a depth-buffered pass over the objects, each covering the
+// pixels it projects to. Triangle mesh instances are rasterized with edge
+// functions, which give each pixel's triangle and depth; the winner's t
+// then comes from one ray-triangle test. Other objects, spheres
+// included, are tested exactly, but only at the pixels their projected
+// bounds cover and only up to the depth in front of them. Either way no
+// pixel traverses the scene's BVH, and the hits are the ones
+// Scene::intersect() finds, except where two surfaces are within
+// rounding of each other.
+class VisibilityBuffer {
+public:
+    // x is the object id, y the primitive; no_id where nothing is seen.
+    Canvas<uvec2> ids;
+
+    VisibilityBuffer(i32 width, i32 height)
+        : ids(width, height)
+        , m_t(usize(width) * usize(height), std::numeric_limits<f32>::infinity())
+    {
+    }
+
+    [[nodiscard]] i32 width() const { return ids.width(); }
+    [[nodiscard]] i32 height() const { return ids.height(); }
+
+    // Fills the buffer with what `camera`, which must match its size, sees
+    // of the built `scene`. Bands of rows are rasterized under
+    // options.policy.
+    raster_stats rasterize(Scene const& scene, Camera const& camera, render_options const& options = render_options())
+    {
+        raster_stats stats;
+        std::vector<raster_triangle> triangles;
+        std::vector<raster_object> objects;
+        for (u32 id = 0; id < scene.objects.size(); id++) {
+            auto const& object = scene.objects.get(id);
+            auto instance = dynamic_cast<Instance const*>(&object);
+            auto mesh = instance ? dynamic_cast<TriangleMesh const*>(instance->geometry().get()) : nullptr;
+            if (mesh && setUpTriangles(camera, *instance, *mesh, triangles)) {
+                continue;
+            }
+            raster_object o;
+            o.pixels = projectedPixels(camera, scene.objectBounds()[id]);
+            o.object = id;
+            if (o.pixels.rows > 0 && o.pixels.cols > 0) {
+                objects.push_back(o);
+            }
+        }
+        stats.triangles = static_cast<u32>(triangles.size());
+        stats.exact_objects = static_cast<u32>(objects.size());
+
+        // Bin by band, keeping scene order within each.
+        i32 band_count = (height() + raster_band - 1) / raster_band;
+        std::vector<std::vector<u32>> triangle_bins(static_cast<usize>(band_count));
+        std::vector<std::vector<u32>> object_bins(static_cast<usize>(band_count));
+        auto bin = [&](pixel_tile const& pixels, std::vector<std::vector<u32>>& bins, u32 index) {
+            for (i32 band = pixels.row / raster_band; band <= (pixels.row + pixels.rows - 1) / raster_band; band++) {
+                bins[usize(band)].push_back(index);
+            }
+        };
+        for (u32 i = 0; i < triangles.size(); i++) {
+            bin(triangles[i].pixels, triangle_bins, i);
+        }
+        for (u32 i = 0; i < objects.size(); i++) {
+            bin(objects[i].pixels, object_bins, i);
+        }
+
+        auto forward = camera.at(f32(height()) * 0.5f, f32(width()) * 0.5f).d;
+        std::atomic<u64> covered = 0;
+        std::atomic<u64> traced = 0;
+        forEachRow(options, 0, band_count, [&](i32 band_index) {
+            raster_band_buffer band(band_index * raster_band, std::min(raster_band, height() - band_index * raster_band), width());
+            // The rays render() shoots, normalized as the tracer does.
+            pixel_tile tile;
+            tile.row = band.row;
+            tile.col = 0;
+            tile.rows = band.rows;
+            tile.cols = width();
+            std::vector<ray> rays(usize(band.rows) * usize(width()));
+            camera.generate(tile, rays);
+            for (auto& r : rays) {
+                r = ray(r.o, normalize(r.d));
+            }
+
+            // Triangles first, so exact tests stop at the depth they left.
+            for (auto i : triangle_bins[usize(band_index)]) {
+                raytracer::rasterize(triangles[i], band);
+            }
+            for (auto i : object_bins[usize(band_index)]) {
+                auto const& o = objects[i];
+                auto const& object = scene.objects.get(o.object);
+                i32 last_row = std::min(o.pixels.row + o.pixels.rows, band.row + band.rows);
+                for (i32 row = std::max(o.pixels.row, band.row); row < last_row; row++) {
+                    for (i32 col = o.pixels.col; col < o.pixels.col + o.pixels.cols; col++) {
+                        auto const& r = rays[usize(row - band.row) * usize(width()) + usize(col)];
+                        auto j = usize(row - band.row) * band.stride + usize(col);
+                        f32 axial = dot(r.d, forward);
+                        if (auto h = object.closestHit(r, band.depth[j] / axial)) {
+                            band.depth[j] = h->t * axial;
+                            band.t[j] = h->t;
+                            band.object[j] = o.object;
+                            band.primitive[j] = h->primitive;
+                        }
+                    }
+                }
+            }
+
+            // Resolve the winners into hits.
+            u64 band_covered = 0;
+            u64 band_traced = 0;
+            for (i32 row = 0; row < band.rows; row++) {
+                for (i32 col = 0; col < width(); col++) {
+                    auto const& r = rays[usize(row) * usize(width()) + usize(col)];
+                    auto j = usize(row) * band.stride + usize(col);
+                    uvec2 id(band.object[j], band.primitive[j]);
+                    f32 t = band.t[j];
+                    if (id.x != no_id && t < 0.0f) {
+                        auto const& instance = static_cast<Instance const&>(scene.objects.get(id.x));
+                        auto const& mesh = static_cast<TriangleMesh const&>(*instance.geometry());
+                        t = mesh.intersectTriangle(instance.inverseTransform() * r, id.y, std::numeric_limits<f32>::infinity());
+                        if (t == std::numeric_limits<f32>::infinity()) {
+                            band_traced++;
+                            auto h = scene.intersect(r);
+                            id = h ? uvec2(h->object_id, h->primitive) : uvec2(no_id, 0);
+                            t = h ? h->t : std::numeric_limits<f32>::infinity();
+                        }
+                    }
+                    band_covered += id.x != no_id;
+                    ids[band.row + row, col] = id;
+                    m_t[usize(band.row + row) * usize(width()) + usize(col)] = t;
+                }
+            }
+            covered += band_covered;
+            traced += band_traced;
+        });
+        stats.covered_pixels = covered;
+        stats.traced_pixels = traced;
+        return stats;
+    }
+
+    // Closest hit along the centre ray of pixel (row, col), with t along
+    // the ray's normalized direction; none where nothing is seen.
+    [[nodiscard]] std::optional<intersection> hit(i32 row, i32 col) const
+    {
+        auto id = ids[row, col];
+        if (id.x == no_id) {
+            return {};
+        }
+        return intersection(m_t[usize(row) * usize(width()) + usize(col)], id.x, id.y);
+    }
+
+private:
+    std::vector<f32> m_t;
+};
+
+// Renders like render(scene, camera, out, options) with one sample per
+// pixel, through the pixel centres, but with every primary hit taken from
+// a VisibilityBuffer, so ray tracing starts at the shadow and secondary
+// rays. options.samples_per_pixel is not used.
+raster_stats renderHybrid(Scene const& scene, Camera const& camera, Canvas<vec3>& out, render_options const& options = render_options())
+{
+    VisibilityBuffer visibility(camera.width(), camera.height());
+    auto stats = visibility.rasterize(scene, camera, options);
+    auto single = options;
+    single.samples_per_pixel = 1;
+    auto kernel = tracingKernel(scene, camera, options.trace, [&visibility](i32 row, i32 col) { return visibility.hit(row, col); });
+    render(camera, out, single, kernel);
+    return stats;
+}
+} // namespace raytracer
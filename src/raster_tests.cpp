@@ -0,0 +1,137 @@
+import boost.ut;
+import raytracer;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+
+namespace {
+constexpr i32 width = 64;
+constexpr i32 height = 48;
+
+std::shared_ptr<TriangleMesh> cube()
+{
+    std::vector<vec3> vertices;
+    for (u32 i = 0; i < 8; i++) {
+        vertices.push_back(vec3(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f));
+    }
+    return std::make_shared<TriangleMesh>(vertices, std::vector {
+        uvec3(0, 1, 3), uvec3(0, 3, 2), uvec3(4, 6, 7), uvec3(4, 7, 5),
+        uvec3(0, 4, 5), uvec3(0, 5, 1), uvec3(2, 3, 7), uvec3(2, 7, 6),
+        uvec3(0, 2, 6), uvec3(0, 6, 4), uvec3(1, 5, 7), uvec3(1, 7, 3) });
+}
+
+std::shared_ptr<TriangleMesh> quad(f32 near_z, f32 far_z)
+{
+    return std::make_shared<TriangleMesh>(
+        std::vector { vec3(-10, -1, near_z), vec3(10, -1, near_z), vec3(10, -1, far_z), vec3(-10, -1, far_z) },
+        std::vector { uvec3(0, 1, 2), uvec3(0, 2, 3) });
+}
+
+// A floor, a turned cube and a mirror ball; the floor starts behind the
+// camera when `floor_near_z` is below its z of -6.
+Scene meshes(f32 floor_near_z)
+{
+    Scene scene;
+    material floor;
+    floor.color = vec3(0.8f, 0.8f, 0.7f);
+    material red;
+    red.color = vec3(0.9f, 0.2f, 0.1f);
+    material mirror;
+    mirror.color = vec3(0.2f);
+    mirror.reflective = 0.8f;
+    scene.objects.add<Instance>(quad(floor_near_z, 10)).material_id = scene.materials.add(floor);
+    auto& box = scene.objects.add<Instance>(cube());
+    box.setTransform(mat4::translate(-1, 0, 1) * mat4::rotateY(0.6f) * mat4::scale(0.8f, 0.8f, 0.8f));
+    box.material_id = scene.materials.add(red);
+    auto& ball = scene.objects.add<Sphere>();
+    ball.setTransform(mat4::translate(1.2f, 0, 0));
+    ball.material_id = scene.materials.add(mirror);
+    scene.lights.push_back(point_light(vec3(-5, 8, -6), one<vec3>));
+    scene.build();
+    return scene;
+}
+
+// Pixels where the visibility buffer disagrees with tracing the centre ray.
+u32 mismatches(Scene const& scene, Camera const& camera, VisibilityBuffer const& visibility)
+{
+    u32 count = 0;
+    for (i32 row = 0; row < height; row++) {
+        for (i32 col = 0; col < width; col++) {
+            auto r = camera(row, col);
+            auto expected = scene.intersect(ray(r.o, normalize(r.d)));
+            auto h = visibility.hit(row, col);
+            bool same = expected ? h && h->object_id == expected->object_id && std::abs(h->t - expected->t) <= 1e-4f * expected->t : !h;
+            count += !same;
+        }
+    }
+    return count;
+}
+
+u32 differences(Canvas<vec3> const& a, Canvas<vec3> const& b)
+{
+    u32 count = 0;
+    for (auto i = 0; i < a.size(); i++) {
+        auto d = a.begin()[i] - b.begin()[i];
+        count += std::max({ std::abs(d.x), std::abs(d.y), std::abs(d.z) }) > 1e-3f;
+    }
+    return count;
+}
+} // namespace
+
+int main()
+{
+    feature("Rasterized visibility") = [] {
+        Camera view(width, height, 1.0f, viewTransform(vec3(0, 1.5f, -6), vec3(0, 0, 0), vec3(0, 1, 0)));
+        render_options options;
+
+        given("Meshes in front of the camera and a sphere") = [&] {
+            auto scene = meshes(-4);
+            VisibilityBuffer visibility(width, height);
+            auto stats = visibility.rasterize(scene, view, options);
+
+            then("Triangles are rasterized and the sphere tested over its bounds") = [&] {
+                expect(stats.triangles == 14u && stats.exact_objects == 1u) << stats.triangles << stats.exact_objects;
+                expect(stats.covered_pixels > u64(width * height) / 2);
+                expect(stats.traced_pixels < 8u) << stats.traced_pixels;
+            };
+
+            then("Each pixel sees what its ray hits") = [&] {
+                expect(mismatches(scene, view, visibility) <= 4u) << mismatches(scene, view, visibility);
+            };
+
+            then("Hybrid rendering matches ray tracing") = [&] {
+                Canvas<vec3> traced(width, height);
+                render(scene, view, traced, options);
+                Canvas<vec3> hybrid(width, height);
+                (void)renderHybrid(scene, view, hybrid, options);
+                expect(differences(traced, hybrid) <= 4u) << differences(traced, hybrid);
+            };
+        };
+
+        given("A mesh reaching behind the camera") = [&] {
+            auto scene = meshes(-20);
+            VisibilityBuffer visibility(width, height);
+            auto stats = visibility.rasterize(scene, view, options);
+
+            then("It is tested exactly instead") = [&] {
+                expect(stats.triangles == 12u && stats.exact_objects == 2u) << stats.triangles << stats.exact_objects;
+                expect(mismatches(scene, view, visibility) <= 4u) << mismatches(scene, view, visibility);
+            };
+        };
+
+        then("Every policy fills the same buffer") = [&] {
+            auto scene = meshes(-4);
+            VisibilityBuffer expected(width, height);
+            (void)expected.rasterize(scene, view, options);
+            for (auto policy : { execution_policy::serial, execution_policy::parallel }) {
+                auto o = options;
+                o.policy = policy;
+                VisibilityBuffer visibility(width, height);
+                (void)visibility.rasterize(scene, view, o);
+                expect(std::equal(visibility.ids.begin(), visibility.ids.end(), expected.ids.begin())) << nameOf(policy);
+            }
+        };
+    };
+}
@@ -15,6 +15,31 @@ struct ray {
     }
 };
 
+// How the origin and direction change from a ray's pixel to the next
+// one across and down (Igehy 1999), for estimating the footprint the
+// pixel covers where the ray lands. All zero means a point footprint.
+struct ray_differential {
+    vec3 dodx, dddx;
+    vec3 dody, dddy;
+};
+
+// Offsets on the surface, with normal `n`, between the hit at `t` along
+// `r` and the neighbouring rays' hits on the surface's tangent plane.
+// Grazing rays, which never meet that plane, get a point footprint.
+[[nodiscard]] constexpr std::pair<vec3, vec3> footprintAt(ray const& r, ray_differential const& rd, f32 t, vec3 const& n)
+{
+    f32 d_dot_n = dot(r.d, n);
+    if (!(std::abs(d_dot_n) > 0.0f)) {
+        return { vec3(), vec3() };
+    }
+    auto transfer = [&](vec3 const& dodx, vec3 const& dddx) {
+        auto dp = dodx + dddx * t;
+        f32 dt = -dot(dp, n) / d_dot_n;
+        return dp + r.d * dt;
+    };
+    return { transfer(rd.dodx, rd.dddx), transfer(rd.dody, rd.dddy) };
+}
+
 [[nodiscard]] constexpr ray operator*(mat4 const& m, ray const& r)
 {
     return {
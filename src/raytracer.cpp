@@ -1,9 +1,39 @@
 export module raytracer;
 
+export import raytracer.aabb;
+export import raytracer.accelerator;
+export import raytracer.animation;
+export import raytracer.bvh;
+export import raytracer.camera;
 export import raytracer.canvas;
 export import raytracer.constants;
+export import raytracer.csg;
+export import raytracer.deferred;
+export import raytracer.denoise;
+export import raytracer.distributed;
+export import raytracer.environment;
+export import raytracer.geometry;
+export import raytracer.grid;
+export import raytracer.incremental;
+export import raytracer.instance;
+export import raytracer.kdtree;
+export import raytracer.light_tree;
 export import raytracer.mat;
+export import raytracer.material;
 export import raytracer.object;
+export import raytracer.path_tracer;
+export import raytracer.random;
+export import raytracer.raster;
 export import raytracer.ray;
+export import raytracer.render;
+export import raytracer.render_job;
+export import raytracer.render_server;
+export import raytracer.sampler;
+export import raytracer.scene;
+export import raytracer.scene_cache;
+export import raytracer.shading;
+export import raytracer.socket;
+export import raytracer.texture;
+export import raytracer.tracer;
 export import raytracer.types;
 export import raytracer.vec;
@@ -0,0 +1,298 @@
+export module raytracer.render;
+
+import raytracer.bvh;
+import raytracer.camera;
+import raytracer.canvas;
+import raytracer.object;
+import raytracer.random;
+import raytracer.ray;
+import raytracer.sampler;
+import raytracer.scene;
+import raytracer.tracer;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+// Fixed set of worker threads, started once and reused by every batch, so
+// a frame doesn't pay for starting threads. forEach() runs a batch on the
+// workers and the calling thread together and returns once all of it is
+// done; batches from several callers run one after another.
+class ThreadPool {
+public:
+    // `threads` counts the calling thread, so 1 starts no workers.
+    explicit ThreadPool(u32 threads = defaultThreadCount())
+    {
+        m_workers.reserve(threads);
+        for (u32 i = 1; i < threads; i++) {
+            m_workers.emplace_back([this](std::stop_token stop) { work(stop); });
+        }
+    }
+
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    // Threads a batch runs on, the calling thread included.
+    [[nodiscard]] u32 size() const
+    {
+        return static_cast<u32>(m_workers.size()) + 1;
+    }
+
+    // Calls task(i) once for every i in [0, count), in no particular order
+    // and on any of the threads. Tasks must not throw.
+    template<typename F>
+    requires std::is_invocable_v<F&, u32>
+    void forEach(u32 count, F& task)
+    {
+        std::scoped_lock batch(m_batch_mutex);
+        {
+            std::unique_lock lock(m_mutex);
+            // Stragglers that woke too late for the last batch must leave
+            // before its counter is reset.
+            m_done.wait(lock, [&] { return m_active == 0; });
+            m_task = &task;
+            m_invoke = [](void* f, u32 i) { (*static_cast<F*>(f))(i); };
+            m_count = count;
+            m_next = 0;
+            m_generation++;
+        }
+        m_wake.notify_all();
+        drain(m_task, m_invoke, count);
+        // Every task has been claimed; wait for the ones still running.
+        std::unique_lock lock(m_mutex);
+        m_done.wait(lock, [&] { return m_active == 0; });
+    }
+
+private:
+    std::mutex m_batch_mutex;
+    std::mutex m_mutex;
+    std::condition_variable_any m_wake;
+    std::condition_variable m_done;
+    u64 m_generation = 0;
+    u32 m_active = 0;
+    void* m_task = nullptr;
+    void (*m_invoke)(void*, u32) = nullptr;
+    u32 m_count = 0;
+    std::atomic<u32> m_next = 0;
+    // Last, so the threads are stopped and joined before anything they use
+    // is destroyed.
+    std::vector<std::jthread> m_workers;
+
+    void drain(void* task, void (*invoke)(void*, u32), u32 count)
+    {
+        for (u32 i; (i = m_next.fetch_add(1)) < count;) {
+            invoke(task, i);
+        }
+    }
+
+    void work(std::stop_token stop)
+    {
+        u64 seen = 0;
+        std::unique_lock lock(m_mutex);
+        while (m_wake.wait(lock, stop, [&] { return m_generation != seen; })) {
+            seen = m_generation;
+            m_active++;
+            auto task = m_task;
+            auto invoke = m_invoke;
+            auto count = m_count;
+            lock.unlock();
+            drain(task, invoke, count);
+            lock.lock();
+            if (--m_active == 0) {
+                m_done.notify_all();
+            }
+        }
+    }
+};
+
+// The pool render() uses unless told otherwise, with one thread per core,
+// started on first use. Thread-safe.
+[[nodiscard]] ThreadPool& sharedThreadPool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+enum class execution_policy : u32 {
+    // Row after row on the calling thread.
+    serial,
+    // Rows through std::for_each with std::execution::par, leaving the
+    // threading to the standard library. Not par_unseq, as rows allocate
+    // and textured scenes lock the TextureCache, which unsequenced
+    // execution does not allow.
+    parallel,
+    // Rows shared out over a ThreadPool.
+    thread_pool,
+};
+
+[[nodiscard]] constexpr std::string_view nameOf(execution_policy policy)
+{
+    switch (policy) {
+    case execution_policy::serial:
+        return "serial";
+    case execution_policy::parallel:
+        return "parallel";
+    case execution_policy::thread_pool:
+        return "thread pool";
+    }
+    return "unknown";
+}
+
+struct render_options {
+    execution_policy policy = execution_policy::thread_pool;
+    // Pool for execution_policy::thread_pool; null picks sharedThreadPool().
+    ThreadPool* pool = nullptr;
+    // Rays averaged per pixel. One goes through the pixel's centre; more
+    // are spread over it by `sampler`.
+    u32 samples_per_pixel = 1;
+    sampler_kind sampler = sampler_kind::sobol;
+    u32 seed = 0;
+    // For the ray tracer the scene overload of render() runs. Each pixel
+    // gets an even share of the frame budget, with no carry-over between
+    // pixels since they run in no particular order.
+    trace_settings trace;
+};
+
+// Calls f(row) for every row in [first, first + count) under
+// options.policy.
+template<typename F>
+requires std::is_invocable_v<F const&, i32>
+void forEachRow(render_options const& options, i32 first, i32 count, F const& f)
+{
+    switch (options.policy) {
+    case execution_policy::serial:
+        for (i32 row = first; row < first + count; row++) {
+            f(row);
+        }
+        break;
+    case execution_policy::parallel: {
+        std::vector<i32> rows(usize(std::max(count, 0)));
+        std::iota(rows.begin(), rows.end(), first);
+        std::for_each(std::execution::par, rows.begin(), rows.end(), f);
+        break;
+    }
+    case execution_policy::thread_pool: {
+        auto& pool = options.pool ? *options.pool : sharedThreadPool();
+        auto task = [&](u32 i) { f(first + static_cast<i32>(i)); };
+        pool.forEach(static_cast<u32>(std::max(count, 0)), task);
+        break;
+    }
+    }
+}
+
+// Rays of sample `index` of `samples` through the pixels of `row`, one per
+// column into `out`: through the centres when there is a single sample,
+// else spread over the pixels by `sampler`.
+void primaryRays(Camera const& camera, Sampler const& sampler, i32 row, u32 samples, u32 index, std::span<ray> out)
+{
+    pixel_tile tile;
+    tile.row = row;
+    tile.col = 0;
+    tile.rows = 1;
+    tile.cols = static_cast<i32>(out.size());
+    if (samples == 1) {
+        camera.generate(tile, out);
+    } else {
+        camera.generate(tile, out, sampler, index);
+    }
+}
+
+// Rays each pixel of `camera` may trace under `settings`: the pixel budget,
+// or an even share of the frame budget when that is smaller.
+[[nodiscard]] u32 pixelRayBudget(Camera const& camera, trace_settings const& settings)
+{
+    u64 pixel_count = static_cast<u64>(camera.width()) * static_cast<u64>(camera.height());
+    u64 budget = settings.pixel_ray_budget;
+    if (settings.frame_ray_budget != 0) {
+        budget = std::min(budget, std::max<u64>(settings.frame_ray_budget / std::max<u64>(pixel_count, 1), 1));
+    }
+    return static_cast<u32>(budget);
+}
+
+// Kernel tracing `scene` with the Whitted ray tracer (see RayTracer) under
+// `settings`, for render(). Each pixel seeds its roulette from its
+// position, as RayTracer::render() does, and from the sample index past
+// the first, so a pixel's samples make independent roulette and budget
+// decisions; textures are filtered over the camera's pixel footprint.
+// When given, primary_hits(row, col) is the closest hit along the pixel's
+// centre ray, already known e.g. from a VisibilityBuffer, and tracing
+// starts at the secondary rays. Holds its own copy of the camera.
+template<typename H = std::nullptr_t>
+requires std::is_null_pointer_v<H> || std::is_invocable_r_v<std::optional<intersection>, H const&, i32, i32>
+[[nodiscard]] auto tracingKernel(Scene const& scene, Camera const& camera, trace_settings const& settings, H primary_hits = nullptr)
+{
+    u32 seed = pcgHash(settings.seed);
+    return [&scene, camera, tracer = RayTracer(settings), stats = trace_stats(), budget = pixelRayBudget(camera, settings), seed, primary_hits](ray const& r, i32 row, i32 col, u32 sample = 0) mutable {
+        u32 rng = pcgHash(static_cast<u32>(row * camera.width() + col) ^ seed);
+        if (sample != 0) {
+            rng = pcgHash(rng + sample);
+        }
+        if constexpr (std::is_null_pointer_v<H>) {
+            return tracer.trace(scene, r, camera.differential(row, col), budget, rng, stats);
+        } else {
+            return tracer.trace(scene, r, camera.differential(row, col), primary_hits(row, col), budget, rng, stats);
+        }
+    };
+}
+
+// kernel(r, row, col, sample) for kernels that take the index of the
+// pixel's sample, such as tracingKernel()'s, else kernel(r, row, col).
+template<typename K>
+decltype(auto) invokeKernel(K& kernel, ray const& r, i32 row, i32 col, u32 sample)
+{
+    if constexpr (std::is_invocable_v<K&, ray const&, i32, i32, u32>) {
+        return kernel(r, row, col, sample);
+    } else {
+        return kernel(r, row, col);
+    }
+}
+
+// Renders pixel row `row` into `out`, which holds one value per column:
+// kernel(r, row, col) for each of the `samples` rays through each pixel,
+// averaged, passing the sample index to kernels that take one. `kernel`
+// is used for the whole row.
+template<typename V, typename K>
+requires std::is_invocable_r_v<V, K&, ray const&, i32, i32>
+void renderRow(Camera const& camera, Sampler const& sampler, u32 samples, K& kernel, i32 row, std::span<V> out)
+{
+    i32 width = static_cast<i32>(out.size());
+    std::vector<ray> rays(out.size());
+    for (u32 s = 0; s < samples; s++) {
+        primaryRays(camera, sampler, row, samples, s, rays);
+        for (i32 col = 0; col < width; col++) {
+            V value = invokeKernel(kernel, rays[usize(col)], row, col, s);
+            out[usize(col)] = s == 0 ? value : out[usize(col)] + value;
+        }
+    }
+    if (samples > 1) {
+        for (auto& value : out) {
+            value = value / f32(samples);
+        }
+    }
+}
+
+// Fills `out`, which must be the camera's size, with kernel(r, row, col)
+// for the camera's ray `r` through each pixel, averaged over the samples.
+// The work is split into rows, each rendered into a copy of `kernel`, so
+// a kernel may keep scratch state but copies run concurrently. Its type
+// is a template parameter so the per-pixel call inlines into the row
+// loop. Rows are rendered the same way under every policy, so the
+// policies give identical images.
+template<typename V, typename K>
+requires std::is_invocable_r_v<V, K&, ray const&, i32, i32> && std::copy_constructible<K>
+void render(Camera const& camera, Canvas<V>& out, render_options const& options, K const& kernel)
+{
+    Sampler sampler(options.sampler, options.seed);
+    u32 samples = std::max(options.samples_per_pixel, 1u);
+    forEachRow(options, 0, out.height(), [&](i32 row) {
+        K k = kernel;
+        renderRow(camera, sampler, samples, k, row, std::span<V>(out.begin() + row * out.width(), usize(out.width())));
+    });
+}
+
+// Renders the built `scene` with tracingKernel() under options.trace.
+void render(Scene const& scene, Camera const& camera, Canvas<vec3>& out, render_options const& options = render_options())
+{
+    render(camera, out, options, tracingKernel(scene, camera, options.trace));
+}
+} // namespace raytracer
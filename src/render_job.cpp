@@ -0,0 +1,276 @@
+export module raytracer.render_job;
+
+import raytracer.camera;
+import raytracer.canvas;
+import raytracer.ray;
+import raytracer.render;
+import raytracer.sampler;
+import raytracer.scene;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+enum class job_status : u32 {
+    running,
+    finished,
+    // Stopped by RenderJob::cancel().
+    cancelled,
+    // Stopped at the deadline.
+    timed_out,
+};
+
+[[nodiscard]] constexpr std::string_view nameOf(job_status status)
+{
+    switch (status) {
+    case job_status::running:
+        return "running";
+    case job_status::finished:
+        return "finished";
+    case job_status::cancelled:
+        return "cancelled";
+    case job_status::timed_out:
+        return "timed out";
+    }
+    return "unknown";
+}
+
+struct render_progress {
+    job_status status = job_status::running;
+    // Passes over the whole image, each adding a sample to every pixel.
+    u32 passes = 0;
+    // Rows rendered so far over all passes, and how many the job has.
+    u64 rows = 0;
+    u64 total_rows = 0;
+    std::chrono::steady_clock::duration elapsed {};
+
+    [[nodiscard]] f32 fraction() const
+    {
+        return total_rows == 0 ? 1.0f : f32(rows) / f32(total_rows);
+    }
+};
+
+struct render_job_options {
+    // How each step is rendered; samples_per_pixel is the number of passes.
+    render_options render;
+    // Rows per step, i.e. between suspensions.
+    i32 rows_per_step = 16;
+    // The job stops at the first row boundary past this.
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+};
+
+// Everything a job's coroutine and its handle share. Held by both, so it
+// outlives the coroutine's locals once the job is over.
+struct render_job_state {
+    render_progress progress;
+    std::stop_source stop;
+    // Sum of the samples of each pixel, and the samples in each row.
+    Canvas<vec3> sum;
+    std::vector<u32> samples;
+
+    render_job_state(i32 width, i32 height)
+        : sum(width, height)
+        , samples(usize(height), 0)
+    {
+    }
+};
+
+// Handle to a progressive render running as a coroutine. The render makes
+// passes of one sample per pixel over the image, a band of rows per
+// step; each step() renders the next band and suspends, so whoever drives
+// the job decides when it runs, may put it aside between steps and reads
+// image() between them. cancel() and the deadline are checked before
+// every row, so a step can end early; the job is then over, with image()
+// holding everything rendered until then.
+class RenderJob {
+public:
+    struct promise_type {
+        std::shared_ptr<render_job_state> state;
+        std::exception_ptr exception;
+
+        RenderJob get_return_object()
+        {
+            return RenderJob(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        // Runs up to the first yield, which only hands over the state.
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        std::suspend_always yield_value(std::shared_ptr<render_job_state> const& s) noexcept
+        {
+            state = s;
+            return {};
+        }
+
+        void return_void() { }
+
+        void unhandled_exception()
+        {
+            exception = std::current_exception();
+        }
+    };
+
+    RenderJob(RenderJob&& other) noexcept
+        : m_coroutine(std::exchange(other.m_coroutine, nullptr))
+    {
+    }
+
+    RenderJob& operator=(RenderJob&& other) noexcept
+    {
+        if (this != &other) {
+            destroy();
+            m_coroutine = std::exchange(other.m_coroutine, nullptr);
+        }
+        return *this;
+    }
+
+    ~RenderJob()
+    {
+        destroy();
+    }
+
+    // Renders the next step. False once the job is over, whether finished,
+    // cancelled or out of time; rethrows anything the render threw.
+    bool step()
+    {
+        if (done()) {
+            return false;
+        }
+        m_coroutine.resume();
+        if (auto exception = m_coroutine.promise().exception) {
+            std::rethrow_exception(exception);
+        }
+        return !done();
+    }
+
+    [[nodiscard]] bool done() const
+    {
+        return !m_coroutine || m_coroutine.done();
+    }
+
+    [[nodiscard]] render_progress const& progress() const
+    {
+        return state().progress;
+    }
+
+    // Asks the job to stop before its next row. Safe to call from any
+    // thread, also while a step runs.
+    void cancel()
+    {
+        state().stop.request_stop();
+    }
+
+    // The average of the samples so far in each pixel, so the best image
+    // yet; rows not reached by the first pass are black.
+    [[nodiscard]] Canvas<vec3> image() const
+    {
+        auto const& s = state();
+        Canvas<vec3> out(s.sum.width(), s.sum.height());
+        for (i32 row = 0; row < out.height(); row++) {
+            if (u32 n = s.samples[usize(row)]; n != 0) {
+                for (i32 col = 0; col < out.width(); col++) {
+                    out[row, col] = s.sum[row, col] / f32(n);
+                }
+            }
+        }
+        return out;
+    }
+
+    // Steps until the job is over and returns the image.
+    Canvas<vec3> wait()
+    {
+        while (step()) { }
+        return image();
+    }
+
+private:
+    std::coroutine_handle<promise_type> m_coroutine;
+
+    explicit RenderJob(std::coroutine_handle<promise_type> coroutine)
+        : m_coroutine(coroutine)
+    {
+    }
+
+    render_job_state const& state() const
+    {
+        return *m_coroutine.promise().state;
+    }
+
+    render_job_state& state()
+    {
+        return *m_coroutine.promise().state;
+    }
+
+    void destroy()
+    {
+        if (m_coroutine) {
+            m_coroutine.destroy();
+        }
+    }
+};
+
+// Starts rendering with kernel(r, row, col) as render() would, as a job:
+// once finished, its image is the one render() gives for the same
+// options. The job keeps copies of the camera, options and kernel; what
+// the kernel refers to must outlive it.
+template<typename K>
+requires std::is_invocable_r_v<vec3, K&, ray const&, i32, i32> && std::copy_constructible<K>
+RenderJob renderJob(Camera camera, render_job_options options, K kernel)
+{
+    u32 passes = std::max(options.render.samples_per_pixel, 1u);
+    i32 height = camera.height();
+    auto state = std::make_shared<render_job_state>(camera.width(), height);
+    state->progress.total_rows = u64(passes) * u64(height);
+    co_yield state;
+
+    auto start = std::chrono::steady_clock::now();
+    Sampler sampler(options.render.sampler, options.render.seed);
+    i32 band = std::max(options.rows_per_step, 1);
+    auto stop = state->stop.get_token();
+    for (u32 pass = 0; pass < passes; pass++) {
+        for (i32 first = 0; first < height; first += band) {
+            i32 count = std::min(band, height - first);
+            std::atomic<u64> rows = 0;
+            forEachRow(options.render, first, count, [&](i32 row) {
+                if (stop.stop_requested() || std::chrono::steady_clock::now() >= options.deadline) {
+                    return;
+                }
+                K k = kernel;
+                std::vector<ray> rays(usize(camera.width()));
+                primaryRays(camera, sampler, row, passes, pass, rays);
+                for (i32 col = 0; col < camera.width(); col++) {
+                    state->sum[row, col] = state->sum[row, col] + invokeKernel(k, rays[usize(col)], row, col, pass);
+                }
+                state->samples[usize(row)]++;
+                rows++;
+            });
+            state->progress.rows += rows;
+            state->progress.elapsed = std::chrono::steady_clock::now() - start;
+            if (rows != u64(count)) {
+                state->progress.status = stop.stop_requested() ? job_status::cancelled : job_status::timed_out;
+                co_return;
+            }
+            if (first + count == height) {
+                state->progress.passes++;
+                if (state->progress.passes == passes) {
+                    state->progress.status = job_status::finished;
+                    co_return;
+                }
+            }
+            if (stop.stop_requested()) {
+                state->progress.status = job_status::cancelled;
+                co_return;
+            }
+            co_yield state;
+        }
+    }
+}
+
+// As above with tracingKernel(), rendering `scene`, which must outlive
+// the job.
+RenderJob renderJob(Scene const& scene, Camera const& camera, render_job_options const& options = render_job_options())
+{
+    return renderJob(camera, options, tracingKernel(scene, camera, options.render.trace));
+}
+} // namespace raytracer
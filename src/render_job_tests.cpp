@@ -0,0 +1,126 @@
+import boost.ut;
+import raytracer;
+import raytracer.testing;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+using namespace raytracer::testing;
+
+namespace {
+constexpr i32 width = 40;
+constexpr i32 height = 30;
+
+// Rows of `image` that aren't entirely black.
+i32 litRows(Canvas<vec3> const& image)
+{
+    i32 lit = 0;
+    for (i32 row = 0; row < image.height(); row++) {
+        bool any = false;
+        for (i32 col = 0; col < image.width(); col++) {
+            any |= image[row, col] != zero<vec3>;
+        }
+        lit += any;
+    }
+    return lit;
+}
+} // namespace
+
+int main()
+{
+    feature("Render jobs") = [] {
+        auto scene = spheres();
+        auto view = camera(width, height);
+        render_job_options options;
+        options.render.samples_per_pixel = 4;
+        options.rows_per_step = 8;
+        auto white = [](ray const&, i32, i32) { return one<vec3>; };
+
+        then("A finished job gives render()'s image") = [&] {
+            auto job = renderJob(scene, view, options);
+            auto image = job.wait();
+            Canvas<vec3> expected(width, height);
+            render(scene, view, expected, options.render);
+            expect(std::equal(image.begin(), image.end(), expected.begin()));
+            expect(job.progress().status == job_status::finished);
+            expect(job.progress().passes == 4u && job.progress().fraction() == 1.0f);
+        };
+
+        then("Each step renders one band and reports it") = [&] {
+            auto job = renderJob(view, options, white);
+            expect(job.progress().rows == 0u && job.progress().total_rows == 4u * height);
+            u32 steps = 0;
+            f32 last = 0.0f;
+            bool more = true;
+            while (more) {
+                more = job.step();
+                steps++;
+                expect(job.progress().fraction() > last);
+                last = job.progress().fraction();
+                if (steps == 1) {
+                    expect(job.progress().rows == 8u && job.progress().passes == 0u);
+                    expect(litRows(job.image()) == 8);
+                }
+            }
+            // Four bands of at most eight rows per pass.
+            expect(steps == 16u) << steps;
+            expect(!job.step() && job.done());
+        };
+
+        then("Cancelled jobs keep what they rendered") = [&] {
+            auto job = renderJob(view, options, white);
+            expect(job.step() && job.step());
+            job.cancel();
+            expect(!job.step());
+            expect(job.progress().status == job_status::cancelled);
+            expect(job.progress().rows == 16u);
+            expect(litRows(job.image()) == 16);
+        };
+
+        then("Cancelling from another thread stops the render midway") = [&] {
+            render_job_options slow = options;
+            slow.rows_per_step = height;
+            std::atomic<u32> pixels = 0;
+            std::optional<RenderJob> job;
+            job.emplace(renderJob(view, slow, [&](ray const&, i32, i32) {
+                if (++pixels == 100) {
+                    job->cancel();
+                }
+                return one<vec3>;
+            }));
+            expect(!job->step());
+            expect(job->progress().status == job_status::cancelled);
+            expect(job->progress().rows < u64(height));
+        };
+
+        then("A passed deadline ends the job with the best image so far") = [&] {
+            // Two threads take far longer than the deadline.
+            ThreadPool pool(2);
+            render_job_options late = options;
+            late.render.pool = &pool;
+            late.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(50);
+            auto job = renderJob(view, late, [](ray const&, i32, i32) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                return one<vec3>;
+            });
+            auto image = job.wait();
+            expect(job.progress().status == job_status::timed_out);
+            expect(job.progress().fraction() < 1.0f);
+            // Rows are whole: each has all of its passes' samples or none.
+            for (i32 row = 0; row < height; row++) {
+                expect(image[row, 0] == image[row, width - 1]);
+                expect(image[row, 0] == zero<vec3> || image[row, 0] == one<vec3>);
+            }
+        };
+
+        then("Jobs may be moved and dropped midway") = [&] {
+            auto job = renderJob(scene, view, options);
+            expect(job.step());
+            RenderJob moved = std::move(job);
+            expect(job.done() && !moved.done());
+            expect(moved.step());
+            expect(moved.progress().rows == 16u);
+        };
+    };
+}
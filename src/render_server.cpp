@@ -0,0 +1,452 @@
+module;
+#include <unistd.h>
+export module raytracer.render_server;
+
+import raytracer.bvh;
+import raytracer.camera;
+import raytracer.canvas;
+import raytracer.render;
+import raytracer.sampler;
+import raytracer.scene;
+import raytracer.scene_cache;
+import raytracer.socket;
+import raytracer.tracer;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+// Render daemon protocol, over a Unix stream socket in host byte order.
+// Every message is a message_header and `size` bytes of payload:
+//
+//   render    client to server: render_request, then the scene cache path
+//   tile      server to client: pixel_tile, then rows * cols RGB f32 triples
+//   done      server to client: render_summary, after the last tile
+//   error     server to client: a message, instead of tiles or after some
+//   shutdown  client to server: no payload; the server stops serving
+//
+// A connection may carry any number of renders, one after another.
+constexpr u32 render_protocol_version = 1;
+
+enum class message_kind : u32 {
+    render = 1,
+    tile = 2,
+    done = 3,
+    error = 4,
+    shutdown = 5,
+};
+
+struct message_header {
+    message_kind kind;
+    u32 size;
+};
+
+// A camera, by where it is and what it looks at, and how to render.
+struct render_request {
+    u32 version = render_protocol_version;
+    i32 width = 0;
+    i32 height = 0;
+    f32 field_of_view = 1.0f;
+    vec3 from = vec3(0.0f, 0.0f, -5.0f);
+    vec3 to = vec3(0.0f, 0.0f, 0.0f);
+    vec3 up = vec3(0.0f, 1.0f, 0.0f);
+    u32 samples_per_pixel = 1;
+    u32 seed = 0;
+    u32 max_depth = 32;
+    // Rows per streamed tile.
+    i32 rows_per_tile = 16;
+};
+
+struct render_summary {
+    u32 tiles = 0;
+    // Whether the scene was already loaded, so only rendering was left.
+    u32 warm = 0;
+    // Wall-clock nanoseconds spent loading the scene and rendering it.
+    u64 setup_ns = 0;
+    u64 render_ns = 0;
+};
+
+static_assert(sizeof(message_header) == 8);
+static_assert(sizeof(render_request) == 68);
+static_assert(sizeof(pixel_tile) == 16);
+static_assert(sizeof(render_summary) == 24);
+
+struct render_server_settings {
+    // Rendering threads, the serving thread included.
+    u32 threads = defaultThreadCount();
+    // Scenes kept loaded; the least recently used one goes first.
+    usize max_scenes = 8;
+    // Connections are served one at a time, so a client that sends
+    // nothing for this long, or stalls partway through a message, is
+    // dropped to let the next one in. Zero waits forever.
+    std::chrono::milliseconds idle_timeout = std::chrono::seconds(30);
+    // Largest image, tile, sample count and ray depth a request may ask
+    // for; bigger ones are refused, so one request can't hold the server
+    // indefinitely.
+    i32 max_width = 16384;
+    i32 max_height = 16384;
+    i32 max_rows_per_tile = 1024;
+    u32 max_samples_per_pixel = 4096;
+    u32 max_depth = 64;
+};
+
+struct render_server_stats {
+    u64 connections = 0;
+    u64 jobs = 0;
+    u64 scene_loads = 0;
+    u64 scene_hits = 0;
+    u64 tiles = 0;
+};
+
+// Long-lived render server on a Unix domain socket. Scenes are named by
+// the path of a scene cache (see writeSceneCache()); each one is mapped
+// and loaded on first use and kept, BVH and all, for later jobs until the
+// file changes or more than max_scenes are wanted. The thread pool also
+// lives as long as the server, so a repeated render of a warm scene goes
+// straight to tracing. Rows stream back in tiles as they are finished.
+class RenderServer {
+public:
+    // Listens on `socket_path`, replacing whatever socket file is there.
+    explicit RenderServer(std::string socket_path, render_server_settings const& settings = render_server_settings())
+        : m_socket_path(std::move(socket_path))
+        , m_settings(settings)
+        , m_pool(settings.threads)
+        , m_listener(listenOn(m_socket_path))
+    {
+    }
+
+    RenderServer(RenderServer const&) = delete;
+    RenderServer& operator=(RenderServer const&) = delete;
+
+    ~RenderServer()
+    {
+        ::unlink(m_socket_path.c_str());
+    }
+
+    [[nodiscard]] std::string const& socketPath() const
+    {
+        return m_socket_path;
+    }
+
+    // Serves clients, one connection at a time, until stop() is called or
+    // a client sends shutdown. Idle clients are dropped after
+    // idle_timeout.
+    void serve()
+    {
+        while (!m_stopping) {
+            if (!readable(m_listener.get(), poll_interval_ms)) {
+                continue;
+            }
+            auto client = acceptFrom(m_listener);
+            if (client.get() < 0) {
+                continue;
+            }
+            update([](auto& s) { s.connections++; });
+            try {
+                setTimeout(client.get(), m_settings.idle_timeout);
+                converse(client.get());
+            } catch (std::exception const&) {
+                // The client went away; serve the next one.
+            }
+        }
+    }
+
+    // Makes serve() return within a poll interval. Thread-safe.
+    void stop()
+    {
+        m_stopping = true;
+    }
+
+    [[nodiscard]] render_server_stats stats() const
+    {
+        std::scoped_lock lock(m_stats_mutex);
+        return m_stats;
+    }
+
+private:
+    static constexpr int poll_interval_ms = 50;
+    // Requests are a render_request and a path.
+    static constexpr u32 max_request_size = 1u << 16;
+
+    struct loaded_scene {
+        std::filesystem::file_time_type modified;
+        std::unique_ptr<SceneCache> cache;
+        std::unique_ptr<Scene> scene;
+        u64 last_used = 0;
+    };
+
+    std::string m_socket_path;
+    render_server_settings m_settings;
+    ThreadPool m_pool;
+    Descriptor m_listener;
+    std::atomic<bool> m_stopping = false;
+    std::unordered_map<std::string, loaded_scene> m_scenes;
+    u64 m_clock = 0;
+    mutable std::mutex m_stats_mutex;
+    render_server_stats m_stats;
+
+    template<typename F>
+    void update(F const& f)
+    {
+        std::scoped_lock lock(m_stats_mutex);
+        f(m_stats);
+    }
+
+    void converse(int fd)
+    {
+        auto last_message = std::chrono::steady_clock::now();
+        while (!m_stopping) {
+            if (!readable(fd, poll_interval_ms)) {
+                if (m_settings.idle_timeout.count() != 0 && std::chrono::steady_clock::now() - last_message >= m_settings.idle_timeout) {
+                    return;
+                }
+                continue;
+            }
+            message_header header;
+            if (!receiveAll(fd, &header, sizeof(header))) {
+                return;
+            }
+            if (header.size > max_request_size) {
+                sendError(fd, "request too large");
+                return;
+            }
+            std::vector<char> payload(header.size);
+            if (!payload.empty() && !receiveAll(fd, payload.data(), payload.size())) {
+                return;
+            }
+            switch (header.kind) {
+            case message_kind::render:
+                try {
+                    serveRender(fd, payload);
+                } catch (std::runtime_error const& e) {
+                    sendError(fd, e.what());
+                }
+                last_message = std::chrono::steady_clock::now();
+                break;
+            case message_kind::shutdown:
+                m_stopping = true;
+                return;
+            default:
+                sendError(fd, "unexpected message");
+                return;
+            }
+        }
+    }
+
+    void serveRender(int fd, std::vector<char> const& payload)
+    {
+        render_request request;
+        if (payload.size() < sizeof(request)) {
+            throw std::runtime_error("truncated render request");
+        }
+        std::memcpy(&request, payload.data(), sizeof(request));
+        if (request.version != render_protocol_version) {
+            throw std::runtime_error(std::format("protocol version {}, expected {}", request.version, render_protocol_version));
+        }
+        if (request.width <= 0 || request.height <= 0) {
+            throw std::runtime_error("empty image");
+        }
+        if (request.width > m_settings.max_width || request.height > m_settings.max_height) {
+            throw std::runtime_error(std::format(
+                "{}x{} image, at most {}x{} allowed",
+                request.width, request.height, m_settings.max_width, m_settings.max_height));
+        }
+        if (request.rows_per_tile > m_settings.max_rows_per_tile) {
+            throw std::runtime_error(std::format("{} rows per tile, at most {} allowed", request.rows_per_tile, m_settings.max_rows_per_tile));
+        }
+        if (request.samples_per_pixel > m_settings.max_samples_per_pixel) {
+            throw std::runtime_error(std::format("{} samples per pixel, at most {} allowed", request.samples_per_pixel, m_settings.max_samples_per_pixel));
+        }
+        if (request.max_depth > m_settings.max_depth) {
+            throw std::runtime_error(std::format("ray depth {}, at most {} allowed", request.max_depth, m_settings.max_depth));
+        }
+        std::string scene_path(payload.begin() + sizeof(request), payload.end());
+
+        auto start = std::chrono::steady_clock::now();
+        bool warm = false;
+        Scene const& scene = sceneAt(scene_path, warm);
+        auto loaded = std::chrono::steady_clock::now();
+
+        Camera camera(request.width, request.height, request.field_of_view, viewTransform(request.from, request.to, request.up));
+        render_options options;
+        options.pool = &m_pool;
+        options.samples_per_pixel = std::max(request.samples_per_pixel, 1u);
+        options.seed = request.seed;
+        options.trace.max_depth = request.max_depth;
+        options.trace.seed = request.seed;
+        Sampler sampler(options.sampler, options.seed);
+        auto kernel = tracingKernel(scene, camera, options.trace);
+
+        render_summary summary;
+        i32 band = std::max(request.rows_per_tile, 1);
+        std::vector<vec3> pixels;
+        for (i32 first = 0; first < request.height; first += band) {
+            pixel_tile tile;
+            tile.row = first;
+            tile.col = 0;
+            tile.rows = std::min(band, request.height - first);
+            tile.cols = request.width;
+            pixels.resize(usize(tile.rows) * usize(tile.cols));
+            forEachRow(options, first, tile.rows, [&](i32 row) {
+                auto k = kernel;
+                renderRow(camera, sampler, options.samples_per_pixel, k, row, std::span(pixels).subspan(usize(row - first) * usize(tile.cols), usize(tile.cols)));
+            });
+            sendMessage(fd, message_kind::tile, &tile, sizeof(tile), pixels.data(), pixels.size() * sizeof(vec3));
+            summary.tiles++;
+        }
+
+        auto done = std::chrono::steady_clock::now();
+        summary.warm = warm;
+        summary.setup_ns = static_cast<u64>(std::chrono::nanoseconds(loaded - start).count());
+        summary.render_ns = static_cast<u64>(std::chrono::nanoseconds(done - loaded).count());
+        sendMessage(fd, message_kind::done, &summary, sizeof(summary));
+        update([&](auto& s) {
+            s.jobs++;
+            s.tiles += summary.tiles;
+        });
+    }
+
+    // The scene cached at `path`, loaded unless it already is and the file
+    // hasn't changed since.
+    Scene const& sceneAt(std::string const& path, bool& warm)
+    {
+        std::error_code error;
+        auto modified = std::filesystem::last_write_time(path, error);
+        if (error) {
+            throw std::runtime_error("cannot open " + path);
+        }
+        auto it = m_scenes.find(path);
+        warm = it != m_scenes.end() && it->second.modified == modified;
+        if (!warm) {
+            if (it != m_scenes.end()) {
+                m_scenes.erase(it);
+            }
+            evict(std::max<usize>(m_settings.max_scenes, 1) - 1);
+            loaded_scene entry;
+            entry.modified = modified;
+            entry.cache = std::make_unique<SceneCache>(path);
+            entry.scene = std::make_unique<Scene>();
+            entry.cache->load(*entry.scene);
+            it = m_scenes.emplace(path, std::move(entry)).first;
+        }
+        it->second.last_used = ++m_clock;
+        update([&](auto& s) { (warm ? s.scene_hits : s.scene_loads)++; });
+        return *it->second.scene;
+    }
+
+    // Drops the least recently used scenes until at most `count` are left.
+    void evict(usize count)
+    {
+        while (m_scenes.size() > count) {
+            auto oldest = std::ranges::min_element(m_scenes, {}, [](auto const& entry) { return entry.second.last_used; });
+            m_scenes.erase(oldest);
+        }
+    }
+
+    // Throws before sending anything if the payload doesn't fit the
+    // header's size field.
+    static void sendMessage(int fd, message_kind kind, void const* data, usize size, void const* more = nullptr, usize more_size = 0)
+    {
+        if (size + more_size > std::numeric_limits<u32>::max()) {
+            throw std::runtime_error("message too large");
+        }
+        message_header header;
+        header.kind = kind;
+        header.size = static_cast<u32>(size + more_size);
+        sendAll(fd, &header, sizeof(header));
+        sendAll(fd, data, size);
+        if (more_size != 0) {
+            sendAll(fd, more, more_size);
+        }
+    }
+
+    static void sendError(int fd, std::string const& message)
+    {
+        sendMessage(fd, message_kind::error, message.data(), message.size());
+    }
+};
+
+struct render_result {
+    Canvas<vec3> image;
+    render_summary summary;
+};
+
+// Connection to a RenderServer.
+class RenderClient {
+public:
+    explicit RenderClient(std::string const& socket_path)
+        : m_socket(connectTo(socket_path))
+    {
+    }
+
+    // Renders the scene cached at `scene_path`, a path the server can
+    // open, calling on_tile(tile, image) as each tile lands in the image.
+    // Throws with the server's message if it fails.
+    render_result render(std::string const& scene_path, render_request const& request, std::function<void(pixel_tile const&, Canvas<vec3> const&)> const& on_tile = {})
+    {
+        message_header header;
+        header.kind = message_kind::render;
+        header.size = static_cast<u32>(sizeof(request) + scene_path.size());
+        sendAll(m_socket.get(), &header, sizeof(header));
+        sendAll(m_socket.get(), &request, sizeof(request));
+        sendAll(m_socket.get(), scene_path.data(), scene_path.size());
+
+        render_result result { Canvas<vec3>(request.width, request.height), render_summary() };
+        std::vector<char> payload;
+        while (true) {
+            if (!receiveAll(m_socket.get(), &header, sizeof(header))) {
+                throw std::runtime_error("render server closed the connection");
+            }
+            payload.resize(header.size);
+            if (!payload.empty()) {
+                receiveAll(m_socket.get(), payload.data(), payload.size());
+            }
+            switch (header.kind) {
+            case message_kind::tile: {
+                pixel_tile tile;
+                if (payload.size() < sizeof(tile)) {
+                    throw std::runtime_error("render server sent a truncated tile");
+                }
+                std::memcpy(&tile, payload.data(), sizeof(tile));
+                auto pixel_count = usize(tile.rows) * usize(tile.cols);
+                if (tile.row < 0 || tile.col < 0 || tile.rows < 0 || tile.cols < 0
+                    || tile.row + tile.rows > request.height || tile.col + tile.cols > request.width
+                    || payload.size() != sizeof(tile) + pixel_count * sizeof(vec3)) {
+                    throw std::runtime_error("render server sent a corrupt tile");
+                }
+                auto pixels = payload.data() + sizeof(tile);
+                for (i32 row = 0; row < tile.rows; row++) {
+                    std::memcpy(&result.image[tile.row + row, tile.col], pixels + usize(row) * usize(tile.cols) * sizeof(vec3), usize(tile.cols) * sizeof(vec3));
+                }
+                if (on_tile) {
+                    on_tile(tile, result.image);
+                }
+                break;
+            }
+            case message_kind::done:
+                if (payload.size() != sizeof(render_summary)) {
+                    throw std::runtime_error("render server sent a corrupt summary");
+                }
+                std::memcpy(&result.summary, payload.data(), sizeof(render_summary));
+                return result;
+            case message_kind::error:
+                throw std::runtime_error("render server: " + std::string(payload.begin(), payload.end()));
+            default:
+                throw std::runtime_error("render server sent an unexpected message");
+            }
+        }
+    }
+
+    // Asks the server to stop serving once this connection is done.
+    void shutdown()
+    {
+        message_header header;
+        header.kind = message_kind::shutdown;
+        header.size = 0;
+        sendAll(m_socket.get(), &header, sizeof(header));
+    }
+
+private:
+    Descriptor m_socket;
+};
+} // namespace raytracer
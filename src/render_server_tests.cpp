@@ -0,0 +1,131 @@
+import boost.ut;
+import raytracer;
+import raytracer.testing;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+using namespace raytracer::testing;
+
+namespace {
+std::string temporary(std::string const& name)
+{
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+render_request requestFrom(vec3 const& from)
+{
+    render_request request;
+    request.width = 40;
+    request.height = 30;
+    request.from = from;
+    request.samples_per_pixel = 2;
+    request.rows_per_tile = 8;
+    return request;
+}
+
+// What the server should send back for `request`.
+Canvas<vec3> expected(Scene const& scene, render_request const& request)
+{
+    Camera camera(request.width, request.height, request.field_of_view, viewTransform(request.from, request.to, request.up));
+    render_options options;
+    options.samples_per_pixel = request.samples_per_pixel;
+    options.seed = request.seed;
+    options.trace.max_depth = request.max_depth;
+    options.trace.seed = request.seed;
+    Canvas<vec3> image(request.width, request.height);
+    render(scene, camera, image, options);
+    return image;
+}
+} // namespace
+
+int main()
+{
+    feature("Render server") = [] {
+        auto scene_path = temporary("raytracer_render_server_tests.cache");
+        auto other_path = temporary("raytracer_render_server_tests_other.cache");
+        auto scene = spheres();
+        auto other = spheres(vec3(1.2f, 1.5f, 0));
+        writeSceneCache(scene, scene_path);
+        writeSceneCache(other, other_path);
+
+        render_server_settings settings;
+        settings.threads = 4;
+        settings.max_scenes = 1;
+        settings.idle_timeout = std::chrono::milliseconds(300);
+        settings.max_width = 64;
+        settings.max_height = 64;
+        settings.max_rows_per_tile = 16;
+        settings.max_samples_per_pixel = 8;
+        settings.max_depth = 32;
+        RenderServer server(temporary("raytracer_render_server_tests.sock"), settings);
+        std::jthread serving([&] { server.serve(); });
+        std::optional<RenderClient> client(std::in_place, server.socketPath());
+
+        then("Tiles stream back into the image a local render gives") = [&] {
+            auto request = requestFrom(vec3(0, 1.5f, -6));
+            std::vector<i32> rows;
+            auto result = client->render(scene_path, request, [&](pixel_tile const& tile, Canvas<vec3> const&) {
+                expect(tile.col == 0 && tile.cols == request.width);
+                rows.push_back(tile.row);
+            });
+            expect(rows == std::vector<i32> { 0, 8, 16, 24 });
+            expect(result.summary.tiles == 4u && result.summary.warm == 0u);
+            expect(same(result.image, expected(scene, request)));
+        };
+
+        then("A new viewpoint of the same scene skips loading it") = [&] {
+            auto request = requestFrom(vec3(2, 3, -5));
+            auto result = client->render(scene_path, request);
+            expect(result.summary.warm == 1u);
+            expect(same(result.image, expected(scene, request)));
+            auto stats = server.stats();
+            expect(stats.scene_loads == 1u && stats.scene_hits == 1u) << stats.scene_loads << stats.scene_hits;
+        };
+
+        then("Changed files and evicted scenes are loaded again") = [&] {
+            auto request = requestFrom(vec3(0, 1.5f, -6));
+            expect(client->render(other_path, request).summary.warm == 0u);
+            expect(same(client->render(other_path, request).image, expected(other, request)));
+            // Only one scene fits.
+            expect(client->render(scene_path, request).summary.warm == 0u);
+            std::filesystem::last_write_time(scene_path, std::filesystem::last_write_time(scene_path) + std::chrono::seconds(1));
+            expect(client->render(scene_path, request).summary.warm == 0u);
+            expect(server.stats().scene_loads == 4u);
+        };
+
+        then("Failed jobs report why and leave the connection usable") = [&] {
+            auto request = requestFrom(vec3(0, 1.5f, -6));
+            expect(throws([&] { (void)client->render(temporary("raytracer_render_server_tests.missing"), request); }));
+            request.width = 0;
+            expect(throws([&] { (void)client->render(scene_path, request); }));
+            request.width = 65;
+            expect(throws([&] { (void)client->render(scene_path, request); }));
+            request.width = 40;
+            request.rows_per_tile = 17;
+            expect(throws([&] { (void)client->render(scene_path, request); }));
+            request.rows_per_tile = 8;
+            request.samples_per_pixel = 0xffffffffu;
+            expect(throws([&] { (void)client->render(scene_path, request); }));
+            request.samples_per_pixel = 2;
+            request.max_depth = 33;
+            expect(throws([&] { (void)client->render(scene_path, request); }));
+            expect(client->render(scene_path, requestFrom(vec3(0, 1.5f, -6))).summary.tiles == 4u);
+        };
+
+        then("Idle clients make way until one shuts the server down") = [&] {
+            // The first client stays connected but sends nothing.
+            RenderClient second(server.socketPath());
+            expect(second.render(scene_path, requestFrom(vec3(0, 1.5f, -6))).summary.warm == 1u);
+            expect(throws([&] { (void)client->render(scene_path, requestFrom(vec3(0, 1.5f, -6))); }));
+            client.reset();
+            second.shutdown();
+            serving.join();
+            expect(server.stats().connections == 2u);
+        };
+
+        std::filesystem::remove(scene_path);
+        std::filesystem::remove(other_path);
+    };
+}
@@ -0,0 +1,181 @@
+import boost.ut;
+import raytracer;
+import raytracer.testing;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+using namespace raytracer::testing;
+
+namespace {
+constexpr i32 width = 48;
+constexpr i32 height = 32;
+
+// A mirror ball and a glass ball on a floor, lit by one light.
+Scene glassSpheres()
+{
+    Scene scene;
+    material floor;
+    floor.color = vec3(0.8f, 0.8f, 0.7f);
+    material mirror;
+    mirror.color = vec3(0.2f);
+    mirror.reflective = 0.8f;
+    material glass;
+    glass.color = vec3(0.1f);
+    glass.transparency = 0.9f;
+    glass.refractive_index = 1.5f;
+    for (auto [center, radius, m] : { std::tuple(vec3(0, -1001, 0), 1000.0f, floor), std::tuple(vec3(-1, 0, 1), 1.0f, mirror), std::tuple(vec3(1.2f, 0, 0), 1.0f, glass) }) {
+        addSphere(scene, center, radius, m);
+    }
+    scene.lights.push_back(point_light(vec3(-5, 8, -6), one<vec3>));
+    scene.build();
+    return scene;
+}
+} // namespace
+
+int main()
+{
+    feature("Thread pools") = [] {
+        then("Every task of every batch runs once") = [] {
+            ThreadPool pool(4);
+            expect(pool.size() == 4u);
+            std::vector<std::atomic<u32>> runs(1000);
+            auto task = [&](u32 i) { runs[i]++; };
+            for (u32 batch = 0; batch < 50; batch++) {
+                pool.forEach(static_cast<u32>(runs.size()), task);
+            }
+            expect(std::ranges::all_of(runs, [](auto const& n) { return n == 50u; }));
+        };
+
+        then("A pool of one runs everything on the caller") = [] {
+            ThreadPool pool(1);
+            auto caller = std::this_thread::get_id();
+            bool elsewhere = false;
+            auto task = [&](u32) { elsewhere |= std::this_thread::get_id() != caller; };
+            pool.forEach(100, task);
+            expect(pool.size() == 1u && !elsewhere);
+        };
+
+        then("Batches from several threads take turns") = [] {
+            ThreadPool pool(3);
+            std::atomic<u32> total = 0;
+            {
+                std::vector<std::jthread> callers;
+                for (u32 i = 0; i < 4; i++) {
+                    callers.emplace_back([&] {
+                        auto task = [&](u32) { total++; };
+                        for (u32 batch = 0; batch < 20; batch++) {
+                            pool.forEach(64, task);
+                        }
+                    });
+                }
+            }
+            expect(total == 4u * 20u * 64u) << total.load();
+        };
+    };
+
+    feature("Rendering") = [] {
+        auto scene = glassSpheres();
+        auto view = camera(width, height);
+
+        then("Every policy gives the same image") = [&] {
+            std::optional<Canvas<vec3>> first;
+            ThreadPool pool(4);
+            for (auto policy : { execution_policy::serial, execution_policy::parallel, execution_policy::thread_pool }) {
+                render_options options;
+                options.policy = policy;
+                options.pool = &pool;
+                options.samples_per_pixel = 4;
+                options.trace.roulette_depth = 0;
+                Canvas<vec3> image(width, height);
+                render(scene, view, image, options);
+                if (!first) {
+                    first.emplace(std::move(image));
+                } else {
+                    expect(same(image, *first)) << nameOf(policy);
+                }
+            }
+        };
+
+        then("It matches the ray tracer's own loop") = [&] {
+            Canvas<vec3> image(width, height);
+            render(scene, view, image);
+            Canvas<vec3> expected(width, height);
+            RayTracer().render(scene, view, expected);
+            // Rays are stepped along rows rather than computed per pixel,
+            // which may tip the odd grazing ray the other way.
+            u32 close = 0;
+            for (i32 i = 0; i < image.size(); i++) {
+                auto d = image.begin()[i] - expected.begin()[i];
+                close += std::max({ std::abs(d.x), std::abs(d.y), std::abs(d.z) }) < 1e-3f;
+            }
+            expect(close >= u32(image.size()) - 4u) << close;
+        };
+
+        then("Kernels see each pixel's centre ray") = [&] {
+            Canvas<vec3> image(width, height);
+            render(view, image, render_options(), [&](ray const& r, i32 row, i32 col) {
+                auto expected = view(row, col);
+                return vec3(f32(row), f32(col), (r.d - expected.d).length());
+            });
+            for (i32 row = 0; row < height; row++) {
+                for (i32 col = 0; col < width; col++) {
+                    expect(image[row, col].x == f32(row) && image[row, col].y == f32(col) && image[row, col].z < 1e-6f);
+                }
+            }
+        };
+
+        then("Several samples average rays spread over the pixel") = [&] {
+            render_options options;
+            options.samples_per_pixel = 16;
+            Canvas<vec3> image(width, height);
+            // Which side of a vertical line through the middle of column 10
+            // each ray passes, in camera space.
+            auto slope = [&](ray const& r) {
+                auto local = view.view() * vec4(r.d.x, r.d.y, r.d.z, 0.0f);
+                return local.x / -local.z;
+            };
+            f32 line = slope(view(0, 10));
+            render(view, image, options, [&](ray const& r, i32, i32) { return vec3(slope(r) > line ? 1.0f : 0.0f); });
+            expect(image[5, 9].x == 1.0f && image[5, 11].x == 0.0f);
+            expect(image[5, 10].x > 0.25f && image[5, 10].x < 0.75f) << image[5, 10].x;
+        };
+
+        then("Kernels may take the index of each pixel's sample") = [&] {
+            render_options options;
+            options.samples_per_pixel = 4;
+            Canvas<vec3> image(width, height);
+            render(view, image, options, [](ray const&, i32, i32, u32 sample = 0) { return vec3(f32(sample)); });
+            expect(std::ranges::all_of(image, [](vec3 const& v) { return v.x == 1.5f; }));
+        };
+
+        then("A pixel's samples play their own roulette") = [&] {
+            trace_settings settings;
+            settings.roulette_threshold = 1.0f;
+            settings.roulette_depth = 0;
+            auto kernel = tracingKernel(scene, view, settings);
+            // A pixel on the mirror ball, whose reflections play.
+            i32 row = height / 2;
+            i32 col = 0;
+            while (col < width && !(scene.intersect(view(row, col)) && scene.intersect(view(row, col))->object_id == 1)) {
+                col++;
+            }
+            expect(col < width);
+            auto r = view(row, col);
+            std::set<f32> values;
+            for (u32 sample = 0; sample < 16; sample++) {
+                values.insert(kernel(r, row, col, sample).x);
+            }
+            expect(values.size() > 1u) << values.size();
+        };
+
+        then("Kernel copies keep their own state") = [&] {
+            Canvas<vec3> image(width, height);
+            render(view, image, render_options(), [calls = 0](ray const&, i32, i32) mutable { return vec3(f32(calls++)); });
+            for (i32 col = 0; col < width; col++) {
+                expect(image[height - 1, col].x == f32(col));
+            }
+        };
+    };
+}
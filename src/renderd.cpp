@@ -0,0 +1,50 @@
+import std;
+import raytracer;
+
+using namespace raytracer;
+
+// Render daemon and its client:
+//
+//   renderd serve <socket>
+//   renderd render <socket> <scene cache> <output.pam> [width height samples]
+//   renderd stop <socket>
+//
+// The scene cache path is opened by the daemon, so make it absolute when
+// the two run in different directories.
+int main(int argc, char** argv)
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+    try {
+        if (args.size() == 2 && args[0] == "serve") {
+            RenderServer server(args[1]);
+            std::println("serving on {}", server.socketPath());
+            server.serve();
+            return 0;
+        }
+        if (args.size() == 2 && args[0] == "stop") {
+            RenderClient(args[1]).shutdown();
+            return 0;
+        }
+        if ((args.size() == 4 || args.size() == 7) && args[0] == "render") {
+            render_request request;
+            request.width = args.size() == 7 ? std::stoi(args[4]) : 640;
+            request.height = args.size() == 7 ? std::stoi(args[5]) : 480;
+            request.samples_per_pixel = args.size() == 7 ? static_cast<u32>(std::stoul(args[6])) : 1;
+            request.from = vec3(0, 1.5f, -5);
+            RenderClient client(args[1]);
+            auto result = client.render(args[2], request, [&](pixel_tile const& tile, Canvas<vec3> const&) {
+                std::print(std::cout, "\r{}/{} rows", tile.row + tile.rows, request.height);
+                std::cout.flush();
+            });
+            std::println(std::cout, "\n{} in {} ms, setup {} ms", result.summary.warm ? "warm" : "cold",
+                f64(result.summary.render_ns) / 1e6, f64(result.summary.setup_ns) / 1e6);
+            writePAM(result.image, args[3]);
+            return 0;
+        }
+    } catch (std::exception const& e) {
+        std::println(std::cerr, "renderd: {}", e.what());
+        return 1;
+    }
+    std::println(std::cerr, "usage: renderd serve <socket> | render <socket> <scene cache> <output.pam> [width height samples] | stop <socket>");
+    return 2;
+}
@@ -0,0 +1,309 @@
+export module raytracer.sampler;
+
+import raytracer.constants;
+import raytracer.random;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+namespace raytracer {
+constexpr u32 sobol_dimensions = 4;
+constexpr u32 sobol_bits = 32;
+
+// Direction numbers for the first Sobol dimensions from their primitive
+// polynomials and initial values (Joe and Kuo 2008), computed at compile
+// time.
+constexpr std::array<std::array<u32, sobol_bits>, sobol_dimensions> sobolDirections()
+{
+    struct polynomial {
+        u32 degree;
+        u32 coefficients;
+        std::array<u32, 3> initial;
+    };
+    constexpr std::array<polynomial, sobol_dimensions - 1> polynomials { {
+        { 1, 0, { 1, 0, 0 } },
+        { 2, 1, { 1, 3, 0 } },
+        { 3, 1, { 1, 3, 1 } },
+    } };
+
+    std::array<std::array<u32, sobol_bits>, sobol_dimensions> directions {};
+    for (u32 k = 0; k < sobol_bits; k++) {
+        directions[0][k] = 1u << (31 - k);
+    }
+    for (u32 d = 1; d < sobol_dimensions; d++) {
+        auto const& p = polynomials[d - 1];
+        auto& v = directions[d];
+        for (u32 k = 0; k < sobol_bits; k++) {
+            if (k < p.degree) {
+                v[k] = p.initial[k] << (31 - k);
+                continue;
+            }
+            v[k] = v[k - p.degree] ^ (v[k - p.degree] >> p.degree);
+            for (u32 j = 1; j < p.degree; j++) {
+                if ((p.coefficients >> (p.degree - 1 - j)) & 1) {
+                    v[k] ^= v[k - j];
+                }
+            }
+        }
+    }
+    return directions;
+}
+
+constexpr auto sobol_directions = sobolDirections();
+
+// For each dimension and each byte of an index, the XOR of the direction
+// numbers that byte's set bits select, so a point takes four lookups
+// instead of a loop over the index bits.
+constexpr auto sobol_byte_tables = [] {
+    std::array<std::array<std::array<u32, 256>, 4>, sobol_dimensions> tables {};
+    for (u32 d = 0; d < sobol_dimensions; d++) {
+        for (u32 byte = 0; byte < 4; byte++) {
+            for (u32 value = 0; value < 256; value++) {
+                u32 x = 0;
+                for (u32 bit = 0; bit < 8; bit++) {
+                    if (value & (1u << bit)) {
+                        x ^= sobol_directions[d][byte * 8 + bit];
+                    }
+                }
+                tables[d][byte][value] = x;
+            }
+        }
+    }
+    return tables;
+}();
+
+constexpr u32 reverseBits(u32 x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+constexpr f32 toUnit(u32 x)
+{
+    return f32(x >> 8) * 0x1p-24f;
+}
+} // namespace raytracer
+
+export namespace raytracer {
+// Point `index` of the Sobol sequence in dimension `dimension`, as a
+// 32-bit fixed-point fraction. Only the first four dimensions are tabled.
+[[nodiscard]] constexpr u32 sobol(u32 index, u32 dimension)
+{
+    auto const& tables = sobol_byte_tables[dimension];
+    return tables[0][index & 0xff] ^ tables[1][(index >> 8) & 0xff] ^ tables[2][(index >> 16) & 0xff] ^ tables[3][index >> 24];
+}
+
+// Owen scrambling of a fixed-point fraction: every bit is flipped based on
+// a hash of the bits above it, which keeps the stratification of Sobol
+// points while decorrelating differently seeded copies (Burley 2020).
+[[nodiscard]] constexpr u32 owenScramble(u32 x, u32 seed)
+{
+    x = reverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverseBits(x);
+}
+
+// Tileable blue-noise threshold map made with the void-and-cluster method
+// (Ulichney 1993): the values are a permutation of the size^2 ranks, and
+// neighbouring texels differ more than in white noise.
+class BlueNoise {
+public:
+    static constexpr u32 size = 64;
+
+    BlueNoise()
+    {
+        constexpr u32 n = size * size;
+        constexpr f32 sigma = 1.5f;
+        std::array<f32, n> kernel;
+        for (u32 y = 0; y < size; y++) {
+            for (u32 x = 0; x < size; x++) {
+                f32 dx = f32(std::min(x, size - x));
+                f32 dy = f32(std::min(y, size - y));
+                kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+            }
+        }
+        std::vector<u8> pattern(n, 0);
+        std::vector<f32> energy(n, 0.0f);
+        auto toggle = [&](u32 p, bool on) {
+            pattern[p] = on;
+            f32 sign = on ? 1.0f : -1.0f;
+            u32 px = p % size, py = p / size;
+            for (u32 y = 0; y < size; y++) {
+                for (u32 x = 0; x < size; x++) {
+                    energy[y * size + x] += sign * kernel[((y - py) % size) * size + (x - px) % size];
+                }
+            }
+        };
+        // Densest set pixel, or emptiest unset one.
+        auto tightestCluster = [&] {
+            u32 best = 0;
+            f32 best_energy = -std::numeric_limits<f32>::infinity();
+            for (u32 p = 0; p < n; p++) {
+                if (pattern[p] && energy[p] > best_energy) {
+                    best = p, best_energy = energy[p];
+                }
+            }
+            return best;
+        };
+        auto largestVoid = [&] {
+            u32 best = 0;
+            f32 best_energy = std::numeric_limits<f32>::infinity();
+            for (u32 p = 0; p < n; p++) {
+                if (!pattern[p] && energy[p] < best_energy) {
+                    best = p, best_energy = energy[p];
+                }
+            }
+            return best;
+        };
+
+        // Initial pattern: a tenth of the pixels set at random, then
+        // relaxed by moving the tightest cluster into the largest void.
+        u32 initial_count = n / 10;
+        for (u32 i = 0, state = 0x9e3779b9u; i < initial_count;) {
+            state = pcgHash(state);
+            if (!pattern[state % n]) {
+                toggle(state % n, true);
+                i++;
+            }
+        }
+        while (true) {
+            auto cluster = tightestCluster();
+            toggle(cluster, false);
+            auto hole = largestVoid();
+            toggle(hole, true);
+            if (hole == cluster) {
+                break;
+            }
+        }
+        auto initial_pattern = pattern;
+        auto initial_energy = energy;
+
+        std::vector<u32> ranks(n);
+        for (u32 rank = initial_count; rank-- > 0;) {
+            auto cluster = tightestCluster();
+            toggle(cluster, false);
+            ranks[cluster] = rank;
+        }
+        pattern = std::move(initial_pattern);
+        energy = std::move(initial_energy);
+        for (u32 rank = initial_count; rank < n; rank++) {
+            auto hole = largestVoid();
+            toggle(hole, true);
+            ranks[hole] = rank;
+        }
+        for (u32 p = 0; p < n; p++) {
+            m_values[p] = (f32(ranks[p]) + 0.5f) / f32(n);
+        }
+    }
+
+    // Threshold in (0, 1) at texel (x, y), wrapping around.
+    [[nodiscard]] f32 operator()(u32 x, u32 y) const
+    {
+        return m_values[(y % size) * size + x % size];
+    }
+
+private:
+    std::array<f32, size * size> m_values;
+};
+
+// The shared map, built on first use. Thread-safe.
+[[nodiscard]] BlueNoise const& blueNoise()
+{
+    static BlueNoise const noise;
+    return noise;
+}
+
+enum class sampler_kind : u32 {
+    // Hashed white noise.
+    independent,
+    // Owen-scrambled Sobol points, scrambled anew in every pixel.
+    sobol,
+    // One Owen-scrambled Sobol point set shared by all pixels and shifted
+    // per pixel by blue noise, so the remaining error looks like blue
+    // noise across the image.
+    blue_noise,
+};
+
+[[nodiscard]] constexpr std::string_view nameOf(sampler_kind kind)
+{
+    switch (kind) {
+    case sampler_kind::independent:
+        return "independent";
+    case sampler_kind::sobol:
+        return "sobol";
+    case sampler_kind::blue_noise:
+        return "blue noise";
+    }
+    return "unknown";
+}
+
+// Sample values as a pure function of pixel, sample index and dimension,
+// with no generator state: each thread or queued path just carries its
+// counters, and the only shared data are read-only tables. Dimensions are
+// drawn four at a time; each group of four is a separately scrambled 4D
+// Sobol point set, so consecutive samples of a pixel stratify every group.
+class Sampler {
+public:
+    explicit Sampler(sampler_kind kind = sampler_kind::sobol, u32 seed = 0)
+        : m_kind(kind)
+        , m_seed(pcgHash(seed))
+    {
+        if (kind == sampler_kind::blue_noise) {
+            m_noise = &blueNoise();
+        }
+    }
+
+    [[nodiscard]] sampler_kind kind() const
+    {
+        return m_kind;
+    }
+
+    // Dimensions [group * 4, group * 4 + 4) of sample `index` in `pixel`.
+    [[nodiscard]] vec4 get4D(uvec2 pixel, u32 index, u32 group) const
+    {
+        u32 pixel_seed = pcgHash(pixel.x ^ pcgHash(pixel.y ^ m_seed));
+        switch (m_kind) {
+        case sampler_kind::independent: {
+            u32 state = pcgHash(index ^ pcgHash(group ^ pixel_seed));
+            return vec4(nextUniform(state), nextUniform(state), nextUniform(state), nextUniform(state));
+        }
+        case sampler_kind::sobol:
+            return scrambledSobol(index, pcgHash(group ^ pixel_seed));
+        case sampler_kind::blue_noise: {
+            auto point = scrambledSobol(index, pcgHash(group ^ m_seed));
+            // Each dimension reads the map at its own fixed offset.
+            vec4 shifted;
+            for (u32 d = 0; d < 4; d++) {
+                u32 offset = pcgHash((group * 4 + d) ^ m_seed);
+                f32 x = point[d] + (*m_noise)(pixel.x + (offset & 0xffff), pixel.y + (offset >> 16));
+                shifted[d] = x >= 1.0f ? x - 1.0f : x;
+            }
+            return shifted;
+        }
+        }
+        return zero<vec4>;
+    }
+
+private:
+    sampler_kind m_kind;
+    u32 m_seed;
+    BlueNoise const* m_noise = nullptr;
+
+    static vec4 scrambledSobol(u32 index, u32 seed)
+    {
+        u32 shuffled = owenScramble(index, seed);
+        vec4 point;
+        for (u32 d = 0; d < sobol_dimensions; d++) {
+            point[d] = toUnit(owenScramble(sobol(shuffled, d), pcgHash(seed + d)));
+        }
+        return point;
+    }
+};
+} // namespace raytracer
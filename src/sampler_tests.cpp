@@ -0,0 +1,141 @@
+import boost.ut;
+import raytracer;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+
+namespace {
+// Root-mean-square error, over many pixels, of estimating the area of the
+// quarter disc x^2 + y^2 < 1 with `count` samples each.
+f32 quarterDiscError(Sampler const& sampler, u32 count)
+{
+    f64 squared = 0.0;
+    u32 pixels = 0;
+    for (u32 y = 0; y < 16; y++) {
+        for (u32 x = 0; x < 16; x++, pixels++) {
+            u32 inside = 0;
+            for (u32 i = 0; i < count; i++) {
+                auto u = sampler.get4D(uvec2(x, y), i, 0);
+                inside += u.x * u.x + u.y * u.y < 1.0f;
+            }
+            f64 error = f64(inside) / count - pi<f64> / 4.0;
+            squared += error * error;
+        }
+    }
+    return f32(std::sqrt(squared / pixels));
+}
+} // namespace
+
+int main()
+{
+    feature("Sobol sequence") = [] {
+        then("The first dimension is the van der Corput sequence") = [] {
+            expect(sobol(0, 0) == 0u);
+            expect(sobol(1, 0) == 0x80000000u);
+            expect(sobol(2, 0) == 0x40000000u);
+            expect(sobol(3, 0) == 0xc0000000u);
+        };
+
+        then("The second dimension follows its polynomial") = [] {
+            expect(sobol(1, 1) == 0x80000000u);
+            expect(sobol(2, 1) == 0xc0000000u);
+            expect(sobol(3, 1) == 0x40000000u);
+            expect(sobol(4, 1) == 0xa0000000u);
+        };
+
+        then("Owen scrambling permutes the strata") = [] {
+            std::set<u32> strata;
+            for (u32 i = 0; i < 16; i++) {
+                strata.insert(owenScramble(sobol(i, 2), 1234u) >> 28);
+            }
+            expect(strata.size() == 16u);
+        };
+    };
+
+    feature("Sampling a pixel") = [] {
+        for (auto kind : { sampler_kind::sobol, sampler_kind::independent, sampler_kind::blue_noise }) {
+            Sampler sampler(kind, 7);
+            then(std::format("{} samples are reproducible and vary by pixel", nameOf(kind))) = [&] {
+                expect(sampler.get4D(uvec2(3, 5), 2, 1) == Sampler(kind, 7).get4D(uvec2(3, 5), 2, 1));
+                expect(sampler.get4D(uvec2(3, 5), 2, 1) != sampler.get4D(uvec2(4, 5), 2, 1));
+                expect(sampler.get4D(uvec2(3, 5), 2, 1) != sampler.get4D(uvec2(3, 5), 2, 2));
+                for (u32 i = 0; i < 64; i++) {
+                    auto u = sampler.get4D(uvec2(9, 1), i, 3);
+                    for (u32 d = 0; d < 4; d++) {
+                        expect(u[d] >= 0.0f && u[d] < 1.0f);
+                    }
+                }
+            };
+        }
+
+        then("Scrambled Sobol samples stay stratified") = [] {
+            Sampler sampler(sampler_kind::sobol, 7);
+            constexpr u32 count = 64;
+            std::vector<vec4> points;
+            for (u32 i = 0; i < count; i++) {
+                points.push_back(sampler.get4D(uvec2(11, 2), i, 5));
+            }
+            // Every dimension has one point per 1/count interval.
+            for (u32 d = 0; d < 4; d++) {
+                std::set<u32> strata;
+                for (auto const& p : points) {
+                    strata.insert(static_cast<u32>(p[d] * count));
+                }
+                expect(strata.size() == count) << d;
+            }
+            // The first two dimensions have one point in every box of
+            // area 1/count.
+            for (u32 bits_x = 0; bits_x <= 6; bits_x++) {
+                std::set<std::pair<u32, u32>> boxes;
+                for (auto const& p : points) {
+                    boxes.emplace(static_cast<u32>(p.x * f32(1u << bits_x)), static_cast<u32>(p.y * f32(1u << (6 - bits_x))));
+                }
+                expect(boxes.size() == count) << bits_x;
+            }
+        };
+
+        then("Low-discrepancy samples integrate with less error") = [] {
+            auto independent = quarterDiscError(Sampler(sampler_kind::independent), 64);
+            auto sobol = quarterDiscError(Sampler(sampler_kind::sobol), 64);
+            auto blue_noise = quarterDiscError(Sampler(sampler_kind::blue_noise), 64);
+            expect(sobol < 0.5f * independent) << sobol << independent;
+            expect(blue_noise < 0.5f * independent) << blue_noise << independent;
+        };
+    };
+
+    feature("Blue noise") = [] {
+        auto const& noise = blueNoise();
+        constexpr u32 size = BlueNoise::size;
+
+        then("Every threshold appears once") = [&] {
+            std::vector<f32> values;
+            for (u32 y = 0; y < size; y++) {
+                for (u32 x = 0; x < size; x++) {
+                    values.push_back(noise(x, y));
+                }
+            }
+            std::ranges::sort(values);
+            for (u32 i = 0; i < values.size(); i++) {
+                expect(std::abs(values[i] - (f32(i) + 0.5f) / f32(values.size())) < 1e-6f) << i;
+            }
+        };
+
+        then("Neighbours differ more than in white noise") = [&] {
+            // White noise averages 1/3.
+            f32 difference = 0.0f;
+            for (u32 y = 0; y < size; y++) {
+                for (u32 x = 0; x < size; x++) {
+                    difference += std::abs(noise(x, y) - noise(x + 1, y)) + std::abs(noise(x, y) - noise(x, y + 1));
+                }
+            }
+            difference /= f32(2 * size * size);
+            expect(difference > 0.4f) << difference;
+        };
+
+        then("It tiles") = [&] {
+            expect(noise(3, 5) == noise(3 + size, 5 + 2 * size));
+        };
+    };
+}
@@ -0,0 +1,177 @@
+export module raytracer.scene;
+
+import raytracer.aabb;
+import raytracer.accelerator;
+import raytracer.bvh;
+import raytracer.environment;
+import raytracer.grid;
+import raytracer.kdtree;
+import raytracer.light_tree;
+import raytracer.material;
+import raytracer.object;
+import raytracer.ray;
+import raytracer.texture;
+import raytracer.types;
+import std;
+
+export namespace raytracer {
+[[nodiscard]] std::unique_ptr<Accelerator> makeAccelerator(accelerator_kind kind)
+{
+    switch (kind) {
+    case accelerator_kind::grid:
+        return std::make_unique<UniformGrid>();
+    case accelerator_kind::kd_tree:
+        return std::make_unique<KdTree>();
+    case accelerator_kind::automatic:
+    case accelerator_kind::bvh:
+        break;
+    }
+    return std::make_unique<BvhAccelerator>();
+}
+
+class Scene {
+public:
+    ObjectPool objects;
+    // Materials the objects' material_id refer to.
+    MaterialRegistry materials;
+    // Where textured materials' texture ids point; may be shared between
+    // scenes so they page through one memory budget.
+    std::shared_ptr<TextureCache> textures;
+    // Light from infinitely far away, seen by rays that miss everything;
+    // none leaves them black.
+    std::shared_ptr<EnvironmentMap const> environment;
+    std::vector<point_light> lights;
+    // Backend for the next build(); automatic picks one from the
+    // distribution of object bounds.
+    accelerator_kind preferred_accelerator = accelerator_kind::automatic;
+
+    // Builds the object index from world bounds. Call again after adding
+    // objects; update() is enough after changing transforms.
+    void build()
+    {
+        objects.takeDirty();
+        m_bounds.resize(objects.size());
+        for (u32 id = 0; id < objects.size(); id++) {
+            m_bounds[id] = objects.get(id).worldBounds();
+        }
+        m_kind = preferred_accelerator == accelerator_kind::automatic
+            ? chooseAccelerator(statisticsOf(m_bounds))
+            : preferred_accelerator;
+        m_accelerator = makeAccelerator(m_kind);
+        m_accelerator->build(m_bounds);
+        buildLights();
+    }
+
+    // Rebuilds the light tree from `lights`; build() does this too.
+    void buildLights()
+    {
+        m_light_tree.build(lights);
+    }
+
+    [[nodiscard]] LightTree const& lightTree() const
+    {
+        return m_light_tree;
+    }
+
+    // Brings the index up to date with objects moved since the last build
+    // or update. The BVH refits their paths and rebuilds only subtrees
+    // that degraded; other backends rebuild. Falls back to build() when
+    // objects were added.
+    bvh_update_stats update()
+    {
+        if (!m_accelerator || m_bounds.size() != objects.size()) {
+            build();
+            bvh_update_stats stats;
+            stats.full_rebuild = true;
+            return stats;
+        }
+        auto dirty = objects.takeDirty();
+        for (auto id : dirty) {
+            m_bounds[id] = objects.get(id).worldBounds();
+        }
+        return m_accelerator->update(m_bounds, dirty);
+    }
+
+    // Uses externally owned BVH nodes, e.g. from a SceneCache, instead of
+    // building. The storage must outlive the scene.
+    void setAcceleration(bvh_view view)
+    {
+        m_bounds.resize(objects.size());
+        for (u32 id = 0; id < objects.size(); id++) {
+            m_bounds[id] = objects.get(id).worldBounds();
+        }
+        m_kind = accelerator_kind::bvh;
+        m_accelerator = std::make_unique<BvhAccelerator>(view);
+    }
+
+    // The object BVH, or an empty view when another backend is in use.
+    [[nodiscard]] bvh_view acceleration() const
+    {
+        if (auto bvh = dynamic_cast<BvhAccelerator const*>(m_accelerator.get())) {
+            return bvh->view();
+        }
+        return {};
+    }
+
+    [[nodiscard]] Accelerator const* accelerator() const
+    {
+        return m_accelerator.get();
+    }
+
+    [[nodiscard]] accelerator_kind acceleratorKind() const
+    {
+        return m_kind;
+    }
+
+    // World bounds of every object as of the last build or update.
+    [[nodiscard]] std::span<aabb const> objectBounds() const
+    {
+        return m_bounds;
+    }
+
+    [[nodiscard]] std::optional<intersection> intersect(ray const& r) const
+    {
+        std::optional<intersection> closest;
+        if (!m_accelerator) {
+            return closest;
+        }
+        auto test = [&](u32 id, f32 t_max) {
+            auto h = objects.get(id).closestHit(r, t_max);
+            if (h) {
+                closest = h;
+                return h->t;
+            }
+            return t_max;
+        };
+        m_accelerator->intersect(r, std::numeric_limits<f32>::infinity(), test);
+        return closest;
+    }
+
+    // Whether anything lies on `r` within (0, t_max), e.g. for shadow
+    // rays. Stops at the first hit found rather than the closest.
+    [[nodiscard]] bool occluded(ray const& r, f32 t_max) const
+    {
+        bool hit = false;
+        if (!m_accelerator) {
+            return hit;
+        }
+        auto test = [&](u32 id, f32 t) {
+            if (objects.get(id).closestHit(r, t)) {
+                hit = true;
+                // Nothing can be closer than the origin; ends traversal.
+                return 0.0f;
+            }
+            return t;
+        };
+        m_accelerator->intersect(r, t_max, test);
+        return hit;
+    }
+
+private:
+    std::unique_ptr<Accelerator> m_accelerator;
+    accelerator_kind m_kind = accelerator_kind::bvh;
+    LightTree m_light_tree;
+    // World bounds the index was last built or updated from, indexed by id.
+    std::vector<aabb> m_bounds;
+};
+} // namespace raytracer
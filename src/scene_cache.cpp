@@ -0,0 +1,416 @@
+module;
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+export module raytracer.scene_cache;
+
+import raytracer.bvh;
+import raytracer.geometry;
+import raytracer.instance;
+import raytracer.mat;
+import raytracer.material;
+import raytracer.object;
+import raytracer.scene;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+// Binary scene cache, little-endian and versioned. Every section is aligned
+// so that a mapped file can be used in place without parsing:
+//
+//   scene_cache_header
+//   object_record[objects.count]
+//   material[materials.count]
+//   point_light[lights.count]
+//   geometry_record[geometries.count]
+//   bvh_node[nodes.count]
+//   u32[indices.count]         BVH leaf primitive indices (object ids)
+//   geometry buffers           vertices, triangles and BVH of each mesh
+//
+// Geometry shared by several instances is stored once. Material texture
+// ids are stored as they are, so open the same textures in the same order
+// before rendering a loaded scene.
+constexpr u32 scene_cache_version = 4;
+constexpr std::array<char, 8> scene_cache_magic = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+constexpr usize scene_cache_alignment = 64;
+
+struct scene_cache_section {
+    u64 offset = 0;
+    u64 count = 0;
+};
+
+struct scene_cache_header {
+    std::array<char, 8> magic = scene_cache_magic;
+    u32 version = scene_cache_version;
+    u32 reserved = 0;
+    scene_cache_section objects;
+    scene_cache_section materials;
+    scene_cache_section lights;
+    scene_cache_section geometries;
+    scene_cache_section nodes;
+    scene_cache_section indices;
+};
+
+enum class object_kind : u32 {
+    sphere = 0,
+    instance = 1,
+};
+
+enum class geometry_kind : u32 {
+    triangle_mesh = 0,
+};
+
+struct object_record {
+    object_kind kind;
+    u32 material;
+    // Index into the geometries section, no_id for analytic shapes.
+    u32 geometry;
+    u32 reserved;
+    mat4 transform;
+    mat4 inverse_transform;
+};
+
+struct geometry_record {
+    geometry_kind kind;
+    u32 reserved;
+    scene_cache_section vertices;
+    scene_cache_section triangles;
+    scene_cache_section nodes;
+    scene_cache_section indices;
+};
+
+static_assert(sizeof(scene_cache_header) == 112);
+static_assert(sizeof(object_record) == 144);
+static_assert(sizeof(material) == 44);
+static_assert(sizeof(point_light) == 24);
+static_assert(sizeof(geometry_record) == 72);
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+public:
+    explicit MappedFile(std::string const& file_path)
+    {
+        int fd = ::open(file_path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open " + file_path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("cannot stat " + file_path);
+        }
+        m_size = static_cast<usize>(st.st_size);
+        if (m_size != 0) {
+            m_data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+        if (m_data == MAP_FAILED) {
+            m_data = nullptr;
+            throw std::runtime_error("cannot map " + file_path);
+        }
+    }
+
+    MappedFile(MappedFile&& other)
+        : m_data(std::exchange(other.m_data, nullptr))
+        , m_size(std::exchange(other.m_size, 0))
+    {
+    }
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile&&) = delete;
+
+    ~MappedFile()
+    {
+        if (m_data != nullptr) {
+            ::munmap(m_data, m_size);
+        }
+    }
+
+    [[nodiscard]] std::span<std::byte const> bytes() const
+    {
+        return { static_cast<std::byte const*>(m_data), m_size };
+    }
+
+private:
+    void* m_data = nullptr;
+    usize m_size = 0;
+};
+
+// A mapped scene cache. Scenes loaded from it keep pointing into the
+// mapping, so the cache must outlive them. Every id and offset in the file
+// is checked once at open, so traversing the loaded scene cannot read
+// outside the mapping however the file was damaged.
+class SceneCache {
+public:
+    explicit SceneCache(std::string const& file_path)
+        : m_file(file_path)
+    {
+        if constexpr (std::endian::native != std::endian::little) {
+            throw std::runtime_error("scene caches can only be mapped on little-endian hosts");
+        }
+        auto bytes = m_file.bytes();
+        if (bytes.size() < sizeof(scene_cache_header)) {
+            throw std::runtime_error(file_path + ": truncated scene cache");
+        }
+        std::memcpy(&m_header, bytes.data(), sizeof(m_header));
+        if (m_header.magic != scene_cache_magic) {
+            throw std::runtime_error(file_path + ": not a scene cache");
+        }
+        if (m_header.version != scene_cache_version) {
+            throw std::runtime_error(std::format(
+                "{}: scene cache version {}, expected {}",
+                file_path, m_header.version, scene_cache_version));
+        }
+        validate<object_record>(m_header.objects, file_path);
+        validate<material>(m_header.materials, file_path);
+        validate<point_light>(m_header.lights, file_path);
+        validate<geometry_record>(m_header.geometries, file_path);
+        validate<bvh_node>(m_header.nodes, file_path);
+        validate<u32>(m_header.indices, file_path);
+        for (auto const& g : geometries()) {
+            validate<vec3>(g.vertices, file_path);
+            validate<uvec3>(g.triangles, file_path);
+            validate<bvh_node>(g.nodes, file_path);
+            validate<u32>(g.indices, file_path);
+            if (g.kind != geometry_kind::triangle_mesh) {
+                throw std::runtime_error(file_path + ": unknown geometry kind");
+            }
+            for (auto const& t : section<uvec3>(g.triangles)) {
+                if (t.x >= g.vertices.count || t.y >= g.vertices.count || t.z >= g.vertices.count) {
+                    throw std::runtime_error(file_path + ": corrupt scene cache triangle");
+                }
+            }
+            validateBvh({ section<bvh_node>(g.nodes), section<u32>(g.indices) }, g.triangles.count, file_path);
+        }
+        for (auto const& record : objects()) {
+            if (record.material >= m_header.materials.count
+                || (record.geometry != no_id && record.geometry >= m_header.geometries.count)) {
+                throw std::runtime_error(file_path + ": corrupt scene cache object");
+            }
+        }
+        validateBvh(acceleration(), m_header.objects.count, file_path);
+    }
+
+    [[nodiscard]] std::span<object_record const> objects() const { return section<object_record>(m_header.objects); }
+    [[nodiscard]] std::span<material const> materials() const { return section<material>(m_header.materials); }
+    [[nodiscard]] std::span<point_light const> lights() const { return section<point_light>(m_header.lights); }
+    [[nodiscard]] std::span<geometry_record const> geometries() const { return section<geometry_record>(m_header.geometries); }
+    [[nodiscard]] bvh_view acceleration() const
+    {
+        return { section<bvh_node>(m_header.nodes), section<u32>(m_header.indices) };
+    }
+
+    // Recreates the objects with their stored inverse transforms and points
+    // the scene and its meshes at the mapped BVHs instead of rebuilding them.
+    // The BVH refers to objects by id, so `scene` must start out empty.
+    void load(Scene& scene) const
+    {
+        if (scene.objects.size() != 0) {
+            throw std::runtime_error("scene cache: can only be loaded into an empty scene");
+        }
+        std::vector<std::shared_ptr<Geometry const>> shared;
+        for (auto const& g : geometries()) {
+            shared.push_back(std::make_shared<TriangleMesh>(
+                section<vec3>(g.vertices),
+                section<uvec3>(g.triangles),
+                bvh_view { section<bvh_node>(g.nodes), section<u32>(g.indices) }));
+        }
+
+        scene.materials.assign(materials());
+        for (auto const& record : objects()) {
+            Object* object;
+            switch (record.kind) {
+            case object_kind::sphere:
+                object = &scene.objects.add<Sphere>();
+                break;
+            case object_kind::instance:
+                if (record.geometry == no_id) {
+                    throw std::runtime_error("scene cache: instance without geometry");
+                }
+                object = &scene.objects.add<Instance>(shared[record.geometry]);
+                break;
+            default:
+                throw std::runtime_error("scene cache: unknown object kind");
+            }
+            object->setTransform(record.transform, record.inverse_transform);
+            object->material_id = record.material;
+        }
+        auto l = lights();
+        scene.lights.assign(l.begin(), l.end());
+        scene.buildLights();
+        scene.setAcceleration(acceleration());
+    }
+
+private:
+    MappedFile m_file;
+    scene_cache_header m_header;
+
+    template<typename T>
+    void validate(scene_cache_section const& s, std::string const& file_path) const
+    {
+        auto size = m_file.bytes().size();
+        if (s.offset % alignof(T) != 0
+            || s.offset > size
+            || s.count > (size - s.offset) / sizeof(T)) {
+            throw std::runtime_error(file_path + ": corrupt scene cache section");
+        }
+    }
+
+    // Walks the nodes reachable from the root. Rejecting nodes reached twice
+    // and trees deeper than Bvh::max_depth keeps a damaged file from making
+    // traversal loop or overflow its fixed stack.
+    static void validateBvh(bvh_view const& bvh, u64 primitive_count, std::string const& file_path)
+    {
+        auto corrupt = [&] { throw std::runtime_error(file_path + ": corrupt scene cache BVH"); };
+        for (auto index : bvh.indices) {
+            if (index >= primitive_count) {
+                corrupt();
+            }
+        }
+        if (bvh.nodes.empty()) {
+            return;
+        }
+        std::vector<bool> visited(bvh.nodes.size());
+        std::vector<std::pair<u32, u32>> stack { { 0, 0 } };
+        while (!stack.empty()) {
+            auto [index, depth] = stack.back();
+            stack.pop_back();
+            if (visited[index]) {
+                corrupt();
+            }
+            visited[index] = true;
+            auto const& node = bvh.nodes[index];
+            if (node.isLeaf()) {
+                if (node.offset > bvh.indices.size() || node.count > bvh.indices.size() - node.offset) {
+                    corrupt();
+                }
+                continue;
+            }
+            if (depth >= Bvh::max_depth || node.offset >= bvh.nodes.size() - 1) {
+                corrupt();
+            }
+            stack.push_back({ node.offset, depth + 1 });
+            stack.push_back({ node.offset + 1, depth + 1 });
+        }
+    }
+
+    template<typename T>
+    std::span<T const> section(scene_cache_section const& s) const
+    {
+        return {
+            reinterpret_cast<T const*>(m_file.bytes().data() + s.offset),
+            static_cast<usize>(s.count),
+        };
+    }
+};
+
+// Writes `scene` together with its built acceleration structures, so call
+// Scene::build() first.
+void writeSceneCache(Scene const& scene, std::ostream& os)
+{
+    if constexpr (std::endian::native != std::endian::little) {
+        throw std::runtime_error("scene caches can only be written on little-endian hosts");
+    }
+
+    std::vector<object_record> records;
+    std::vector<TriangleMesh const*> meshes;
+    std::unordered_map<Geometry const*, u32> mesh_indices;
+    records.reserve(scene.objects.size());
+    for (u32 id = 0; id < scene.objects.size(); id++) {
+        auto const& object = scene.objects.get(id);
+        object_record record {
+            .kind = object_kind::sphere,
+            .material = object.material_id,
+            .geometry = no_id,
+            .reserved = 0,
+            .transform = object.transform(),
+            .inverse_transform = object.inverseTransform(),
+        };
+        if (auto instance = dynamic_cast<Instance const*>(&object)) {
+            auto mesh = dynamic_cast<TriangleMesh const*>(instance->geometry().get());
+            if (mesh == nullptr) {
+                throw std::runtime_error("scene cache: unsupported geometry type");
+            }
+            auto [it, inserted] = mesh_indices.try_emplace(mesh, static_cast<u32>(meshes.size()));
+            if (inserted) {
+                meshes.push_back(mesh);
+            }
+            record.kind = object_kind::instance;
+            record.geometry = it->second;
+        } else if (dynamic_cast<Sphere const*>(&object) == nullptr) {
+            throw std::runtime_error("scene cache: unsupported object type");
+        }
+        records.push_back(record);
+    }
+    std::vector<material> materials(scene.materials.size());
+    for (u32 id = 0; id < materials.size(); id++) {
+        materials[id] = scene.materials.get(id);
+    }
+    // The cache always stores a BVH; scenes built with another backend get
+    // one built from the same bounds.
+    auto bvh = scene.acceleration();
+    Bvh fallback;
+    if (bvh.nodes.empty() && !records.empty()) {
+        fallback.build(scene.objectBounds());
+        bvh = fallback.view();
+    }
+
+    scene_cache_header header;
+    u64 offset = sizeof(header);
+    auto place = [&](scene_cache_section& s, usize count, usize element_size) {
+        offset = (offset + scene_cache_alignment - 1) / scene_cache_alignment * scene_cache_alignment;
+        s = { offset, count };
+        offset += count * element_size;
+    };
+    place(header.objects, records.size(), sizeof(object_record));
+    place(header.materials, materials.size(), sizeof(material));
+    place(header.lights, scene.lights.size(), sizeof(point_light));
+    place(header.geometries, meshes.size(), sizeof(geometry_record));
+    place(header.nodes, bvh.nodes.size(), sizeof(bvh_node));
+    place(header.indices, bvh.indices.size(), sizeof(u32));
+
+    std::vector<geometry_record> geometries(meshes.size());
+    for (usize i = 0; i < meshes.size(); i++) {
+        auto mesh_bvh = meshes[i]->acceleration();
+        geometries[i].kind = geometry_kind::triangle_mesh;
+        place(geometries[i].vertices, meshes[i]->vertices().size(), sizeof(vec3));
+        place(geometries[i].triangles, meshes[i]->triangles().size(), sizeof(uvec3));
+        place(geometries[i].nodes, mesh_bvh.nodes.size(), sizeof(bvh_node));
+        place(geometries[i].indices, mesh_bvh.indices.size(), sizeof(u32));
+    }
+
+    u64 written = 0;
+    auto write = [&](scene_cache_section const& s, void const* data, usize size) {
+        static constexpr std::array<char, scene_cache_alignment> padding {};
+        os.write(padding.data(), static_cast<std::streamsize>(s.offset - written));
+        os.write(static_cast<char const*>(data), static_cast<std::streamsize>(size));
+        written = s.offset + size;
+    };
+    write({}, &header, sizeof(header));
+    write(header.objects, records.data(), records.size() * sizeof(object_record));
+    write(header.materials, materials.data(), materials.size() * sizeof(material));
+    write(header.lights, scene.lights.data(), scene.lights.size() * sizeof(point_light));
+    write(header.geometries, geometries.data(), geometries.size() * sizeof(geometry_record));
+    write(header.nodes, bvh.nodes.data(), bvh.nodes.size_bytes());
+    write(header.indices, bvh.indices.data(), bvh.indices.size_bytes());
+    for (usize i = 0; i < meshes.size(); i++) {
+        auto mesh_bvh = meshes[i]->acceleration();
+        write(geometries[i].vertices, meshes[i]->vertices().data(), meshes[i]->vertices().size_bytes());
+        write(geometries[i].triangles, meshes[i]->triangles().data(), meshes[i]->triangles().size_bytes());
+        write(geometries[i].nodes, mesh_bvh.nodes.data(), mesh_bvh.nodes.size_bytes());
+        write(geometries[i].indices, mesh_bvh.indices.data(), mesh_bvh.indices.size_bytes());
+    }
+}
+
+void writeSceneCache(Scene const& scene, std::string const& file_path)
+{
+    std::ofstream os(file_path, std::ios::binary);
+    writeSceneCache(scene, os);
+    if (!os) {
+        throw std::runtime_error("cannot write " + file_path);
+    }
+}
+} // namespace raytracer
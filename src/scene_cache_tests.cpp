@@ -0,0 +1,171 @@
+import boost.ut;
+import raytracer;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+
+namespace {
+// Writes `scene` to `path` after letting `damage` edit the serialized bytes.
+template<typename F>
+void writeDamaged(Scene const& scene, std::string const& path, F&& damage)
+{
+    std::ostringstream os;
+    writeSceneCache(scene, os);
+    auto bytes = std::move(os).str();
+    scene_cache_header header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    damage(header, bytes);
+    std::ofstream(path, std::ios::binary).write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+template<typename T>
+void poke(std::string& bytes, scene_cache_section const& s, usize i, T const& value)
+{
+    std::memcpy(bytes.data() + s.offset + i * sizeof(T), &value, sizeof(T));
+}
+} // namespace
+
+int main()
+{
+    feature("Round-tripping a scene through the cache") = [] {
+        Scene scene;
+        for (i32 i = 0; i < 16; i++) {
+            auto& s = scene.objects.add<Sphere>();
+            s.setTransform(mat4::translate(f32(i) * 3.0f, 0.0f, 0.0f) * mat4::scale(1.0f, 2.0f, 1.0f));
+            material m;
+            m.color = vec3(f32(i % 4) / 4.0f, 0.5f, 1.0f);
+            s.material_id = scene.materials.add(m);
+        }
+        scene.lights.push_back(point_light(vec3(-10, 10, -10), one<vec3>));
+        scene.build();
+
+        auto path = (std::filesystem::temp_directory_path() / "raytracer_scene_cache_tests.bin").string();
+        writeSceneCache(scene, path);
+
+        given("A scene loaded from the mapped cache") = [&] {
+            SceneCache cache(path);
+            Scene loaded;
+            cache.load(loaded);
+
+            expect(loaded.objects.size() == scene.objects.size());
+            expect(loaded.materials.size() == scene.materials.size());
+            expect(loaded.lights == scene.lights);
+            for (u32 id = 0; id < scene.objects.size(); id++) {
+                auto const& a = scene.objects.get(id);
+                auto const& b = loaded.objects.get(id);
+                expect(a.transform() == b.transform());
+                expect(a.inverseTransform() == b.inverseTransform());
+                expect(a.material_id == b.material_id);
+                expect(scene.materials.get(a.material_id) == loaded.materials.get(b.material_id));
+            }
+
+            then("It intersects like the original") = [&] {
+                for (i32 i = 0; i < 16; i++) {
+                    auto r = ray(vec3(f32(i) * 3.0f, 0.5f, -5.0f), unit_z<vec3>);
+                    auto h1 = scene.intersect(r);
+                    auto h2 = loaded.intersect(r);
+                    expect(h1.has_value() && h2.has_value());
+                    expect(h1 == h2);
+                }
+            };
+        };
+
+        std::filesystem::remove(path);
+    };
+
+    feature("Opening damaged caches") = [] {
+        Scene scene;
+        for (i32 i = 0; i < 64; i++) {
+            scene.objects.add<Sphere>().setTransform(mat4::translate(f32(i) * 3.0f, 0.0f, 0.0f));
+        }
+        scene.materials.add(material());
+        scene.build();
+        auto quad = std::make_shared<TriangleMesh>(
+            std::vector { vec3(-1, -1, 0), vec3(1, -1, 0), vec3(1, 1, 0), vec3(-1, 1, 0) },
+            std::vector { uvec3(0, 1, 2), uvec3(0, 2, 3) });
+        Scene instanced;
+        instanced.objects.add<Instance>(quad);
+        instanced.build();
+
+        auto path = (std::filesystem::temp_directory_path() / "raytracer_scene_cache_damaged.bin").string();
+
+        then("Leaves naming objects past the end are refused") = [&] {
+            writeDamaged(scene, path, [](scene_cache_header const& h, std::string& bytes) {
+                poke(bytes, h.indices, 0, u32(h.objects.count));
+            });
+            expect(throws([&] { SceneCache cache(path); }));
+        };
+
+        then("Children past the last node are refused") = [&] {
+            writeDamaged(scene, path, [](scene_cache_header const& h, std::string& bytes) {
+                bvh_node root;
+                std::memcpy(&root, bytes.data() + h.nodes.offset, sizeof(root));
+                root.offset = u32(h.nodes.count - 1);
+                poke(bytes, h.nodes, 0, root);
+            });
+            expect(throws([&] { SceneCache cache(path); }));
+        };
+
+        then("Nodes that lead back to the root are refused") = [&] {
+            writeDamaged(scene, path, [](scene_cache_header const& h, std::string& bytes) {
+                bvh_node root;
+                std::memcpy(&root, bytes.data() + h.nodes.offset, sizeof(root));
+                root.offset = 0;
+                poke(bytes, h.nodes, 0, root);
+            });
+            expect(throws([&] { SceneCache cache(path); }));
+        };
+
+        then("Triangles naming vertices past the end are refused") = [&] {
+            writeDamaged(instanced, path, [](scene_cache_header const& h, std::string& bytes) {
+                geometry_record g;
+                std::memcpy(&g, bytes.data() + h.geometries.offset, sizeof(g));
+                poke(bytes, g.triangles, 1, uvec3(0, 2, u32(g.vertices.count)));
+            });
+            expect(throws([&] { SceneCache cache(path); }));
+        };
+
+        then("Caches load only into empty scenes") = [&] {
+            writeSceneCache(scene, path);
+            SceneCache cache(path);
+            Scene loaded;
+            loaded.objects.add<Sphere>();
+            expect(throws([&] { cache.load(loaded); }));
+        };
+
+        std::filesystem::remove(path);
+    };
+
+    feature("Caching instanced geometry") = [] {
+        auto quad = std::make_shared<TriangleMesh>(
+            std::vector { vec3(-1, -1, 0), vec3(1, -1, 0), vec3(1, 1, 0), vec3(-1, 1, 0) },
+            std::vector { uvec3(0, 1, 2), uvec3(0, 2, 3) });
+        Scene scene;
+        for (i32 i = 0; i < 8; i++) {
+            auto& inst = scene.objects.add<Instance>(quad);
+            inst.setTransform(mat4::translate(f32(i) * 3.0f, 0.0f, 0.0f));
+        }
+        scene.build();
+
+        auto path = (std::filesystem::temp_directory_path() / "raytracer_scene_cache_instances.bin").string();
+        writeSceneCache(scene, path);
+
+        SceneCache cache(path);
+        expect(cache.geometries().size() == 1u);
+
+        Scene loaded;
+        cache.load(loaded);
+        for (i32 i = 0; i < 8; i++) {
+            auto r = ray(vec3(f32(i) * 3.0f + 0.5f, 0.25f, -5.0f), unit_z<vec3>);
+            auto h1 = scene.intersect(r);
+            auto h2 = loaded.intersect(r);
+            expect(h1.has_value() && h2.has_value());
+            expect(h1 == h2);
+            expect(loaded.objects.get(h2->object_id).normalAt(r.at(h2->t), *h2) == vec3(0, 0, 1));
+        }
+
+        std::filesystem::remove(path);
+    };
+}
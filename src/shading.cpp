@@ -0,0 +1,96 @@
+export module raytracer.shading;
+
+import raytracer.material;
+import raytracer.object;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+// lighting() with the specular falloff read from a table built for
+// m.shininess, for hot paths. lighting() stays the exact reference.
+[[nodiscard]] vec3 lighting(
+    material const& m,
+    SpecularTable const& specular_table,
+    point_light const& light,
+    vec3 const& point,
+    vec3 const& eyev,
+    vec3 const& normalv)
+{
+    vec3 effective_color = m.color * light.intensity;
+    vec3 lightv = normalize(light.position - point);
+    vec3 ambient = effective_color * m.ambient;
+    f32 light_dot_normal = dot(lightv, normalv);
+    if (light_dot_normal < 0.0f) {
+        return ambient;
+    }
+    vec3 diffuse = effective_color * m.diffuse * light_dot_normal;
+    f32 reflect_dot_eye = dot(reflect(-lightv, normalv), eyev);
+    if (reflect_dot_eye <= 0.0f) {
+        return ambient + diffuse;
+    }
+    return ambient + diffuse + light.intensity * m.specular * specular_table(reflect_dot_eye);
+}
+
+inline constexpr usize lighting_batch_size = 8;
+
+// Shading inputs for up to lighting_batch_size hits, laid out one array
+// per component so the batched lighting() maps each lane to a SIMD lane.
+struct shading_batch {
+    std::array<f32, lighting_batch_size> px, py, pz;
+    std::array<f32, lighting_batch_size> ex, ey, ez;
+    std::array<f32, lighting_batch_size> nx, ny, nz;
+
+    void set(usize lane, vec3 const& point, vec3 const& eyev, vec3 const& normalv)
+    {
+        px[lane] = point.x, py[lane] = point.y, pz[lane] = point.z;
+        ex[lane] = eyev.x, ey[lane] = eyev.y, ez[lane] = eyev.z;
+        nx[lane] = normalv.x, ny[lane] = normalv.y, nz[lane] = normalv.z;
+    }
+};
+
+struct color_batch {
+    std::array<f32, lighting_batch_size> r {}, g {}, b {};
+
+    [[nodiscard]] vec3 get(usize lane) const
+    {
+        return vec3(r[lane], g[lane], b[lane]);
+    }
+};
+
+// Adds one light's contribution to every lane of `out`. Branches become
+// selects and the table lookup a gather, so the loop vectorizes; unused
+// lanes just compute garbage.
+void lighting(
+    material const& m,
+    SpecularTable const& specular_table,
+    point_light const& light,
+    shading_batch const& in,
+    color_batch& out)
+{
+    vec3 effective_color = m.color * light.intensity;
+    vec3 specular_color = light.intensity * m.specular;
+    for (usize i = 0; i < lighting_batch_size; i++) {
+        f32 lx = light.position.x - in.px[i];
+        f32 ly = light.position.y - in.py[i];
+        f32 lz = light.position.z - in.pz[i];
+        f32 inv_length = 1.0f / std::sqrt(lx * lx + ly * ly + lz * lz);
+        lx *= inv_length, ly *= inv_length, lz *= inv_length;
+
+        f32 light_dot_normal = lx * in.nx[i] + ly * in.ny[i] + lz * in.nz[i];
+        // reflect(-l, n) = 2 (l . n) n - l
+        f32 rx = 2.0f * light_dot_normal * in.nx[i] - lx;
+        f32 ry = 2.0f * light_dot_normal * in.ny[i] - ly;
+        f32 rz = 2.0f * light_dot_normal * in.nz[i] - lz;
+        f32 reflect_dot_eye = rx * in.ex[i] + ry * in.ey[i] + rz * in.ez[i];
+
+        bool lit = light_dot_normal >= 0.0f;
+        f32 diffuse = lit ? m.diffuse * light_dot_normal : 0.0f;
+        f32 specular = lit && reflect_dot_eye > 0.0f ? specular_table(reflect_dot_eye) : 0.0f;
+        f32 lambert = m.ambient + diffuse;
+        out.r[i] += effective_color.x * lambert + specular_color.x * specular;
+        out.g[i] += effective_color.y * lambert + specular_color.y * specular;
+        out.b[i] += effective_color.z * lambert + specular_color.z * specular;
+    }
+}
+} // namespace raytracer
@@ -0,0 +1,93 @@
+import boost.ut;
+import raytracer;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+
+namespace {
+bool near(vec3 const& a, vec3 const& b, f32 tolerance)
+{
+    return std::abs(a.x - b.x) <= tolerance && std::abs(a.y - b.y) <= tolerance && std::abs(a.z - b.z) <= tolerance;
+}
+} // namespace
+
+int main()
+{
+    feature("Specular lookup tables") = [] {
+        for (f32 shininess : { 1.0f, 10.0f, 200.0f, 2000.0f }) {
+            given("Shininess " + std::to_string(shininess)) = [shininess] {
+                SpecularTable table(shininess);
+                f32 worst = 0.0f;
+                for (i32 i = 0; i <= 100000; i++) {
+                    f32 x = f32(i) / 100000.0f;
+                    worst = std::max(worst, std::abs(table(x) - std::pow(x, shininess)));
+                }
+                expect(worst < 1e-3f) << worst;
+                expect(table(1.0f) == 1.0f);
+                expect(table(0.0f) == 0.0f);
+                expect(table(1.5f) == 1.0f && table(-0.5f) == 0.0f);
+                expect(table(std::numeric_limits<f32>::quiet_NaN()) == 0.0f);
+            };
+        }
+
+        then("Registered materials with the same exponent share a table") = [] {
+            MaterialRegistry materials;
+            material red;
+            red.color = vec3(1, 0, 0);
+            material dull;
+            dull.shininess = 100.0f;
+            auto red_id = materials.add(red);
+            auto dull_id = materials.add(dull);
+            auto const& table = materials.specularTable(MaterialRegistry::default_material);
+            expect(&materials.specularTable(red_id) == &table);
+            expect(&materials.specularTable(dull_id) != &table);
+            expect(materials.specularTable(dull_id).shininess() == 100.0f);
+            dull.shininess = 200.0f;
+            materials.set(dull_id, dull);
+            expect(&materials.specularTable(dull_id) == &table);
+        };
+    };
+
+    feature("Shading with tables") = [] {
+        std::mt19937 rng(9);
+        std::uniform_real_distribution<f32> u(-1.0f, 1.0f);
+        material m;
+        m.color = vec3(0.8f, 0.5f, 0.2f);
+        SpecularTable table(m.shininess);
+        auto light = point_light(vec3(-10, 10, -10), vec3(1.0f, 0.9f, 0.8f));
+
+        std::vector<vec3> points, eyes, normals;
+        for (i32 i = 0; i < 64; i++) {
+            points.push_back(vec3(u(rng), u(rng), u(rng)));
+            normals.push_back(normalize(vec3(u(rng), u(rng), u(rng))));
+            // Mostly mirror directions, so the specular lobe is exercised.
+            auto mirror = reflect(-normalize(light.position - points.back()), normals.back());
+            eyes.push_back(normalize(mirror + vec3(u(rng), u(rng), u(rng)) * 0.05f));
+        }
+
+        then("The scalar path matches the exact reference") = [&] {
+            for (usize i = 0; i < points.size(); i++) {
+                auto exact = lighting(m, light, points[i], eyes[i], normals[i]);
+                auto fast = lighting(m, table, light, points[i], eyes[i], normals[i]);
+                expect(near(exact, fast, 1e-3f));
+            }
+        };
+
+        then("The batched path matches lane by lane") = [&] {
+            for (usize first = 0; first < points.size(); first += lighting_batch_size) {
+                shading_batch batch;
+                for (usize lane = 0; lane < lighting_batch_size; lane++) {
+                    batch.set(lane, points[first + lane], eyes[first + lane], normals[first + lane]);
+                }
+                color_batch colors;
+                lighting(m, table, light, batch, colors);
+                for (usize lane = 0; lane < lighting_batch_size; lane++) {
+                    auto i = first + lane;
+                    expect(near(colors.get(lane), lighting(m, light, points[i], eyes[i], normals[i]), 1e-3f));
+                }
+            }
+        };
+    };
+}
@@ -0,0 +1,172 @@
+module;
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+export module raytracer.socket;
+
+import raytracer.types;
+import std;
+
+namespace raytracer {
+sockaddr_un addressOf(std::string const& socket_path)
+{
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error(socket_path + ": socket path too long");
+    }
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    return address;
+}
+} // namespace raytracer
+
+export namespace raytracer {
+// Owned file descriptor.
+class Descriptor {
+public:
+    explicit Descriptor(int fd = -1)
+        : m_fd(fd)
+    {
+    }
+
+    Descriptor(Descriptor&& other)
+        : m_fd(std::exchange(other.m_fd, -1))
+    {
+    }
+
+    Descriptor(Descriptor const&) = delete;
+    Descriptor& operator=(Descriptor const&) = delete;
+
+    Descriptor& operator=(Descriptor&& other)
+    {
+        if (this != &other) {
+            reset();
+            m_fd = std::exchange(other.m_fd, -1);
+        }
+        return *this;
+    }
+
+    ~Descriptor()
+    {
+        reset();
+    }
+
+    [[nodiscard]] int get() const { return m_fd; }
+
+    void reset()
+    {
+        if (m_fd >= 0) {
+            ::close(std::exchange(m_fd, -1));
+        }
+    }
+
+private:
+    int m_fd;
+};
+
+// Listening Unix stream socket at `socket_path`, replacing whatever socket
+// file is there.
+[[nodiscard]] Descriptor listenOn(std::string const& socket_path)
+{
+    auto address = addressOf(socket_path);
+    Descriptor fd(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    ::unlink(socket_path.c_str());
+    if (fd.get() < 0
+        || ::bind(fd.get(), reinterpret_cast<sockaddr const*>(&address), sizeof(address)) != 0
+        || ::listen(fd.get(), 16) != 0) {
+        throw std::runtime_error("cannot listen on " + socket_path);
+    }
+    return fd;
+}
+
+[[nodiscard]] Descriptor connectTo(std::string const& socket_path)
+{
+    auto address = addressOf(socket_path);
+    Descriptor fd(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (fd.get() < 0
+        || ::connect(fd.get(), reinterpret_cast<sockaddr const*>(&address), sizeof(address)) != 0) {
+        throw std::runtime_error("cannot connect to " + socket_path);
+    }
+    return fd;
+}
+
+// The next connection waiting on `listener`, if any; an empty descriptor
+// otherwise.
+[[nodiscard]] Descriptor acceptFrom(Descriptor const& listener)
+{
+    return Descriptor(::accept4(listener.get(), nullptr, nullptr, SOCK_CLOEXEC));
+}
+
+// Both ends of a connected Unix stream socket pair.
+[[nodiscard]] std::pair<Descriptor, Descriptor> socketPair()
+{
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        throw std::runtime_error("cannot create a socket pair");
+    }
+    return { Descriptor(fds[0]), Descriptor(fds[1]) };
+}
+
+// Waits up to `timeout_ms` for `fd` to have something to read, or to be
+// closed by the peer.
+[[nodiscard]] bool readable(int fd, int timeout_ms)
+{
+    pollfd p {};
+    p.fd = fd;
+    p.events = POLLIN;
+    return ::poll(&p, 1, timeout_ms) > 0;
+}
+
+// Makes sends and receives on `fd` that make no progress for `timeout`
+// fail instead of blocking; zero waits forever.
+void setTimeout(int fd, std::chrono::milliseconds timeout)
+{
+    timeval tv {};
+    tv.tv_sec = static_cast<decltype(tv.tv_sec)>(timeout.count() / 1000);
+    tv.tv_usec = static_cast<decltype(tv.tv_usec)>(timeout.count() % 1000 * 1000);
+    if (::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0
+        || ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0) {
+        throw std::runtime_error("socket: cannot set timeout");
+    }
+}
+
+void sendAll(int fd, void const* data, usize size)
+{
+    auto bytes = static_cast<char const*>(data);
+    while (size > 0) {
+        auto sent = ::send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            throw std::runtime_error("socket: send failed");
+        }
+        bytes += sent;
+        size -= static_cast<usize>(sent);
+    }
+}
+
+// False if the peer closed the connection before the first byte.
+bool receiveAll(int fd, void* data, usize size)
+{
+    auto bytes = static_cast<char*>(data);
+    usize received = 0;
+    while (received < size) {
+        auto n = ::recv(fd, bytes + received, size - received, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0 && received == 0) {
+            return false;
+        }
+        if (n <= 0) {
+            throw std::runtime_error("socket: connection lost");
+        }
+        received += static_cast<usize>(n);
+    }
+    return true;
+}
+} // namespace raytracer
@@ -0,0 +1,56 @@
+export module raytracer.testing;
+
+import raytracer;
+import std;
+
+// Scenes and checks the rendering tests share.
+export namespace raytracer::testing {
+// Adds a sphere of `radius` around `center` with a material of its own.
+Sphere& addSphere(Scene& scene, vec3 const& center, f32 radius, material const& m)
+{
+    auto& s = scene.objects.add<Sphere>();
+    s.setTransform(mat4::translate(center.x, center.y, center.z) * mat4::scale(radius, radius, radius));
+    s.material_id = scene.materials.add(m);
+    return s;
+}
+
+// A floor (object 0), a red ball (1) and a mirror ball (2), lit by one
+// light. Objects a test adds come after, from 3.
+Scene spheres(vec3 const& mirror_center = vec3(1.2f, 0, 0))
+{
+    Scene scene;
+    material floor;
+    floor.color = vec3(0.8f, 0.8f, 0.7f);
+    material red;
+    red.color = vec3(0.9f, 0.2f, 0.1f);
+    material mirror;
+    mirror.color = vec3(0.2f);
+    mirror.reflective = 0.8f;
+    for (auto [center, radius, m] : { std::tuple(vec3(0, -1001, 0), 1000.0f, floor), std::tuple(vec3(-1, 0, 1), 1.0f, red), std::tuple(mirror_center, 1.0f, mirror) }) {
+        addSphere(scene, center, radius, m);
+    }
+    scene.lights.push_back(point_light(vec3(-5, 8, -6), one<vec3>));
+    scene.build();
+    return scene;
+}
+
+// Adds a small green ball resting on the floor of spheres() at `x`, `z`.
+// Call build() again afterwards.
+Sphere& addSmallBall(Scene& scene, f32 x, f32 z)
+{
+    material green;
+    green.color = vec3(0.1f, 0.8f, 0.2f);
+    return addSphere(scene, vec3(x, -0.7f, z), 0.3f, green);
+}
+
+// Looks down at spheres() from in front and above.
+Camera camera(i32 width, i32 height)
+{
+    return Camera(width, height, 1.0f, viewTransform(vec3(0, 1.5f, -6), vec3(0, 0, 0), vec3(0, 1, 0)));
+}
+
+bool same(Canvas<vec3> const& a, Canvas<vec3> const& b)
+{
+    return a.width() == b.width() && a.height() == b.height() && std::equal(a.begin(), a.end(), b.begin());
+}
+} // namespace raytracer::testing
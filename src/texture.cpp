@@ -0,0 +1,393 @@
+export module raytracer.texture;
+
+import raytracer.canvas;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+// Tiled mip-mapped texture file, little-endian: a header, then every level
+// from the finest down to 1x1, each as whole tiles in row-major order. A
+// tile is tile_size^2 RGBA8 texels, row-major, with the ones past the edge
+// of the level repeating the edge, so a tile is always read in one piece.
+namespace raytracer {
+constexpr u32 texture_magic = 0x58545452; // "RTTX"
+constexpr u32 texture_version = 1;
+
+struct texture_header {
+    u32 magic = texture_magic;
+    u32 version = texture_version;
+    u32 width;
+    u32 height;
+    u32 levels;
+    u32 tile_size;
+};
+
+static_assert(sizeof(texture_header) == 24);
+
+// Placement of one mip level in a texture file.
+struct texture_level {
+    u32 width;
+    u32 height;
+    u32 tiles_x;
+    u32 tiles_y;
+    // Index of the level's first tile in the file.
+    u64 first_tile;
+};
+
+std::vector<texture_level> levelsOf(u32 width, u32 height, u32 tile_size)
+{
+    std::vector<texture_level> levels;
+    u64 tiles = 0;
+    while (true) {
+        texture_level level;
+        level.width = width;
+        level.height = height;
+        level.tiles_x = (width + tile_size - 1) / tile_size;
+        level.tiles_y = (height + tile_size - 1) / tile_size;
+        level.first_tile = tiles;
+        tiles += u64(level.tiles_x) * level.tiles_y;
+        levels.push_back(level);
+        if (width == 1 && height == 1) {
+            return levels;
+        }
+        width = std::max(width / 2, 1u);
+        height = std::max(height / 2, 1u);
+    }
+}
+
+u8 quantize(f32 x)
+{
+    return static_cast<u8>(std::clamp(x, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+} // namespace raytracer
+
+export namespace raytracer {
+// Texels per tile side; a tile is 4 KiB.
+constexpr u32 texture_tile_size = 32;
+
+// Writes `image` as a texture file with its full mip pyramid, each level
+// a 2x2 box filter of the one above. Colours are clamped to [0, 1] and
+// stored with 8 bits per channel.
+void writeTexture(Canvas<vec3> const& image, std::string const& file_path)
+{
+    if constexpr (std::endian::native != std::endian::little) {
+        throw std::runtime_error("textures can only be written on little-endian hosts");
+    }
+    if (image.width() <= 0 || image.height() <= 0) {
+        throw std::runtime_error(file_path + ": empty texture");
+    }
+    auto levels = levelsOf(static_cast<u32>(image.width()), static_cast<u32>(image.height()), texture_tile_size);
+    texture_header header;
+    header.width = levels[0].width;
+    header.height = levels[0].height;
+    header.levels = static_cast<u32>(levels.size());
+    header.tile_size = texture_tile_size;
+
+    std::ofstream os(file_path, std::ios::binary);
+    if (!os) {
+        throw std::runtime_error("cannot open " + file_path);
+    }
+    os.write(reinterpret_cast<char const*>(&header), sizeof(header));
+
+    std::vector<vec3> level(image.begin(), image.end());
+    std::vector<u8> tile(texture_tile_size * texture_tile_size * 4);
+    for (usize l = 0; l < levels.size(); l++) {
+        auto const& info = levels[l];
+        for (u32 ty = 0; ty < info.tiles_y; ty++) {
+            for (u32 tx = 0; tx < info.tiles_x; tx++) {
+                for (u32 y = 0; y < texture_tile_size; y++) {
+                    for (u32 x = 0; x < texture_tile_size; x++) {
+                        u32 col = std::min(tx * texture_tile_size + x, info.width - 1);
+                        u32 row = std::min(ty * texture_tile_size + y, info.height - 1);
+                        auto const& c = level[row * info.width + col];
+                        auto* texel = &tile[(y * texture_tile_size + x) * 4];
+                        texel[0] = quantize(c.x);
+                        texel[1] = quantize(c.y);
+                        texel[2] = quantize(c.z);
+                        texel[3] = 255;
+                    }
+                }
+                os.write(reinterpret_cast<char const*>(tile.data()), static_cast<std::streamsize>(tile.size()));
+            }
+        }
+        if (l + 1 == levels.size()) {
+            break;
+        }
+        auto const& next = levels[l + 1];
+        std::vector<vec3> smaller(usize(next.width) * next.height);
+        for (u32 row = 0; row < next.height; row++) {
+            for (u32 col = 0; col < next.width; col++) {
+                u32 x0 = std::min(2 * col, info.width - 1), x1 = std::min(2 * col + 1, info.width - 1);
+                u32 y0 = std::min(2 * row, info.height - 1), y1 = std::min(2 * row + 1, info.height - 1);
+                smaller[row * next.width + col] = (level[y0 * info.width + x0] + level[y0 * info.width + x1]
+                                                      + level[y1 * info.width + x0] + level[y1 * info.width + x1])
+                    / 4.0f;
+            }
+        }
+        level = std::move(smaller);
+    }
+    if (!os) {
+        throw std::runtime_error("cannot write " + file_path);
+    }
+}
+
+struct texture_cache_stats {
+    // Texel fetches, each of which needs its tile resident.
+    u64 lookups = 0;
+    u64 hits = 0;
+    // Tiles read from disk.
+    u64 misses = 0;
+    u64 evictions = 0;
+    usize resident_bytes = 0;
+};
+
+// Texture files opened by id and paged in a tile at a time. Resident tiles
+// share a fixed pool sized by the memory budget, and when it is full a
+// tile not used lately makes way, so the textures a scene references may
+// be far bigger than memory. A texture only costs its open file and level
+// table until sampled, and a sample only touches the tiles under its
+// footprint at the mip level that footprint selects, which keeps distant
+// and minified surfaces down to a few small tiles.
+//
+// The cache can be shared by threads. Fetches from resident tiles hold
+// the lock shared and only set their tile's used bit, so they don't wait
+// on each other; a miss takes it exclusively to read the tile in. The
+// tile to evict is picked by the clock algorithm (Corbató 1968), which
+// approximates least recently used without reordering a list on every
+// hit.
+class TextureCache {
+public:
+    static constexpr usize tile_bytes = usize(texture_tile_size) * texture_tile_size * 4;
+
+    // Holds at most `budget_bytes` of tiles, and always room for one.
+    explicit TextureCache(usize budget_bytes)
+        : m_slots(std::max<usize>(budget_bytes / tile_bytes, 1))
+        , m_memory(m_slots.size() * tile_bytes)
+    {
+    }
+
+    // Opens a texture file for sampling and returns its id. Throws if the
+    // file cannot be read or is not a texture.
+    u32 open(std::string const& file_path)
+    {
+        texture t;
+        t.file.open(file_path, std::ios::binary);
+        if (!t.file) {
+            throw std::runtime_error("cannot open " + file_path);
+        }
+        texture_header header;
+        if (!t.file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != texture_magic) {
+            throw std::runtime_error(file_path + ": not a texture");
+        }
+        if (header.version != texture_version) {
+            throw std::runtime_error(std::format(
+                "{}: texture version {}, expected {}",
+                file_path, header.version, texture_version));
+        }
+        if (header.width == 0 || header.height == 0 || header.tile_size != texture_tile_size) {
+            throw std::runtime_error(file_path + ": corrupt texture header");
+        }
+        t.levels = levelsOf(header.width, header.height, header.tile_size);
+        auto const& coarsest = t.levels.back();
+        u64 tiles = coarsest.first_tile + u64(coarsest.tiles_x) * coarsest.tiles_y;
+        t.file.seekg(0, std::ios::end);
+        if (header.levels != t.levels.size() || u64(t.file.tellg()) < sizeof(header) + tiles * tile_bytes) {
+            throw std::runtime_error(file_path + ": truncated texture");
+        }
+        std::unique_lock lock(m_mutex);
+        if (m_textures.size() >= max_textures) {
+            throw std::runtime_error(file_path + ": too many textures");
+        }
+        m_textures.push_back(std::move(t));
+        return static_cast<u32>(m_textures.size() - 1);
+    }
+
+    [[nodiscard]] usize size() const
+    {
+        std::shared_lock lock(m_mutex);
+        return m_textures.size();
+    }
+
+    [[nodiscard]] uvec2 dimensions(u32 texture) const
+    {
+        std::shared_lock lock(m_mutex);
+        auto const& level = m_textures[texture].levels[0];
+        return uvec2(level.width, level.height);
+    }
+
+    [[nodiscard]] u32 levels(u32 texture) const
+    {
+        std::shared_lock lock(m_mutex);
+        return static_cast<u32>(m_textures[texture].levels.size());
+    }
+
+    // Colour at `uv`, with u to the right and v up the image, wrapping
+    // around outside [0, 1]. `width` is the footprint's extent in uv
+    // units; levels are picked so a texel spans about that much and
+    // blended trilinearly. 0 reads the finest level.
+    [[nodiscard]] vec3 sample(u32 texture, vec2 uv, f32 width)
+    {
+        std::shared_lock lock(m_mutex);
+        auto const& t = m_textures[texture];
+        auto const& finest = t.levels[0];
+        f32 lod = width > 0.0f ? std::log2(width * f32(std::max(finest.width, finest.height))) : 0.0f;
+        lod = std::clamp(lod, 0.0f, f32(t.levels.size() - 1));
+        u32 level = static_cast<u32>(lod);
+        f32 blend = lod - f32(level);
+        auto color = bilinear(lock, texture, level, uv);
+        if (blend > 0.0f) {
+            color = color * (1.0f - blend) + bilinear(lock, texture, level + 1, uv) * blend;
+        }
+        return color;
+    }
+
+    // Texel (x, y) of `level`, with row 0 at the top; both wrap around.
+    [[nodiscard]] vec3 texel(u32 texture, u32 level, i32 x, i32 y)
+    {
+        std::shared_lock lock(m_mutex);
+        return fetch(lock, texture, level, x, y);
+    }
+
+    [[nodiscard]] texture_cache_stats stats() const
+    {
+        std::shared_lock lock(m_mutex);
+        auto stats = m_stats;
+        stats.lookups = m_lookups;
+        stats.hits = m_hits;
+        stats.resident_bytes = m_resident.size() * tile_bytes;
+        return stats;
+    }
+
+private:
+    static constexpr u64 no_key = std::numeric_limits<u64>::max();
+    // Tile keys hold the texture in their top 16 bits, the level in the
+    // next 8 and the tile in the rest.
+    static constexpr usize max_textures = 1 << 16;
+
+    struct texture {
+        std::ifstream file;
+        std::vector<texture_level> levels;
+    };
+
+    // Room for one tile; no_key while empty.
+    struct slot {
+        u64 key = no_key;
+        // Set by every fetch from the tile, cleared as the clock hand
+        // passes.
+        std::atomic<bool> used = false;
+    };
+
+    std::vector<texture> m_textures;
+    std::vector<slot> m_slots;
+    std::vector<u8> m_memory;
+    std::unordered_map<u64, u32> m_resident;
+    u32 m_hand = 0;
+    // Counted under the shared lock; m_stats has the rest.
+    std::atomic<u64> m_lookups = 0;
+    std::atomic<u64> m_hits = 0;
+    texture_cache_stats m_stats;
+    mutable std::shared_mutex m_mutex;
+
+    vec3 bilinear(std::shared_lock<std::shared_mutex>& lock, u32 texture, u32 level, vec2 uv)
+    {
+        // A copy, as a miss lets go of the lock and open() may move it.
+        auto info = m_textures[texture].levels[level];
+        f32 x = uv.x * f32(info.width) - 0.5f;
+        f32 y = (1.0f - uv.y) * f32(info.height) - 0.5f;
+        // Coordinates that aren't finite, e.g. from a degenerate mapping,
+        // read the first texel rather than convert to garbage.
+        if (!std::isfinite(x) || !std::isfinite(y)) {
+            x = y = 0.0f;
+        }
+        f32 x0 = std::floor(x), y0 = std::floor(y);
+        f32 fx = x - x0, fy = y - y0;
+        // Brings the coordinates within one period, which i32 holds;
+        // whole periods don't change the result.
+        i32 ix = static_cast<i32>(std::fmod(x0, f32(info.width)));
+        i32 iy = static_cast<i32>(std::fmod(y0, f32(info.height)));
+        auto top = fetch(lock, texture, level, ix, iy) * (1.0f - fx) + fetch(lock, texture, level, ix + 1, iy) * fx;
+        auto bottom = fetch(lock, texture, level, ix, iy + 1) * (1.0f - fx) + fetch(lock, texture, level, ix + 1, iy + 1) * fx;
+        return top * (1.0f - fy) + bottom * fy;
+    }
+
+    // Texel (x, y) of the level, with `lock` held shared. On a miss the
+    // lock is given up while the tile is read in, and held again on
+    // return.
+    vec3 fetch(std::shared_lock<std::shared_mutex>& lock, u32 texture, u32 level, i32 x, i32 y)
+    {
+        auto const& info = m_textures[texture].levels[level];
+        u32 col = static_cast<u32>((x % i32(info.width) + i32(info.width)) % i32(info.width));
+        u32 row = static_cast<u32>((y % i32(info.height) + i32(info.height)) % i32(info.height));
+        u64 tile = info.first_tile + u64(row / texture_tile_size) * info.tiles_x + col / texture_tile_size;
+        u64 key = u64(texture) << 48 | u64(level) << 40 | tile;
+        usize offset = ((row % texture_tile_size) * texture_tile_size + col % texture_tile_size) * 4;
+        m_lookups++;
+        if (auto it = m_resident.find(key); it != m_resident.end()) {
+            m_hits++;
+            return texelAt(it->second, offset);
+        }
+
+        lock.unlock();
+        vec3 color;
+        {
+            std::unique_lock exclusive(m_mutex);
+            color = texelAt(residentTile(texture, key, tile), offset);
+        }
+        lock.lock();
+        return color;
+    }
+
+    vec3 texelAt(u32 s, usize offset)
+    {
+        m_slots[s].used.store(true, std::memory_order_relaxed);
+        u8 const* c = &m_memory[s * tile_bytes + offset];
+        return vec3(f32(c[0]), f32(c[1]), f32(c[2])) / 255.0f;
+    }
+
+    // Slot holding the tile, read in over an evicted one if it isn't
+    // resident. Needs the lock held exclusively.
+    u32 residentTile(u32 texture, u64 key, u64 tile)
+    {
+        // Another thread may have read it in while the lock was free.
+        if (auto it = m_resident.find(key); it != m_resident.end()) {
+            m_hits++;
+            return it->second;
+        }
+
+        m_stats.misses++;
+        u32 s = evict();
+        auto& file = m_textures[texture].file;
+        file.clear();
+        file.seekg(static_cast<std::streamoff>(sizeof(texture_header) + tile * tile_bytes));
+        // open() checked the size, so this only fails if the file changed.
+        // The slot stays empty then, and nothing is left pointing at it.
+        if (!file.read(reinterpret_cast<char*>(&m_memory[s * tile_bytes]), tile_bytes)) {
+            throw std::runtime_error("texture file changed while open");
+        }
+        m_slots[s].key = key;
+        m_resident.emplace(key, s);
+        return s;
+    }
+
+    // Empties a slot and returns it: the first empty one the clock hand
+    // meets, or else the first whose used bit it finds clear, clearing
+    // the bits it passes.
+    u32 evict()
+    {
+        while (true) {
+            u32 s = m_hand;
+            m_hand = (m_hand + 1) % static_cast<u32>(m_slots.size());
+            auto& entry = m_slots[s];
+            if (entry.key == no_key) {
+                return s;
+            }
+            if (!entry.used.exchange(false, std::memory_order_relaxed)) {
+                m_resident.erase(entry.key);
+                entry.key = no_key;
+                m_stats.evictions++;
+                return s;
+            }
+        }
+    }
+};
+} // namespace raytracer
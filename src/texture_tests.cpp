@@ -0,0 +1,264 @@
+import boost.ut;
+import raytracer;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+
+namespace {
+// Black and white squares `square` texels wide.
+Canvas<vec3> checker(i32 size, i32 square)
+{
+    Canvas<vec3> image(size, size);
+    for (i32 row = 0; row < size; row++) {
+        for (i32 col = 0; col < size; col++) {
+            image[row, col] = vec3((row / square + col / square) % 2 == 0 ? 1.0f : 0.0f);
+        }
+    }
+    return image;
+}
+
+std::string temporary(std::string const& name)
+{
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+bool near(vec3 const& a, vec3 const& b, f32 tolerance)
+{
+    return std::abs(a.x - b.x) <= tolerance && std::abs(a.y - b.y) <= tolerance && std::abs(a.z - b.z) <= tolerance;
+}
+} // namespace
+
+int main()
+{
+    feature("Texture files") = [] {
+        auto path = temporary("raytracer_texture_tests.tex");
+        Canvas<vec3> image(40, 24);
+        for (i32 row = 0; row < image.height(); row++) {
+            for (i32 col = 0; col < image.width(); col++) {
+                image[row, col] = vec3(f32(col) / 40.0f, f32(row) / 24.0f, 0.5f);
+            }
+        }
+        writeTexture(image, path);
+        TextureCache cache(1 << 20);
+        auto id = cache.open(path);
+
+        then("Every level down to 1x1 is stored") = [&] {
+            expect(cache.dimensions(id) == uvec2(40, 24));
+            expect(cache.levels(id) == 6u);
+        };
+
+        then("The finest level holds the image in 8 bits") = [&] {
+            for (auto [row, col] : { std::pair(0, 0), std::pair(23, 39), std::pair(5, 33) }) {
+                expect(near(cache.texel(id, 0, col, row), image[row, col], 0.6f / 255.0f)) << row << col;
+            }
+        };
+
+        then("Coarser levels average the one above") = [&] {
+            auto expected = (image[2, 4] + image[2, 5] + image[3, 4] + image[3, 5]) / 4.0f;
+            expect(near(cache.texel(id, 1, 2, 1), expected, 1.0f / 255.0f));
+            expect(cache.texel(id, 0, 40, -1) == cache.texel(id, 0, 0, 23));
+        };
+
+        then("Opening something else fails") = [&] {
+            expect(throws([] { TextureCache(1 << 20).open(temporary("raytracer_texture_tests.missing")); }));
+            auto truncated = temporary("raytracer_texture_tests.truncated");
+            std::filesystem::copy_file(path, truncated, std::filesystem::copy_options::overwrite_existing);
+            std::filesystem::resize_file(truncated, 100);
+            expect(throws([&] { TextureCache(1 << 20).open(truncated); }));
+            std::filesystem::remove(truncated);
+        };
+        std::filesystem::remove(path);
+    };
+
+    feature("Sampling") = [] {
+        auto path = temporary("raytracer_texture_sampling.tex");
+        writeTexture(checker(256, 1), path);
+        TextureCache cache(1 << 20);
+        auto id = cache.open(path);
+
+        then("A point footprint reads single texels, v up") = [&] {
+            // Texel centres of the bottom row, where v is 0.
+            expect(near(cache.sample(id, vec2(0.5f / 256.0f, 0.5f / 256.0f), 0.0f), vec3(0.0f), 1e-3f));
+            expect(near(cache.sample(id, vec2(1.5f / 256.0f, 0.5f / 256.0f), 0.0f), vec3(1.0f), 1e-3f));
+        };
+
+        then("Wider footprints read coarser levels, which are blurred") = [&] {
+            for (auto width : { 2.0f / 256.0f, 0.1f, 10.0f }) {
+                expect(near(cache.sample(id, vec2(0.3f, 0.7f), width), vec3(0.5f), 2.0f / 255.0f)) << width;
+            }
+        };
+
+        then("Coordinates wrap around") = [&] {
+            expect(cache.sample(id, vec2(0.25f, 0.5f), 0.0f) == cache.sample(id, vec2(1.25f, -1.5f), 0.0f));
+        };
+
+        then("Coordinates that aren't finite or are huge still read a texel") = [&] {
+            auto nan = std::numeric_limits<f32>::quiet_NaN();
+            auto inf = std::numeric_limits<f32>::infinity();
+            for (auto uv : { vec2(nan, 0.5f), vec2(0.5f, inf), vec2(1e30f, -1e30f) }) {
+                for (f32 width : { 0.0f, nan, inf }) {
+                    auto c = cache.sample(id, uv, width);
+                    expect(std::isfinite(c.x) && c.x >= 0.0f && c.x <= 1.0f);
+                }
+            }
+        };
+        std::filesystem::remove(path);
+    };
+
+    feature("Bounded cache") = [] {
+        auto path = temporary("raytracer_texture_cache.tex");
+        writeTexture(checker(256, 4), path);
+
+        given("A budget of four tiles") = [&] {
+            TextureCache cache(4 * TextureCache::tile_bytes);
+            auto id = cache.open(path);
+            // Every texel of the finest level, row by row.
+            for (i32 row = 0; row < 256; row++) {
+                for (i32 col = 0; col < 256; col++) {
+                    (void)cache.texel(id, 0, col, row);
+                }
+            }
+            auto stats = cache.stats();
+
+            then("Memory stays within the budget") = [&] {
+                expect(stats.resident_bytes == 4 * TextureCache::tile_bytes);
+                expect(stats.evictions > 0u);
+            };
+
+            then("Sweeping more tiles than fit rereads each one") = [&] {
+                // Eight tiles across, of which the oldest is always the
+                // next one wanted.
+                expect(stats.misses == 256u * 8u) << stats.misses;
+                expect(stats.hits + stats.misses == stats.lookups);
+            };
+
+            then("Recently used tiles are the ones kept") = [&] {
+                auto before = cache.stats();
+                (void)cache.texel(id, 0, 255, 255);
+                (void)cache.texel(id, 0, 130, 255);
+                auto after = cache.stats();
+                expect(after.misses == before.misses);
+                (void)cache.texel(id, 0, 0, 0);
+                expect(cache.stats().misses == before.misses + 1);
+            };
+        };
+
+        then("Texel fetches within a tile are hits") = [&] {
+            TextureCache cache(TextureCache::tile_bytes);
+            auto id = cache.open(path);
+            for (i32 row = 0; row < 32; row++) {
+                for (i32 col = 0; col < 32; col++) {
+                    (void)cache.texel(id, 0, col, row);
+                }
+            }
+            expect(cache.stats().misses == 1u);
+        };
+
+        then("Threads sampling at once each see the right texels") = [&] {
+            TextureCache cache(4 * TextureCache::tile_bytes);
+            auto id = cache.open(path);
+            std::atomic<u32> wrong = 0;
+            std::vector<std::jthread> threads;
+            for (i32 t = 0; t < 4; t++) {
+                threads.emplace_back([&, t] {
+                    for (i32 row = t; row < 256; row += 4) {
+                        for (i32 col = 0; col < 256; col++) {
+                            f32 expected = (row / 4 + col / 4) % 2 == 0 ? 1.0f : 0.0f;
+                            wrong += cache.texel(id, 0, col, row) != vec3(expected);
+                        }
+                    }
+                });
+            }
+            threads.clear();
+            auto stats = cache.stats();
+            expect(wrong == 0u);
+            expect(stats.lookups == 256u * 256u);
+            expect(stats.hits + stats.misses == stats.lookups);
+            expect(stats.resident_bytes == 4 * TextureCache::tile_bytes);
+        };
+
+        then("A tile that fails to read is not left resident") = [&] {
+            auto shrinking = temporary("raytracer_texture_cache.shrinking");
+            std::filesystem::copy_file(path, shrinking, std::filesystem::copy_options::overwrite_existing);
+            TextureCache cache(4 * TextureCache::tile_bytes);
+            auto id = cache.open(shrinking);
+            std::filesystem::resize_file(shrinking, 100);
+            expect(throws([&] { (void)cache.texel(id, 0, 0, 0); }));
+            expect(throws([&] { (void)cache.texel(id, 0, 0, 0); }));
+            expect(cache.stats().resident_bytes == 0u);
+            std::filesystem::remove(shrinking);
+        };
+        std::filesystem::remove(path);
+    };
+
+    feature("Footprints") = [] {
+        then("Spheres map longitude to u and latitude to v") = [] {
+            Sphere s;
+            auto uvAt = [&](vec3 const& p) { return s.uvAt(p, intersection(1.0f, s)); };
+            auto near2 = [](vec2 const& a, vec2 const& b) { return std::abs(a.x - b.x) < 1e-5f && std::abs(a.y - b.y) < 1e-5f; };
+            expect(near2(uvAt(vec3(0, 0, -1)), vec2(0.0f, 0.5f)));
+            expect(near2(uvAt(vec3(1, 0, 0)), vec2(0.25f, 0.5f)));
+            expect(near2(uvAt(vec3(0, 0, 1)), vec2(0.5f, 0.5f)));
+            expect(near2(uvAt(vec3(-1, 0, 0)), vec2(0.75f, 0.5f)));
+            expect(near2(uvAt(vec3(0, 1, 0)), vec2(0.5f, 1.0f)));
+            expect(near2(uvAt(vec3(0, -1, 0)), vec2(0.5f, 0.0f)));
+        };
+
+        then("Differentials grow with distance and obliquity") = [] {
+            ray_differential rd;
+            rd.dddx = vec3(0.01f, 0, 0);
+            rd.dddy = vec3(0, 0.01f, 0);
+            auto r = ray(zero<vec3>, vec3(0, 0, 1));
+            auto [dpdx, dpdy] = footprintAt(r, rd, 5.0f, vec3(0, 0, -1));
+            expect(near(dpdx, vec3(0.05f, 0, 0), 1e-6f) && near(dpdy, vec3(0, 0.05f, 0), 1e-6f));
+            // A plane tilted 60 degrees about y stretches x by 2.
+            auto tilted = footprintAt(r, rd, 5.0f, normalize(vec3(std::sqrt(3.0f), 0, -1)));
+            expect(std::abs(tilted.first.length() - 0.1f) < 1e-5f) << tilted.first.length();
+            // A ray along the surface has no point on its tangent plane.
+            auto grazing = footprintAt(r, rd, 5.0f, vec3(1, 0, 0));
+            expect(grazing.first == vec3() && grazing.second == vec3());
+        };
+
+        then("Distant textured surfaces read filtered levels") = [] {
+            auto path = temporary("raytracer_texture_tracer.tex");
+            writeTexture(checker(256, 1), path);
+            Scene scene;
+            scene.textures = std::make_shared<TextureCache>(1 << 20);
+            material m;
+            m.ambient = 1.0f;
+            m.diffuse = m.specular = 0.0f;
+            m.texture = scene.textures->open(path);
+            auto& s = scene.objects.add<Sphere>();
+            s.material_id = scene.materials.add(m);
+            scene.lights.push_back(point_light(vec3(0, 0, -10), one<vec3>));
+            scene.build();
+
+            constexpr i32 size = 16;
+            u32 outside = 0;
+            auto primary = [&outside](i32 row, i32 col) {
+                outside += row < 0 || row >= size || col < 0 || col >= size;
+                auto target = vec3(-1.2f + 2.4f * (f32(col) + 0.5f) / size, 1.2f - 2.4f * (f32(row) + 0.5f) / size, 0.0f);
+                auto origin = vec3(0, 0, -5);
+                return ray(origin, normalize(target - origin));
+            };
+            Canvas<vec3> image(size, size);
+            RayTracer().render(scene, primary, image);
+            u32 hits = 0;
+            for (i32 row = 0; row < size; row++) {
+                for (i32 col = 0; col < size; col++) {
+                    if (image[row, col] != zero<vec3>) {
+                        hits++;
+                        // Single texels would be black or white.
+                        expect(near(image[row, col], vec3(0.5f), 0.05f)) << row << col << image[row, col].x;
+                    }
+                }
+            }
+            expect(hits > size * size / 2u);
+            // The last row and column take differences backwards.
+            expect(outside == 0u);
+            std::filesystem::remove(path);
+        };
+    };
+}
@@ -0,0 +1,327 @@
+export module raytracer.tracer;
+
+import raytracer.canvas;
+import raytracer.constants;
+import raytracer.environment;
+import raytracer.material;
+import raytracer.object;
+import raytracer.random;
+import raytracer.ray;
+import raytracer.scene;
+import raytracer.texture;
+import raytracer.types;
+import raytracer.vec;
+import std;
+
+export namespace raytracer {
+struct trace_settings {
+    // Hard cap on reflection and refraction bounces.
+    u32 max_depth = 32;
+    // Branches whose weight falls below this, in every channel, play
+    // Russian roulette: they survive with probability weight / threshold
+    // and are scaled up to compensate.
+    f32 roulette_threshold = 0.05f;
+    // Bounces traced before roulette starts.
+    u32 roulette_depth = 2;
+    // Most rays one pixel may trace, its primary ray included.
+    u32 pixel_ray_budget = 64;
+    // Most rays a whole frame may trace, 0 for no limit. Each pixel gets
+    // an even share plus whatever earlier pixels left unused, and always
+    // at least its primary ray.
+    u64 frame_ray_budget = 0;
+    u32 seed = 0;
+};
+
+struct trace_stats {
+    // Primary and secondary rays; shadow rays are counted apart.
+    u64 rays = 0;
+    u64 shadow_rays = 0;
+    u64 roulette_kills = 0;
+    // Branches dropped because their pixel's budget was spent.
+    u64 budget_kills = 0;
+    usize max_stack_size = 0;
+};
+
+// Whitted-style ray tracer: Phong shading with hard shadows from every
+// light, plus mirror reflection and refraction weighted by the material
+// and split by Schlick's Fresnel term when both are present. Branches are
+// kept on an explicit stack rather than by recursion, heaviest on top, so
+// depth costs no call stack and a tight budget drops the dimmest work.
+// Rays that escape see the scene's environment map, which lights nothing
+// else here; the path tracer samples it as a light.
+class RayTracer {
+public:
+    explicit RayTracer(trace_settings const& settings = trace_settings())
+        : m_settings(settings)
+    {
+    }
+
+    [[nodiscard]] trace_settings const& settings() const
+    {
+        return m_settings;
+    }
+
+    // Colour seen along `r`, tracing at most `budget` rays. `rng` drives
+    // the roulette. Textures are read at their finest level.
+    vec3 trace(Scene const& scene, ray const& r, u32 budget, u32& rng, trace_stats& stats) const
+    {
+        return trace(scene, r, ray_differential(), budget, rng, stats);
+    }
+
+    // As above, with `rd` giving the pixel's footprint, which picks the
+    // texture level. The differential is carried along reflections as if
+    // the surface were flat at each hit, and along refractions unchanged.
+    vec3 trace(Scene const& scene, ray const& r, ray_differential const& rd, u32 budget, u32& rng, trace_stats& stats) const
+    {
+        return trace(scene, r, rd, scene.intersect(ray(r.o, normalize(r.d))), budget, rng, stats);
+    }
+
+    // As above, with the closest hit along `r`, or its absence, already
+    // known, e.g. from a VisibilityBuffer, so intersecting starts at the
+    // secondary rays. The hit's t is along `r` with its direction
+    // normalized. The primary ray still counts against the budget and in
+    // the stats, so the result matches tracing it.
+    vec3 trace(Scene const& scene, ray const& r, ray_differential const& rd, std::optional<intersection> const& primary_hit, u32 budget, u32& rng, trace_stats& stats) const
+    {
+        m_stack.clear();
+        branch primary;
+        primary.r = ray(r.o, normalize(r.d));
+        primary.rd = rd;
+        primary.weight = one<vec3>;
+        primary.depth = 0;
+        m_stack.push_back(primary);
+
+        vec3 color = zero<vec3>;
+        u32 traced = 0;
+        while (!m_stack.empty()) {
+            stats.max_stack_size = std::max(stats.max_stack_size, m_stack.size());
+            auto b = m_stack.back();
+            m_stack.pop_back();
+            if (traced == budget) {
+                stats.budget_kills += m_stack.size() + 1;
+                break;
+            }
+            traced++;
+            stats.rays++;
+            auto h = b.depth == 0 ? primary_hit : scene.intersect(b.r);
+            if (!h) {
+                if (scene.environment) {
+                    color = color + b.weight * scene.environment->radiance(b.r.d);
+                }
+                continue;
+            }
+            auto const& object = scene.objects.get(h->object_id);
+            auto m = scene.materials.get(object.material_id);
+            auto point = b.r.at(h->t);
+            auto eye = -b.r.d;
+            auto normal = object.normalAt(point, *h);
+            bool inside = dot(normal, eye) < 0.0f;
+            if (inside) {
+                normal = -normal;
+            }
+            auto [dpdx, dpdy] = footprintAt(b.r, b.rd, h->t, normal);
+            if (m.texture != no_texture && scene.textures) {
+                m.color = m.color * textureColor(*scene.textures, m.texture, object, *h, point, dpdx, dpdy);
+            }
+            color = color + b.weight * shade(scene, m, point, eye, normal, stats);
+
+            if (b.depth + 1 >= m_settings.max_depth) {
+                continue;
+            }
+            f32 n1 = inside ? m.refractive_index : 1.0f;
+            f32 n2 = inside ? 1.0f : m.refractive_index;
+            auto refracted = refract(b.r.d, normal, n1 / n2);
+            f32 reflected_part = m.reflective;
+            f32 refracted_part = m.transparency;
+            if (refracted_part > 0.0f && !refracted) {
+                // Total internal reflection.
+                reflected_part += refracted_part;
+                refracted_part = 0.0f;
+            } else if (reflected_part > 0.0f && refracted_part > 0.0f) {
+                f32 reflectance = schlick(eye, normal, *refracted, n1, n2);
+                reflected_part *= reflectance;
+                refracted_part *= 1.0f - reflectance;
+            }
+
+            std::array<branch, 2> children;
+            usize count = 0;
+            if (reflected_part > 0.0f) {
+                auto& c = children[count++];
+                c.r = ray(point + normal * ray_bias, reflect(b.r.d, normal));
+                c.rd.dodx = dpdx;
+                c.rd.dddx = reflect(b.rd.dddx, normal);
+                c.rd.dody = dpdy;
+                c.rd.dddy = reflect(b.rd.dddy, normal);
+                c.weight = b.weight * reflected_part;
+            }
+            if (refracted_part > 0.0f) {
+                auto& c = children[count++];
+                c.r = ray(point - normal * ray_bias, *refracted);
+                c.rd.dodx = dpdx;
+                c.rd.dddx = b.rd.dddx;
+                c.rd.dody = dpdy;
+                c.rd.dddy = b.rd.dddy;
+                c.weight = b.weight * m.color * refracted_part;
+            }
+            if (count == 2 && maxOf(children[0].weight) > maxOf(children[1].weight)) {
+                std::swap(children[0], children[1]);
+            }
+            for (usize i = 0; i < count; i++) {
+                auto& c = children[i];
+                c.depth = b.depth + 1;
+                if (c.depth >= m_settings.roulette_depth && maxOf(c.weight) < m_settings.roulette_threshold) {
+                    f32 survival = maxOf(c.weight) / m_settings.roulette_threshold;
+                    if (nextUniform(rng) >= survival) {
+                        stats.roulette_kills++;
+                        continue;
+                    }
+                    c.weight = c.weight / survival;
+                }
+                if (maxOf(c.weight) > 0.0f) {
+                    m_stack.push_back(c);
+                }
+            }
+        }
+        return color;
+    }
+
+    // Traces one ray through each pixel, `primary(row, col)`, within the
+    // pixel and frame budgets. When the scene has textures, the rays
+    // through the next pixels across and down give each ray's
+    // differential, or the previous ones at the last column and row. The
+    // scene must be built.
+    template<typename F>
+    requires std::is_invocable_r_v<ray, F const&, i32, i32>
+    trace_stats render(Scene const& scene, F const& primary, Canvas<vec3>& out) const
+    {
+        trace_stats stats;
+        auto pixel_count = static_cast<u64>(out.size());
+        u64 share = m_settings.frame_ray_budget / std::max<u64>(pixel_count, 1);
+        u64 credit = 0;
+        for (i32 row = 0; row < out.height(); row++) {
+            for (i32 col = 0; col < out.width(); col++) {
+                u64 budget = m_settings.pixel_ray_budget;
+                if (m_settings.frame_ray_budget != 0) {
+                    credit += share;
+                    budget = std::min(budget, std::max<u64>(credit, 1));
+                }
+                auto pixel = static_cast<u32>(row * out.width() + col);
+                u32 rng = pcgHash(pixel ^ pcgHash(m_settings.seed));
+                auto rays_before = stats.rays;
+                auto r = primary(row, col);
+                ray_differential rd {};
+                if (scene.textures) {
+                    rd = differentialOf(primary, r, row, col, out.width(), out.height());
+                }
+                out[row, col] = trace(scene, r, rd, static_cast<u32>(budget), rng, stats);
+                credit -= std::min(credit, stats.rays - rays_before);
+            }
+        }
+        return stats;
+    }
+
+private:
+    static constexpr f32 ray_bias = 1e-4f;
+
+    struct branch {
+        ray r;
+        ray_differential rd;
+        // Fraction of this ray's colour that reaches the pixel.
+        vec3 weight;
+        u32 depth;
+    };
+
+    trace_settings m_settings;
+    // Reused across pixels so tracing doesn't allocate; a RayTracer is
+    // therefore not for sharing between threads.
+    mutable std::vector<branch> m_stack;
+
+    // Differential of `r`, the ray through (row, col), from its
+    // neighbours within a width x height canvas: forward differences,
+    // backward ones where the canvas ends, and none along a side of one
+    // pixel.
+    template<typename F>
+    static ray_differential differentialOf(F const& primary, ray const& r, i32 row, i32 col, i32 width, i32 height)
+    {
+        auto d = normalize(r.d);
+        auto difference = [&](i32 next_row, i32 next_col, f32 sign, vec3& dodx, vec3& dddx) {
+            auto next = primary(next_row, next_col);
+            dodx = (next.o - r.o) * sign;
+            dddx = (normalize(next.d) - d) * sign;
+        };
+        ray_differential rd {};
+        if (width > 1) {
+            bool last = col + 1 == width;
+            difference(row, last ? col - 1 : col + 1, last ? -1.0f : 1.0f, rd.dodx, rd.dddx);
+        }
+        if (height > 1) {
+            bool last = row + 1 == height;
+            difference(last ? row - 1 : row + 1, col, last ? -1.0f : 1.0f, rd.dody, rd.dddy);
+        }
+        return rd;
+    }
+
+    static f32 maxOf(vec3 const& v)
+    {
+        return std::max({ v.x, v.y, v.z });
+    }
+
+    // Texture colour at a hit whose footprint spans `dpdx` and `dpdy`,
+    // with the footprint's size in texture space found by mapping its
+    // corners. Differences in u are taken the short way round, since
+    // most mappings wrap in u.
+    static vec3 textureColor(TextureCache& textures, u32 texture, Object const& object, intersection const& h, vec3 const& point, vec3 const& dpdx, vec3 const& dpdy)
+    {
+        auto uv = object.uvAt(point, h);
+        auto extent = [&](vec3 const& dp) {
+            auto d = object.uvAt(point + dp, h) - uv;
+            d.x -= std::round(d.x);
+            return d.length();
+        };
+        return textures.sample(texture, uv, std::max(extent(dpdx), extent(dpdy)));
+    }
+
+    // Phong shading of one hit from every light, with hard shadows.
+    static vec3 shade(Scene const& scene, material const& m, vec3 const& point, vec3 const& eye, vec3 const& normal, trace_stats& stats)
+    {
+        vec3 color = zero<vec3>;
+        auto over_point = point + normal * ray_bias;
+        for (auto const& light : scene.lights) {
+            auto to_light = light.position - over_point;
+            f32 distance = to_light.length();
+            stats.shadow_rays++;
+            if (scene.occluded(ray(over_point, to_light / distance), distance)) {
+                color = color + m.color * light.intensity * m.ambient;
+            } else {
+                color = color + lighting(m, light, point, eye, normal);
+            }
+        }
+        return color;
+    }
+
+    // Direction refracted through a surface with normal `n` facing the
+    // incoming direction `d`, or none on total internal reflection.
+    static std::optional<vec3> refract(vec3 const& d, vec3 const& n, f32 eta)
+    {
+        f32 cos_i = -dot(d, n);
+        f32 sin2_t = eta * eta * (1.0f - cos_i * cos_i);
+        if (sin2_t > 1.0f) {
+            return {};
+        }
+        f32 cos_t = std::sqrt(1.0f - sin2_t);
+        return normalize(d * eta + n * (eta * cos_i - cos_t));
+    }
+
+    // Schlick's approximation of the reflected fraction.
+    static f32 schlick(vec3 const& eye, vec3 const& normal, vec3 const& refracted, f32 n1, f32 n2)
+    {
+        f32 cos = dot(eye, normal);
+        if (n1 > n2) {
+            cos = -dot(refracted, normal);
+        }
+        f32 r0 = (n1 - n2) / (n1 + n2);
+        r0 = r0 * r0;
+        return r0 + (1.0f - r0) * std::pow(1.0f - cos, 5.0f);
+    }
+};
+} // namespace raytracer
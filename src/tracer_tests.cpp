@@ -0,0 +1,208 @@
+import boost.ut;
+import raytracer;
+import std;
+
+using namespace boost::ut::bdd;
+using namespace boost::ut;
+using namespace raytracer;
+
+namespace {
+Sphere& addSphere(Scene& scene, vec3 const& center, f32 radius, material const& m)
+{
+    auto& s = scene.objects.add<Sphere>();
+    s.setTransform(mat4::translate(center.x, center.y, center.z) * mat4::scale(radius, radius, radius));
+    s.material_id = scene.materials.add(m);
+    return s;
+}
+
+bool near(vec3 const& a, vec3 const& b, f32 tolerance)
+{
+    return std::abs(a.x - b.x) <= tolerance && std::abs(a.y - b.y) <= tolerance && std::abs(a.z - b.z) <= tolerance;
+}
+
+vec3 traceOnce(RayTracer const& tracer, Scene const& scene, ray const& r, trace_stats& stats, u32 seed = 0)
+{
+    return tracer.trace(scene, r, tracer.settings().pixel_ray_budget, seed, stats);
+}
+
+// Shades only through what it reflects or transmits.
+material clear(f32 reflective, f32 transparency, f32 refractive_index = 1.0f)
+{
+    material m;
+    m.ambient = m.diffuse = m.specular = 0.0f;
+    m.reflective = reflective;
+    m.transparency = transparency;
+    m.refractive_index = refractive_index;
+    return m;
+}
+
+// Inside a mirrored ball, where every reflection hits the wall again.
+Scene mirroredRoom(f32 reflective)
+{
+    Scene scene;
+    auto m = clear(reflective, 0.0f);
+    m.ambient = 0.1f;
+    addSphere(scene, zero<vec3>, 5.0f, m);
+    scene.lights.push_back(point_light(vec3(0, 1, 0), one<vec3>));
+    scene.build();
+    return scene;
+}
+} // namespace
+
+int main()
+{
+    feature("Secondary rays") = [] {
+        material red;
+        red.color = vec3(1, 0.2f, 0.2f);
+
+        given("An opaque sphere") = [&] {
+            Scene scene;
+            addSphere(scene, zero<vec3>, 1.0f, red);
+            scene.lights.push_back(point_light(vec3(-10, 10, -10), one<vec3>));
+            scene.build();
+            RayTracer tracer;
+            trace_stats stats;
+            auto r = ray(vec3(0.3f, 0.2f, -5), unit_z<vec3>);
+            auto color = traceOnce(tracer, scene, r, stats);
+            auto h = scene.intersect(r);
+            auto point = r.at(h->t);
+            expect(near(color, lighting(red, scene.lights[0], point, -r.d, scene.objects.get(0).normalAt(point)), 1e-6f));
+            expect(stats.rays == 1u && stats.shadow_rays == 1u);
+        };
+
+        given("A mirror in front of a lit sphere") = [&] {
+            Scene scene;
+            addSphere(scene, zero<vec3>, 1.0f, clear(1.0f, 0.0f));
+            addSphere(scene, vec3(0, 0, -10), 2.0f, red);
+            scene.lights.push_back(point_light(vec3(5, 5, -5), one<vec3>));
+            scene.build();
+            RayTracer tracer;
+            trace_stats stats;
+            auto seen = traceOnce(tracer, scene, ray(vec3(0, 0, -5), unit_z<vec3>), stats);
+            auto reflected = traceOnce(tracer, scene, ray(vec3(0, 0, -1.001f), -unit_z<vec3>), stats);
+            expect(reflected != zero<vec3>);
+            expect(near(seen, reflected, 1e-4f));
+
+            then("A known primary hit gives the same colour") = [&] {
+                auto r = ray(vec3(0.1f, 0, -5), unit_z<vec3>);
+                u32 rng = 0;
+                trace_stats known_stats;
+                auto known = tracer.trace(scene, r, ray_differential(), scene.intersect(r), tracer.settings().pixel_ray_budget, rng, known_stats);
+                trace_stats traced_stats;
+                expect(known == traceOnce(tracer, scene, r, traced_stats));
+                expect(known_stats.rays == traced_stats.rays && known_stats.shadow_rays == traced_stats.shadow_rays);
+                rng = 0;
+                expect(tracer.trace(scene, r, ray_differential(), std::nullopt, tracer.settings().pixel_ray_budget, rng, known_stats) == zero<vec3>);
+            };
+        };
+
+        given("Clear glass in front of a lit sphere") = [&] {
+            Scene scene;
+            addSphere(scene, vec3(0, 0, 10), 2.0f, red);
+            scene.lights.push_back(point_light(vec3(-10, 10, -10), one<vec3>));
+            scene.build();
+            RayTracer tracer;
+            trace_stats stats;
+            auto r = ray(vec3(0.2f, 0.1f, -5), unit_z<vec3>);
+            auto without = traceOnce(tracer, scene, r, stats);
+
+            addSphere(scene, zero<vec3>, 1.0f, clear(0.0f, 1.0f));
+            scene.build();
+            auto through = traceOnce(tracer, scene, r, stats);
+            expect(near(through, without, 1e-3f));
+
+            then("Bending the rays changes what is seen") = [&] {
+                Scene lens;
+                addSphere(lens, vec3(0, 0, 10), 2.0f, red);
+                addSphere(lens, zero<vec3>, 1.0f, clear(0.0f, 1.0f, 1.5f));
+                lens.lights = scene.lights;
+                lens.build();
+                auto off_axis = ray(vec3(0.9f, 0, -5), unit_z<vec3>);
+                expect(traceOnce(tracer, scene, off_axis, stats) != traceOnce(tracer, lens, off_axis, stats));
+            };
+        };
+    };
+
+    feature("Bounding the work") = [] {
+        auto tilted = ray(zero<vec3>, normalize(vec3(0.01f, 0, 1)));
+
+        given("Perfect mirrors and a deep limit") = [&] {
+            auto scene = mirroredRoom(1.0f);
+            trace_settings settings;
+            settings.max_depth = 5000;
+            settings.pixel_ray_budget = 10000;
+            RayTracer tracer(settings);
+            trace_stats stats;
+            auto color = traceOnce(tracer, scene, tilted, stats);
+
+            then("Thousands of bounces use a constant stack") = [&] {
+                expect(stats.rays == 5000u);
+                expect(stats.max_stack_size <= 2u);
+                expect(std::isfinite(color.x));
+            };
+        };
+
+        given("A per-pixel budget") = [&] {
+            auto scene = mirroredRoom(1.0f);
+            trace_settings settings;
+            settings.pixel_ray_budget = 8;
+            RayTracer tracer(settings);
+            trace_stats stats;
+            (void)traceOnce(tracer, scene, tilted, stats);
+            expect(stats.rays == 8u);
+            expect(stats.budget_kills == 1u);
+        };
+
+        given("A frame budget") = [&] {
+            auto scene = mirroredRoom(1.0f);
+            trace_settings settings;
+            settings.frame_ray_budget = 16 * 16 * 3;
+            RayTracer tracer(settings);
+            Canvas<vec3> image(16, 16);
+            auto stats = tracer.render(scene, [](i32 row, i32 col) {
+                return ray(zero<vec3>, normalize(vec3(f32(col - 8) * 0.01f, f32(row - 8) * 0.01f, 1)));
+            }, image);
+            expect(stats.rays <= settings.frame_ray_budget);
+            expect(stats.rays >= settings.frame_ray_budget - 16u);
+        };
+
+        given("A scene without textures") = [&] {
+            auto scene = mirroredRoom(0.5f);
+            Canvas<vec3> image(16, 16);
+            u32 calls = 0;
+            (void)RayTracer().render(scene, [&calls](i32 row, i32 col) {
+                calls++;
+                return ray(zero<vec3>, normalize(vec3(f32(col - 8) * 0.01f, f32(row - 8) * 0.01f, 1)));
+            }, image);
+
+            then("No neighbouring rays are made for differentials") = [&] {
+                expect(calls == 16u * 16u) << calls;
+            };
+        };
+
+        given("Dim mirrors under Russian roulette") = [&] {
+            auto scene = mirroredRoom(0.5f);
+            trace_settings exact;
+            exact.roulette_threshold = 0.0f;
+            trace_stats exact_stats;
+            auto expected = traceOnce(RayTracer(exact), scene, tilted, exact_stats);
+
+            trace_settings settings;
+            settings.roulette_threshold = 0.2f;
+            RayTracer tracer(settings);
+            trace_stats stats;
+            vec3 sum = zero<vec3>;
+            constexpr u32 trials = 20000;
+            for (u32 i = 0; i < trials; i++) {
+                sum = sum + traceOnce(tracer, scene, tilted, stats, pcgHash(i));
+            }
+            auto mean = sum * (1.0f / trials);
+
+            then("Paths are cut short without biasing the result") = [&] {
+                expect(stats.roulette_kills > 0u);
+                expect(f64(stats.rays) / trials < f64(exact_stats.rays) / 2.0);
+                expect(std::abs(mean.x - expected.x) < 0.01f * expected.x) << mean.x << expected.x;
+            };
+        };
+    };
+}